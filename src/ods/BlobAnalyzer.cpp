@@ -0,0 +1,289 @@
+/*
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Initial Developer of the Original Code is Adriano dos Santos Fernandes.
+ * Portions created by the Initial Developer are Copyright (C) 2012 the Initial Developer.
+ * All Rights Reserved.
+ *
+ * Contributor(s):
+ *
+ */
+
+#include "BlobAnalyzer.h"
+#include "PageSweep.h"
+#include <algorithm>
+#include <cstddef>
+#include <boost/unordered_map.hpp>
+
+namespace fbods
+{
+
+using std::map;
+using std::vector;
+
+//------------------------------------------------------------------------------
+
+
+RelationBlobs::RelationBlobs()
+	: maxLength(0),
+	  headerLength(0),
+	  blobPages(0),
+	  pointerPages(0),
+	  pageLength(0)
+{
+	std::fill(blobs, blobs + LEVELS, 0);
+	std::fill(length, length + LEVELS, 0);
+	std::fill(sizeHistogram, sizeHistogram + SIZE_BUCKETS, 0);
+}
+
+void RelationBlobs::merge(const RelationBlobs& other)
+{
+	for (unsigned i = 0; i < LEVELS; ++i)
+	{
+		blobs[i] += other.blobs[i];
+		length[i] += other.length[i];
+	}
+
+	for (unsigned i = 0; i < SIZE_BUCKETS; ++i)
+		sizeHistogram[i] += other.sizeHistogram[i];
+
+	maxLength = std::max(maxLength, other.maxLength);
+	headerLength += other.headerLength;
+	blobPages += other.blobPages;
+	pointerPages += other.pointerPages;
+	pageLength += other.pageLength;
+}
+
+unsigned RelationBlobs::getSizeBucket(boost::uint64_t length)
+{
+	unsigned bucket = 0;
+
+	while (bucket < SIZE_BUCKETS - 1 && length >= (boost::uint64_t(1024) << (2 * bucket)))
+		++bucket;
+
+	return bucket;
+}
+
+double RelationBlobs::getPageOverhead(unsigned pageSize) const
+{
+	const double size = double(blobPages + pointerPages) * pageSize;
+	return size == 0 ? 0 : 100.0 * (size - pageLength) / size;
+}
+
+
+//--------------------------------------
+
+
+class BlobAnalyzer::Visitor : public PageVisitor
+{
+public:
+	Visitor(Database* aDatabase, unsigned aTopCount, int aTopRelation)
+		: database(aDatabase),
+		  pageSize(aDatabase->header.pageSize),
+		  maxRecords(aDatabase->getMaxRecords()),
+		  topCount(aTopCount),
+		  topRelation(aTopRelation)
+	{
+	}
+
+public:
+	virtual void visit(unsigned /*number*/, const PageHeader* page)
+	{
+		if (page->type == PageHeader::TYPE_BLOB)
+			visitBlob(reinterpret_cast<const BlobPage*>(page));
+		else if (page->type == PageHeader::TYPE_DATA)
+			visitData(reinterpret_cast<const DataPage*>(page));
+	}
+
+private:
+	void visitBlob(const BlobPage* blob)
+	{
+		PageUsage& usage = pages[blob->leadPage];
+
+		if (blob->pageHeader.flags & BlobPage::FLAG_POINTERS)
+			++usage.pointerPages;
+		else
+		{
+			++usage.blobPages;
+			usage.length += std::min<unsigned>(blob->length, pageSize - offsetof(BlobPage, data));
+		}
+	}
+
+	void visitData(const DataPage* data)
+	{
+		const boost::uint8_t* raw = reinterpret_cast<const boost::uint8_t*>(data);
+
+		// Damaged pages are for the validation to report.
+		if (offsetof(DataPage, rpt) + data->count * sizeof(data->rpt[0]) > pageSize)
+			return;
+
+		for (unsigned i = 0; i < data->count; ++i)
+		{
+			const DataPage::Repeat& line = data->rpt[i];
+
+			if (line.length < offsetof(BlobHeader, data) || line.offset + line.length > pageSize)
+				continue;
+
+			const BlobHeader* header = reinterpret_cast<const BlobHeader*>(&raw[line.offset]);
+
+			if (!(header->flags & RecordHeader::FLAG_BLOB) || header->level > BlobHeader::MAX_LEVEL)
+				continue;
+
+			RelationBlobs& blobs = relations[data->relation];
+
+			++blobs.blobs[header->level];
+			blobs.length[header->level] += header->length;
+			++blobs.sizeHistogram[RelationBlobs::getSizeBucket(header->length)];
+			blobs.maxLength = std::max<boost::uint64_t>(blobs.maxLength, header->length);
+			blobs.headerLength += line.length;
+
+			BlobInfo info;
+			info.relation = data->relation;
+			info.number = boost::uint64_t(data->sequence) * maxRecords + i;
+			info.leadPage = header->leadPage;
+			info.level = header->level;
+			info.length = header->length;
+			info.pages = 0;
+
+			if (info.level > 0)
+				headers.push_back(info);
+
+			if (topRelation < 0 || info.relation == unsigned(topRelation))
+				addLargest(info);
+		}
+	}
+
+	// Keeps the largest blobs in a heap with the smallest of them on top.
+	void addLargest(const BlobInfo& info)
+	{
+		if (largest.size() < topCount)
+		{
+			largest.push_back(info);
+			std::push_heap(largest.begin(), largest.end());
+		}
+		else if (topCount > 0 && info < largest.front())
+		{
+			std::pop_heap(largest.begin(), largest.end());
+			largest.back() = info;
+			std::push_heap(largest.begin(), largest.end());
+		}
+	}
+
+public:
+	map<unsigned, RelationBlobs> relations;
+	boost::unordered_map<unsigned, PageUsage> pages;	// by lead page
+	vector<BlobInfo> headers;	// of the blobs stored in blob pages
+	vector<BlobInfo> largest;
+
+private:
+	Database* database;
+	unsigned pageSize;
+	unsigned maxRecords;
+	unsigned topCount;
+	int topRelation;
+};
+
+
+BlobAnalyzer::BlobAnalyzer(Database* aDatabase, unsigned aTopCount, int aTopRelation)
+	: orphanPages(0),
+	  database(aDatabase),
+	  topCount(aTopCount),
+	  topRelation(aTopRelation)
+{
+}
+
+void BlobAnalyzer::run(unsigned threads, unsigned chunkPages)
+{
+	vector<Visitor*> visitors;
+
+	for (unsigned i = 0; i < std::max(threads, 1u); ++i)
+		visitors.push_back(new Visitor(database, topCount, topRelation));
+
+	try
+	{
+		sweepPages(database, vector<PageVisitor*>(visitors.begin(), visitors.end()), chunkPages);
+	}
+	catch (...)
+	{
+		for (vector<Visitor*>::iterator i = visitors.begin(); i != visitors.end(); ++i)
+			delete *i;
+
+		throw;
+	}
+
+	boost::unordered_map<unsigned, PageUsage> pages;
+	vector<BlobInfo> headers;
+
+	for (vector<Visitor*>::iterator i = visitors.begin(); i != visitors.end(); ++i)
+	{
+		Visitor* visitor = *i;
+
+		for (map<unsigned, RelationBlobs>::const_iterator j = visitor->relations.begin();
+			 j != visitor->relations.end();
+			 ++j)
+		{
+			relations[j->first].merge(j->second);
+		}
+
+		// The pages of a blob may have been read by different threads.
+		for (boost::unordered_map<unsigned, PageUsage>::const_iterator j = visitor->pages.begin();
+			 j != visitor->pages.end();
+			 ++j)
+		{
+			PageUsage& usage = pages[j->first];
+			usage.blobPages += j->second.blobPages;
+			usage.pointerPages += j->second.pointerPages;
+			usage.length += j->second.length;
+		}
+
+		headers.insert(headers.end(), visitor->headers.begin(), visitor->headers.end());
+		largest.insert(largest.end(), visitor->largest.begin(), visitor->largest.end());
+		delete visitor;
+	}
+
+	std::sort(largest.begin(), largest.end());
+	largest.resize(std::min<size_t>(largest.size(), topCount));
+
+	for (vector<BlobInfo>::iterator i = largest.begin(); i != largest.end(); ++i)
+	{
+		boost::unordered_map<unsigned, PageUsage>::const_iterator usage;
+
+		if (i->level > 0 && (usage = pages.find(i->leadPage)) != pages.end())
+			i->pages = usage->second.blobPages + usage->second.pointerPages;
+	}
+
+	for (vector<BlobInfo>::const_iterator i = headers.begin(); i != headers.end(); ++i)
+	{
+		boost::unordered_map<unsigned, PageUsage>::iterator usage = pages.find(i->leadPage);
+
+		if (usage == pages.end())
+			continue;
+
+		RelationBlobs& blobs = relations[i->relation];
+		blobs.blobPages += usage->second.blobPages;
+		blobs.pointerPages += usage->second.pointerPages;
+		blobs.pageLength += usage->second.length;
+
+		pages.erase(usage);
+	}
+
+	for (boost::unordered_map<unsigned, PageUsage>::const_iterator i = pages.begin();
+		 i != pages.end();
+		 ++i)
+	{
+		orphanPages += i->second.blobPages + i->second.pointerPages;
+	}
+}
+
+
+//------------------------------------------------------------------------------
+
+}	// fbods
@@ -0,0 +1,122 @@
+/*
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Initial Developer of the Original Code is Adriano dos Santos Fernandes.
+ * Portions created by the Initial Developer are Copyright (C) 2012 the Initial Developer.
+ * All Rights Reserved.
+ *
+ * Contributor(s):
+ *
+ */
+
+#ifndef FBSTUFF_ODS_BLOB_ANALYZER_H
+#define FBSTUFF_ODS_BLOB_ANALYZER_H
+
+#include "Database.h"
+#include <map>
+#include <vector>
+#include <boost/cstdint.hpp>
+
+namespace fbods
+{
+
+//------------------------------------------------------------------------------
+
+
+// Blob storage of one relation.
+struct RelationBlobs
+{
+	static const unsigned LEVELS = BlobHeader::MAX_LEVEL + 1;
+	static const unsigned SIZE_BUCKETS = 9;	// < 1 KB, < 4 KB, ..., < 16 MB, larger
+
+	RelationBlobs();
+
+	void merge(const RelationBlobs& other);
+
+	static unsigned getSizeBucket(boost::uint64_t length);
+
+	// Bytes of the blob pages not holding blob data, in percent of their size.
+	double getPageOverhead(unsigned pageSize) const;
+
+	boost::uint64_t blobs[LEVELS];
+	boost::uint64_t length[LEVELS];
+	boost::uint64_t sizeHistogram[SIZE_BUCKETS];
+	boost::uint64_t maxLength;
+	boost::uint64_t headerLength;	// blob headers and level 0 data in data pages
+	boost::uint64_t blobPages;		// holding data
+	boost::uint64_t pointerPages;	// of level 2 blobs
+	boost::uint64_t pageLength;		// data in the blob pages
+};
+
+struct BlobInfo
+{
+	// Largest first.
+	bool operator <(const BlobInfo& other) const
+	{
+		return length > other.length ||
+			(length == other.length && (relation < other.relation ||
+				(relation == other.relation && number < other.number)));
+	}
+
+	unsigned relation;
+	boost::uint64_t number;	// the one in blob ids, as the record numbers
+	unsigned leadPage;
+	unsigned level;
+	boost::uint64_t length;
+	unsigned pages;			// blob and pointer pages
+};
+
+// Computes the blob storage of all relations in one parallel sweep over the database file.
+// Blob pages don't carry their relation, so they are counted by their lead page and charged to
+// the relation of the blob header with that lead page after the sweep.
+class BlobAnalyzer
+{
+public:
+	// The largest blobs are looked for in the given relation, or in all when it's negative.
+	BlobAnalyzer(Database* aDatabase, unsigned aTopCount, int aTopRelation = -1);
+
+public:
+	void run(unsigned threads, unsigned chunkPages);
+
+public:
+	std::map<unsigned, RelationBlobs> relations;
+	std::vector<BlobInfo> largest;	// up to topCount, largest first
+	boost::uint64_t orphanPages;	// blob pages of no blob header found
+
+private:
+	class Visitor;
+
+	// Blob pages with the same lead page.
+	struct PageUsage
+	{
+		PageUsage()
+			: blobPages(0),
+			  pointerPages(0),
+			  length(0)
+		{
+		}
+
+		unsigned blobPages;
+		unsigned pointerPages;
+		boost::uint64_t length;
+	};
+
+	Database* database;
+	unsigned topCount;
+	int topRelation;
+};
+
+
+//------------------------------------------------------------------------------
+
+}	// fbods
+
+#endif	// FBSTUFF_ODS_BLOB_ANALYZER_H
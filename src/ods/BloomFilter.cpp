@@ -0,0 +1,346 @@
+/*
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Initial Developer of the Original Code is Adriano dos Santos Fernandes.
+ * Portions created by the Initial Developer are Copyright (C) 2012 the Initial Developer.
+ * All Rights Reserved.
+ *
+ * Contributor(s):
+ *
+ */
+
+#include "BloomFilter.h"
+#include "Hash.h"
+#include "RecordView.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+
+namespace fbods
+{
+
+using std::runtime_error;
+using std::string;
+using std::vector;
+
+//------------------------------------------------------------------------------
+
+
+namespace
+{
+	const char MAGIC[8] = {'F', 'B', 'O', 'D', 'S', 'B', 'L', 'M'};
+	const boost::uint32_t VERSION = 1;
+	const unsigned MAX_HASHES = 16;
+
+	// The file has this header, the key spec, the signature and the bits, in the native
+	// byte order.
+	struct FileHeader
+	{
+		char magic[8];
+		boost::uint32_t version;
+		boost::uint32_t hashes;
+		boost::uint64_t keys;
+		boost::uint64_t blocks;
+		boost::uint32_t keyLength;
+		boost::uint32_t signatureLength;
+	};
+
+	template <typename T>
+	void appendNumber(string& key, T value)
+	{
+		key.append(reinterpret_cast<const char*>(&value), sizeof(value));
+	}
+}	// namespace
+
+
+KeyHasher::KeyHasher(const Format* aFormat, const vector<unsigned>& aFields)
+	: format(aFormat),
+	  fields(aFields)
+{
+	for (vector<unsigned>::const_iterator i = fields.begin(); i != fields.end(); ++i)
+	{
+		if (*i >= format->fields.size())
+			throw runtime_error("Invalid key field");
+
+		if (format->fields[*i].type == Format::TYPE_BLOB)
+			throw runtime_error("Blob fields can't be keys: " + format->fields[*i].name);
+	}
+}
+
+bool KeyHasher::hash(const void* record, boost::uint64_t& value)
+{
+	key.clear();
+
+	for (vector<unsigned>::const_iterator i = fields.begin(); i != fields.end(); ++i)
+	{
+		if (format->isNull(record, *i))
+			return false;
+
+		appendValue(*i, format->getPointer(record, *i), key);
+	}
+
+	value = hash64(key.data(), key.length());
+	return true;
+}
+
+bool KeyHasher::hash(RecordView& view, boost::uint64_t& value)
+{
+	key.clear();
+
+	for (vector<unsigned>::const_iterator i = fields.begin(); i != fields.end(); ++i)
+	{
+		if (view.isNull(*i))
+			return false;
+
+		appendValue(*i, view.getPointer(*i), key);
+	}
+
+	value = hash64(key.data(), key.length());
+	return true;
+}
+
+string KeyHasher::getSignature() const
+{
+	std::ostringstream out;
+
+	for (vector<unsigned>::const_iterator i = fields.begin(); i != fields.end(); ++i)
+	{
+		const Format::Field& field = format->fields[*i];
+
+		if (i != fields.begin())
+			out << ",";
+
+		switch (field.type)
+		{
+			case Format::TYPE_SHORT:
+			case Format::TYPE_LONG:
+			case Format::TYPE_INT64:
+				out << "integer(" << field.scale << ")";
+				break;
+
+			case Format::TYPE_FLOAT:
+			case Format::TYPE_DOUBLE:
+				out << "double";
+				break;
+
+			case Format::TYPE_DATE:
+				out << "date";
+				break;
+
+			case Format::TYPE_TIME:
+				out << "time";
+				break;
+
+			case Format::TYPE_TIMESTAMP:
+				out << "timestamp";
+				break;
+
+			default:
+				out << "varchar";
+				break;
+		}
+	}
+
+	return out.str();
+}
+
+void KeyHasher::appendValue(unsigned n, const boost::uint8_t* value, string& key) const
+{
+	const Format::Field& field = format->fields[n];
+
+	switch (field.type)
+	{
+		case Format::TYPE_SHORT:
+		{
+			boost::int16_t v;
+			memcpy(&v, value, sizeof(v));
+			appendNumber(key, boost::int64_t(v));
+			break;
+		}
+
+		case Format::TYPE_LONG:
+		{
+			boost::int32_t v;
+			memcpy(&v, value, sizeof(v));
+			appendNumber(key, boost::int64_t(v));
+			break;
+		}
+
+		case Format::TYPE_INT64:
+			key.append(reinterpret_cast<const char*>(value), sizeof(boost::int64_t));
+			break;
+
+		// Zero is hashed without its sign.
+		case Format::TYPE_FLOAT:
+		{
+			float v;
+			memcpy(&v, value, sizeof(v));
+			appendNumber(key, v == 0 ? 0.0 : double(v));
+			break;
+		}
+
+		case Format::TYPE_DOUBLE:
+		{
+			double v;
+			memcpy(&v, value, sizeof(v));
+			appendNumber(key, v == 0 ? 0.0 : v);
+			break;
+		}
+
+		case Format::TYPE_DATE:
+		case Format::TYPE_TIME:
+		case Format::TYPE_TIMESTAMP:
+			key.append(reinterpret_cast<const char*>(value), field.length);
+			break;
+
+		// Text is prefixed by its length, for keys of several fields not to be ambiguous.
+		case Format::TYPE_TEXT:
+		case Format::TYPE_VARYING:
+		{
+			unsigned length = field.length;
+			const char* text = reinterpret_cast<const char*>(value);
+
+			if (field.type == Format::TYPE_VARYING)
+			{
+				boost::uint16_t varyingLength;
+				memcpy(&varyingLength, value, sizeof(varyingLength));
+				// Damaged records may have lengths past the field.
+				length = std::min<unsigned>(varyingLength, field.length - sizeof(varyingLength));
+				text += sizeof(varyingLength);
+			}
+
+			while (length > 0 && text[length - 1] == ' ')
+				--length;
+
+			appendNumber(key, boost::uint16_t(length));
+			key.append(text, length);
+			break;
+		}
+
+		case Format::TYPE_BLOB:
+			break;
+	}
+}
+
+
+// Bits and hashes of the optimal filter for the rate, the blocks adding a little to it.
+BloomFilter::BloomFilter(boost::uint64_t aKeys, double falsePositiveRate)
+	: keys(0)
+{
+	if (!(falsePositiveRate > 0 && falsePositiveRate < 1))
+		throw runtime_error("The false positive rate must be between 0 and 1");
+
+	const double ln2 = std::log(2.0);
+	const double bitsPerKey = -std::log(falsePositiveRate) / (ln2 * ln2);
+	const double totalBits = std::max(1.0, std::ceil(bitsPerKey * double(aKeys)));
+
+	blocks = boost::uint64_t(std::ceil(totalBits / (BLOCK_WORDS * 64)));
+	hashes = std::min(MAX_HASHES, std::max(1u, unsigned(bitsPerKey * ln2 + 0.5)));
+
+	if (blocks > (boost::uint64_t(1) << 32))
+		throw runtime_error("Too many keys for a Bloom filter");
+
+	bits.resize(blocks * BLOCK_WORDS);
+}
+
+BloomFilter::BloomFilter(const char* filename)
+{
+	FILE* file = fopen(filename, "rb");
+
+	if (!file)
+		throw runtime_error(string("Cannot open ") + filename);
+
+	try
+	{
+		FileHeader header;
+
+		if (fread(&header, sizeof(header), 1, file) != 1 ||
+			memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 ||
+			header.version != VERSION ||
+			header.hashes == 0 || header.hashes > MAX_HASHES ||
+			header.blocks == 0 || header.blocks > (boost::uint64_t(1) << 32))
+		{
+			throw runtime_error(string("Invalid Bloom filter ") + filename);
+		}
+
+		keys = header.keys;
+		blocks = header.blocks;
+		hashes = header.hashes;
+
+		keySpec.resize(header.keyLength);
+		signature.resize(header.signatureLength);
+		bits.resize(blocks * BLOCK_WORDS);
+
+		if ((header.keyLength != 0 && fread(&keySpec[0], header.keyLength, 1, file) != 1) ||
+			(header.signatureLength != 0 &&
+				fread(&signature[0], header.signatureLength, 1, file) != 1) ||
+			fread(&bits.front(), sizeof(boost::uint64_t), bits.size(), file) != bits.size())
+		{
+			throw runtime_error(string("Invalid Bloom filter ") + filename);
+		}
+	}
+	catch (...)
+	{
+		fclose(file);
+		throw;
+	}
+
+	fclose(file);
+}
+
+void BloomFilter::save(const char* filename) const
+{
+	FileHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, MAGIC, sizeof(header.magic));
+	header.version = VERSION;
+	header.hashes = hashes;
+	header.keys = keys;
+	header.blocks = blocks;
+	header.keyLength = keySpec.length();
+	header.signatureLength = signature.length();
+
+	FILE* file = fopen(filename, "wb");
+
+	if (!file)
+		throw runtime_error(string("Cannot create ") + filename);
+
+	const bool written = fwrite(&header, sizeof(header), 1, file) == 1 &&
+		fwrite(keySpec.data(), 1, keySpec.length(), file) == keySpec.length() &&
+		fwrite(signature.data(), 1, signature.length(), file) == signature.length() &&
+		fwrite(&bits.front(), sizeof(boost::uint64_t), bits.size(), file) == bits.size();
+
+	if ((fclose(file) != 0) || !written)
+		throw runtime_error(string("Error writing ") + filename);
+}
+
+
+SemiJoinFilter::SemiJoinFilter(const BloomFilter* aFilter, const Format* format,
+			const vector<unsigned>& fields)
+	: passed(0),
+	  rejected(0),
+	  filter(aFilter),
+	  hasher(format, fields)
+{
+	if (hasher.getSignature() != filter->signature)
+	{
+		throw runtime_error("The Bloom filter keys (" + filter->signature +
+			") don't match the scanned ones (" + hasher.getSignature() + ")");
+	}
+}
+
+
+//------------------------------------------------------------------------------
+
+}	// fbods
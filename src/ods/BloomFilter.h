@@ -0,0 +1,177 @@
+/*
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Initial Developer of the Original Code is Adriano dos Santos Fernandes.
+ * Portions created by the Initial Developer are Copyright (C) 2012 the Initial Developer.
+ * All Rights Reserved.
+ *
+ * Contributor(s):
+ *
+ */
+
+#ifndef FBSTUFF_ODS_BLOOM_FILTER_H
+#define FBSTUFF_ODS_BLOOM_FILTER_H
+
+#include "Format.h"
+#include <string>
+#include <vector>
+#include <boost/cstdint.hpp>
+
+namespace fbods
+{
+
+//------------------------------------------------------------------------------
+
+
+class RecordView;
+
+// Hashes the values of some fields of a decoded record in a form independent of their
+// declared types, so keys of another relation or read from a text file hash the same: integers
+// as 64 bits with their scale, floats as doubles and char as varchar, without trailing spaces.
+// Keys with a null field have no hash.
+class KeyHasher
+{
+public:
+	KeyHasher(const Format* aFormat, const std::vector<unsigned>& aFields);
+
+public:
+	bool hash(const void* record, boost::uint64_t& value);
+
+	// Decompresses the record only up to the last key field.
+	bool hash(RecordView& view, boost::uint64_t& value);
+
+	// Types of the fields as hashed, e.g. "integer(-2),varchar". Filters are only applied to
+	// keys of the same signature.
+	std::string getSignature() const;
+
+private:
+	void appendValue(unsigned n, const boost::uint8_t* value, std::string& key) const;
+
+public:
+	const Format* format;
+	std::vector<unsigned> fields;
+
+private:
+	std::string key;	// normalized values of the last record hashed
+};
+
+// Bloom filter split in blocks of a cache line. The block of a key is chosen by the high
+// half of its hash and the bits inside it by double hashing, so a probe touches a single line.
+class BloomFilter
+{
+public:
+	static const unsigned BLOCK_WORDS = 8;
+
+public:
+	BloomFilter(boost::uint64_t keys, double falsePositiveRate);
+	explicit BloomFilter(const char* filename);
+
+public:
+	void add(boost::uint64_t hash)
+	{
+		boost::uint64_t* block = getBlock(hash);
+		boost::uint32_t h1 = boost::uint32_t(hash);
+		const boost::uint32_t h2 = getStep(hash);
+
+		for (unsigned i = 0; i < hashes; ++i, h1 += h2)
+			block[(h1 >> 6) & (BLOCK_WORDS - 1)] |= boost::uint64_t(1) << (h1 & 63);
+
+		++keys;
+	}
+
+	bool mayContain(boost::uint64_t hash) const
+	{
+		const boost::uint64_t* block = getBlock(hash);
+		boost::uint32_t h1 = boost::uint32_t(hash);
+		const boost::uint32_t h2 = getStep(hash);
+
+		for (unsigned i = 0; i < hashes; ++i, h1 += h2)
+		{
+			if (!(block[(h1 >> 6) & (BLOCK_WORDS - 1)] & (boost::uint64_t(1) << (h1 & 63))))
+				return false;
+		}
+
+		return true;
+	}
+
+	void save(const char* filename) const;
+
+	size_t getSize() const
+	{
+		return bits.size() * sizeof(boost::uint64_t);
+	}
+
+private:
+	// Odd step of the bits of a key, remixed for them not to depend on its block.
+	static boost::uint32_t getStep(boost::uint64_t hash)
+	{
+		return boost::uint32_t((hash * 0x9E3779B97F4A7C15ULL) >> 32) | 1;
+	}
+
+	const boost::uint64_t* getBlock(boost::uint64_t hash) const
+	{
+		return &bits[((hash >> 32) * blocks >> 32) * BLOCK_WORDS];
+	}
+
+	boost::uint64_t* getBlock(boost::uint64_t hash)
+	{
+		return &bits[((hash >> 32) * blocks >> 32) * BLOCK_WORDS];
+	}
+
+public:
+	std::string keySpec;	// comma separated field names the filter was built from
+	std::string signature;	// as in KeyHasher::getSignature
+	boost::uint64_t keys;	// added, counting repetitions
+
+private:
+	boost::uint64_t blocks;
+	unsigned hashes;
+	std::vector<boost::uint64_t> bits;
+};
+
+// Semi-join of a scan with the keys of a filter: records whose key is not in the filter are
+// rejected after decompressing only the key fields. False positives pass, nulls never do.
+class SemiJoinFilter
+{
+public:
+	SemiJoinFilter(const BloomFilter* aFilter, const Format* format,
+		const std::vector<unsigned>& fields);
+
+public:
+	bool matches(RecordView& view)
+	{
+		boost::uint64_t value;
+
+		if (!hasher.hash(view, value) || !filter->mayContain(value))
+		{
+			++rejected;
+			return false;
+		}
+
+		++passed;
+		return true;
+	}
+
+public:
+	boost::uint64_t passed;
+	boost::uint64_t rejected;
+
+private:
+	const BloomFilter* filter;
+	KeyHasher hasher;
+};
+
+
+//------------------------------------------------------------------------------
+
+}	// fbods
+
+#endif	// FBSTUFF_ODS_BLOOM_FILTER_H
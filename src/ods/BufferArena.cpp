@@ -0,0 +1,276 @@
+/*
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Initial Developer of the Original Code is Adriano dos Santos Fernandes.
+ * Portions created by the Initial Developer are Copyright (C) 2012 the Initial Developer.
+ * All Rights Reserved.
+ *
+ * Contributor(s):
+ *
+ */
+
+#include "BufferArena.h"
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <new>
+#include <string>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+
+namespace fbods
+{
+
+using std::string;
+using std::vector;
+
+//------------------------------------------------------------------------------
+
+
+namespace
+{
+	__thread BufferArena* currentArena = NULL;
+
+	// Parses a sysfs CPU list such as "0-3,8-11".
+	void parseCpuList(const string& list, vector<unsigned>& cpus)
+	{
+		const char* p = list.c_str();
+
+		while (*p)
+		{
+			unsigned first, last;
+			int n;
+
+			if (sscanf(p, "%u-%u%n", &first, &last, &n) == 2)
+				p += n;
+			else if (sscanf(p, "%u%n", &first, &n) == 1)
+			{
+				last = first;
+				p += n;
+			}
+			else
+				break;
+
+			for (unsigned cpu = first; cpu <= last; ++cpu)
+				cpus.push_back(cpu);
+
+			if (*p == ',')
+				++p;
+		}
+	}
+
+	// CPUs of each NUMA node, or of a single node when the system has no NUMA information.
+	void getNodes(vector<vector<unsigned> >& nodes)
+	{
+		for (unsigned node = 0; ; ++node)
+		{
+			char path[64];
+			sprintf(path, "/sys/devices/system/node/node%u/cpulist", node);
+
+			std::ifstream file(path);
+			string list;
+
+			if (!std::getline(file, list))
+				break;
+
+			nodes.push_back(vector<unsigned>());
+			parseCpuList(list, nodes.back());
+		}
+
+		if (nodes.empty())
+		{
+			cpu_set_t cpus;
+			sched_getaffinity(0, sizeof(cpus), &cpus);
+
+			nodes.push_back(vector<unsigned>());
+
+			for (unsigned cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+			{
+				if (CPU_ISSET(cpu, &cpus))
+					nodes.back().push_back(cpu);
+			}
+		}
+	}
+
+	// NUMA node of the device holding a file, -1 when unknown.
+	int getFileNode(int handle)
+	{
+		struct stat st;
+
+		if (fstat(handle, &st) != 0)
+			return -1;
+
+		// Partitions have the device attributes in their parent.
+		const char* const suffixes[] = {"device/numa_node", "../device/numa_node"};
+
+		for (unsigned i = 0; i < sizeof(suffixes) / sizeof(suffixes[0]); ++i)
+		{
+			char path[96];
+			sprintf(path, "/sys/dev/block/%u:%u/%s", major(st.st_dev), minor(st.st_dev),
+				suffixes[i]);
+
+			std::ifstream file(path);
+			int node;
+
+			if (file >> node)
+				return node;
+		}
+
+		return -1;
+	}
+}	// namespace
+
+
+BufferArena::BufferArena(bool aHugePages)
+	: hugePages(aHugePages),
+	  used(0)
+{
+}
+
+BufferArena::~BufferArena()
+{
+	for (vector<Chunk>::iterator i = chunks.begin(); i != chunks.end(); ++i)
+		munmap(i->base, i->size);
+}
+
+void* BufferArena::allocate(size_t size)
+{
+	size = (size + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+
+	if (chunks.empty() || chunks.back().size - used < size)
+	{
+		Chunk chunk;
+		chunk.size = (size + CHUNK_SIZE - 1) & ~(CHUNK_SIZE - 1);
+		chunk.base = static_cast<char*>(MAP_FAILED);
+
+		if (hugePages)
+		{
+			chunk.base = static_cast<char*>(mmap(NULL, chunk.size, PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0));
+		}
+
+		// Without reserved huge pages, ask for transparent ones.
+		if (chunk.base == MAP_FAILED)
+		{
+			chunk.base = static_cast<char*>(mmap(NULL, chunk.size, PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+
+			if (chunk.base == MAP_FAILED)
+				throw std::bad_alloc();
+
+			if (hugePages)
+				madvise(chunk.base, chunk.size, MADV_HUGEPAGE);
+		}
+
+		memset(chunk.base, 0, chunk.size);
+
+		chunks.push_back(chunk);
+		used = 0;
+	}
+
+	void* p = chunks.back().base + used;
+	used += size;
+
+	return p;
+}
+
+BufferArena* BufferArena::getCurrent()
+{
+	return currentArena;
+}
+
+void BufferArena::setCurrent(BufferArena* arena)
+{
+	currentArena = arena;
+}
+
+
+//--------------------------------------
+
+
+char* allocateBuffer(size_t size, boost::scoped_array<char>& scope)
+{
+	BufferArena* arena = BufferArena::getCurrent();
+
+	if (arena)
+		return static_cast<char*>(arena->allocate(size));
+
+	scope.reset(new char[size + BufferArena::ALIGNMENT - 1]);
+	return reinterpret_cast<char*>(
+		(size_t(scope.get()) + BufferArena::ALIGNMENT - 1) & ~(BufferArena::ALIGNMENT - 1));
+}
+
+
+//--------------------------------------
+
+
+WorkerPlacement::WorkerPlacement(Database* database, unsigned worker)
+	: previousArena(BufferArena::getCurrent()),
+	  pinned(false)
+{
+	place(database->placement, database->handle, worker);
+}
+
+WorkerPlacement::WorkerPlacement(const PlacementOptions& options, unsigned worker)
+	: previousArena(BufferArena::getCurrent()),
+	  pinned(false)
+{
+	place(options, -1, worker);
+}
+
+WorkerPlacement::~WorkerPlacement()
+{
+	BufferArena::setCurrent(previousArena);
+
+	if (pinned)
+		pthread_setaffinity_np(pthread_self(), sizeof(previousCpus), &previousCpus);
+}
+
+void WorkerPlacement::place(const PlacementOptions& options, int handle, unsigned worker)
+{
+	if (options.pinThreads)
+	{
+		vector<vector<unsigned> > nodes;
+		getNodes(nodes);
+
+		int node = handle < 0 ? -1 : getFileNode(handle);
+		unsigned index = worker;
+
+		if (node < 0 || unsigned(node) >= nodes.size() || nodes[node].empty())
+		{
+			node = worker % nodes.size();
+			index = worker / nodes.size();
+		}
+
+		if (!nodes[node].empty() &&
+			pthread_getaffinity_np(pthread_self(), sizeof(previousCpus), &previousCpus) == 0)
+		{
+			cpu_set_t cpus;
+			CPU_ZERO(&cpus);
+			CPU_SET(nodes[node][index % nodes[node].size()], &cpus);
+
+			pinned = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) == 0;
+		}
+	}
+
+	if (options.pinThreads || options.hugePages)
+	{
+		arena.reset(new BufferArena(options.hugePages));
+		BufferArena::setCurrent(arena.get());
+	}
+}
+
+
+//------------------------------------------------------------------------------
+
+}	// fbods
@@ -0,0 +1,104 @@
+/*
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Initial Developer of the Original Code is Adriano dos Santos Fernandes.
+ * Portions created by the Initial Developer are Copyright (C) 2012 the Initial Developer.
+ * All Rights Reserved.
+ *
+ * Contributor(s):
+ *
+ */
+
+#ifndef FBSTUFF_ODS_BUFFER_ARENA_H
+#define FBSTUFF_ODS_BUFFER_ARENA_H
+
+#include "Database.h"
+#include <cstddef>
+#include <vector>
+#include <boost/scoped_array.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <sched.h>
+
+namespace fbods
+{
+
+//------------------------------------------------------------------------------
+
+
+// Page and record buffers of one worker, carved from 2 MB chunks that are backed by huge
+// pages when possible. Chunks are touched when mapped, so with the worker pinned they are
+// placed in its NUMA node. Memory is only released with the arena.
+class BufferArena
+{
+public:
+	static const size_t CHUNK_SIZE = 2 * 1024 * 1024;
+	static const size_t ALIGNMENT = 4096;
+
+public:
+	explicit BufferArena(bool aHugePages);
+	~BufferArena();
+
+private:
+	BufferArena(const BufferArena&);
+	BufferArena& operator =(const BufferArena&);
+
+public:
+	void* allocate(size_t size);
+
+	// Arena of the calling thread, used by the scans it creates.
+	static BufferArena* getCurrent();
+	static void setCurrent(BufferArena* arena);
+
+private:
+	struct Chunk
+	{
+		char* base;
+		size_t size;
+	};
+
+	bool hugePages;
+	std::vector<Chunk> chunks;
+	size_t used;	// in the last chunk
+};
+
+// Buffer from the arena of the calling thread, or from the heap, owned by scope, when it
+// has none. Either way it's aligned for direct I/O.
+char* allocateBuffer(size_t size, boost::scoped_array<char>& scope);
+
+// Places the calling worker thread as set in Database::placement: pins it to a CPU of the
+// NUMA node of the database file (or of a node chosen round robin when that is unknown)
+// and gives it a current arena. Both are undone when the placement goes out of scope.
+class WorkerPlacement
+{
+public:
+	WorkerPlacement(Database* database, unsigned worker);
+
+	// For workers reading many databases, placed on the nodes round robin.
+	WorkerPlacement(const PlacementOptions& options, unsigned worker);
+
+	~WorkerPlacement();
+
+private:
+	void place(const PlacementOptions& options, int handle, unsigned worker);
+
+private:
+	boost::scoped_ptr<BufferArena> arena;
+	BufferArena* previousArena;
+	bool pinned;
+	cpu_set_t previousCpus;
+};
+
+
+//------------------------------------------------------------------------------
+
+}	// fbods
+
+#endif	// FBSTUFF_ODS_BUFFER_ARENA_H
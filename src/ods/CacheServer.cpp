@@ -0,0 +1,1197 @@
+/*
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Initial Developer of the Original Code is Adriano dos Santos Fernandes.
+ * Portions created by the Initial Developer are Copyright (C) 2012 the Initial Developer.
+ * All Rights Reserved.
+ *
+ * Contributor(s):
+ *
+ */
+
+#include "CacheServer.h"
+#include "ScanMetrics.h"
+#include "TextExporter.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <boost/algorithm/string.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/scoped_array.hpp>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+namespace fbods
+{
+
+using std::cerr;
+using std::endl;
+using std::ostream;
+using std::ostringstream;
+using std::runtime_error;
+using std::string;
+using std::vector;
+
+//------------------------------------------------------------------------------
+
+
+namespace
+{
+	const unsigned MAX_REQUEST = 65536;
+	const int CLIENT_TIMEOUT = 10;	// seconds
+
+	volatile sig_atomic_t stopRequested = 0;
+
+	void requestStop(int)
+	{
+		stopRequested = 1;
+	}
+
+	// Words, quoted values, operators and the characters "(", ")" and ",".
+	vector<string> tokenize(const string& request)
+	{
+		vector<string> tokens;
+		string::size_type i = 0;
+
+		while (i < request.length())
+		{
+			const char c = request[i];
+
+			if (isspace(static_cast<unsigned char>(c)))
+				++i;
+			else if (c == '\'')
+			{
+				string value;
+
+				for (++i; ; ++i)
+				{
+					if (i == request.length())
+						throw runtime_error("Unterminated quoted value");
+
+					if (request[i] == '\'')
+					{
+						if (i + 1 < request.length() && request[i + 1] == '\'')
+							++i;
+						else
+							break;
+					}
+
+					value += request[i];
+				}
+
+				++i;
+				tokens.push_back("'" + value);
+			}
+			else if (c == '(' || c == ')' || c == ',')
+				tokens.push_back(string(1, request[i++]));
+			else
+			{
+				const bool isOperator = strchr("<>=", c) != NULL;
+				const string::size_type start = i;
+
+				while (i < request.length() && !isspace(static_cast<unsigned char>(request[i])) &&
+					   !strchr("(),'", request[i]) && (strchr("<>=", request[i]) != NULL) == isOperator)
+				{
+					++i;
+				}
+
+				tokens.push_back(request.substr(start, i - start));
+			}
+		}
+
+		return tokens;
+	}
+
+	// Tokens read in order, quoted values having a leading quote.
+	class Tokens
+	{
+	public:
+		explicit Tokens(const string& request)
+			: tokens(tokenize(request)),
+			  position(0)
+		{
+		}
+
+	public:
+		bool atEnd() const
+		{
+			return position == tokens.size();
+		}
+
+		bool peek(const char* keyword) const
+		{
+			return !atEnd() && boost::algorithm::iequals(tokens[position], keyword);
+		}
+
+		bool accept(const char* keyword)
+		{
+			if (!peek(keyword))
+				return false;
+
+			++position;
+			return true;
+		}
+
+		void expect(const char* keyword)
+		{
+			if (!accept(keyword))
+				throw runtime_error(string("Expected ") + keyword + " in the request");
+		}
+
+		string next()
+		{
+			if (atEnd())
+				throw runtime_error("Incomplete request");
+
+			return tokens[position++];
+		}
+
+		// A quoted or unquoted value.
+		string nextValue()
+		{
+			const string token = next();
+			return token[0] == '\'' ? token.substr(1) : token;
+		}
+
+	private:
+		vector<string> tokens;
+		size_t position;
+	};
+
+	unsigned findField(const Format& format, const string& name)
+	{
+		for (unsigned i = 0; i < format.fields.size(); ++i)
+		{
+			if (boost::algorithm::iequals(format.fields[i].name, name))
+				return i;
+		}
+
+		throw runtime_error("Field " + name + " not found in the format");
+	}
+
+	bool isNumber(const Format::Field& field)
+	{
+		switch (field.type)
+		{
+			case Format::TYPE_SHORT:
+			case Format::TYPE_LONG:
+			case Format::TYPE_INT64:
+			case Format::TYPE_FLOAT:
+			case Format::TYPE_DOUBLE:
+				return true;
+
+			default:
+				return false;
+		}
+	}
+
+	void writeJsonString(ostream& out, const string& text)
+	{
+		out << '"';
+
+		for (string::const_iterator i = text.begin(); i != text.end(); ++i)
+		{
+			const unsigned char c = *i;
+
+			if (c == '"' || c == '\\')
+				out << '\\' << c;
+			else if (c < 0x20)
+			{
+				char s[8];
+				sprintf(s, "\\u%04x", c);
+				out << s;
+			}
+			else
+				out << c;
+		}
+
+		out << '"';
+	}
+
+	// Numbers as JSON numbers, other values as strings.
+	void writeJsonValue(ostream& out, const Format& format, unsigned n, const void* value)
+	{
+		if (isNumber(format.fields[n]))
+			format.print(out, n, value);
+		else
+		{
+			ostringstream text;
+			format.print(text, n, value);
+			writeJsonString(out, text.str());
+		}
+	}
+
+	void writeAll(int handle, const string& text)
+	{
+		const char* p = text.data();
+		size_t length = text.length();
+
+		while (length != 0)
+		{
+			const ssize_t n = write(handle, p, length);
+
+			if (n < 0 && errno == EINTR)
+				continue;
+
+			if (n <= 0)
+				throw runtime_error(string("Error writing the answer: ") + strerror(errno));
+
+			p += n;
+			length -= n;
+		}
+	}
+
+	struct Condition
+	{
+		enum Operator
+		{
+			OPERATOR_EQUAL,
+			OPERATOR_NOT_EQUAL,
+			OPERATOR_LESS,
+			OPERATOR_LESS_EQUAL,
+			OPERATOR_GREATER,
+			OPERATOR_GREATER_EQUAL,
+			OPERATOR_NULL,
+			OPERATOR_NOT_NULL
+		};
+
+		unsigned field;
+		Operator op;
+		boost::int64_t integer;
+		double real;
+		string text;
+	};
+
+	template <typename T>
+	bool compare(T value, T constant, Condition::Operator op)
+	{
+		switch (op)
+		{
+			case Condition::OPERATOR_EQUAL:
+				return value == constant;
+
+			case Condition::OPERATOR_NOT_EQUAL:
+				return value != constant;
+
+			case Condition::OPERATOR_LESS:
+				return value < constant;
+
+			case Condition::OPERATOR_LESS_EQUAL:
+				return value <= constant;
+
+			case Condition::OPERATOR_GREATER:
+				return value > constant;
+
+			case Condition::OPERATOR_GREATER_EQUAL:
+				return value >= constant;
+
+			default:
+				return false;
+		}
+	}
+
+	// The constant is converted to the form the column is encoded in.
+	Condition parseCondition(Tokens& tokens, const Format& format)
+	{
+		Condition condition;
+		condition.field = findField(format, tokens.next());
+		condition.integer = 0;
+		condition.real = 0;
+
+		const Format::Field& field = format.fields[condition.field];
+
+		if (tokens.accept("is"))
+		{
+			condition.op = tokens.accept("not") ? Condition::OPERATOR_NOT_NULL :
+				Condition::OPERATOR_NULL;
+			tokens.expect("null");
+			return condition;
+		}
+
+		static const char* const OPERATORS[] = {"=", "<>", "<", "<=", ">", ">="};
+		const string op = tokens.next();
+		unsigned n = 0;
+
+		while (n < sizeof(OPERATORS) / sizeof(OPERATORS[0]) && op != OPERATORS[n])
+			++n;
+
+		if (n == sizeof(OPERATORS) / sizeof(OPERATORS[0]))
+			throw runtime_error("Invalid operator: " + op);
+
+		condition.op = Condition::Operator(n);
+
+		if (field.type == Format::TYPE_BLOB)
+			throw runtime_error("Blob fields can't be compared: " + field.name);
+
+		boost::scoped_array<char> value(new char[field.length]);
+		format.parse(condition.field, tokens.nextValue(), value.get());
+
+		switch (field.type)
+		{
+			case Format::TYPE_FLOAT:
+				condition.real = *reinterpret_cast<const float*>(value.get());
+				break;
+
+			case Format::TYPE_DOUBLE:
+				condition.real = *reinterpret_cast<const double*>(value.get());
+				break;
+
+			case Format::TYPE_TEXT:
+				condition.text.assign(value.get(), field.length);
+				break;
+
+			case Format::TYPE_VARYING:
+			{
+				boost::uint16_t length;
+				memcpy(&length, value.get(), sizeof(length));
+				condition.text.assign(value.get() + sizeof(length), length);
+				break;
+			}
+
+			default:
+				condition.integer = ColumnSegment::readInteger(field, value.get());
+				break;
+		}
+
+		return condition;
+	}
+
+	// Keeps the selected rows of a segment that satisfy the condition.
+	void filter(const ColumnSegment& segment, const Condition& condition,
+		vector<unsigned>& selected)
+	{
+		const unsigned n = condition.field;
+		const ColumnSegment::Column& column = segment.columns[n];
+		vector<unsigned>::iterator out = selected.begin();
+
+		if (condition.op == Condition::OPERATOR_NULL || condition.op == Condition::OPERATOR_NOT_NULL)
+		{
+			const bool null = condition.op == Condition::OPERATOR_NULL;
+
+			for (vector<unsigned>::const_iterator i = selected.begin(); i != selected.end(); ++i)
+			{
+				if (segment.isNull(n, *i) == null)
+					*out++ = *i;
+			}
+
+			selected.erase(out, selected.end());
+			return;
+		}
+
+		switch (column.encoding)
+		{
+			case ColumnSegment::ENCODING_FRAME:
+				// Segments whose values are all out of the range are skipped.
+				if ((condition.op == Condition::OPERATOR_EQUAL &&
+						(condition.integer < column.min || condition.integer > column.max)) ||
+					((condition.op == Condition::OPERATOR_LESS ||
+						condition.op == Condition::OPERATOR_LESS_EQUAL) &&
+						!compare(column.min, condition.integer, condition.op)) ||
+					((condition.op == Condition::OPERATOR_GREATER ||
+						condition.op == Condition::OPERATOR_GREATER_EQUAL) &&
+						!compare(column.max, condition.integer, condition.op)))
+				{
+					break;
+				}
+
+				for (vector<unsigned>::const_iterator i = selected.begin(); i != selected.end(); ++i)
+				{
+					if (!segment.isNull(n, *i) &&
+						compare(segment.getInteger(n, *i), condition.integer, condition.op))
+					{
+						*out++ = *i;
+					}
+				}
+				break;
+
+			case ColumnSegment::ENCODING_DOUBLE:
+				for (vector<unsigned>::const_iterator i = selected.begin(); i != selected.end(); ++i)
+				{
+					if (!segment.isNull(n, *i) &&
+						compare(segment.getDouble(n, *i), condition.real, condition.op))
+					{
+						*out++ = *i;
+					}
+				}
+				break;
+
+			// The sorted dictionary turns the constant into a range of codes.
+			case ColumnSegment::ENCODING_DICTIONARY:
+			{
+				const vector<string>& dictionary = column.dictionary;
+				const unsigned lower = std::lower_bound(dictionary.begin(), dictionary.end(),
+					condition.text) - dictionary.begin();
+				const unsigned found = lower < dictionary.size() && dictionary[lower] == condition.text;
+				unsigned low = 0;
+				unsigned high = dictionary.size();
+				bool negate = false;
+
+				switch (condition.op)
+				{
+					case Condition::OPERATOR_NOT_EQUAL:
+						negate = true;
+						// fall through
+
+					case Condition::OPERATOR_EQUAL:
+						low = lower;
+						high = lower + found;
+						break;
+
+					case Condition::OPERATOR_LESS:
+						high = lower;
+						break;
+
+					case Condition::OPERATOR_LESS_EQUAL:
+						high = lower + found;
+						break;
+
+					case Condition::OPERATOR_GREATER:
+						low = lower + found;
+						break;
+
+					default:
+						low = lower;
+						break;
+				}
+
+				for (vector<unsigned>::const_iterator i = selected.begin(); i != selected.end(); ++i)
+				{
+					if (segment.isNull(n, *i))
+						continue;
+
+					const unsigned code = segment.getCode(n, *i);
+
+					if ((code >= low && code < high) != negate)
+						*out++ = *i;
+				}
+				break;
+			}
+		}
+
+		selected.erase(out, selected.end());
+	}
+
+	void select(const ColumnSegment& segment, const vector<Condition>& conditions,
+		vector<unsigned>& selected)
+	{
+		selected.clear();
+
+		for (unsigned row = 0; row < segment.rows; ++row)
+		{
+			if (!segment.isDeleted(row))
+				selected.push_back(row);
+		}
+
+		for (vector<Condition>::const_iterator i = conditions.begin();
+			 i != conditions.end() && !selected.empty();
+			 ++i)
+		{
+			filter(segment, *i, selected);
+		}
+	}
+
+	vector<Condition> parseWhere(Tokens& tokens, const Format& format)
+	{
+		vector<Condition> conditions;
+
+		if (tokens.accept("where"))
+		{
+			do
+			{
+				conditions.push_back(parseCondition(tokens, format));
+			} while (tokens.accept("and"));
+		}
+
+		return conditions;
+	}
+
+	struct Aggregate
+	{
+		enum Function
+		{
+			FUNCTION_COUNT,
+			FUNCTION_SUM,
+			FUNCTION_MIN,
+			FUNCTION_MAX,
+			FUNCTION_AVG
+		};
+
+		Function function;
+		int field;	// -1 for count(*)
+		string name;
+	};
+
+	struct Accumulator
+	{
+		Accumulator()
+			: count(0),
+			  integer(0),
+			  real(0),
+			  minInteger(0),
+			  maxInteger(0),
+			  minReal(0),
+			  maxReal(0)
+		{
+		}
+
+		void add(const ColumnSegment& segment, int field, unsigned row)
+		{
+			if (field < 0)
+			{
+				++count;
+				return;
+			}
+
+			if (segment.isNull(field, row))
+				return;
+
+			const ColumnSegment::Column& column = segment.columns[field];
+			const bool first = count++ == 0;
+
+			switch (column.encoding)
+			{
+				case ColumnSegment::ENCODING_FRAME:
+				{
+					const boost::int64_t value = segment.getInteger(field, row);
+					integer += value;
+
+					if (first || value < minInteger)
+						minInteger = value;
+
+					if (first || value > maxInteger)
+						maxInteger = value;
+					break;
+				}
+
+				case ColumnSegment::ENCODING_DOUBLE:
+				{
+					const double value = segment.getDouble(field, row);
+					real += value;
+
+					if (first || value < minReal)
+						minReal = value;
+
+					if (first || value > maxReal)
+						maxReal = value;
+					break;
+				}
+
+				case ColumnSegment::ENCODING_DICTIONARY:
+				{
+					const string& value = column.dictionary[segment.getCode(field, row)];
+
+					if (first || value < minText)
+						minText = value;
+
+					if (first || value > maxText)
+						maxText = value;
+					break;
+				}
+			}
+		}
+
+		boost::uint64_t count;
+		boost::int64_t integer;
+		double real;
+		boost::int64_t minInteger, maxInteger;
+		double minReal, maxReal;
+		string minText, maxText;
+	};
+
+	void writeAggregate(ostream& out, const Format& format, const Aggregate& aggregate,
+		const Accumulator& accumulator)
+	{
+		if (aggregate.function == Aggregate::FUNCTION_COUNT)
+		{
+			out << accumulator.count;
+			return;
+		}
+
+		if (accumulator.count == 0)
+		{
+			out << "null";
+			return;
+		}
+
+		const Format::Field& field = format.fields[aggregate.field];
+		const bool real = field.type == Format::TYPE_FLOAT || field.type == Format::TYPE_DOUBLE;
+
+		if (aggregate.function == Aggregate::FUNCTION_SUM && !real)
+			Format::printScaled(out, accumulator.integer, field.scale);
+		else if (aggregate.function == Aggregate::FUNCTION_SUM)
+			out << std::setprecision(17) << accumulator.real;
+		else if (aggregate.function == Aggregate::FUNCTION_AVG)
+		{
+			double average = (real ? accumulator.real : double(accumulator.integer)) /
+				accumulator.count;
+
+			for (int i = 0; !real && i < -field.scale; ++i)
+				average /= 10;
+
+			out << std::setprecision(17) << average;
+		}
+		else
+		{
+			// Minimum or maximum, converted back to the format layout to be printed.
+			const bool min = aggregate.function == Aggregate::FUNCTION_MIN;
+			boost::scoped_array<char> value(new char[field.length]);
+
+			if (real && field.type == Format::TYPE_FLOAT)
+			{
+				const float f = float(min ? accumulator.minReal : accumulator.maxReal);
+				memcpy(value.get(), &f, sizeof(f));
+			}
+			else if (real)
+			{
+				const double d = min ? accumulator.minReal : accumulator.maxReal;
+				memcpy(value.get(), &d, sizeof(d));
+			}
+			else if (field.type == Format::TYPE_TEXT || field.type == Format::TYPE_VARYING)
+			{
+				const string& text = min ? accumulator.minText : accumulator.maxText;
+
+				if (field.type == Format::TYPE_VARYING)
+				{
+					const boost::uint16_t length = text.length();
+					memcpy(value.get(), &length, sizeof(length));
+					memcpy(value.get() + sizeof(length), text.data(), text.length());
+				}
+				else
+					memcpy(value.get(), text.data(), text.length());
+			}
+			else
+			{
+				ColumnSegment::writeInteger(field,
+					(min ? accumulator.minInteger : accumulator.maxInteger), value.get());
+			}
+
+			writeJsonValue(out, format, aggregate.field, value.get());
+		}
+	}
+
+	vector<Aggregate> parseAggregates(Tokens& tokens, const Format& format)
+	{
+		static const char* const FUNCTIONS[] = {"count", "sum", "min", "max", "avg"};
+		vector<Aggregate> aggregates;
+
+		do
+		{
+			const string function = tokens.next();
+			Aggregate aggregate;
+			unsigned n = 0;
+
+			while (n < sizeof(FUNCTIONS) / sizeof(FUNCTIONS[0]) &&
+				   !boost::algorithm::iequals(function, FUNCTIONS[n]))
+			{
+				++n;
+			}
+
+			if (n == sizeof(FUNCTIONS) / sizeof(FUNCTIONS[0]))
+				throw runtime_error("Invalid aggregate function: " + function);
+
+			aggregate.function = Aggregate::Function(n);
+			tokens.expect("(");
+
+			if (aggregate.function == Aggregate::FUNCTION_COUNT && tokens.accept("*"))
+			{
+				aggregate.field = -1;
+				aggregate.name = "count(*)";
+			}
+			else
+			{
+				aggregate.field = findField(format, tokens.next());
+
+				const Format::Field& field = format.fields[aggregate.field];
+
+				if ((aggregate.function == Aggregate::FUNCTION_SUM ||
+						aggregate.function == Aggregate::FUNCTION_AVG) && !isNumber(field))
+				{
+					throw runtime_error("Only numbers can be summed: " + field.name);
+				}
+
+				if (aggregate.function != Aggregate::FUNCTION_COUNT && field.type == Format::TYPE_BLOB)
+					throw runtime_error("Blob fields can't be aggregated: " + field.name);
+
+				aggregate.name = boost::algorithm::to_lower_copy(function) + "(" + field.name + ")";
+			}
+
+			tokens.expect(")");
+			aggregates.push_back(aggregate);
+		} while (tokens.accept(","));
+
+		return aggregates;
+	}
+
+	// Rows of the group field are mapped to the groups by their encoded values, so the key of
+	// a group is printed once per segment.
+	class Grouper
+	{
+	public:
+		Grouper(const Format& aFormat, int aField)
+			: format(aFormat),
+			  field(aField),
+			  nullGroup(-1),
+			  segment(NULL),
+			  value(new char[aField < 0 ? 1 : aFormat.fields[aField].length])
+		{
+		}
+
+	public:
+		void setSegment(const ColumnSegment* aSegment)
+		{
+			segment = aSegment;
+			segmentGroups.clear();
+		}
+
+		unsigned getGroup(unsigned row)
+		{
+			if (field < 0 || segment->isNull(field, row))
+			{
+				if (nullGroup < 0)
+					nullGroup = getGroup(string("null"));
+
+				return nullGroup;
+			}
+
+			const ColumnSegment::Column& column = segment->columns[field];
+			boost::uint64_t encoded;
+
+			if (column.encoding == ColumnSegment::ENCODING_DOUBLE)
+			{
+				const double real = segment->getDouble(field, row);
+				memcpy(&encoded, &real, sizeof(encoded));
+			}
+			else
+				encoded = column.packed.get(row);
+
+			std::map<boost::uint64_t, unsigned>::const_iterator i = segmentGroups.find(encoded);
+
+			if (i != segmentGroups.end())
+				return i->second;
+
+			segment->getValue(field, row, value.get());
+
+			ostringstream key;
+			writeJsonValue(key, format, field, value.get());
+
+			const unsigned group = getGroup(key.str());
+			segmentGroups[encoded] = group;
+
+			return group;
+		}
+
+	private:
+		unsigned getGroup(const string& key)
+		{
+			std::map<string, unsigned>::const_iterator i = groups.find(key);
+
+			if (i != groups.end())
+				return i->second;
+
+			const unsigned group = groups.size();
+			groups[key] = group;
+
+			return group;
+		}
+
+	public:
+		std::map<string, unsigned> groups;	// key as JSON -> number
+
+	private:
+		const Format& format;
+		int field;
+		int nullGroup;	// also the single group without a field
+		const ColumnSegment* segment;
+		std::map<boost::uint64_t, unsigned> segmentGroups;
+		boost::scoped_array<char> value;
+	};
+}	// namespace
+
+
+CacheServer::CacheServer(Database* aDatabase, const string& aSocketName)
+	: database(aDatabase),
+	  socketName(aSocketName),
+	  handle(-1)
+{
+	sockaddr_un address;
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+
+	if (socketName.length() >= sizeof(address.sun_path))
+		throw runtime_error("Socket path too long: " + socketName);
+
+	strcpy(address.sun_path, socketName.c_str());
+
+	// A socket left by a previous server is replaced, other files are not.
+	struct stat st;
+
+	if (lstat(socketName.c_str(), &st) == 0)
+	{
+		if (!S_ISSOCK(st.st_mode))
+			throw runtime_error(socketName + " exists and is not a socket");
+
+		unlink(socketName.c_str());
+	}
+
+	handle = socket(AF_UNIX, SOCK_STREAM, 0);
+
+	if (handle < 0)
+		throw runtime_error("Cannot create the socket");
+
+	if (bind(handle, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 ||
+		listen(handle, 64) != 0)
+	{
+		close(handle);
+		throw runtime_error("Cannot listen on " + socketName + ": " + strerror(errno));
+	}
+}
+
+CacheServer::~CacheServer()
+{
+	close(handle);
+	unlink(socketName.c_str());
+
+	for (vector<CachedRelation*>::iterator i = relations.begin(); i != relations.end(); ++i)
+		delete *i;
+}
+
+void CacheServer::addRelation(const string& name, const string& formatSpec)
+{
+	if (findRelation(name))
+		throw runtime_error("Relation " + name + " is cached twice");
+
+	// Fails early when the relation doesn't exist.
+	database->findRelation(name.c_str());
+
+	relations.push_back(new CachedRelation(database, name, formatSpec));
+}
+
+void CacheServer::run(double interval)
+{
+	struct sigaction action;
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = requestStop;
+	sigaction(SIGINT, &action, NULL);
+	sigaction(SIGTERM, &action, NULL);
+
+	// Clients closing the connection early must not stop the server.
+	signal(SIGPIPE, SIG_IGN);
+
+	refresh();
+
+	boost::uint64_t nextRefresh = ScanCounters::now() + boost::uint64_t(interval * 1e9);
+
+	while (!stopRequested)
+	{
+		const boost::uint64_t now = ScanCounters::now();
+
+		if (now >= nextRefresh)
+		{
+			refresh();
+			nextRefresh = ScanCounters::now() + boost::uint64_t(interval * 1e9);
+			continue;
+		}
+
+		pollfd listener;
+		listener.fd = handle;
+		listener.events = POLLIN;
+
+		const int ready = poll(&listener, 1, int((nextRefresh - now + 999999) / 1000000));
+
+		if (ready < 0 && errno != EINTR)
+			throw runtime_error(string("Error waiting for clients: ") + strerror(errno));
+
+		if (ready <= 0)
+			continue;
+
+		const int client = accept(handle, NULL, NULL);
+
+		if (client >= 0)
+		{
+			serve(client);
+			close(client);
+		}
+	}
+}
+
+// Refresh errors are reported and the relation loaded again by the next one.
+void CacheServer::refresh()
+{
+	database->refreshHeader();
+
+	for (vector<CachedRelation*>::iterator i = relations.begin(); i != relations.end(); ++i)
+	{
+		CachedRelation* relation = *i;
+		const boost::uint64_t start = ScanCounters::now();
+
+		try
+		{
+			if (relation->refresh() == 0)
+				continue;
+		}
+		catch (const std::exception& e)
+		{
+			cerr << relation->name << ": " << e.what() << endl;
+			continue;
+		}
+
+		cerr << relation->name << ": " << relation->changedPages << " changed pages, " <<
+			relation->getRows() << " rows, " << relation->segments.size() << " segments, " <<
+			relation->getSize() << " bytes, " << (ScanCounters::now() - start) / 1000 <<
+			" us" << endl;
+	}
+}
+
+void CacheServer::serve(int client)
+{
+	timeval timeout;
+	timeout.tv_sec = CLIENT_TIMEOUT;
+	timeout.tv_usec = 0;
+	setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+	setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+	string request;
+	char buffer[4096];
+
+	while (request.find('\n') == string::npos && request.length() < MAX_REQUEST)
+	{
+		const ssize_t n = read(client, buffer, sizeof(buffer));
+
+		if (n < 0 && errno == EINTR)
+			continue;
+
+		if (n <= 0)
+			break;
+
+		request.append(buffer, n);
+	}
+
+	request = request.substr(0, request.find('\n'));
+
+	try
+	{
+		execute(request, client);
+	}
+	catch (const std::exception& e)
+	{
+		ostringstream out;
+		out << "{\"error\": ";
+		writeJsonString(out, e.what());
+		out << "}" << endl;
+
+		try
+		{
+			writeAll(client, out.str());
+		}
+		catch (const std::exception&)
+		{
+		}
+	}
+}
+
+void CacheServer::execute(const string& request, int client)
+{
+	const boost::uint64_t start = ScanCounters::now();
+	Tokens tokens(request);
+	ostringstream out;
+
+	if (tokens.accept("relations"))
+	{
+		out << "{\"relations\": [";
+
+		for (vector<CachedRelation*>::const_iterator i = relations.begin(); i != relations.end(); ++i)
+		{
+			const CachedRelation* relation = *i;
+
+			out << (i == relations.begin() ? "" : ", ") << "{\"name\": ";
+			writeJsonString(out, relation->name);
+			out << ", \"rows\": " << relation->getRows() <<
+				", \"segments\": " << relation->segments.size() <<
+				", \"bytes\": " << relation->getSize() <<
+				", \"refreshes\": " << relation->refreshes <<
+				", \"changedPages\": " << relation->changedPages << "}";
+		}
+
+		out << "]}" << endl;
+		writeAll(client, out.str());
+		return;
+	}
+
+	const string command = boost::algorithm::to_lower_copy(tokens.next());
+
+	if (command != "count" && command != "aggregate" && command != "scan")
+		throw runtime_error("Invalid request: " + command);
+
+	const string relationName = tokens.next();
+	const CachedRelation* relation = findRelation(relationName);
+
+	if (!relation)
+		throw runtime_error("Relation " + relationName + " is not cached");
+
+	const Format& format = relation->format;
+	vector<Aggregate> aggregates;
+
+	if (command == "aggregate")
+		aggregates = parseAggregates(tokens, format);
+
+	const vector<Condition> conditions = parseWhere(tokens, format);
+	int groupField = -1;
+	boost::uint64_t limit = ~boost::uint64_t(0);
+
+	if (command == "aggregate" && tokens.accept("group"))
+	{
+		tokens.expect("by");
+		groupField = findField(format, tokens.next());
+	}
+	else if (command == "scan" && tokens.accept("limit"))
+		limit = boost::lexical_cast<boost::uint64_t>(tokens.next());
+
+	if (!tokens.atEnd())
+		throw runtime_error("Unexpected " + tokens.next() + " in the request");
+
+	vector<unsigned> selected;
+	boost::uint64_t matched = 0;
+
+	if (command == "scan")
+	{
+		TextExporter exporter(&format, client, TextExporter::STYLE_CSV);
+		exporter.writeHeader();
+
+		boost::scoped_array<char> record(new char[format.length]);
+		boost::uint8_t* nulls = reinterpret_cast<boost::uint8_t*>(record.get());
+
+		for (vector<ColumnSegment*>::const_iterator i = relation->segments.begin();
+			 i != relation->segments.end() && matched < limit;
+			 ++i)
+		{
+			const ColumnSegment& segment = **i;
+			select(segment, conditions, selected);
+
+			for (vector<unsigned>::const_iterator row = selected.begin();
+				 row != selected.end() && matched < limit;
+				 ++row, ++matched)
+			{
+				memset(record.get(), 0, format.length);
+
+				for (unsigned n = 0; n < format.fields.size(); ++n)
+				{
+					if (segment.isNull(n, *row))
+						nulls[n >> 3] |= 1 << (n & 7);
+					else
+						segment.getValue(n, *row, record.get() + format.fields[n].offset);
+				}
+
+				exporter.add(record.get());
+			}
+		}
+
+		exporter.finish();
+		return;
+	}
+
+	Grouper grouper(format, groupField);
+	vector<vector<Accumulator> > accumulators;
+
+	for (vector<ColumnSegment*>::const_iterator i = relation->segments.begin();
+		 i != relation->segments.end();
+		 ++i)
+	{
+		const ColumnSegment& segment = **i;
+		select(segment, conditions, selected);
+		matched += selected.size();
+
+		if (command == "count")
+			continue;
+
+		grouper.setSegment(&segment);
+
+		for (vector<unsigned>::const_iterator row = selected.begin(); row != selected.end(); ++row)
+		{
+			const unsigned group = grouper.getGroup(*row);
+
+			if (group >= accumulators.size())
+				accumulators.resize(group + 1, vector<Accumulator>(aggregates.size()));
+
+			for (unsigned j = 0; j < aggregates.size(); ++j)
+				accumulators[group][j].add(segment, aggregates[j].field, *row);
+		}
+	}
+
+	out << "{\"relation\": ";
+	writeJsonString(out, relation->name);
+	out << ", \"rows\": " << matched;
+
+	if (command == "aggregate")
+	{
+		// Without grouping there's a single group, even when no rows match.
+		if (groupField < 0 && accumulators.empty())
+		{
+			grouper.groups["null"] = 0;
+			accumulators.resize(1, vector<Accumulator>(aggregates.size()));
+		}
+
+		out << ", \"aggregates\": [";
+
+		for (unsigned j = 0; j < aggregates.size(); ++j)
+		{
+			out << (j == 0 ? "" : ", ");
+			writeJsonString(out, aggregates[j].name);
+		}
+
+		out << "], \"groups\": [";
+
+		for (std::map<string, unsigned>::const_iterator i = grouper.groups.begin();
+			 i != grouper.groups.end();
+			 ++i)
+		{
+			out << (i == grouper.groups.begin() ? "" : ", ") << "{\"key\": " << i->first <<
+				", \"values\": [";
+
+			for (unsigned j = 0; j < aggregates.size(); ++j)
+			{
+				out << (j == 0 ? "" : ", ");
+				writeAggregate(out, format, aggregates[j], accumulators[i->second][j]);
+			}
+
+			out << "]}";
+		}
+
+		out << "]";
+	}
+
+	out << ", \"micros\": " << (ScanCounters::now() - start) / 1000 << "}" << endl;
+	writeAll(client, out.str());
+}
+
+CachedRelation* CacheServer::findRelation(const string& name) const
+{
+	for (vector<CachedRelation*>::const_iterator i = relations.begin(); i != relations.end(); ++i)
+	{
+		if (boost::algorithm::iequals((*i)->name, name))
+			return *i;
+	}
+
+	return NULL;
+}
+
+
+//------------------------------------------------------------------------------
+
+}	// fbods
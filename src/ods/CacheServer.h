@@ -0,0 +1,82 @@
+/*
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Initial Developer of the Original Code is Adriano dos Santos Fernandes.
+ * Portions created by the Initial Developer are Copyright (C) 2012 the Initial Developer.
+ * All Rights Reserved.
+ *
+ * Contributor(s):
+ *
+ */
+
+#ifndef FBSTUFF_ODS_CACHE_SERVER_H
+#define FBSTUFF_ODS_CACHE_SERVER_H
+
+#include "ColumnStore.h"
+#include "Database.h"
+#include <string>
+#include <vector>
+
+namespace fbods
+{
+
+//------------------------------------------------------------------------------
+
+
+// Answers queries over cached relations through a Unix socket. A client connects, sends a
+// request line and reads the answer until the server closes the connection: JSON for
+// relations, count and aggregate, CSV with a header for scan.
+//
+//   relations
+//   count <relation> [where <condition> [and <condition>]...]
+//   aggregate <relation> <function>(<field> | *)[, ...] [where ...] [group by <field>]
+//   scan <relation> [where ...] [limit <records>]
+//
+// Functions are count, sum, min, max and avg. Conditions are "<field> <operator> <value>",
+// with =, <>, <, <=, > or >=, or "<field> is [not] null". Values with spaces are quoted with
+// single quotes.
+//
+// Requests are served one at a time and the relations are refreshed between them.
+class CacheServer
+{
+public:
+	CacheServer(Database* aDatabase, const std::string& aSocketName);
+	~CacheServer();
+
+private:
+	CacheServer(const CacheServer&);
+	CacheServer& operator =(const CacheServer&);
+
+public:
+	void addRelation(const std::string& name, const std::string& formatSpec);
+
+	// Serves until SIGINT or SIGTERM, refreshing the relations every interval seconds.
+	void run(double interval);
+
+private:
+	void refresh();
+	void serve(int client);
+	void execute(const std::string& request, int client);
+	CachedRelation* findRelation(const std::string& name) const;
+
+private:
+	Database* database;
+	std::string socketName;
+	int handle;
+	std::vector<CachedRelation*> relations;
+};
+
+
+//------------------------------------------------------------------------------
+
+}	// fbods
+
+#endif	// FBSTUFF_ODS_CACHE_SERVER_H
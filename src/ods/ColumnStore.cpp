@@ -0,0 +1,503 @@
+/*
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Initial Developer of the Original Code is Adriano dos Santos Fernandes.
+ * Portions created by the Initial Developer are Copyright (C) 2012 the Initial Developer.
+ * All Rights Reserved.
+ *
+ * Contributor(s):
+ *
+ */
+
+#include "ColumnStore.h"
+#include "RecordBatch.h"
+#include "ScanStream.h"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <boost/scoped_array.hpp>
+
+namespace fbods
+{
+
+using std::string;
+using std::vector;
+
+//------------------------------------------------------------------------------
+
+
+namespace
+{
+	// Timestamp times are 1/10000 of second.
+	const boost::int64_t TICKS_PER_DAY = boost::int64_t(86400) * 10000;
+
+	// Segments added by refreshes beyond the ones of a full load before the relation is
+	// loaded again.
+	const unsigned MAX_EXTRA_SEGMENTS = 64;
+
+	template <typename T>
+	T readValue(const void* p)
+	{
+		T value;
+		memcpy(&value, p, sizeof(value));
+		return value;
+	}
+
+	template <typename T>
+	void writeValue(void* p, T value)
+	{
+		memcpy(p, &value, sizeof(value));
+	}
+
+	unsigned getWidth(boost::uint64_t maxValue)
+	{
+		unsigned width = 0;
+
+		while (width < 64 && (maxValue >> width) != 0)
+			++width;
+
+		return width;
+	}
+}	// namespace
+
+
+void BitPacked::assign(const vector<boost::uint64_t>& values, unsigned aWidth)
+{
+	width = aWidth;
+	words.assign((boost::uint64_t(values.size()) * width + 63) / 64 + 1, 0);
+
+	if (width == 0)
+		return;
+
+	for (size_t i = 0; i < values.size(); ++i)
+	{
+		const boost::uint64_t position = boost::uint64_t(i) * width;
+		const unsigned shift = position & 63;
+		boost::uint64_t* p = &words[position >> 6];
+
+		p[0] |= values[i] << shift;
+
+		if (shift + width > 64)
+			p[1] |= values[i] >> (64 - shift);
+	}
+}
+
+
+ColumnSegment::ColumnSegment(const RecordBatch& batch, const vector<PageRows>& aPages)
+	: format(batch.format),
+	  rows(batch.count),
+	  deletedRows(0),
+	  columns(batch.columns.size()),
+	  pages(aPages)
+{
+	vector<boost::uint64_t> values(rows);
+
+	for (unsigned i = 0; i < columns.size(); ++i)
+	{
+		const Format::Field& field = format->fields[i];
+		const RecordBatch::Column& source = batch.columns[i];
+		Column& column = columns[i];
+
+		column.min = column.max = 0;
+
+		if (std::find(source.nulls.begin(), source.nulls.end(), 1) != source.nulls.end())
+		{
+			for (unsigned row = 0; row < rows; ++row)
+				values[row] = source.nulls[row];
+
+			column.nulls.assign(values, 1);
+		}
+
+		switch (field.type)
+		{
+			case Format::TYPE_FLOAT:
+			case Format::TYPE_DOUBLE:
+				column.encoding = ENCODING_DOUBLE;
+				column.doubles.resize(rows);
+
+				for (unsigned row = 0; row < rows; ++row)
+				{
+					const boost::uint8_t* value = &source.values[row * field.length];
+					column.doubles[row] = (field.type == Format::TYPE_FLOAT ?
+						double(readValue<float>(value)) : readValue<double>(value));
+				}
+				break;
+
+			case Format::TYPE_TEXT:
+			case Format::TYPE_VARYING:
+			{
+				column.encoding = ENCODING_DICTIONARY;
+
+				for (unsigned row = 0; row < rows; ++row)
+				{
+					if (!source.nulls[row])
+					{
+						column.dictionary.push_back(string(
+							reinterpret_cast<const char*>(&source.values[0]) + source.offsets[row],
+							source.offsets[row + 1] - source.offsets[row]));
+					}
+				}
+
+				std::sort(column.dictionary.begin(), column.dictionary.end());
+				column.dictionary.erase(
+					std::unique(column.dictionary.begin(), column.dictionary.end()),
+					column.dictionary.end());
+
+				for (unsigned row = 0; row < rows; ++row)
+				{
+					values[row] = 0;
+
+					if (!source.nulls[row])
+					{
+						const string text(
+							reinterpret_cast<const char*>(&source.values[0]) + source.offsets[row],
+							source.offsets[row + 1] - source.offsets[row]);
+						values[row] = std::lower_bound(column.dictionary.begin(),
+							column.dictionary.end(), text) - column.dictionary.begin();
+					}
+				}
+
+				column.packed.assign(values, getWidth(
+					column.dictionary.empty() ? 0 : column.dictionary.size() - 1));
+				break;
+			}
+
+			default:
+			{
+				column.encoding = ENCODING_FRAME;
+				bool first = true;
+
+				for (unsigned row = 0; row < rows; ++row)
+				{
+					if (source.nulls[row])
+						continue;
+
+					const boost::int64_t integer =
+						readInteger(field, &source.values[row * field.length]);
+
+					if (first || integer < column.min)
+						column.min = integer;
+
+					if (first || integer > column.max)
+						column.max = integer;
+
+					first = false;
+				}
+
+				for (unsigned row = 0; row < rows; ++row)
+				{
+					values[row] = source.nulls[row] ? 0 : boost::uint64_t(
+						readInteger(field, &source.values[row * field.length])) -
+						boost::uint64_t(column.min);
+				}
+
+				column.packed.assign(values,
+					getWidth(boost::uint64_t(column.max) - boost::uint64_t(column.min)));
+				break;
+			}
+		}
+	}
+}
+
+boost::int64_t ColumnSegment::readInteger(const Format::Field& field, const void* value)
+{
+	switch (field.type)
+	{
+		case Format::TYPE_SHORT:
+			return readValue<boost::int16_t>(value);
+
+		case Format::TYPE_LONG:
+		case Format::TYPE_DATE:
+			return readValue<boost::int32_t>(value);
+
+		case Format::TYPE_TIME:
+			return readValue<boost::uint32_t>(value);
+
+		case Format::TYPE_TIMESTAMP:
+			return readValue<boost::int32_t>(value) * TICKS_PER_DAY +
+				readValue<boost::uint32_t>(static_cast<const char*>(value) + 4);
+
+		// Blob ids as their relation and number.
+		case Format::TYPE_BLOB:
+			return (boost::int64_t(readValue<boost::uint32_t>(value)) << 32) |
+				readValue<boost::uint32_t>(static_cast<const char*>(value) + 4);
+
+		default:
+			return readValue<boost::int64_t>(value);
+	}
+}
+
+void ColumnSegment::writeInteger(const Format::Field& field, boost::int64_t integer, void* value)
+{
+	switch (field.type)
+	{
+		case Format::TYPE_SHORT:
+			writeValue(value, boost::int16_t(integer));
+			break;
+
+		case Format::TYPE_LONG:
+		case Format::TYPE_DATE:
+			writeValue(value, boost::int32_t(integer));
+			break;
+
+		case Format::TYPE_TIME:
+			writeValue(value, boost::uint32_t(integer));
+			break;
+
+		case Format::TYPE_TIMESTAMP:
+		{
+			boost::int64_t date = integer / TICKS_PER_DAY;
+
+			if (integer % TICKS_PER_DAY < 0)
+				--date;
+
+			writeValue(value, boost::int32_t(date));
+			writeValue(static_cast<char*>(value) + 4,
+				boost::uint32_t(integer - date * TICKS_PER_DAY));
+			break;
+		}
+
+		case Format::TYPE_BLOB:
+			writeValue(value, boost::uint32_t(boost::uint64_t(integer) >> 32));
+			writeValue(static_cast<char*>(value) + 4, boost::uint32_t(integer));
+			break;
+
+		default:
+			writeValue(value, integer);
+			break;
+	}
+}
+
+void ColumnSegment::getValue(unsigned column, unsigned row, void* value) const
+{
+	const Format::Field& field = format->fields[column];
+	const Column& c = columns[column];
+
+	switch (c.encoding)
+	{
+		case ENCODING_DOUBLE:
+			if (field.type == Format::TYPE_FLOAT)
+				writeValue(value, float(c.doubles[row]));
+			else
+				writeValue(value, c.doubles[row]);
+			break;
+
+		case ENCODING_DICTIONARY:
+		{
+			const string& text = c.dictionary[getCode(column, row)];
+
+			if (field.type == Format::TYPE_VARYING)
+			{
+				writeValue(value, boost::uint16_t(text.length()));
+				memcpy(static_cast<char*>(value) + 2, text.data(), text.length());
+			}
+			else
+				memcpy(value, text.data(), text.length());
+			break;
+		}
+
+		case ENCODING_FRAME:
+			writeInteger(field, getInteger(column, row), value);
+			break;
+	}
+}
+
+void ColumnSegment::deletePage(const PageRows& pageRows)
+{
+	if (deleted.empty())
+		deleted.resize(rows);
+
+	for (unsigned row = pageRows.first; row < pageRows.first + pageRows.count; ++row)
+		deleted[row] = true;
+
+	deletedRows += pageRows.count;
+}
+
+size_t ColumnSegment::getSize() const
+{
+	size_t size = sizeof(*this) + pages.size() * sizeof(PageRows) + deleted.size() / 8;
+
+	for (vector<Column>::const_iterator i = columns.begin(); i != columns.end(); ++i)
+	{
+		size += sizeof(*i) + i->nulls.getSize() + i->packed.getSize() +
+			i->doubles.size() * sizeof(double);
+
+		for (vector<string>::const_iterator j = i->dictionary.begin();
+			 j != i->dictionary.end();
+			 ++j)
+		{
+			size += sizeof(*j) + j->capacity();
+		}
+	}
+
+	return size;
+}
+
+
+CachedRelation::CachedRelation(Database* aDatabase, const string& aName, const string& formatSpec)
+	: name(aName),
+	  format(formatSpec),
+	  refreshes(0),
+	  changedPages(0),
+	  database(aDatabase),
+	  rows(0),
+	  deletedRows(0)
+{
+}
+
+CachedRelation::~CachedRelation()
+{
+	clear();
+}
+
+// A refresh failing half way leaves the relation to be loaded again by the next one.
+unsigned CachedRelation::refresh()
+{
+	if (deletedRows > rows || segments.size() > rows / SEGMENT_ROWS + MAX_EXTRA_SEGMENTS)
+		clear();
+
+	const GenerationMap previous(generations);
+	vector<ColumnSegment*> added;
+
+	try
+	{
+		IncrementalScanStream scan(database, name.c_str(), 0, &generations);
+		RecordBatch batch(&format, SEGMENT_ROWS);
+		vector<ColumnSegment::PageRows> batchPages;
+		boost::scoped_array<char> record(new char[ScanStream::MAX_RECORD_SIZE]);
+
+		// Segments end at page boundaries, for the rows of a page to be in a single one.
+		while (scan.fetch(record.get()))
+		{
+			const unsigned page = scan.getPageNumber();
+
+			if (batchPages.empty() || batchPages.back().page != page)
+			{
+				if (batch.count >= SEGMENT_ROWS)
+				{
+					added.push_back(new ColumnSegment(batch, batchPages));
+					batch.clear();
+					batchPages.clear();
+				}
+
+				const ColumnSegment::PageRows pageRows = {page, batch.count, 0};
+				batchPages.push_back(pageRows);
+			}
+
+			batch.add(record.get());
+			++batchPages.back().count;
+		}
+
+		if (batch.count != 0)
+			added.push_back(new ColumnSegment(batch, batchPages));
+
+		// Pages that left the relation are removed from the map, and they and the changed ones
+		// from the segments.
+		vector<unsigned> current(scan.getPages());
+		std::sort(current.begin(), current.end());
+		changedPages = 0;
+
+		for (GenerationMap::iterator i = generations.begin(); i != generations.end();)
+		{
+			const unsigned page = i->first;
+			const GenerationMap::const_iterator old = previous.find(page);
+			const bool removed = !std::binary_search(current.begin(), current.end(), page);
+
+			if (old == previous.end() || old->second.generation != i->second.generation || removed)
+			{
+				std::map<unsigned, std::pair<ColumnSegment*, unsigned> >::iterator cached =
+					pageRows.find(page);
+
+				if (cached != pageRows.end())
+				{
+					ColumnSegment* segment = cached->second.first;
+					const ColumnSegment::PageRows& segmentRows =
+						segment->pages[cached->second.second];
+
+					segment->deletePage(segmentRows);
+					rows -= segmentRows.count;
+					deletedRows += segmentRows.count;
+					pageRows.erase(cached);
+				}
+
+				++changedPages;
+			}
+
+			if (removed)
+				generations.erase(i++);
+			else
+				++i;
+		}
+	}
+	catch (...)
+	{
+		for (vector<ColumnSegment*>::iterator i = added.begin(); i != added.end(); ++i)
+			delete *i;
+
+		clear();
+		throw;
+	}
+
+	// Segments whose rows were all deleted are dropped.
+	for (vector<ColumnSegment*>::iterator i = segments.begin(); i != segments.end();)
+	{
+		if ((*i)->deletedRows == (*i)->rows)
+		{
+			deletedRows -= (*i)->rows;
+			delete *i;
+			i = segments.erase(i);
+		}
+		else
+			++i;
+	}
+
+	for (vector<ColumnSegment*>::iterator i = added.begin(); i != added.end(); ++i)
+	{
+		ColumnSegment* segment = *i;
+
+		for (unsigned j = 0; j < segment->pages.size(); ++j)
+			pageRows[segment->pages[j].page] = std::make_pair(segment, j);
+
+		rows += segment->rows;
+		segments.push_back(segment);
+	}
+
+	++refreshes;
+
+	return changedPages;
+}
+
+size_t CachedRelation::getSize() const
+{
+	size_t size = sizeof(*this) + pageRows.size() * 48 + generations.size() * 40;
+
+	for (vector<ColumnSegment*>::const_iterator i = segments.begin(); i != segments.end(); ++i)
+		size += (*i)->getSize();
+
+	return size;
+}
+
+void CachedRelation::clear()
+{
+	for (vector<ColumnSegment*>::iterator i = segments.begin(); i != segments.end(); ++i)
+		delete *i;
+
+	segments.clear();
+	pageRows.clear();
+	generations.clear();
+	rows = 0;
+	deletedRows = 0;
+}
+
+
+//------------------------------------------------------------------------------
+
+}	// fbods
@@ -0,0 +1,222 @@
+/*
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Initial Developer of the Original Code is Adriano dos Santos Fernandes.
+ * Portions created by the Initial Developer are Copyright (C) 2012 the Initial Developer.
+ * All Rights Reserved.
+ *
+ * Contributor(s):
+ *
+ */
+
+#ifndef FBSTUFF_ODS_COLUMN_STORE_H
+#define FBSTUFF_ODS_COLUMN_STORE_H
+
+#include "Database.h"
+#include "Format.h"
+#include "IncrementalScanStream.h"
+#include <map>
+#include <string>
+#include <vector>
+#include <boost/cstdint.hpp>
+#include <boost/scoped_ptr.hpp>
+
+namespace fbods
+{
+
+//------------------------------------------------------------------------------
+
+
+class RecordBatch;
+
+// Packed array of unsigned values of a fixed number of bits.
+class BitPacked
+{
+public:
+	BitPacked()
+		: width(0)
+	{
+	}
+
+public:
+	void assign(const std::vector<boost::uint64_t>& values, unsigned aWidth);
+
+	boost::uint64_t get(unsigned n) const
+	{
+		if (width == 0)
+			return 0;
+
+		const boost::uint64_t position = boost::uint64_t(n) * width;
+		const unsigned shift = position & 63;
+		const boost::uint64_t* p = &words[position >> 6];
+		boost::uint64_t value = p[0] >> shift;
+
+		// The last word is padding, so the next one can always be read.
+		if (shift + width > 64)
+			value |= p[1] << (64 - shift);
+
+		return width == 64 ? value : value & ((boost::uint64_t(1) << width) - 1);
+	}
+
+	size_t getSize() const
+	{
+		return words.size() * sizeof(boost::uint64_t);
+	}
+
+public:
+	unsigned width;
+	std::vector<boost::uint64_t> words;
+};
+
+// Records of some data pages of a relation, encoded column by column when the segment is
+// built and never changed after that, but for the rows deleted when their pages change.
+//
+// Null flags are a bit per row, absent when the column has no nulls. Numbers, dates, times,
+// timestamps and blob ids are stored as their difference to the minimum of the column (frame
+// of reference) in as many bits as the maximum difference needs. Floats are stored as doubles.
+// Text is stored as codes in a sorted dictionary, so comparisons with a constant are done on
+// the codes.
+class ColumnSegment
+{
+public:
+	enum Encoding
+	{
+		ENCODING_FRAME,
+		ENCODING_DOUBLE,
+		ENCODING_DICTIONARY
+	};
+
+	struct Column
+	{
+		Encoding encoding;
+		BitPacked nulls;	// empty when there are no nulls
+		BitPacked packed;	// frame differences or dictionary codes
+		boost::int64_t min;	// frame of reference
+		boost::int64_t max;
+		std::vector<double> doubles;
+		std::vector<std::string> dictionary;
+	};
+
+	// Rows of a data page, consecutive in the segment.
+	struct PageRows
+	{
+		unsigned page;
+		unsigned first;
+		unsigned count;
+	};
+
+public:
+	ColumnSegment(const RecordBatch& batch, const std::vector<PageRows>& aPages);
+
+public:
+	bool isNull(unsigned column, unsigned row) const
+	{
+		const BitPacked& nulls = columns[column].nulls;
+		return !nulls.words.empty() && nulls.get(row) != 0;
+	}
+
+	bool isDeleted(unsigned row) const
+	{
+		return !deleted.empty() && deleted[row];
+	}
+
+	// Numbers as integers of the field scale, dates and times as in the format, timestamps as
+	// their date times a day in 1/10000 seconds plus their time.
+	boost::int64_t getInteger(unsigned column, unsigned row) const
+	{
+		const Column& c = columns[column];
+		return c.min + boost::int64_t(c.packed.get(row));
+	}
+
+	double getDouble(unsigned column, unsigned row) const
+	{
+		return columns[column].doubles[row];
+	}
+
+	unsigned getCode(unsigned column, unsigned row) const
+	{
+		return unsigned(columns[column].packed.get(row));
+	}
+
+	// Writes the value in the format layout.
+	void getValue(unsigned column, unsigned row, void* value) const;
+
+	// Conversions between values in the format layout and the integers of frame encoded columns.
+	static boost::int64_t readInteger(const Format::Field& field, const void* value);
+	static void writeInteger(const Format::Field& field, boost::int64_t integer, void* value);
+
+	void deletePage(const PageRows& pageRows);
+	size_t getSize() const;
+
+public:
+	const Format* format;
+	unsigned rows;
+	unsigned deletedRows;
+	std::vector<Column> columns;
+	std::vector<PageRows> pages;
+
+private:
+	std::vector<bool> deleted;
+};
+
+// Relation kept in memory as column segments. Refreshes read the page headers of the relation
+// and decode only the data pages whose generation changed, deleting the rows the segments had
+// of them and adding a segment with their current records.
+class CachedRelation
+{
+public:
+	static const unsigned SEGMENT_ROWS = 65536;
+
+public:
+	CachedRelation(Database* aDatabase, const std::string& aName, const std::string& formatSpec);
+	~CachedRelation();
+
+private:
+	CachedRelation(const CachedRelation&);
+	CachedRelation& operator =(const CachedRelation&);
+
+public:
+	// Loads the relation the first time. Returns the number of changed pages.
+	unsigned refresh();
+
+	boost::uint64_t getRows() const
+	{
+		return rows;
+	}
+
+	size_t getSize() const;
+
+private:
+	void clear();
+
+public:
+	std::string name;
+	Format format;
+	std::vector<ColumnSegment*> segments;
+	unsigned refreshes;
+	unsigned changedPages;	// by the last refresh
+
+private:
+	Database* database;
+	GenerationMap generations;
+
+	// Page -> segment with its rows and index of the page in the segment pages.
+	std::map<unsigned, std::pair<ColumnSegment*, unsigned> > pageRows;
+	boost::uint64_t rows;
+	boost::uint64_t deletedRows;
+};
+
+
+//------------------------------------------------------------------------------
+
+}	// fbods
+
+#endif	// FBSTUFF_ODS_COLUMN_STORE_H
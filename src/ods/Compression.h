@@ -0,0 +1,115 @@
+/*
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Initial Developer of the Original Code is Adriano dos Santos Fernandes.
+ * Portions created by the Initial Developer are Copyright (C) 2012 the Initial Developer.
+ * All Rights Reserved.
+ *
+ * Contributor(s):
+ *
+ */
+
+#ifndef FBSTUFF_ODS_COMPRESSION_H
+#define FBSTUFF_ODS_COMPRESSION_H
+
+#include <algorithm>
+#include <cstring>
+#include <boost/cstdint.hpp>
+
+namespace fbods
+{
+
+//------------------------------------------------------------------------------
+
+
+// Record compression. A control byte is followed by that many literal bytes when positive,
+// and by a byte repeated minus that many times when negative. Since ODS 12, -1 and -2 are
+// followed by a 16 or 32 bit run length before the byte, and records may be stored as is.
+// Decoders are instantiated per scheme, so the classic one pays nothing for the long runs.
+enum Compression
+{
+	COMPRESSION_RLE,
+	COMPRESSION_RLE_LONG_RUNS,
+	COMPRESSION_NONE
+};
+
+// Bytes of the length stored after the control byte of a run, before its byte.
+template <Compression COMPRESSION>
+inline unsigned getRunLengthSize(boost::int8_t control)
+{
+	if (COMPRESSION == COMPRESSION_RLE_LONG_RUNS && control >= -2)
+		return control == -1 ? sizeof(boost::uint16_t) : sizeof(boost::uint32_t);
+
+	return 0;
+}
+
+// Length of the run of a negative control byte, moving p past the length of a long run.
+template <Compression COMPRESSION>
+inline unsigned getRunLength(boost::int8_t control, const boost::uint8_t*& p)
+{
+	if (COMPRESSION == COMPRESSION_RLE_LONG_RUNS && control >= -2)
+	{
+		if (control == -1)
+		{
+			boost::uint16_t length;
+			memcpy(&length, p, sizeof(length));
+			p += sizeof(length);
+			return length;
+		}
+
+		boost::uint32_t length;
+		memcpy(&length, p, sizeof(length));
+		p += sizeof(length);
+		return length;
+	}
+
+	return unsigned(-control);
+}
+
+// Length of the decompressed data, without decompressing it. Damaged records are cut where
+// their data ends.
+template <Compression COMPRESSION>
+inline size_t getUnpackedLength(const boost::uint8_t* p, const boost::uint8_t* end)
+{
+	if (COMPRESSION == COMPRESSION_NONE)
+		return end - p;
+
+	size_t length = 0;
+
+	while (p < end)
+	{
+		const boost::int8_t control = boost::int8_t(*p++);
+
+		if (control < 0)
+		{
+			if (getRunLengthSize<COMPRESSION>(control) >= size_t(end - p))
+				break;
+
+			length += getRunLength<COMPRESSION>(control, p);
+			++p;
+		}
+		else
+		{
+			const size_t n = std::min<size_t>(control, end - p);
+			length += n;
+			p += n;
+		}
+	}
+
+	return length;
+}
+
+
+//------------------------------------------------------------------------------
+
+}	// fbods
+
+#endif	// FBSTUFF_ODS_COMPRESSION_H
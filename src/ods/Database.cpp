@@ -0,0 +1,536 @@
+/*
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Initial Developer of the Original Code is Adriano dos Santos Fernandes.
+ * Portions created by the Initial Developer are Copyright (C) 2012 the Initial Developer.
+ * All Rights Reserved.
+ *
+ * Contributor(s):
+ *
+ */
+
+#include "Database.h"
+#include "BufferArena.h"
+#include "FullScanStream.h"
+#include "Message.h"
+#include "PageReader.h"
+#include <algorithm>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <boost/algorithm/string.hpp>
+#include <boost/scoped_array.hpp>
+#include <sys/mman.h>
+
+namespace fbods
+{
+
+using std::map;
+using std::runtime_error;
+using std::string;
+using std::vector;
+
+//------------------------------------------------------------------------------
+
+
+namespace
+{
+	// Names have 31 bytes up to ODS 12 and 252 (63 UTF-8 characters) since ODS 13, which also
+	// added RDB$SQL_SECURITY.
+	template <int NAME_LENGTH>
+	struct RdbRelations
+	{
+		boost::uint32_t nullFlags[1];
+		boost::uint64_t viewBlr;
+		boost::uint64_t viewSource;
+		boost::uint64_t description;
+		boost::int16_t relationId;
+		boost::int16_t systemFlag;
+		boost::int16_t dbkeyLength;
+		boost::int16_t format;
+		boost::int16_t fieldId;
+		char relationName[NAME_LENGTH];
+		char securityClass[NAME_LENGTH];
+		VarChar<255> externalFile;
+		boost::uint64_t runtime;
+		boost::uint64_t externalDescription;
+		char ownerName[NAME_LENGTH];
+		char defaultClass[NAME_LENGTH];
+		boost::int16_t flags;
+		boost::int16_t relationType;
+		boost::uint8_t sqlSecurity;
+	};
+
+	template <int NAME_LENGTH>
+	void fetchRelationNames(Database* database, map<Database::RelationId, string>& names)
+	{
+		FullScanStream scan(database, Database::RELATION_ID_RELATIONS);
+
+		// Records may have fields past the struct.
+		boost::scoped_array<char> record(new char[ScanStream::MAX_RECORD_SIZE]);
+		const RdbRelations<NAME_LENGTH>* rdbRelations =
+			reinterpret_cast<const RdbRelations<NAME_LENGTH>*>(record.get());
+
+		while (scan.fetch(record.get()))
+		{
+			string str(rdbRelations->relationName, sizeof(rdbRelations->relationName));
+			boost::algorithm::trim(str);
+
+			names[static_cast<Database::RelationId>(rdbRelations->relationId)] = str;
+		}
+	}
+
+	FBODS_MESSAGE(RdbPages,
+		(FBODS_INTEGER, pageNumber)
+		(FBODS_SMALLINT, relationId)
+		(FBODS_INTEGER, pageSequence)
+		(FBODS_SMALLINT, pageType)
+	);
+
+	// Pages of a type and relation stored in RDB$PAGES, in sequence order.
+	void getRdbPages(Database* database, Database::RelationId relationId, boost::int16_t pageType,
+		vector<unsigned>& pages)
+	{
+		FullScanStream scan(database, Database::RELATION_ID_PAGES);
+		RdbPages rdbPages;
+		map<boost::int32_t, unsigned> sequences;
+
+		while (scan.fetchMessage(rdbPages))
+		{
+			if (rdbPages.relationId == static_cast<boost::int16_t>(relationId) &&
+				rdbPages.pageType == pageType)
+			{
+				sequences[rdbPages.pageSequence] = rdbPages.pageNumber;
+			}
+		}
+
+		for (map<boost::int32_t, unsigned>::const_iterator i = sequences.begin();
+			 i != sequences.end();
+			 ++i)
+		{
+			pages.push_back(i->second);
+		}
+	}
+
+	// Whether the page structures are inside the page, as they may not be in a torn image.
+	bool isConsistent(const PageHeader* page, unsigned pageSize)
+	{
+		if (page->type == PageHeader::TYPE_POINTER)
+		{
+			const PointerPage* pointer = reinterpret_cast<const PointerPage*>(page);
+			return offsetof(PointerPage, page) + pointer->count * sizeof(pointer->page[0]) <= pageSize;
+		}
+		else if (page->type == PageHeader::TYPE_DATA)
+		{
+			const DataPage* data = reinterpret_cast<const DataPage*>(page);
+			const unsigned linesEnd = offsetof(DataPage, rpt) + data->count * sizeof(data->rpt[0]);
+
+			if (linesEnd > pageSize)
+				return false;
+
+			for (unsigned i = 0; i < data->count; ++i)
+			{
+				const DataPage::Repeat& line = data->rpt[i];
+
+				if (line.length != 0 &&
+					(line.offset < linesEnd || line.offset + line.length > pageSize))
+				{
+					return false;
+				}
+			}
+		}
+
+		return true;
+	}
+
+	int getRelation(const PageHeader* page)
+	{
+		if (page->type == PageHeader::TYPE_POINTER)
+			return reinterpret_cast<const PointerPage*>(page)->relation;
+		else if (page->type == PageHeader::TYPE_DATA)
+			return reinterpret_cast<const DataPage*>(page)->relation;
+		else
+			return -1;
+	}
+}	// namespace
+
+
+void Database::parseHeader(const char* page)
+{
+	memcpy(&header, page, sizeof(header));
+
+	const unsigned major = getOdsMajor();
+
+	if (!(header.odsVersion & HeaderPage::ODS_FIREBIRD_FLAG) || major < 11 || major > 13)
+	{
+		char s[32];
+		sprintf(s, "%u", major);
+		throw runtime_error(string("Unsupported ODS version ") + s);
+	}
+
+	if (major == 11)
+	{
+		odsMinor = header.odsMinor;
+		transactions.oldest = boost::uint32_t(header.oldestTransaction);
+		transactions.oldestActive = boost::uint32_t(header.oldestActive);
+		transactions.oldestSnapshot = boost::uint32_t(header.oldestSnapshot);
+		transactions.next = boost::uint32_t(header.nextTransaction);
+	}
+	else
+	{
+		HeaderPage12 header12;
+		memcpy(&header12, page, sizeof(header12));
+
+		const boost::uint16_t* high = header12.transactionHigh;
+
+		odsMinor = header12.odsMinor;
+		transactions.oldest = header12.oldestTransaction |
+			boost::uint64_t(high[HeaderPage12::TRA_HIGH_OLDEST]) << 32;
+		transactions.oldestActive = header12.oldestActive |
+			boost::uint64_t(high[HeaderPage12::TRA_HIGH_OLDEST_ACTIVE]) << 32;
+		transactions.oldestSnapshot = header12.oldestSnapshot |
+			boost::uint64_t(high[HeaderPage12::TRA_HIGH_OLDEST_SNAPSHOT]) << 32;
+		transactions.next = header12.nextTransaction |
+			boost::uint64_t(high[HeaderPage12::TRA_HIGH_NEXT]) << 32;
+	}
+}
+
+void Database::openDelta(const char* filename)
+{
+	if ((header.flags & HeaderPage::BACKUP_MASK) == HeaderPage::BACKUP_NORMAL)
+		throw runtime_error("The database is not locked by nbackup");
+
+	deltaHandle = open(filename, O_RDONLY);
+
+	if (deltaHandle < 0)
+		throw runtime_error(string("Cannot open ") + filename);
+
+	// The page map is in allocation pages, the first one being page 1 of the delta. Each one
+	// has the count and the database numbers of the pages following it, and when it's full
+	// another allocation page follows them.
+	const unsigned pageSize = header.pageSize;
+	const unsigned perPage = pageSize / sizeof(boost::uint32_t) - 1;
+	boost::scoped_array<boost::uint32_t> allocation(new boost::uint32_t[perPage + 1]);
+	boost::unordered_map<unsigned, unsigned> pages;
+
+	for (unsigned allocationPage = 1; ; allocationPage += perPage + 1)
+	{
+		ssize_t n = pread(deltaHandle, allocation.get(), pageSize, off_t(pageSize) * allocationPage);
+
+		if (n == 0 && allocationPage == 1)
+			break;
+
+		char s[32];
+		sprintf(s, "%u", allocationPage);
+
+		if (n != ssize_t(pageSize))
+			throw runtime_error(string("Cannot read the delta allocation page ") + s);
+
+		const unsigned count = allocation[0];
+
+		if (count > perPage)
+			throw runtime_error(string("Invalid delta allocation page ") + s);
+
+		for (unsigned i = 1; i <= count; ++i)
+		{
+			pages[allocation[i]] = allocationPage + i;
+			deltaEnd = std::max(deltaEnd, unsigned(allocation[i]) + 1);
+		}
+
+		if (count < perPage)
+			break;
+	}
+
+	deltaPages.swap(pages);
+
+	// The header may have been changed too.
+	refreshHeader();
+}
+
+void Database::setDirectIo(bool direct)
+{
+	if (directHandle >= 0)
+	{
+		close(directHandle);
+		directHandle = -1;
+	}
+
+	if (direct)
+	{
+		directHandle = open(filename.c_str(), O_RDONLY | O_DIRECT);
+
+		if (directHandle < 0)
+			throw runtime_error("Cannot open " + filename + " for direct I/O");
+	}
+}
+
+unsigned Database::getCachedPages() const
+{
+	struct stat st;
+
+	if (fstat(handle, &st) != 0)
+		throw runtime_error("Cannot get the database file size");
+
+	if (st.st_size == 0)
+		return 0;
+
+	void* map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, handle, 0);
+
+	if (map == MAP_FAILED)
+		throw runtime_error("Cannot map the database file");
+
+	const size_t systemPage = sysconf(_SC_PAGESIZE);
+	vector<unsigned char> resident((st.st_size + systemPage - 1) / systemPage);
+
+	if (mincore(map, st.st_size, &resident.front()) != 0)
+	{
+		munmap(map, st.st_size);
+		throw runtime_error("Cannot get the cached pages of the database file");
+	}
+
+	munmap(map, st.st_size);
+
+	// Partially cached pages are counted too.
+	const unsigned pageCount = st.st_size / header.pageSize;
+	unsigned count = 0;
+
+	for (unsigned page = 0; page < pageCount; ++page)
+	{
+		size_t last = (off_t(page + 1) * header.pageSize - 1) / systemPage;
+
+		for (size_t i = off_t(page) * header.pageSize / systemPage; i <= last; ++i)
+		{
+			if (resident[i] & 1)
+			{
+				++count;
+				break;
+			}
+		}
+	}
+
+	return count;
+}
+
+bool Database::readPage(unsigned number, void* data, boost::int8_t type, int relation)
+{
+	readPage(number, data);
+	return checkPage(number, data, type, relation);
+}
+
+bool Database::checkPage(unsigned number, void* data, boost::int8_t type, int relation)
+{
+	if (!live.enabled)
+		return true;
+
+	const PageHeader* page = static_cast<const PageHeader*>(data);
+	unsigned backoff = live.backoff;
+
+	for (unsigned retry = 0; ; ++retry)
+	{
+		// A write that happened during the read changes the generation.
+		PageHeader again;
+		readPageHeader(number, &again);
+
+		const bool torn = again.generation != page->generation ||
+			(getOdsMajor() == 11 && page->type != PageHeader::TYPE_UNDEFINED &&
+				page->checksum != PageHeader::CHECKSUM_STAMP) ||
+			!isConsistent(page, header.pageSize);
+		const bool changed = page->type != type || (relation >= 0 && getRelation(page) != relation);
+
+		if (!torn && !changed)
+			return true;
+
+		if (retry == live.retries)
+		{
+			if (torn)
+			{
+				char s[32];
+				sprintf(s, "%u", number);
+				throw runtime_error(string("Page ") + s + " is still changing after the retries");
+			}
+
+			__sync_fetch_and_add(&skippedPages, 1);
+			return false;
+		}
+
+		__sync_fetch_and_add(&retriedReads, 1);
+		usleep(backoff);
+		backoff = std::min(backoff * 2, unsigned(LiveOptions::MAX_BACKOFF));
+
+		readPage(number, data);
+	}
+}
+
+Database::RelationId Database::findRelation(const char* relationName)
+{
+	map<RelationId, string> names;
+	getRelationNames(names);
+
+	for (map<RelationId, string>::const_iterator i = names.begin(); i != names.end(); ++i)
+	{
+		if (i->second == relationName)
+			return i->first;
+	}
+
+	throw runtime_error(string("Relation ") + relationName + " not found");
+}
+
+void Database::getRelationNames(map<RelationId, string>& names)
+{
+	if (getOdsMajor() >= 13)
+		fetchRelationNames<252>(this, names);
+	else
+		fetchRelationNames<31>(this, names);
+}
+
+unsigned Database::getFirstPointer(RelationId relationId)
+{
+	map<RelationId, unsigned>::iterator it = relationPointer.find(relationId);
+
+	if (it != relationPointer.end())
+		return it->second;
+
+	FullScanStream scan(this, RELATION_ID_PAGES);
+	RdbPages rdbPages;
+	unsigned firstPointer = 0;
+
+	while (scan.fetchMessage(rdbPages))
+	{
+		if (rdbPages.relationId == static_cast<boost::int16_t>(relationId) &&
+			rdbPages.pageType == PageHeader::TYPE_POINTER &&
+			rdbPages.pageSequence == 0)
+		{
+			firstPointer = rdbPages.pageNumber;
+			break;
+		}
+	}
+
+	if (firstPointer == 0)
+	{
+		char s[32];
+		sprintf(s, "%d", static_cast<boost::int16_t>(relationId));
+		throw runtime_error(string("Pointer page for relation id ") + s +
+			" has not been found");
+	}
+
+	relationPointer.insert(std::make_pair(relationId, firstPointer));
+
+	return firstPointer;
+}
+
+void Database::getSystemPages(boost::int16_t pageType, vector<unsigned>& pages)
+{
+	getRdbPages(this, RELATION_ID_PAGES, pageType, pages);
+}
+
+void Database::getPointerPages(RelationId relationId, vector<unsigned>& pages)
+{
+	getRdbPages(this, relationId, PageHeader::TYPE_POINTER, pages);
+}
+
+// The pointer pages listed in RDB$PAGES are read at once, in physical order, instead of one
+// after the other along the chain. The chain is still walked when they don't match it, as when
+// pointer pages are added while reading a live file.
+void Database::getDataPages(RelationId relationId, vector<unsigned>& pages)
+{
+	vector<unsigned> pointers;
+	getPointerPages(relationId, pointers);
+
+	if (pointers.empty() || !readPointerPages(relationId, pointers, pages))
+	{
+		pages.clear();
+		walkPointerPages(relationId, pages);
+	}
+}
+
+// Returns false when the pages are not the chain of pointer pages of the relation.
+bool Database::readPointerPages(RelationId relationId, const vector<unsigned>& pointers,
+	vector<unsigned>& pages)
+{
+	const unsigned batch = std::min<size_t>(pointers.size(), PageReader::DEFAULT_DEPTH);
+	const unsigned capacity = (header.pageSize - offsetof(PointerPage, page)) /
+		sizeof(boost::int32_t);
+	boost::scoped_array<char> bufferScope;
+	char* buffer = allocateBuffer(size_t(batch) * header.pageSize, bufferScope);
+	PageReader reader(this, batch);
+	vector<size_t> tags;
+
+	for (size_t first = 0; first < pointers.size(); first += batch)
+	{
+		const size_t count = std::min<size_t>(batch, pointers.size() - first);
+
+		for (size_t i = 0; i < count; ++i)
+			reader.queue(pointers[first + i], &buffer[i * header.pageSize], i);
+
+		reader.submit();
+
+		while (reader.getPending() > 0)
+			reader.complete(tags);
+
+		for (size_t i = 0; i < count; ++i)
+		{
+			const size_t n = first + i;
+			PointerPage* pointer = reinterpret_cast<PointerPage*>(&buffer[i * header.pageSize]);
+			const unsigned next = n + 1 < pointers.size() ? pointers[n + 1] : 0;
+
+			if (!checkPage(pointers[n], pointer, PageHeader::TYPE_POINTER, relationId) ||
+				pointer->pageHeader.type != PageHeader::TYPE_POINTER ||
+				pointer->relation != relationId || pointer->sequence != boost::int32_t(n) ||
+				boost::uint32_t(pointer->next) != next || pointer->count > capacity)
+			{
+				return false;
+			}
+
+			for (unsigned j = 0; j < pointer->count; ++j)
+			{
+				if (pointer->page[j] != 0)
+					pages.push_back(pointer->page[j]);
+			}
+		}
+	}
+
+	return true;
+}
+
+// Reads the pointer pages along the chain, each one asking for the next to be read meanwhile.
+void Database::walkPointerPages(RelationId relationId, vector<unsigned>& pages)
+{
+	boost::scoped_array<char> pointerScope(new char[header.pageSize]);
+	PointerPage* pointer = reinterpret_cast<PointerPage*>(pointerScope.get());
+
+	for (unsigned pointerPage = getFirstPointer(relationId); pointerPage != 0;
+		 pointerPage = pointer->next)
+	{
+		if (!readPage(pointerPage, pointer, PageHeader::TYPE_POINTER, relationId))
+		{
+			char s[32];
+			sprintf(s, "%u", pointerPage);
+			throw runtime_error(string("Pointer page ") + s + " has been released");
+		}
+
+		if (pointer->next != 0)
+			prefetchPage(pointer->next);
+
+		for (unsigned i = 0; i < pointer->count; ++i)
+		{
+			if (pointer->page[i] != 0)
+				pages.push_back(pointer->page[i]);
+		}
+	}
+}
+
+//------------------------------------------------------------------------------
+
+}	// fbods
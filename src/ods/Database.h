@@ -21,10 +21,20 @@
 #define FBSTUFF_ODS_DATABASE_H
 
 #include "Ods.h"
-#include <fstream>
+#include "Compression.h"
+#include "ScanMetrics.h"
+#include <algorithm>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
 #include <stdexcept>
 #include <string>
 #include <map>
+#include <vector>
+#include <boost/unordered_map.hpp>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
 namespace fbods
 {
@@ -32,27 +42,336 @@ namespace fbods
 //------------------------------------------------------------------------------
 
 
+class TransactionSnapshot;
+
+// Reading of a file the server is writing to. Pages are read again, with a backoff doubled on
+// each retry, while their image looks torn or no longer has the expected type and relation.
+struct LiveOptions
+{
+	static const unsigned MAX_BACKOFF = 1000000;
+
+	LiveOptions()
+		: enabled(false),
+		  retries(5),
+		  backoff(1000)
+	{
+	}
+
+	bool enabled;
+	unsigned retries;
+	unsigned backoff;	// microseconds
+};
+
+// Transaction counters of the header page, with the high words of ODS 12 and later.
+struct TransactionCounters
+{
+	boost::uint64_t oldest;	// oldest interesting
+	boost::uint64_t oldestActive;
+	boost::uint64_t oldestSnapshot;
+	boost::uint64_t next;
+};
+
+// Placement of the scan workers and their buffers, see WorkerPlacement.
+struct PlacementOptions
+{
+	PlacementOptions()
+		: pinThreads(false),
+		  hugePages(false)
+	{
+	}
+
+	bool pinThreads;
+	bool hugePages;
+};
+
 class Database
 {
 public:
-	Database(const char* filename)
-		: file(filename, std::ios::in | std::ios::binary)
+	Database(const char* aFilename)
+		: queueDepth(0),
+		  snapshot(NULL),
+		  retriedReads(0),
+		  skippedPages(0),
+		  unresolvedVersions(0),
+		  filename(aFilename),
+		  handle(open(aFilename, O_RDONLY)),
+		  directHandle(-1),
+		  deltaHandle(-1),
+		  deltaEnd(0)
 	{
-		if (file.fail())
-			throw std::runtime_error(std::string("Cannot open ") + filename);
+		if (handle < 0)
+			throw std::runtime_error(std::string("Cannot open ") + aFilename);
+
+		char page[sizeof(HeaderPage12)];
 
-		file.read(reinterpret_cast<char*>(&header), sizeof(header));
+		if (pread(handle, page, sizeof(page), 0) != sizeof(page))
+		{
+			close(handle);
+			throw std::runtime_error(std::string("Cannot read header of ") + aFilename);
+		}
+
+		try
+		{
+			parseHeader(page);
+		}
+		catch (...)
+		{
+			close(handle);
+			throw;
+		}
 
 		relationPointer.insert(std::make_pair(RELATION_ID_PAGES, header.pages));
 	}
 
+	~Database()
+	{
+		close(handle);
+
+		if (directHandle >= 0)
+			close(directHandle);
+
+		if (deltaHandle >= 0)
+			close(deltaHandle);
+	}
+
+private:
+	Database(const Database&);
+	Database& operator =(const Database&);
+
+	// Sets header and the fields whose layout depends on the ODS from a header page image.
+	void parseHeader(const char* page);
+
+public:
+	// Makes the pages written to the nbackup delta file, while the database is locked,
+	// replace the ones of the main file.
+	void openDelta(const char* filename);
+
+	// Makes the page reads into aligned buffers bypass the OS page cache, so bulk scans don't
+	// evict the pages of the server running in the same host.
+	void setDirectIo(bool direct);
+
+	bool isDirectIo() const
+	{
+		return directHandle >= 0;
+	}
+
+	// Number of pages of the file in the OS page cache.
+	unsigned getCachedPages() const;
+
+	// May be called concurrently by scans running in different threads.
 	void readPage(unsigned number, void* data)
 	{
-		file.seekg(header.pageSize * number, std::ios::beg);
-		file.read(static_cast<char*>(data), header.pageSize);
+		unsigned position = number;
+		int file = getReadHandle(locatePage(position), data);
+		ScanCounters* counters = ScanMetrics::getCounters();
+		const boost::uint64_t start = counters ? ScanCounters::now() : 0;
+
+		if (pread(file, data, header.pageSize, off_t(header.pageSize) * position) !=
+				header.pageSize)
+		{
+			char s[32];
+			sprintf(s, "%u", number);
+			throw std::runtime_error(std::string("Cannot read page ") + s);
+		}
+
+		if (counters)
+			counters->addRead(data, 1, header.pageSize, start);
+	}
+
+	// Has the OS read a page into its cache in the background, for a read coming soon. Does
+	// nothing with direct I/O, whose reads bypass that cache.
+	void prefetchPage(unsigned number) const
+	{
+		if (directHandle >= 0)
+			return;
+
+		unsigned position = number;
+		int file = locatePage(position);
+
+		posix_fadvise(file, off_t(header.pageSize) * position, header.pageSize,
+			POSIX_FADV_WILLNEED);
+	}
+
+	// Reads a pointer or data page of a relation (any when relation is negative), checking it
+	// when reading a live file. Returns false when it's no longer such a page after the retries
+	// and throws when it's still torn.
+	bool readPage(unsigned number, void* data, boost::int8_t type, int relation);
+
+	// The checks of the above, for a page image read by other means.
+	bool checkPage(unsigned number, void* data, boost::int8_t type, int relation);
+
+	// Reads up to count consecutive pages, returning how many were read.
+	unsigned readPages(unsigned first, unsigned count, void* data)
+	{
+		size_t length = size_t(header.pageSize) * count;
+		size_t done = 0;
+		int file = getReadHandle(handle, data);
+		ScanCounters* counters = ScanMetrics::getCounters();
+		const boost::uint64_t start = counters ? ScanCounters::now() : 0;
+
+		while (done < length)
+		{
+			ssize_t n = pread(file, static_cast<char*>(data) + done, length - done,
+				off_t(header.pageSize) * first + done);
+
+			if (n < 0)
+			{
+				char s[32];
+				sprintf(s, "%u", first);
+				throw std::runtime_error(std::string("Cannot read pages starting at ") + s);
+			}
+
+			if (n == 0)
+				break;
+
+			done += n;
+		}
+
+		unsigned read = done / header.pageSize;
+
+		if (counters)
+			counters->addRead(data, read, header.pageSize, start);
+
+		// Pages of the delta may be past the end of the main file.
+		if (!deltaPages.empty())
+		{
+			memset(static_cast<char*>(data) + done, 0, length - done);
+
+			for (unsigned i = 0; i < count; ++i)
+			{
+				if (deltaPages.find(first + i) != deltaPages.end())
+				{
+					readPage(first + i, static_cast<char*>(data) + size_t(header.pageSize) * i);
+					read = std::max(read, i + 1);
+				}
+			}
+		}
+
+		return read;
+	}
+
+	unsigned getPageCount() const
+	{
+		struct stat st;
+
+		if (fstat(handle, &st) != 0)
+			throw std::runtime_error("Cannot get the database file size");
+
+		return std::max(unsigned(st.st_size / header.pageSize), deltaEnd);
+	}
+
+	unsigned getOdsMajor() const
+	{
+		return header.odsVersion & ~HeaderPage::ODS_FIREBIRD_FLAG;
+	}
+
+	// Reads the header page again, with the transaction counters of a database in use.
+	void refreshHeader()
+	{
+		unsigned position = 0;
+		int file = locatePage(position);
+		char page[sizeof(HeaderPage12)];
+
+		if (pread(file, page, sizeof(page), off_t(header.pageSize) * position) != sizeof(page))
+			throw std::runtime_error("Cannot read the header page");
+
+		parseHeader(page);
+	}
+
+	// Records per data page as the engine computes it, the factor of the data page sequence in
+	// record numbers.
+	unsigned getMaxRecords() const
+	{
+		return (header.pageSize - offsetof(DataPage, rpt) - sizeof(DataPage::Repeat)) /
+			(sizeof(DataPage::Repeat) + ((offsetof(RecordHeader, data) + 7) & ~7u));
+	}
+
+	// Record layout and compression changed with ODS 12, see RecordHeader and Compression.
+	Compression getCompression(const RecordHeader* record) const
+	{
+		if (getOdsMajor() < 12)
+			return COMPRESSION_RLE;
+
+		return (record->flags & RecordHeader::FLAG_NOT_PACKED) ?
+			COMPRESSION_NONE : COMPRESSION_RLE_LONG_RUNS;
+	}
+
+	unsigned getRecordHeaderSize(const RecordHeader* record) const
+	{
+		if (record->flags & RecordHeader::FLAG_INCOMPLETE)
+			return RecordHeader::FRAGMENTED_HEADER_SIZE;
+
+		if ((record->flags & RecordHeader::FLAG_LONG_TRANSACTION) && getOdsMajor() >= 12)
+			return RecordHeader::EXTENDED_HEADER_SIZE;
+
+		return offsetof(RecordHeader, data);
+	}
+
+	const boost::uint8_t* getRecordData(const RecordHeader* record) const
+	{
+		return reinterpret_cast<const boost::uint8_t*>(record) + getRecordHeaderSize(record);
+	}
+
+	boost::uint64_t getRecordTransaction(const RecordHeader* record) const
+	{
+		boost::uint64_t transaction = boost::uint32_t(record->transaction);
+
+		if ((record->flags & RecordHeader::FLAG_LONG_TRANSACTION) && getOdsMajor() >= 12)
+		{
+			boost::uint16_t high;
+			memcpy(&high, reinterpret_cast<const char*>(record) +
+				RecordHeader::TRANSACTION_HIGH_OFFSET, sizeof(high));
+			transaction |= boost::uint64_t(high) << 32;
+		}
+
+		return transaction;
+	}
+
+	// Reads just the header of a page.
+	void readPageHeader(unsigned number, PageHeader* pageHeader)
+	{
+		unsigned position = number;
+		int file = locatePage(position);
+
+		if (pread(file, pageHeader, sizeof(PageHeader), off_t(header.pageSize) * position) !=
+				sizeof(PageHeader))
+		{
+			char s[32];
+			sprintf(s, "%u", number);
+			throw std::runtime_error(std::string("Cannot read page ") + s);
+		}
+	}
+
+	// Returns the file with the current image of a page, changing number to its position there.
+	int locatePage(unsigned& number) const
+	{
+		if (!deltaPages.empty())
+		{
+			boost::unordered_map<unsigned, unsigned>::const_iterator i = deltaPages.find(number);
+
+			if (i != deltaPages.end())
+			{
+				number = i->second;
+				return deltaHandle;
+			}
+		}
+
+		return handle;
+	}
+
+	// O_DIRECT needs buffers aligned as the file offsets and lengths, which are whole pages.
+	int getReadHandle(int file, const void* data) const
+	{
+		if (file == handle && directHandle >= 0 && (size_t(data) & (DIRECT_ALIGNMENT - 1)) == 0)
+			return directHandle;
+
+		return file;
 	}
 
 public:
+	static const size_t DIRECT_ALIGNMENT = 4096;
+
+
 	enum RelationId
 	{
 		RELATION_ID_PAGES = 0,
@@ -60,9 +379,46 @@ public:
 		RELATION_ID_RELATIONS = 6
 	};
 
-	std::fstream file;
+	RelationId findRelation(const char* relationName);
+	void getRelationNames(std::map<RelationId, std::string>& names);
+	unsigned getFirstPointer(RelationId relationId);
+
+	// Collects the pages of a type stored in RDB$PAGES for the whole database, in sequence order.
+	void getSystemPages(boost::int16_t pageType, std::vector<unsigned>& pages);
+
+	// Collects the pointer pages of a relation stored in RDB$PAGES, in sequence order.
+	void getPointerPages(RelationId relationId, std::vector<unsigned>& pages);
+
+	// Collects the relation data pages in pointer page order.
+	void getDataPages(RelationId relationId, std::vector<unsigned>& pages);
+
+private:
+	bool readPointerPages(RelationId relationId, const std::vector<unsigned>& pointers,
+		std::vector<unsigned>& pages);
+	void walkPointerPages(RelationId relationId, std::vector<unsigned>& pages);
+
+public:
+
+	LiveOptions live;
+	PlacementOptions placement;
+	unsigned queueDepth;	// pages read ahead by the scans, see PageFetcher, none when zero
+	const TransactionSnapshot* snapshot;	// record versions to read, all primary when NULL
+
+	// Counters of the live and snapshot reads.
+	boost::uint64_t retriedReads;
+	boost::uint64_t skippedPages;
+	boost::uint64_t unresolvedVersions;
+
+	std::string filename;
+	int handle;
+	int directHandle;	// the file opened with O_DIRECT, -1 when reads are buffered
+	int deltaHandle;
+	boost::unordered_map<unsigned, unsigned> deltaPages;	// database page to delta page
+	unsigned deltaEnd;	// past the last page in the delta
 	std::map<RelationId, unsigned> relationPointer;
-	HeaderPage header;
+	unsigned odsMinor;
+	TransactionCounters transactions;
+	HeaderPage header;	// valid up to flags in all the supported versions
 };
 
 template <int LENGTH>
@@ -0,0 +1,1814 @@
+/*
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Initial Developer of the Original Code is Adriano dos Santos Fernandes.
+ * Portions created by the Initial Developer are Copyright (C) 2012 the Initial Developer.
+ * All Rights Reserved.
+ *
+ * Contributor(s):
+ *
+ */
+
+#include "Expression.h"
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+#include <boost/algorithm/string.hpp>
+
+using std::max;
+using std::min;
+using std::runtime_error;
+using std::string;
+using std::vector;
+
+namespace fbods
+{
+
+//------------------------------------------------------------------------------
+
+
+// Node of an expression tree. Values are computed for the selected rows of a batch, in vectors
+// indexed by row, so the kernels of the nodes loop over plain arrays.
+class ExpressionNode
+{
+public:
+	ExpressionNode(Expression::Kind aKind, int aScale = 0, unsigned aMaxLength = 0)
+		: kind(aKind),
+		  scale(aScale),
+		  maxLength(aMaxLength)
+	{
+	}
+
+	virtual ~ExpressionNode()
+	{
+	}
+
+public:
+	virtual void evaluate(const RecordBatch& batch, const Selection& selection) = 0;
+
+	// Keeps the selected rows where the value is true. Boolean nodes only.
+	virtual void select(const RecordBatch& batch, Selection& selection);
+
+protected:
+	void prepare(unsigned count)
+	{
+		values.nulls.resize(count);
+
+		if (kind == Expression::KIND_TEXT)
+		{
+			values.texts.resize(count);
+			values.lengths.resize(count);
+		}
+		else
+			values.integers.resize(count);
+	}
+
+public:
+	Expression::Kind kind;
+	int scale;
+	unsigned maxLength;	// text
+	ExpressionVector values;
+};
+
+
+namespace
+{
+	const char* getKindName(Expression::Kind kind)
+	{
+		switch (kind)
+		{
+			case Expression::KIND_BOOLEAN:
+				return "boolean";
+
+			case Expression::KIND_INTEGER:
+				return "number";
+
+			case Expression::KIND_DATE:
+				return "date";
+
+			default:
+				return "text";
+		}
+	}
+
+	boost::int64_t getFactor(int scale)
+	{
+		boost::int64_t factor = 1;
+
+		for (; scale > 0; --scale)
+			factor *= 10;
+
+		return factor;
+	}
+
+	// Compares text ignoring trailing spaces.
+	int compareText(const char* text1, unsigned length1, const char* text2, unsigned length2)
+	{
+		while (length1 > 0 && text1[length1 - 1] == ' ')
+			--length1;
+
+		while (length2 > 0 && text2[length2 - 1] == ' ')
+			--length2;
+
+		const int result = memcmp(text1, text2, min(length1, length2));
+
+		if (result != 0)
+			return result;
+
+		return length1 < length2 ? -1 : length1 > length2 ? 1 : 0;
+	}
+
+	// Kernels. Each loop writes a single array, so that the compiler, knowing what can
+	// alias, vectorizes the loops over all the rows of a batch.
+
+	template <typename Op>
+	void integerKernel(const Selection& selection, const boost::int64_t* values1,
+		boost::int64_t factor1, const boost::int64_t* values2, boost::int64_t factor2,
+		boost::int64_t* out)
+	{
+		if (selection.isDense())
+		{
+			for (unsigned i = 0; i < selection.count; ++i)
+				out[i] = Op::apply(values1[i] * factor1, values2[i] * factor2);
+		}
+		else
+		{
+			for (vector<boost::uint32_t>::const_iterator i = selection.rows.begin();
+				 i != selection.rows.end();
+				 ++i)
+			{
+				const unsigned r = *i;
+				out[r] = Op::apply(values1[r] * factor1, values2[r] * factor2);
+			}
+		}
+	}
+
+	template <typename Op>
+	void nullKernel(const Selection& selection, const boost::uint8_t* nulls1,
+		const boost::int64_t* values1, const boost::uint8_t* nulls2,
+		const boost::int64_t* values2, boost::uint8_t* out)
+	{
+		if (selection.isDense())
+		{
+			for (unsigned i = 0; i < selection.count; ++i)
+				out[i] = Op::apply(nulls1[i], values1[i], nulls2[i], values2[i]);
+		}
+		else
+		{
+			for (vector<boost::uint32_t>::const_iterator i = selection.rows.begin();
+				 i != selection.rows.end();
+				 ++i)
+			{
+				const unsigned r = *i;
+				out[r] = Op::apply(nulls1[r], values1[r], nulls2[r], values2[r]);
+			}
+		}
+	}
+
+	template <typename T>
+	void loadKernel(const Selection& selection, const boost::uint8_t* values,
+		boost::int64_t* out)
+	{
+		if (selection.isDense())
+		{
+			for (unsigned i = 0; i < selection.count; ++i)
+			{
+				T value;
+				memcpy(&value, values + i * sizeof(T), sizeof(T));
+				out[i] = value;
+			}
+		}
+		else
+		{
+			for (vector<boost::uint32_t>::const_iterator i = selection.rows.begin();
+				 i != selection.rows.end();
+				 ++i)
+			{
+				T value;
+				memcpy(&value, values + *i * sizeof(T), sizeof(T));
+				out[*i] = value;
+			}
+		}
+	}
+
+	template <typename T>
+	void copyKernel(const Selection& selection, const T* values, T* out)
+	{
+		if (selection.isDense())
+			std::copy(values, values + selection.count, out);
+		else
+		{
+			for (vector<boost::uint32_t>::const_iterator i = selection.rows.begin();
+				 i != selection.rows.end();
+				 ++i)
+			{
+				out[*i] = values[*i];
+			}
+		}
+	}
+
+	template <typename T>
+	void fillKernel(const Selection& selection, T value, T* out)
+	{
+		if (selection.isDense())
+			std::fill(out, out + selection.count, value);
+		else
+		{
+			for (vector<boost::uint32_t>::const_iterator i = selection.rows.begin();
+				 i != selection.rows.end();
+				 ++i)
+			{
+				out[*i] = value;
+			}
+		}
+	}
+
+	struct AddOp
+	{
+		static boost::int64_t apply(boost::int64_t a, boost::int64_t b)
+		{
+			return a + b;
+		}
+	};
+
+	struct SubtractOp
+	{
+		static boost::int64_t apply(boost::int64_t a, boost::int64_t b)
+		{
+			return a - b;
+		}
+	};
+
+	struct MultiplyOp
+	{
+		static boost::int64_t apply(boost::int64_t a, boost::int64_t b)
+		{
+			return a * b;
+		}
+	};
+
+	// The divisor is never zero: those rows are null. Dividing by -1 negates, wrapping as the
+	// other operations do, since the division of the minimum value by it traps.
+	struct DivideOp
+	{
+		static boost::int64_t apply(boost::int64_t a, boost::int64_t b)
+		{
+			return b == -1 ? boost::int64_t(0 - boost::uint64_t(a)) : a / (b + (b == 0));
+		}
+	};
+
+	struct EqualOp
+	{
+		static boost::int64_t apply(boost::int64_t a, boost::int64_t b)
+		{
+			return a == b;
+		}
+	};
+
+	struct NotEqualOp
+	{
+		static boost::int64_t apply(boost::int64_t a, boost::int64_t b)
+		{
+			return a != b;
+		}
+	};
+
+	struct LessOp
+	{
+		static boost::int64_t apply(boost::int64_t a, boost::int64_t b)
+		{
+			return a < b;
+		}
+	};
+
+	struct LessEqualOp
+	{
+		static boost::int64_t apply(boost::int64_t a, boost::int64_t b)
+		{
+			return a <= b;
+		}
+	};
+
+	struct GreaterOp
+	{
+		static boost::int64_t apply(boost::int64_t a, boost::int64_t b)
+		{
+			return a > b;
+		}
+	};
+
+	struct GreaterEqualOp
+	{
+		static boost::int64_t apply(boost::int64_t a, boost::int64_t b)
+		{
+			return a >= b;
+		}
+	};
+
+	// Null when any operand is.
+	struct EitherNullOp
+	{
+		static boost::uint8_t apply(boost::uint8_t null1, boost::int64_t, boost::uint8_t null2,
+			boost::int64_t)
+		{
+			return null1 | null2;
+		}
+	};
+
+	struct DivideNullOp
+	{
+		static boost::uint8_t apply(boost::uint8_t null1, boost::int64_t, boost::uint8_t null2,
+			boost::int64_t divisor)
+		{
+			return null1 | null2 | (divisor == 0);
+		}
+	};
+
+	// Three valued logic: false AND null is false, true OR null is true.
+	struct AndOp
+	{
+		static boost::int64_t apply(boost::int64_t a, boost::int64_t b)
+		{
+			return (a != 0) & (b != 0);
+		}
+	};
+
+	struct OrOp
+	{
+		static boost::int64_t apply(boost::int64_t a, boost::int64_t b)
+		{
+			return (a != 0) | (b != 0);
+		}
+	};
+
+	struct AndNullOp
+	{
+		static boost::uint8_t apply(boost::uint8_t null1, boost::int64_t value1,
+			boost::uint8_t null2, boost::int64_t value2)
+		{
+			const bool false1 = !null1 & (value1 == 0);
+			const bool false2 = !null2 & (value2 == 0);
+			return (null1 | null2) & !(false1 | false2);
+		}
+	};
+
+	struct OrNullOp
+	{
+		static boost::uint8_t apply(boost::uint8_t null1, boost::int64_t value1,
+			boost::uint8_t null2, boost::int64_t value2)
+		{
+			const bool true1 = !null1 & (value1 != 0);
+			const bool true2 = !null2 & (value2 != 0);
+			return (null1 | null2) & !(true1 | true2);
+		}
+	};
+
+	// Nodes.
+
+	class ColumnNode : public ExpressionNode
+	{
+	public:
+		ColumnNode(const Format* format, unsigned aField)
+			: ExpressionNode(getKind(format->fields[aField]), format->fields[aField].scale),
+			  field(aField),
+			  type(format->fields[aField].type)
+		{
+			if (type == Format::TYPE_TEXT)
+				maxLength = format->fields[field].length;
+			else if (type == Format::TYPE_VARYING)
+				maxLength = format->fields[field].length - 2;
+		}
+
+	private:
+		static Expression::Kind getKind(const Format::Field& field)
+		{
+			switch (field.type)
+			{
+				case Format::TYPE_SHORT:
+				case Format::TYPE_LONG:
+				case Format::TYPE_INT64:
+					return Expression::KIND_INTEGER;
+
+				case Format::TYPE_DATE:
+					return Expression::KIND_DATE;
+
+				case Format::TYPE_TEXT:
+				case Format::TYPE_VARYING:
+					return Expression::KIND_TEXT;
+
+				default:
+					throw runtime_error("Field " + field.name + " can't be used in expressions");
+			}
+		}
+
+	public:
+		virtual void evaluate(const RecordBatch& batch, const Selection& selection)
+		{
+			const RecordBatch::Column& column = batch.columns[field];
+
+			prepare(selection.count);
+
+			if (selection.count == 0)
+				return;
+
+			copyKernel(selection, &column.nulls[0], &values.nulls[0]);
+
+			if (kind == Expression::KIND_TEXT)
+			{
+				static const boost::uint8_t empty = 0;
+				const char* base = reinterpret_cast<const char*>(
+					column.values.empty() ? &empty : &column.values[0]);
+				const boost::uint32_t* offsets = &column.offsets[0];
+
+				for (vector<boost::uint32_t>::const_iterator i = selection.rows.begin();
+					 i != selection.rows.end();
+					 ++i)
+				{
+					const unsigned r = *i;
+					values.texts[r] = base + offsets[r];
+					values.lengths[r] = offsets[r + 1] - offsets[r];
+				}
+
+				return;
+			}
+
+			const boost::uint8_t* data = &column.values[0];
+			boost::int64_t* out = &values.integers[0];
+
+			switch (type)
+			{
+				case Format::TYPE_SHORT:
+					loadKernel<boost::int16_t>(selection, data, out);
+					break;
+
+				case Format::TYPE_LONG:
+				case Format::TYPE_DATE:
+					loadKernel<boost::int32_t>(selection, data, out);
+					break;
+
+				default:
+					loadKernel<boost::int64_t>(selection, data, out);
+					break;
+			}
+		}
+
+	private:
+		unsigned field;
+		Format::Type type;
+	};
+
+	class ConstantNode : public ExpressionNode
+	{
+	public:
+		ConstantNode(Expression::Kind aKind, boost::int64_t aValue, int aScale = 0)
+			: ExpressionNode(aKind, aScale),
+			  value(aValue)
+		{
+		}
+
+		explicit ConstantNode(const string& aText)
+			: ExpressionNode(Expression::KIND_TEXT, 0, aText.length()),
+			  value(0),
+			  text(aText)
+		{
+		}
+
+	public:
+		virtual void evaluate(const RecordBatch& /*batch*/, const Selection& selection)
+		{
+			prepare(selection.count);
+
+			if (selection.count == 0)
+				return;
+
+			fillKernel<boost::uint8_t>(selection, 0, &values.nulls[0]);
+
+			if (kind == Expression::KIND_TEXT)
+			{
+				fillKernel<const char*>(selection, text.data(), &values.texts[0]);
+				fillKernel<boost::uint32_t>(selection, text.length(), &values.lengths[0]);
+			}
+			else
+				fillKernel(selection, value, &values.integers[0]);
+		}
+
+	public:
+		boost::int64_t value;
+		string text;
+	};
+
+	// Arithmetic on numbers, and days added to or subtracted from dates.
+	class ArithmeticNode : public ExpressionNode
+	{
+	public:
+		ArithmeticNode(char aOp, ExpressionNode* aLeft, ExpressionNode* aRight)
+			: ExpressionNode(Expression::KIND_INTEGER),
+			  op(aOp),
+			  left(aLeft),
+			  right(aRight),
+			  leftFactor(1),
+			  rightFactor(1)
+		{
+			const Expression::Kind leftKind = left->kind;
+			const Expression::Kind rightKind = right->kind;
+
+			if (leftKind == Expression::KIND_INTEGER && rightKind == Expression::KIND_INTEGER)
+			{
+				switch (op)
+				{
+					case '+':
+					case '-':
+						scale = min(left->scale, right->scale);
+						leftFactor = getFactor(left->scale - scale);
+						rightFactor = getFactor(right->scale - scale);
+						break;
+
+					case '*':
+						scale = left->scale + right->scale;
+
+						if (scale < -Format::MAX_SCALE)
+							throw runtime_error("Too many decimal places in a product");
+
+						break;
+
+					case '/':
+						// The dividend is scaled up so the quotient keeps its scale.
+						scale = left->scale;
+						leftFactor = getFactor(-right->scale);
+						break;
+				}
+			}
+			else if (leftKind == Expression::KIND_DATE && rightKind == Expression::KIND_INTEGER &&
+				(op == '+' || op == '-'))
+			{
+				kind = Expression::KIND_DATE;
+
+				if (right->scale != 0)
+					throw runtime_error("Only whole days can be added to dates");
+			}
+			else if (leftKind == Expression::KIND_INTEGER && rightKind == Expression::KIND_DATE &&
+				op == '+')
+			{
+				kind = Expression::KIND_DATE;
+
+				if (left->scale != 0)
+					throw runtime_error("Only whole days can be added to dates");
+			}
+			else if (leftKind == Expression::KIND_DATE && rightKind == Expression::KIND_DATE &&
+				op == '-')
+			{
+			}
+			else
+			{
+				throw runtime_error(string("Invalid operands for ") + op + ": " +
+					getKindName(leftKind) + " and " + getKindName(rightKind));
+			}
+		}
+
+	public:
+		virtual void evaluate(const RecordBatch& batch, const Selection& selection)
+		{
+			left->evaluate(batch, selection);
+			right->evaluate(batch, selection);
+			prepare(selection.count);
+
+			if (selection.count == 0)
+				return;
+
+			const boost::int64_t* values1 = &left->values.integers[0];
+			const boost::int64_t* values2 = &right->values.integers[0];
+			boost::int64_t* out = &values.integers[0];
+
+			switch (op)
+			{
+				case '+':
+					integerKernel<AddOp>(selection, values1, leftFactor, values2, rightFactor, out);
+					break;
+
+				case '-':
+					integerKernel<SubtractOp>(selection, values1, leftFactor, values2, rightFactor,
+						out);
+					break;
+
+				case '*':
+					integerKernel<MultiplyOp>(selection, values1, leftFactor, values2, rightFactor,
+						out);
+					break;
+
+				case '/':
+					integerKernel<DivideOp>(selection, values1, leftFactor, values2, rightFactor,
+						out);
+					break;
+			}
+
+			if (op == '/')
+			{
+				nullKernel<DivideNullOp>(selection, &left->values.nulls[0], values1,
+					&right->values.nulls[0], values2, &values.nulls[0]);
+			}
+			else
+			{
+				nullKernel<EitherNullOp>(selection, &left->values.nulls[0], values1,
+					&right->values.nulls[0], values2, &values.nulls[0]);
+			}
+		}
+
+	private:
+		char op;
+		ExpressionNode* left;
+		ExpressionNode* right;
+		boost::int64_t leftFactor;
+		boost::int64_t rightFactor;
+	};
+
+	class ComparisonNode : public ExpressionNode
+	{
+	public:
+		enum Op
+		{
+			OP_EQUAL,
+			OP_NOT_EQUAL,
+			OP_LESS,
+			OP_LESS_EQUAL,
+			OP_GREATER,
+			OP_GREATER_EQUAL
+		};
+
+	public:
+		ComparisonNode(Op aOp, ExpressionNode* aLeft, ExpressionNode* aRight)
+			: ExpressionNode(Expression::KIND_BOOLEAN),
+			  op(aOp),
+			  left(aLeft),
+			  right(aRight),
+			  leftFactor(1),
+			  rightFactor(1)
+		{
+			if (left->kind != right->kind)
+			{
+				throw runtime_error(string("Can't compare ") + getKindName(left->kind) + " with " +
+					getKindName(right->kind));
+			}
+
+			if (left->kind == Expression::KIND_INTEGER)
+			{
+				const int commonScale = min(left->scale, right->scale);
+				leftFactor = getFactor(left->scale - commonScale);
+				rightFactor = getFactor(right->scale - commonScale);
+			}
+		}
+
+	public:
+		virtual void evaluate(const RecordBatch& batch, const Selection& selection)
+		{
+			left->evaluate(batch, selection);
+			right->evaluate(batch, selection);
+			prepare(selection.count);
+
+			if (selection.count == 0)
+				return;
+
+			if (left->kind == Expression::KIND_TEXT)
+				compareTexts(selection);
+			else
+				compareIntegers(selection);
+
+			nullKernel<EitherNullOp>(selection, &left->values.nulls[0], &values.integers[0],
+				&right->values.nulls[0], &values.integers[0], &values.nulls[0]);
+		}
+
+	private:
+		void compareIntegers(const Selection& selection)
+		{
+			const boost::int64_t* values1 = &left->values.integers[0];
+			const boost::int64_t* values2 = &right->values.integers[0];
+			boost::int64_t* out = &values.integers[0];
+
+			switch (op)
+			{
+				case OP_EQUAL:
+					integerKernel<EqualOp>(selection, values1, leftFactor, values2, rightFactor,
+						out);
+					break;
+
+				case OP_NOT_EQUAL:
+					integerKernel<NotEqualOp>(selection, values1, leftFactor, values2, rightFactor,
+						out);
+					break;
+
+				case OP_LESS:
+					integerKernel<LessOp>(selection, values1, leftFactor, values2, rightFactor, out);
+					break;
+
+				case OP_LESS_EQUAL:
+					integerKernel<LessEqualOp>(selection, values1, leftFactor, values2, rightFactor,
+						out);
+					break;
+
+				case OP_GREATER:
+					integerKernel<GreaterOp>(selection, values1, leftFactor, values2, rightFactor,
+						out);
+					break;
+
+				case OP_GREATER_EQUAL:
+					integerKernel<GreaterEqualOp>(selection, values1, leftFactor, values2,
+						rightFactor, out);
+					break;
+			}
+		}
+
+		void compareTexts(const Selection& selection)
+		{
+			const ExpressionVector& values1 = left->values;
+			const ExpressionVector& values2 = right->values;
+
+			for (vector<boost::uint32_t>::const_iterator i = selection.rows.begin();
+				 i != selection.rows.end();
+				 ++i)
+			{
+				const unsigned r = *i;
+				const int result = compareText(values1.texts[r], values1.lengths[r],
+					values2.texts[r], values2.lengths[r]);
+				bool value = false;
+
+				switch (op)
+				{
+					case OP_EQUAL:
+						value = result == 0;
+						break;
+
+					case OP_NOT_EQUAL:
+						value = result != 0;
+						break;
+
+					case OP_LESS:
+						value = result < 0;
+						break;
+
+					case OP_LESS_EQUAL:
+						value = result <= 0;
+						break;
+
+					case OP_GREATER:
+						value = result > 0;
+						break;
+
+					case OP_GREATER_EQUAL:
+						value = result >= 0;
+						break;
+				}
+
+				values.integers[r] = value;
+			}
+		}
+
+	private:
+		Op op;
+		ExpressionNode* left;
+		ExpressionNode* right;
+		boost::int64_t leftFactor;
+		boost::int64_t rightFactor;
+	};
+
+	class StartingNode : public ExpressionNode
+	{
+	public:
+		StartingNode(ExpressionNode* aValue, ExpressionNode* aPrefix, bool aNegated)
+			: ExpressionNode(Expression::KIND_BOOLEAN),
+			  value(aValue),
+			  prefix(aPrefix),
+			  negated(aNegated)
+		{
+			if (value->kind != Expression::KIND_TEXT || prefix->kind != Expression::KIND_TEXT)
+				throw runtime_error("STARTING WITH needs text operands");
+		}
+
+	public:
+		virtual void evaluate(const RecordBatch& batch, const Selection& selection)
+		{
+			value->evaluate(batch, selection);
+			prefix->evaluate(batch, selection);
+			prepare(selection.count);
+
+			if (selection.count == 0)
+				return;
+
+			const ExpressionVector& values1 = value->values;
+			const ExpressionVector& values2 = prefix->values;
+
+			for (vector<boost::uint32_t>::const_iterator i = selection.rows.begin();
+				 i != selection.rows.end();
+				 ++i)
+			{
+				const unsigned r = *i;
+				const unsigned length = values2.lengths[r];
+				const bool starts = values1.lengths[r] >= length &&
+					memcmp(values1.texts[r], values2.texts[r], length) == 0;
+
+				values.integers[r] = starts != negated;
+			}
+
+			nullKernel<EitherNullOp>(selection, &values1.nulls[0], &values.integers[0],
+				&values2.nulls[0], &values.integers[0], &values.nulls[0]);
+		}
+
+	private:
+		ExpressionNode* value;
+		ExpressionNode* prefix;
+		bool negated;
+	};
+
+	class IsNullNode : public ExpressionNode
+	{
+	public:
+		IsNullNode(ExpressionNode* aValue, bool aNegated)
+			: ExpressionNode(Expression::KIND_BOOLEAN),
+			  value(aValue),
+			  negated(aNegated)
+		{
+		}
+
+	public:
+		virtual void evaluate(const RecordBatch& batch, const Selection& selection)
+		{
+			value->evaluate(batch, selection);
+			prepare(selection.count);
+
+			if (selection.count == 0)
+				return;
+
+			const boost::uint8_t* nulls = &value->values.nulls[0];
+			boost::int64_t* out = &values.integers[0];
+			const boost::int64_t flip = negated;
+
+			if (selection.isDense())
+			{
+				for (unsigned i = 0; i < selection.count; ++i)
+					out[i] = nulls[i] ^ flip;
+			}
+			else
+			{
+				for (vector<boost::uint32_t>::const_iterator i = selection.rows.begin();
+					 i != selection.rows.end();
+					 ++i)
+				{
+					out[*i] = nulls[*i] ^ flip;
+				}
+			}
+
+			fillKernel<boost::uint8_t>(selection, 0, &values.nulls[0]);
+		}
+
+	private:
+		ExpressionNode* value;
+		bool negated;
+	};
+
+	class NotNode : public ExpressionNode
+	{
+	public:
+		explicit NotNode(ExpressionNode* aValue)
+			: ExpressionNode(Expression::KIND_BOOLEAN),
+			  value(aValue)
+		{
+		}
+
+	public:
+		virtual void evaluate(const RecordBatch& batch, const Selection& selection)
+		{
+			value->evaluate(batch, selection);
+			prepare(selection.count);
+
+			if (selection.count == 0)
+				return;
+
+			const boost::int64_t* in = &value->values.integers[0];
+			boost::int64_t* out = &values.integers[0];
+
+			if (selection.isDense())
+			{
+				for (unsigned i = 0; i < selection.count; ++i)
+					out[i] = in[i] == 0;
+			}
+			else
+			{
+				for (vector<boost::uint32_t>::const_iterator i = selection.rows.begin();
+					 i != selection.rows.end();
+					 ++i)
+				{
+					out[*i] = in[*i] == 0;
+				}
+			}
+
+			copyKernel(selection, &value->values.nulls[0], &values.nulls[0]);
+		}
+
+	private:
+		ExpressionNode* value;
+	};
+
+	class LogicalNode : public ExpressionNode
+	{
+	public:
+		LogicalNode(bool aAnd, ExpressionNode* aLeft, ExpressionNode* aRight)
+			: ExpressionNode(Expression::KIND_BOOLEAN),
+			  isAnd(aAnd),
+			  left(aLeft),
+			  right(aRight)
+		{
+		}
+
+	public:
+		virtual void evaluate(const RecordBatch& batch, const Selection& selection)
+		{
+			left->evaluate(batch, selection);
+			right->evaluate(batch, selection);
+			prepare(selection.count);
+
+			if (selection.count == 0)
+				return;
+
+			const boost::int64_t* values1 = &left->values.integers[0];
+			const boost::int64_t* values2 = &right->values.integers[0];
+			const boost::uint8_t* nulls1 = &left->values.nulls[0];
+			const boost::uint8_t* nulls2 = &right->values.nulls[0];
+
+			if (isAnd)
+			{
+				integerKernel<AndOp>(selection, values1, 1, values2, 1, &values.integers[0]);
+				nullKernel<AndNullOp>(selection, nulls1, values1, nulls2, values2,
+					&values.nulls[0]);
+			}
+			else
+			{
+				integerKernel<OrOp>(selection, values1, 1, values2, 1, &values.integers[0]);
+				nullKernel<OrNullOp>(selection, nulls1, values1, nulls2, values2,
+					&values.nulls[0]);
+			}
+		}
+
+		// Conjunctions narrow the selection one operand at a time, so the later ones are
+		// evaluated only for the rows that are left.
+		virtual void select(const RecordBatch& batch, Selection& selection)
+		{
+			if (isAnd)
+			{
+				left->select(batch, selection);
+				right->select(batch, selection);
+			}
+			else
+				ExpressionNode::select(batch, selection);
+		}
+
+	private:
+		bool isAnd;
+		ExpressionNode* left;
+		ExpressionNode* right;
+	};
+
+	class CaseNode : public ExpressionNode
+	{
+	public:
+		CaseNode(const vector<ExpressionNode*>& aConditions,
+				const vector<ExpressionNode*>& aResults, ExpressionNode* aElseResult)
+			: ExpressionNode(aResults[0]->kind, aResults[0]->scale),
+			  conditions(aConditions),
+			  results(aResults),
+			  elseResult(aElseResult)
+		{
+			if (elseResult)
+				results.push_back(elseResult);
+
+			for (vector<ExpressionNode*>::iterator i = results.begin(); i != results.end(); ++i)
+			{
+				if ((*i)->kind != kind)
+				{
+					throw runtime_error(string("CASE results of different types: ") +
+						getKindName(kind) + " and " + getKindName((*i)->kind));
+				}
+
+				scale = min(scale, (*i)->scale);
+				maxLength = max(maxLength, (*i)->maxLength);
+			}
+
+			for (vector<ExpressionNode*>::iterator i = conditions.begin();
+				 i != conditions.end();
+				 ++i)
+			{
+				if ((*i)->kind != Expression::KIND_BOOLEAN)
+					throw runtime_error("CASE WHEN needs a condition");
+			}
+		}
+
+	public:
+		virtual void evaluate(const RecordBatch& batch, const Selection& selection)
+		{
+			prepare(selection.count);
+
+			if (selection.count == 0)
+				return;
+
+			// Rows without a true condition nor ELSE are null.
+			fillKernel<boost::uint8_t>(selection, 1, &values.nulls[0]);
+
+			remaining.count = matched.count = selection.count;
+			remaining.rows = selection.rows;
+
+			for (unsigned n = 0; n < results.size() && !remaining.rows.empty(); ++n)
+			{
+				if (n < conditions.size())
+				{
+					matched.rows = remaining.rows;
+					conditions[n]->select(batch, matched);
+					removeMatched();
+				}
+				else
+					matched.rows.swap(remaining.rows);
+
+				if (matched.rows.empty())
+					continue;
+
+				ExpressionNode* result = results[n];
+				result->evaluate(batch, matched);
+				copyResult(result, matched);
+			}
+		}
+
+	private:
+		// Both lists are sorted, so the matched rows are merged out of the remaining ones.
+		void removeMatched()
+		{
+			vector<boost::uint32_t>::iterator out = remaining.rows.begin();
+			vector<boost::uint32_t>::const_iterator m = matched.rows.begin();
+
+			for (vector<boost::uint32_t>::const_iterator i = remaining.rows.begin();
+				 i != remaining.rows.end();
+				 ++i)
+			{
+				if (m != matched.rows.end() && *m == *i)
+					++m;
+				else
+					*out++ = *i;
+			}
+
+			remaining.rows.erase(out, remaining.rows.end());
+		}
+
+		void copyResult(ExpressionNode* result, const Selection& rows)
+		{
+			copyKernel(rows, &result->values.nulls[0], &values.nulls[0]);
+
+			if (kind == Expression::KIND_TEXT)
+			{
+				copyKernel(rows, &result->values.texts[0], &values.texts[0]);
+				copyKernel(rows, &result->values.lengths[0], &values.lengths[0]);
+				return;
+			}
+
+			const boost::int64_t* in = &result->values.integers[0];
+			const boost::int64_t factor = getFactor(result->scale - scale);
+			boost::int64_t* out = &values.integers[0];
+
+			for (vector<boost::uint32_t>::const_iterator i = rows.rows.begin();
+				 i != rows.rows.end();
+				 ++i)
+			{
+				out[*i] = in[*i] * factor;
+			}
+		}
+
+	private:
+		vector<ExpressionNode*> conditions;
+		vector<ExpressionNode*> results;
+		ExpressionNode* elseResult;
+		Selection remaining;
+		Selection matched;
+	};
+
+	// Recursive descent parser. The nodes are registered in the list of the expression as they
+	// are created, so they are freed when parsing fails.
+	class Parser
+	{
+	private:
+		enum TokenType
+		{
+			TOKEN_END,
+			TOKEN_NAME,
+			TOKEN_NUMBER,
+			TOKEN_STRING,
+			TOKEN_SYMBOL
+		};
+
+	public:
+		Parser(const string& aText, const Format* aFormat, vector<ExpressionNode*>& aNodes)
+			: text(aText),
+			  format(aFormat),
+			  nodes(aNodes),
+			  pos(0)
+		{
+			next();
+		}
+
+	public:
+		ExpressionNode* parse()
+		{
+			ExpressionNode* node = parseOr();
+
+			if (tokenType != TOKEN_END)
+				error("Unexpected " + token);
+
+			return node;
+		}
+
+	private:
+		ExpressionNode* parseOr()
+		{
+			ExpressionNode* node = parseAnd();
+
+			while (isKeyword("or"))
+			{
+				next();
+				node = add(new LogicalNode(false, checkBoolean(node), checkBoolean(parseAnd())));
+			}
+
+			return node;
+		}
+
+		ExpressionNode* parseAnd()
+		{
+			ExpressionNode* node = parseNot();
+
+			while (isKeyword("and"))
+			{
+				next();
+				node = add(new LogicalNode(true, checkBoolean(node), checkBoolean(parseNot())));
+			}
+
+			return node;
+		}
+
+		ExpressionNode* parseNot()
+		{
+			if (isKeyword("not"))
+			{
+				next();
+				return add(new NotNode(checkBoolean(parseNot())));
+			}
+
+			return parsePredicate();
+		}
+
+		ExpressionNode* parsePredicate()
+		{
+			ExpressionNode* node = parseAdditive();
+
+			if (tokenType == TOKEN_SYMBOL)
+			{
+				ComparisonNode::Op op;
+
+				if (token == "=")
+					op = ComparisonNode::OP_EQUAL;
+				else if (token == "<>" || token == "!=")
+					op = ComparisonNode::OP_NOT_EQUAL;
+				else if (token == "<")
+					op = ComparisonNode::OP_LESS;
+				else if (token == "<=")
+					op = ComparisonNode::OP_LESS_EQUAL;
+				else if (token == ">")
+					op = ComparisonNode::OP_GREATER;
+				else if (token == ">=")
+					op = ComparisonNode::OP_GREATER_EQUAL;
+				else
+					return node;
+
+				next();
+				ExpressionNode* other = parseAdditive();
+
+				node = toDate(node, other);
+				other = toDate(other, node);
+
+				return add(new ComparisonNode(op, node, other));
+			}
+
+			if (isKeyword("is"))
+			{
+				next();
+				bool negated = false;
+
+				if (isKeyword("not"))
+				{
+					negated = true;
+					next();
+				}
+
+				expectKeyword("null");
+				return add(new IsNullNode(node, negated));
+			}
+
+			bool negated = false;
+
+			if (isKeyword("not"))
+			{
+				negated = true;
+				next();
+
+				if (!isKeyword("starting"))
+					error("Expected STARTING after NOT");
+			}
+
+			if (isKeyword("starting"))
+			{
+				next();
+
+				if (isKeyword("with"))
+					next();
+
+				return add(new StartingNode(node, parseAdditive(), negated));
+			}
+
+			return node;
+		}
+
+		ExpressionNode* parseAdditive()
+		{
+			ExpressionNode* node = parseTerm();
+
+			while (isSymbol("+") || isSymbol("-"))
+			{
+				const char op = token[0];
+				next();
+				node = add(new ArithmeticNode(op, node, parseTerm()));
+			}
+
+			return node;
+		}
+
+		ExpressionNode* parseTerm()
+		{
+			ExpressionNode* node = parseUnary();
+
+			while (isSymbol("*") || isSymbol("/"))
+			{
+				const char op = token[0];
+				next();
+				node = add(new ArithmeticNode(op, node, parseUnary()));
+			}
+
+			return node;
+		}
+
+		ExpressionNode* parseUnary()
+		{
+			if (isSymbol("-"))
+			{
+				next();
+				ExpressionNode* node = parseUnary();
+				ConstantNode* constant = dynamic_cast<ConstantNode*>(node);
+
+				if (constant && constant->kind == Expression::KIND_INTEGER)
+				{
+					constant->value = -constant->value;
+					return constant;
+				}
+
+				if (node->kind != Expression::KIND_INTEGER)
+					error("Invalid operand for -");
+
+				return add(new ArithmeticNode('-',
+					add(new ConstantNode(Expression::KIND_INTEGER, 0, node->scale)), node));
+			}
+
+			if (isSymbol("+"))
+				next();
+
+			return parsePrimary();
+		}
+
+		ExpressionNode* parsePrimary()
+		{
+			switch (tokenType)
+			{
+				case TOKEN_NUMBER:
+				{
+					const string::size_type point = token.find('.');
+					string digits(token);
+					int scale = 0;
+
+					if (point != string::npos)
+					{
+						digits.erase(point, 1);
+						scale = -int(token.length() - point - 1);
+					}
+
+					if (scale < -Format::MAX_SCALE)
+						error("Too many decimal places in " + token);
+
+					errno = 0;
+					const boost::int64_t value = strtoll(digits.c_str(), NULL, 10);
+
+					if (errno == ERANGE)
+						error("Number out of range: " + token);
+
+					ExpressionNode* node = add(new ConstantNode(Expression::KIND_INTEGER, value,
+						scale));
+					next();
+					return node;
+				}
+
+				case TOKEN_STRING:
+				{
+					ExpressionNode* node = add(new ConstantNode(token));
+					next();
+					return node;
+				}
+
+				case TOKEN_SYMBOL:
+					if (token == "(")
+					{
+						next();
+						ExpressionNode* node = parseOr();
+						expectSymbol(")");
+						return node;
+					}
+					break;
+
+				case TOKEN_NAME:
+				{
+					if (isKeyword("true") || isKeyword("false"))
+					{
+						ExpressionNode* node = add(new ConstantNode(Expression::KIND_BOOLEAN,
+							isKeyword("true")));
+						next();
+						return node;
+					}
+
+					if (isKeyword("case"))
+						return parseCase();
+
+					for (unsigned n = 0; n < format->fields.size(); ++n)
+					{
+						if (boost::algorithm::iequals(format->fields[n].name, token))
+						{
+							next();
+							return add(new ColumnNode(format, n));
+						}
+					}
+
+					error("Unknown field " + token);
+					break;
+				}
+
+				default:
+					break;
+			}
+
+			error(tokenType == TOKEN_END ? string("Unexpected end") : "Unexpected " + token);
+			return NULL;
+		}
+
+		ExpressionNode* parseCase()
+		{
+			next();
+
+			vector<ExpressionNode*> conditions;
+			vector<ExpressionNode*> results;
+			ExpressionNode* elseResult = NULL;
+
+			do
+			{
+				expectKeyword("when");
+				conditions.push_back(checkBoolean(parseOr()));
+				expectKeyword("then");
+				results.push_back(parseOr());
+			} while (isKeyword("when"));
+
+			if (isKeyword("else"))
+			{
+				next();
+				elseResult = parseOr();
+			}
+
+			expectKeyword("end");
+
+			return add(new CaseNode(conditions, results, elseResult));
+		}
+
+		// A string compared with a date is a date.
+		ExpressionNode* toDate(ExpressionNode* node, ExpressionNode* other)
+		{
+			ConstantNode* constant = dynamic_cast<ConstantNode*>(node);
+
+			if (!constant || constant->kind != Expression::KIND_TEXT ||
+				other->kind != Expression::KIND_DATE)
+			{
+				return node;
+			}
+
+			int year, month, day;
+			char rest;
+
+			if (sscanf(constant->text.c_str(), "%d-%d-%d%c", &year, &month, &day, &rest) != 3)
+				error("Invalid date: " + constant->text);
+
+			return add(new ConstantNode(Expression::KIND_DATE,
+				Format::encodeDate(year, month, day)));
+		}
+
+		ExpressionNode* checkBoolean(ExpressionNode* node)
+		{
+			if (node->kind != Expression::KIND_BOOLEAN)
+				error(string("Expected a condition, not ") + getKindName(node->kind));
+
+			return node;
+		}
+
+		ExpressionNode* add(ExpressionNode* node)
+		{
+			nodes.push_back(node);
+			return node;
+		}
+
+		bool isKeyword(const char* keyword) const
+		{
+			return tokenType == TOKEN_NAME && boost::algorithm::iequals(token, keyword);
+		}
+
+		bool isSymbol(const char* symbol) const
+		{
+			return tokenType == TOKEN_SYMBOL && token == symbol;
+		}
+
+		void expectKeyword(const char* keyword)
+		{
+			if (!isKeyword(keyword))
+				error(string("Expected ") + boost::algorithm::to_upper_copy(string(keyword)));
+
+			next();
+		}
+
+		void expectSymbol(const char* symbol)
+		{
+			if (!isSymbol(symbol))
+				error(string("Expected ") + symbol);
+
+			next();
+		}
+
+		void error(const string& message) const
+		{
+			throw runtime_error(message + " in expression: " + text);
+		}
+
+		void next()
+		{
+			while (pos < text.length() && isspace(static_cast<unsigned char>(text[pos])))
+				++pos;
+
+			token.clear();
+
+			if (pos == text.length())
+			{
+				tokenType = TOKEN_END;
+				return;
+			}
+
+			const char c = text[pos];
+
+			if (isalpha(static_cast<unsigned char>(c)) || c == '_')
+			{
+				tokenType = TOKEN_NAME;
+
+				while (pos < text.length() && (isalnum(static_cast<unsigned char>(text[pos])) ||
+					   text[pos] == '_' || text[pos] == '$'))
+				{
+					token += text[pos++];
+				}
+			}
+			else if (isdigit(static_cast<unsigned char>(c)) ||
+				(c == '.' && pos + 1 < text.length() &&
+				 isdigit(static_cast<unsigned char>(text[pos + 1]))))
+			{
+				tokenType = TOKEN_NUMBER;
+				bool point = false;
+
+				while (pos < text.length() && (isdigit(static_cast<unsigned char>(text[pos])) ||
+					   (text[pos] == '.' && !point)))
+				{
+					point |= text[pos] == '.';
+					token += text[pos++];
+				}
+			}
+			else if (c == '\'')
+			{
+				tokenType = TOKEN_STRING;
+
+				for (++pos; ; ++pos)
+				{
+					if (pos == text.length())
+						error("Unterminated string");
+
+					if (text[pos] == '\'')
+					{
+						if (pos + 1 < text.length() && text[pos + 1] == '\'')
+							++pos;
+						else
+							break;
+					}
+
+					token += text[pos];
+				}
+
+				++pos;
+			}
+			else
+			{
+				tokenType = TOKEN_SYMBOL;
+				token = c;
+				++pos;
+
+				if (pos < text.length() &&
+					((c == '<' && (text[pos] == '=' || text[pos] == '>')) ||
+					 ((c == '>' || c == '!') && text[pos] == '=')))
+				{
+					token += text[pos++];
+				}
+				else if (strchr("+-*/(),=<>", c) == NULL)
+					error("Unexpected " + token);
+			}
+		}
+
+	private:
+		const string& text;
+		const Format* format;
+		vector<ExpressionNode*>& nodes;
+		string::size_type pos;
+		TokenType tokenType;
+		string token;
+	};
+}	// namespace
+
+
+void ExpressionNode::select(const RecordBatch& batch, Selection& selection)
+{
+	evaluate(batch, selection);
+
+	if (selection.rows.empty())
+		return;
+
+	// Branch free compaction: every row is written, and kept when true and not null.
+	const boost::int64_t* in = &values.integers[0];
+	const boost::uint8_t* nulls = &values.nulls[0];
+	boost::uint32_t* rows = &selection.rows[0];
+	unsigned kept = 0;
+
+	for (unsigned i = 0; i < selection.rows.size(); ++i)
+	{
+		const unsigned r = rows[i];
+		rows[kept] = r;
+		kept += (in[r] != 0) & !nulls[r];
+	}
+
+	selection.rows.resize(kept);
+}
+
+
+//------------------------------------------------------------------------------
+
+
+Expression::Expression(const string& text, const Format* format)
+{
+	try
+	{
+		Parser parser(text, format, nodes);
+		root = parser.parse();
+	}
+	catch (...)
+	{
+		for (vector<ExpressionNode*>::iterator i = nodes.begin(); i != nodes.end(); ++i)
+			delete *i;
+
+		throw;
+	}
+}
+
+Expression::~Expression()
+{
+	for (vector<ExpressionNode*>::iterator i = nodes.begin(); i != nodes.end(); ++i)
+		delete *i;
+}
+
+void Expression::select(const RecordBatch& batch, Selection& selection)
+{
+	if (root->kind != KIND_BOOLEAN)
+		throw runtime_error("Expression is not a condition");
+
+	root->select(batch, selection);
+}
+
+const ExpressionVector& Expression::evaluate(const RecordBatch& batch, const Selection& selection)
+{
+	root->evaluate(batch, selection);
+	return root->values;
+}
+
+Expression::Kind Expression::getKind() const
+{
+	return root->kind;
+}
+
+int Expression::getScale() const
+{
+	return root->scale;
+}
+
+string Expression::getTypeSpec() const
+{
+	std::ostringstream s;
+
+	switch (root->kind)
+	{
+		case KIND_BOOLEAN:
+			s << "smallint";
+			break;
+
+		case KIND_INTEGER:
+			if (root->scale < 0)
+				s << "numeric(18, " << -root->scale << ")";
+			else
+				s << "bigint";
+			break;
+
+		case KIND_DATE:
+			s << "date";
+			break;
+
+		case KIND_TEXT:
+			s << "varchar(" << max(root->maxLength, 1u) << ")";
+			break;
+	}
+
+	return s.str();
+}
+
+
+//------------------------------------------------------------------------------
+
+
+Projection::Projection(const string& formatSpec, const string& conditionText,
+		const vector<string>& columnTexts)
+	: format(formatSpec),
+	  outputSpec(formatSpec),
+	  batch(&format, BATCH_ROWS),
+	  outputCount(0),
+	  sameLayout(true)
+{
+	if (!conditionText.empty())
+		condition.reset(new Expression(conditionText, &format));
+
+	try
+	{
+		for (vector<string>::const_iterator i = columnTexts.begin(); i != columnTexts.end(); ++i)
+		{
+			const string::size_type equal = i->find('=');
+
+			if (equal == string::npos)
+				throw runtime_error("Computed columns are name = expression: " + *i);
+
+			const string name(boost::algorithm::trim_copy(i->substr(0, equal)));
+			columns.push_back(new Expression(i->substr(equal + 1), &format));
+
+			outputSpec += ", " + name + " " + columns.back()->getTypeSpec();
+		}
+
+		outputFormat.reset(new Format(outputSpec));
+	}
+	catch (...)
+	{
+		for (vector<Expression*>::iterator i = columns.begin(); i != columns.end(); ++i)
+			delete *i;
+
+		throw;
+	}
+
+	for (unsigned n = 0; n < format.fields.size(); ++n)
+		sameLayout &= format.fields[n].offset == outputFormat->fields[n].offset;
+
+	sameLayout &= format.length <= outputFormat->length;
+	records.reserve(BATCH_ROWS * format.length);
+}
+
+Projection::~Projection()
+{
+	for (vector<Expression*>::iterator i = columns.begin(); i != columns.end(); ++i)
+		delete *i;
+}
+
+void Projection::add(const void* record)
+{
+	const char* p = static_cast<const char*>(record);
+	records.insert(records.end(), p, p + format.length);
+	batch.add(record);
+}
+
+void Projection::run()
+{
+	selection.selectAll(batch.count);
+
+	if (condition)
+		condition->select(batch, selection);
+
+	outputCount = selection.rows.size();
+	output.assign(outputCount * outputFormat->length, 0);
+
+	vector<const ExpressionVector*> results;
+
+	for (vector<Expression*>::iterator i = columns.begin(); i != columns.end(); ++i)
+		results.push_back(&(*i)->evaluate(batch, selection));
+
+	const unsigned inputFields = format.fields.size();
+
+	for (unsigned n = 0; n < outputCount; ++n)
+	{
+		const unsigned r = selection.rows[n];
+		const char* in = &records[r * format.length];
+		boost::uint8_t* out = reinterpret_cast<boost::uint8_t*>(&output[n * outputFormat->length]);
+
+		if (sameLayout)
+			memcpy(out, in, format.length);
+		else
+		{
+			for (unsigned f = 0; f < inputFields; ++f)
+			{
+				if (format.isNull(in, f))
+					out[f >> 3] |= 1 << (f & 7);
+
+				memcpy(out + outputFormat->fields[f].offset, format.getPointer(in, f),
+					format.fields[f].length);
+			}
+		}
+
+		for (unsigned c = 0; c < columns.size(); ++c)
+		{
+			const unsigned f = inputFields + c;
+			const Format::Field& field = outputFormat->fields[f];
+			const ExpressionVector& values = *results[c];
+			boost::uint8_t* value = out + field.offset;
+
+			if (values.nulls[r])
+			{
+				out[f >> 3] |= 1 << (f & 7);
+				continue;
+			}
+
+			switch (field.type)
+			{
+				case Format::TYPE_SHORT:
+				{
+					const boost::int16_t n16 = boost::int16_t(values.integers[r]);
+					memcpy(value, &n16, sizeof(n16));
+					break;
+				}
+
+				case Format::TYPE_DATE:
+				{
+					const boost::int32_t n32 = boost::int32_t(values.integers[r]);
+					memcpy(value, &n32, sizeof(n32));
+					break;
+				}
+
+				case Format::TYPE_VARYING:
+				{
+					const boost::uint16_t length = boost::uint16_t(min<unsigned>(values.lengths[r],
+						field.length - 2));
+					memcpy(value, &length, sizeof(length));
+					memcpy(value + 2, values.texts[r], length);
+					break;
+				}
+
+				default:
+					memcpy(value, &values.integers[r], sizeof(boost::int64_t));
+					break;
+			}
+		}
+	}
+
+	batch.clear();
+	records.clear();
+}
+
+
+//------------------------------------------------------------------------------
+
+}	// fbods
@@ -0,0 +1,199 @@
+/*
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Initial Developer of the Original Code is Adriano dos Santos Fernandes.
+ * Portions created by the Initial Developer are Copyright (C) 2012 the Initial Developer.
+ * All Rights Reserved.
+ *
+ * Contributor(s):
+ *
+ */
+
+#ifndef FBSTUFF_ODS_EXPRESSION_H
+#define FBSTUFF_ODS_EXPRESSION_H
+
+#include "Format.h"
+#include "RecordBatch.h"
+#include <string>
+#include <vector>
+#include <boost/cstdint.hpp>
+#include <boost/scoped_ptr.hpp>
+
+namespace fbods
+{
+
+//------------------------------------------------------------------------------
+
+
+// Rows of a batch an expression is evaluated for. Kernels loop over contiguous arrays when all
+// rows are selected, and over the row numbers otherwise.
+struct Selection
+{
+	Selection()
+		: count(0)
+	{
+	}
+
+	void selectAll(unsigned aCount)
+	{
+		count = aCount;
+		rows.resize(count);
+
+		for (unsigned i = 0; i < count; ++i)
+			rows[i] = i;
+	}
+
+	bool isDense() const
+	{
+		return rows.size() == count;
+	}
+
+	std::vector<boost::uint32_t> rows;
+	unsigned count;	// rows of the batch
+};
+
+// Values of an expression for the rows of a batch, indexed by row. Integers hold numbers of
+// the expression scale, dates as days and booleans as 0 or 1. Text points into the batch or
+// the constants of the expression.
+struct ExpressionVector
+{
+	std::vector<boost::int64_t> integers;
+	std::vector<boost::uint8_t> nulls;
+	std::vector<const char*> texts;
+	std::vector<boost::uint32_t> lengths;
+};
+
+class ExpressionNode;
+
+// Expression over the fields of a format, in SQL syntax: arithmetic, comparisons, AND, OR,
+// NOT, IS [NOT] NULL, [NOT] STARTING [WITH] and CASE WHEN ... THEN ... [ELSE ...] END, on
+// integer, numeric, date and char fields. Constants are numbers, quoted strings, which are
+// also dates when compared with them, and TRUE and FALSE.
+//
+// Numbers keep their scale: sums align the scales of their operands, products add them and
+// quotients have the scale of the dividend. Division by zero is null. Char values are compared
+// without their trailing spaces.
+class Expression
+{
+public:
+	enum Kind
+	{
+		KIND_BOOLEAN,
+		KIND_INTEGER,
+		KIND_DATE,
+		KIND_TEXT
+	};
+
+public:
+	Expression(const std::string& text, const Format* format);
+	~Expression();
+
+private:
+	Expression(const Expression&);
+	Expression& operator =(const Expression&);
+
+public:
+	// Keeps the selected rows where the expression is true.
+	void select(const RecordBatch& batch, Selection& selection);
+
+	// Computes the values of the selected rows.
+	const ExpressionVector& evaluate(const RecordBatch& batch, const Selection& selection);
+
+	Kind getKind() const;
+	int getScale() const;
+
+	// Type of the values in a format spec, booleans being smallint.
+	std::string getTypeSpec() const;
+
+private:
+	ExpressionNode* root;
+	std::vector<ExpressionNode*> nodes;	// all of the tree, owned by the expression
+};
+
+// Filters batches of records with a condition and appends computed columns to them. The records
+// kept are laid out in the output format: the input fields followed by the computed ones.
+class Projection
+{
+public:
+	static const unsigned BATCH_ROWS = 1024;
+
+public:
+	// Columns are "name = expression". The condition may be empty.
+	Projection(const std::string& formatSpec, const std::string& condition,
+		const std::vector<std::string>& columns);
+	~Projection();
+
+private:
+	Projection(const Projection&);
+	Projection& operator =(const Projection&);
+
+public:
+	void add(const void* record);
+
+	bool isFull() const
+	{
+		return batch.count == BATCH_ROWS;
+	}
+
+	bool isEmpty() const
+	{
+		return batch.count == 0;
+	}
+
+	// Evaluates the batch into the output records and clears it.
+	void run();
+
+	unsigned getOutputCount() const
+	{
+		return outputCount;
+	}
+
+	const void* getOutput(unsigned n) const
+	{
+		return &output[n * outputFormat->length];
+	}
+
+	// Row of the batch the output record was evaluated from.
+	unsigned getOutputRow(unsigned n) const
+	{
+		return selection.rows[n];
+	}
+
+	const Format& getFormat() const
+	{
+		return *outputFormat;
+	}
+
+	const std::string& getSpec() const
+	{
+		return outputSpec;
+	}
+
+private:
+	Format format;
+	std::string outputSpec;
+	boost::scoped_ptr<Format> outputFormat;
+	boost::scoped_ptr<Expression> condition;
+	std::vector<Expression*> columns;
+	RecordBatch batch;
+	std::vector<char> records;	// copies of the batch records
+	Selection selection;
+	std::vector<char> output;
+	unsigned outputCount;
+	bool sameLayout;	// the input fields are at the same offsets in the output
+};
+
+
+//------------------------------------------------------------------------------
+
+}	// fbods
+
+#endif	// FBSTUFF_ODS_EXPRESSION_H
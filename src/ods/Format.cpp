@@ -0,0 +1,603 @@
+/*
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Initial Developer of the Original Code is Adriano dos Santos Fernandes.
+ * Portions created by the Initial Developer are Copyright (C) 2012 the Initial Developer.
+ * All Rights Reserved.
+ *
+ * Contributor(s):
+ *
+ */
+
+#include "Format.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <boost/algorithm/string.hpp>
+
+namespace fbods
+{
+
+using std::ostream;
+using std::runtime_error;
+using std::string;
+using std::vector;
+
+//------------------------------------------------------------------------------
+
+
+namespace
+{
+	template <typename T>
+	T readValue(const void* p)
+	{
+		T value;
+		memcpy(&value, p, sizeof(value));
+		return value;
+	}
+
+	template <typename T>
+	int compareValues(const void* p1, const void* p2)
+	{
+		T v1 = readValue<T>(p1);
+		T v2 = readValue<T>(p2);
+		return v1 < v2 ? -1 : v1 > v2 ? 1 : 0;
+	}
+
+	void printDate(ostream& out, boost::int32_t date)
+	{
+		int year, month, day;
+		Format::decodeDate(date, year, month, day);
+
+		char s[32];
+		sprintf(s, "%04d-%02d-%02d", year, month, day);
+		out << s;
+	}
+
+	// Times are 1/10000 of second since midnight.
+	void printTime(ostream& out, boost::uint32_t time)
+	{
+		char s[16];
+		sprintf(s, "%02u:%02u:%02u.%04u", time / 36000000, time / 600000 % 60,
+			time / 10000 % 60, time % 10000);
+		out << s;
+	}
+
+	boost::int64_t parseScaled(const string& text, int scale)
+	{
+		string::size_type point = text.find('.');
+		string digits(text, 0, point);
+		string fraction(point == string::npos ? string() : text.substr(point + 1));
+
+		if (scale > 0 || fraction.length() > unsigned(-scale))
+			throw runtime_error("Too many decimal places in " + text);
+
+		digits += fraction;
+		digits.append(-scale - fraction.length(), '0');
+
+		char* end;
+		const boost::int64_t value = strtoll(digits.c_str(), &end, 10);
+
+		if (text.empty() || *end != '\0')
+			throw runtime_error("Invalid number: " + text);
+
+		return value;
+	}
+
+	boost::int32_t parseDate(const string& text)
+	{
+		int year, month, day;
+		char rest;
+
+		if (sscanf(text.c_str(), "%d-%d-%d%c", &year, &month, &day, &rest) != 3)
+			throw runtime_error("Invalid date: " + text);
+
+		return Format::encodeDate(year, month, day);
+	}
+
+	boost::uint32_t parseTime(const string& text)
+	{
+		unsigned hours, minutes, seconds = 0;
+		char fraction[8] = "";
+		char rest;
+
+		const int count = sscanf(text.c_str(), "%u:%u:%u.%4[0-9]%c", &hours, &minutes, &seconds,
+			fraction, &rest);
+
+		if (count < 2 || count > 4 || hours > 23 || minutes > 59 || seconds > 59)
+		{
+			throw runtime_error("Invalid time: " + text);
+		}
+
+		unsigned ticks = 0;
+
+		for (unsigned i = 0; i < 4; ++i)
+			ticks = ticks * 10 + (fraction[i] ? fraction[i] - '0' : 0);
+
+		return ((hours * 60 + minutes) * 60 + seconds) * 10000 + ticks;
+	}
+
+	unsigned parseArgument(const string& spec, string::size_type& pos)
+	{
+		string::size_type end = spec.find_first_of(",)", pos);
+
+		if (end == string::npos)
+			throw runtime_error("Invalid format: " + spec);
+
+		string arg(spec, pos, end - pos);
+		boost::algorithm::trim(arg);
+		pos = end;
+
+		return atoi(arg.c_str());
+	}
+}	// namespace
+
+
+Format::Format(const string& spec)
+{
+	// Split the spec in fields, ignoring commas inside parenthesis.
+	vector<string> items;
+	int level = 0;
+	string::size_type start = 0;
+
+	for (string::size_type i = 0; i <= spec.length(); ++i)
+	{
+		if (i == spec.length() || (spec[i] == ',' && level == 0))
+		{
+			string item(spec, start, i - start);
+			boost::algorithm::trim(item);
+
+			if (!item.empty())
+				items.push_back(item);
+
+			start = i + 1;
+		}
+		else if (spec[i] == '(')
+			++level;
+		else if (spec[i] == ')')
+			--level;
+	}
+
+	if (items.empty())
+		throw runtime_error("Empty format");
+
+	length = ((items.size() + 32) & ~31) >> 3;
+
+	for (vector<string>::iterator i = items.begin(); i != items.end(); ++i)
+	{
+		Field field;
+		field.scale = 0;
+
+		string typeSpec(*i);
+
+		if (boost::algorithm::iends_with(typeSpec, "double precision"))
+			typeSpec.erase(typeSpec.length() - strlen(" precision"));
+
+		string::size_type paren = typeSpec.find('(');
+		string::size_type space = typeSpec.find_first_of(" \t");
+
+		if (space != string::npos && (paren == string::npos || space < paren))
+		{
+			string rest(typeSpec, space);
+			boost::algorithm::trim(rest);
+
+			if (!rest.empty() && rest[0] != '(')
+			{
+				field.name = typeSpec.substr(0, space);
+				typeSpec = rest;
+			}
+		}
+
+		if (field.name.empty())
+		{
+			char s[16];
+			sprintf(s, "F%u", unsigned(fields.size() + 1));
+			field.name = s;
+		}
+
+		paren = typeSpec.find('(');
+		string type(typeSpec, 0, paren);
+		boost::algorithm::trim(type);
+		boost::algorithm::to_lower(type);
+
+		unsigned arg1 = 0;
+		int arg2 = 0;
+
+		if (paren != string::npos)
+		{
+			string::size_type pos = paren + 1;
+			arg1 = parseArgument(typeSpec, pos);
+
+			if (typeSpec[pos] == ',')
+			{
+				++pos;
+				arg2 = parseArgument(typeSpec, pos);
+			}
+		}
+
+		unsigned alignment;
+
+		if (type == "smallint")
+		{
+			field.type = TYPE_SHORT;
+			field.length = alignment = 2;
+		}
+		else if (type == "integer" || type == "int")
+		{
+			field.type = TYPE_LONG;
+			field.length = alignment = 4;
+		}
+		else if (type == "bigint")
+		{
+			field.type = TYPE_INT64;
+			field.length = alignment = 8;
+		}
+		else if (type == "numeric" || type == "decimal")
+		{
+			if (arg2 > MAX_SCALE)
+				throw runtime_error("Invalid scale of " + field.name);
+
+			field.scale = -arg2;
+
+			if (arg1 < 5 && type == "numeric")
+			{
+				field.type = TYPE_SHORT;
+				field.length = alignment = 2;
+			}
+			else if (arg1 < 10)
+			{
+				field.type = TYPE_LONG;
+				field.length = alignment = 4;
+			}
+			else
+			{
+				field.type = TYPE_INT64;
+				field.length = alignment = 8;
+			}
+		}
+		else if (type == "float")
+		{
+			field.type = TYPE_FLOAT;
+			field.length = alignment = 4;
+		}
+		else if (type == "double")
+		{
+			field.type = TYPE_DOUBLE;
+			field.length = alignment = 8;
+		}
+		else if (type == "date")
+		{
+			field.type = TYPE_DATE;
+			field.length = alignment = 4;
+		}
+		else if (type == "time")
+		{
+			field.type = TYPE_TIME;
+			field.length = alignment = 4;
+		}
+		else if (type == "timestamp")
+		{
+			field.type = TYPE_TIMESTAMP;
+			field.length = 8;
+			alignment = 4;
+		}
+		else if (type == "char")
+		{
+			field.type = TYPE_TEXT;
+			field.length = arg1 == 0 ? 1 : arg1;
+			alignment = 1;
+		}
+		else if (type == "varchar")
+		{
+			field.type = TYPE_VARYING;
+			field.length = arg1 + 2;
+			alignment = 2;
+		}
+		else if (type == "blob")
+		{
+			field.type = TYPE_BLOB;
+			field.length = 8;
+			alignment = 4;
+		}
+		else
+			throw runtime_error("Invalid type in format: " + *i);
+
+		field.offset = (length + alignment - 1) & ~(alignment - 1);
+		length = field.offset + field.length;
+
+		fields.push_back(field);
+	}
+}
+
+void Format::decodeDate(boost::int32_t date, int& year, int& month, int& day)
+{
+	boost::int32_t z = date + 678881;	// days since 0000-03-01
+	boost::int32_t era = (z >= 0 ? z : z - 146096) / 146097;
+	unsigned doe = z - era * 146097;
+	unsigned yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+	unsigned doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+	unsigned mp = (5 * doy + 2) / 153;
+
+	day = doy - (153 * mp + 2) / 5 + 1;
+	month = mp < 10 ? mp + 3 : mp - 9;
+	year = yoe + era * 400 + (month <= 2 ? 1 : 0);
+}
+
+boost::int32_t Format::encodeDate(int year, int month, int day)
+{
+	const int y = month <= 2 ? year - 1 : year;
+	const boost::int32_t era = (y >= 0 ? y : y - 399) / 400;
+	const unsigned yoe = y - era * 400;
+	const unsigned doy = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+	const unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+
+	return era * 146097 + boost::int32_t(doe) - 678881;
+}
+
+unsigned Format::getValueLength(const void* record, unsigned n) const
+{
+	const Field& field = fields[n];
+
+	if (field.type == TYPE_VARYING)
+	{
+		return std::min<unsigned>(readValue<boost::uint16_t>(getPointer(record, n)),
+			field.length - sizeof(boost::uint16_t));
+	}
+
+	return field.length;
+}
+
+void Format::printScaled(ostream& out, boost::int64_t value, int scale)
+{
+	if (scale >= 0)
+	{
+		out << value;
+
+		for (int i = 0; i < scale; ++i)
+			out << '0';
+
+		return;
+	}
+
+	boost::uint64_t absValue = value < 0 ? -boost::uint64_t(value) : value;
+	boost::uint64_t divisor = 1;
+
+	for (int i = 0; i < -scale; ++i)
+		divisor *= 10;
+
+	char fraction[24];
+	const int length = snprintf(fraction, sizeof(fraction), "%llu",
+		static_cast<unsigned long long>(absValue % divisor));
+
+	out << (value < 0 ? "-" : "") << absValue / divisor << '.';
+
+	for (int i = length; i < -scale; ++i)
+		out << '0';
+
+	out << fraction;
+}
+
+int Format::compare(unsigned n, const void* value1, const void* value2) const
+{
+	const Field& field = fields[n];
+
+	switch (field.type)
+	{
+		case TYPE_SHORT:
+			return compareValues<boost::int16_t>(value1, value2);
+
+		case TYPE_LONG:
+		case TYPE_DATE:
+			return compareValues<boost::int32_t>(value1, value2);
+
+		case TYPE_TIME:
+			return compareValues<boost::uint32_t>(value1, value2);
+
+		case TYPE_INT64:
+			return compareValues<boost::int64_t>(value1, value2);
+
+		case TYPE_FLOAT:
+			return compareValues<float>(value1, value2);
+
+		case TYPE_DOUBLE:
+			return compareValues<double>(value1, value2);
+
+		case TYPE_TIMESTAMP:
+		{
+			int n = compareValues<boost::int32_t>(value1, value2);
+			return n != 0 ? n : compareValues<boost::uint32_t>(
+				static_cast<const char*>(value1) + 4, static_cast<const char*>(value2) + 4);
+		}
+
+		case TYPE_TEXT:
+			return memcmp(value1, value2, field.length);
+
+		case TYPE_VARYING:
+		{
+			// Damaged records may have lengths past the field.
+			const unsigned maxLength = field.length - sizeof(boost::uint16_t);
+			unsigned length1 = std::min<unsigned>(readValue<boost::uint16_t>(value1), maxLength);
+			unsigned length2 = std::min<unsigned>(readValue<boost::uint16_t>(value2), maxLength);
+			int n = memcmp(static_cast<const char*>(value1) + 2,
+				static_cast<const char*>(value2) + 2, std::min(length1, length2));
+			return n != 0 ? n : length1 < length2 ? -1 : length1 > length2 ? 1 : 0;
+		}
+
+		case TYPE_BLOB:
+			return memcmp(value1, value2, field.length);
+	}
+
+	return 0;
+}
+
+void Format::print(ostream& out, unsigned n, const void* value) const
+{
+	const Field& field = fields[n];
+
+	switch (field.type)
+	{
+		case TYPE_SHORT:
+			printScaled(out, readValue<boost::int16_t>(value), field.scale);
+			break;
+
+		case TYPE_LONG:
+			printScaled(out, readValue<boost::int32_t>(value), field.scale);
+			break;
+
+		case TYPE_INT64:
+			printScaled(out, readValue<boost::int64_t>(value), field.scale);
+			break;
+
+		case TYPE_FLOAT:
+			out << readValue<float>(value);
+			break;
+
+		case TYPE_DOUBLE:
+			out << readValue<double>(value);
+			break;
+
+		case TYPE_DATE:
+			printDate(out, readValue<boost::int32_t>(value));
+			break;
+
+		case TYPE_TIME:
+			printTime(out, readValue<boost::uint32_t>(value));
+			break;
+
+		case TYPE_TIMESTAMP:
+			printDate(out, readValue<boost::int32_t>(value));
+			out << ' ';
+			printTime(out, readValue<boost::uint32_t>(static_cast<const char*>(value) + 4));
+			break;
+
+		case TYPE_TEXT:
+			out.write(static_cast<const char*>(value), field.length);
+			break;
+
+		case TYPE_VARYING:
+			out.write(static_cast<const char*>(value) + 2, std::min<unsigned>(
+				readValue<boost::uint16_t>(value), field.length - sizeof(boost::uint16_t)));
+			break;
+
+		case TYPE_BLOB:
+			out << readValue<boost::uint32_t>(value) << ':' <<
+				readValue<boost::uint32_t>(static_cast<const char*>(value) + 4);
+			break;
+	}
+}
+
+void Format::parse(unsigned n, const string& text, void* value) const
+{
+	const Field& field = fields[n];
+	char* p = static_cast<char*>(value);
+
+	switch (field.type)
+	{
+		case TYPE_SHORT:
+		{
+			const boost::int64_t scaled = parseScaled(text, field.scale);
+			const boost::int16_t n16 = boost::int16_t(scaled);
+
+			if (n16 != scaled)
+				throw runtime_error("Number out of range: " + text);
+
+			memcpy(p, &n16, sizeof(n16));
+			break;
+		}
+
+		case TYPE_LONG:
+		{
+			const boost::int64_t scaled = parseScaled(text, field.scale);
+			const boost::int32_t n32 = boost::int32_t(scaled);
+
+			if (n32 != scaled)
+				throw runtime_error("Number out of range: " + text);
+
+			memcpy(p, &n32, sizeof(n32));
+			break;
+		}
+
+		case TYPE_INT64:
+		{
+			const boost::int64_t n64 = parseScaled(text, field.scale);
+			memcpy(p, &n64, sizeof(n64));
+			break;
+		}
+
+		case TYPE_FLOAT:
+		{
+			const float f = float(atof(text.c_str()));
+			memcpy(p, &f, sizeof(f));
+			break;
+		}
+
+		case TYPE_DOUBLE:
+		{
+			const double d = atof(text.c_str());
+			memcpy(p, &d, sizeof(d));
+			break;
+		}
+
+		case TYPE_DATE:
+		{
+			const boost::int32_t date = parseDate(text);
+			memcpy(p, &date, sizeof(date));
+			break;
+		}
+
+		case TYPE_TIME:
+		{
+			const boost::uint32_t time = parseTime(text);
+			memcpy(p, &time, sizeof(time));
+			break;
+		}
+
+		case TYPE_TIMESTAMP:
+		{
+			const string::size_type space = text.find(' ');
+			const boost::int32_t date = parseDate(text.substr(0, space));
+			const boost::uint32_t time = space == string::npos ? 0 : parseTime(text.substr(space + 1));
+			memcpy(p, &date, sizeof(date));
+			memcpy(p + 4, &time, sizeof(time));
+			break;
+		}
+
+		case TYPE_TEXT:
+			if (text.length() > field.length)
+				throw runtime_error("Text too long for " + field.name + ": " + text);
+
+			memset(p, ' ', field.length);
+			memcpy(p, text.data(), text.length());
+			break;
+
+		case TYPE_VARYING:
+		{
+			const boost::uint16_t length = text.length();
+
+			if (length + 2u > field.length || length != text.length())
+				throw runtime_error("Text too long for " + field.name + ": " + text);
+
+			memcpy(p, &length, sizeof(length));
+			memcpy(p + 2, text.data(), length);
+			break;
+		}
+
+		case TYPE_BLOB:
+			throw runtime_error("Blob values can't be parsed: " + field.name);
+	}
+}
+
+
+//------------------------------------------------------------------------------
+
+}	// fbods
@@ -0,0 +1,108 @@
+/*
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Initial Developer of the Original Code is Adriano dos Santos Fernandes.
+ * Portions created by the Initial Developer are Copyright (C) 2012 the Initial Developer.
+ * All Rights Reserved.
+ *
+ * Contributor(s):
+ *
+ */
+
+#ifndef FBSTUFF_ODS_FORMAT_H
+#define FBSTUFF_ODS_FORMAT_H
+
+#include <ostream>
+#include <string>
+#include <vector>
+#include <boost/cstdint.hpp>
+
+namespace fbods
+{
+
+//------------------------------------------------------------------------------
+
+
+// Runtime description of a decoded record, laid out the same way the engine does: null
+// flags first (one bit per field, rounded to 32 bits) followed by the fields at their
+// natural alignment.
+class Format
+{
+public:
+	static const int MAX_SCALE = 18;	// decimal places of numeric and decimal
+
+	enum Type
+	{
+		TYPE_SHORT,
+		TYPE_LONG,
+		TYPE_INT64,
+		TYPE_FLOAT,
+		TYPE_DOUBLE,
+		TYPE_DATE,
+		TYPE_TIME,
+		TYPE_TIMESTAMP,
+		TYPE_TEXT,
+		TYPE_VARYING,
+		TYPE_BLOB
+	};
+
+	struct Field
+	{
+		std::string name;
+		Type type;
+		unsigned offset;
+		unsigned length;	// bytes used in the record, including the varying length prefix
+		int scale;
+	};
+
+public:
+	// spec is a comma separated list of "[name] type", e.g. "id integer, name varchar(20),
+	// amount numeric(18, 2), d date".
+	explicit Format(const std::string& spec);
+
+public:
+	bool isNull(const void* record, unsigned n) const
+	{
+		return (static_cast<const boost::uint8_t*>(record)[n >> 3] & (1 << (n & 7))) != 0;
+	}
+
+	const boost::uint8_t* getPointer(const void* record, unsigned n) const
+	{
+		return static_cast<const boost::uint8_t*>(record) + fields[n].offset;
+	}
+
+	// Length of the value, discounting the prefix of varying fields.
+	unsigned getValueLength(const void* record, unsigned n) const;
+
+	// Dates are days since 1858-11-17, times are 1/10000 of second since midnight.
+	static void decodeDate(boost::int32_t date, int& year, int& month, int& day);
+	static boost::int32_t encodeDate(int year, int month, int day);
+
+	// Prints an integer of the given scale, e.g. 12345 with scale -2 as 123.45.
+	static void printScaled(std::ostream& out, boost::int64_t value, int scale);
+
+	int compare(unsigned n, const void* value1, const void* value2) const;
+	void print(std::ostream& out, unsigned n, const void* value) const;
+
+	// Reads a value in the text form written by print, char values being padded with spaces.
+	void parse(unsigned n, const std::string& text, void* value) const;
+
+public:
+	std::vector<Field> fields;
+	unsigned length;
+};
+
+
+//------------------------------------------------------------------------------
+
+}	// fbods
+
+#endif	// FBSTUFF_ODS_FORMAT_H
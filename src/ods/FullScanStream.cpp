@@ -18,230 +18,104 @@
  */
 
 #include "FullScanStream.h"
-#include <map>
+#include "BufferArena.h"
+#include <cstdio>
 #include <stdexcept>
 #include <string>
-#include <boost/algorithm/string.hpp>
 
 namespace fbods
 {
 
-using std::map;
-using std::runtime_error;
-using std::string;
-
 //------------------------------------------------------------------------------
 
 
 FullScanStream::FullScanStream(Database* aDatabase, Database::RelationId aRelationId)
-	: database(aDatabase),
+	: PageListScanStream(aDatabase),
 	  relationId(aRelationId),
-	  first(true),
 	  pointerNum(0),
-	  dataNum(0)
+	  pointer(NULL)
 {
 	init();
 }
 
 FullScanStream::FullScanStream(Database* aDatabase, const char* relationName)
-	: database(aDatabase),
-	  first(true),
+	: PageListScanStream(aDatabase),
+	  relationId(aDatabase->findRelation(relationName)),
 	  pointerNum(0),
-	  dataNum(0)
+	  pointer(NULL)
 {
-	string strRelationName(relationName);
-
-	FullScanStream scan(database, Database::RELATION_ID_RELATIONS);
-
-	struct RdbRelations
-	{
-		boost::uint32_t nullFlags[1];
-		boost::uint64_t viewBlr;
-		boost::uint64_t viewSource;
-		boost::uint64_t description;
-		boost::int16_t relationId;
-		boost::int16_t systemFlag;
-		boost::int16_t dbkeyLength;
-		boost::int16_t format;
-		boost::int16_t fieldId;
-		char relationName[31];
-		char securityClass[31];
-		VarChar<255> externalFile;
-		boost::uint64_t runtime;
-		boost::uint64_t externalDescription;
-		char ownerName[31];
-		char defaultClass[31];
-		boost::int16_t flags;
-		boost::int16_t relationType;
-	} rdbRelations;
-
-	while (scan.fetch(&rdbRelations))
-	{
-		string str(rdbRelations.relationName, sizeof(rdbRelations.relationName));
-		boost::algorithm::trim(str);
-
-		if (str == strRelationName)
-		{
-			relationId = static_cast<Database::RelationId>(rdbRelations.relationId);
-			init();
-			return;
-		}
-	}
-
-	throw runtime_error(string("Relation ") + relationName + " not found");
+	init();
 }
 
 void FullScanStream::init()
 {
-	map<Database::RelationId, unsigned>::iterator it = database->relationPointer.find(relationId);
-	unsigned firstPointer;
-
-	if (it != database->relationPointer.end())
-		firstPointer = it->second;
-	else
+	if (database->queueDepth > 0 && relationId != Database::RELATION_ID_PAGES)
 	{
-		FullScanStream scan(database, Database::RELATION_ID_PAGES);
+		relation = relationId;
+		database->getDataPages(relationId, pages);
+		return;
+	}
 
-		struct RdbPages
-		{
-			boost::uint32_t nullFlags[1];
-			boost::int32_t pageNumber;
-			boost::int16_t relationId;
-			boost::int32_t pageSequence;
-			boost::int16_t pageType;
-		} rdbPages;
+	unsigned firstPointer = database->getFirstPointer(relationId);
 
-		firstPointer = 0;
+	pointer = reinterpret_cast<PointerPage*>(
+		allocateBuffer(database->header.pageSize, pointerScope));
 
-		while (scan.fetch(&rdbPages))
-		{
-			if (rdbPages.relationId == static_cast<boost::int16_t>(relationId) &&
-				rdbPages.pageType == PageHeader::TYPE_POINTER &&
-				rdbPages.pageSequence == 0)
-			{
-				firstPointer = rdbPages.pageNumber;
-				break;
-			}
-		}
+	readPointer(firstPointer);
+}
 
-		if (firstPointer == 0)
-		{
-			char s[32];
-			sprintf(s, "%d", static_cast<boost::int16_t>(relationId));
-			throw runtime_error(string("Pointer page for relation id ") + s +
-				" has not been found");
-		}
+void FullScanStream::readPointer(unsigned number)
+{
+	if (!database->readPage(number, pointer, PageHeader::TYPE_POINTER, relationId))
+	{
+		char s[32];
+		sprintf(s, "%u", number);
+		throw std::runtime_error(std::string("Pointer page ") + s + " has been released");
 	}
 
-	pointerScope.reset(new char[database->header.pageSize]);
-	dataScope.reset(new char[database->header.pageSize]);
-
-	pointer = reinterpret_cast<PointerPage*>(pointerScope.get());
-	data = reinterpret_cast<DataPage*>(dataScope.get());
-
-	database->readPage(firstPointer, pointer);
-	readPointer();
+	if (pointer->next != 0)
+		database->prefetchPage(pointer->next);
 }
 
-bool FullScanStream::fetch(void* recordBuffer)
+bool FullScanStream::readData()
 {
-	boost::uint8_t* raw = reinterpret_cast<boost::uint8_t*>(data);
-	RecordHeader* record;
+	if (!pointer)
+		return PageListScanStream::readData();
 
-	do
+	while (true)
 	{
-		if (first)
-			first = false;
-		else
-			++dataNum;
-
-		while (!(dataNum < data->count))
+		if (pointerNum < pointer->count)
 		{
-			if (++pointerNum < pointer->count)
-			{
-				dataNum = 0;
-				readPointer();
-			}
-			else if (pointer->next != 0)
-			{
-				pointerNum = 0;
-				dataNum = 0;
+			unsigned number = pointer->page[pointerNum++];
 
-				database->readPage(pointer->next, pointer);
-				readPointer();
+			// Pages released while scanning a live file are skipped.
+			if (number == 0 ||
+				!database->readPage(number, data, PageHeader::TYPE_DATA, relationId))
+			{
+				continue;
 			}
-			else
-				return false;
-		}
-
-		record = reinterpret_cast<RecordHeader*>(&raw[data->rpt[dataNum].offset]);
-	} while (record->backPage != 0 ||
-		(record->flags & (RecordHeader::FLAG_DELETED | RecordHeader::FLAG_BLOB)));
 
-	boost::uint8_t* recordStart = record->data;
-	boost::uint8_t* recordEnd = record->data + data->rpt[dataNum].length -
-		offsetof(RecordHeader, data);
+			// The page number for getPageNumber.
+			pages.assign(1, number);
+			pageNum = 1;
 
-	boost::uint8_t* pt = static_cast<boost::uint8_t*>(recordBuffer);
+			/***
+			cout << "\tpage: " << number << endl;
+			cout << "\t\ttype: " << int(data->pageHeader.type) <<
+				", sequence: " << data->sequence <<
+				", count: " << data->count << endl;
+			***/
 
-	for (const boost::uint8_t* p = recordStart; p != recordEnd;)
-	{
-		if (*p & 0x80)
-		{
-			boost::uint8_t n = -boost::int8_t(*p++);
-
-			while (n-- > 0)
-				*pt++ = *p;
-
-			++p;
+			return true;
 		}
-		else
+		else if (pointer->next != 0)
 		{
-			boost::uint8_t n = *p++;
-
-			while (n-- > 0)
-				*pt++ = *p++;
+			pointerNum = 0;
+			readPointer(pointer->next);
 		}
+		else
+			return false;
 	}
-
-	/***
-	cout << "\t\t\toffset: " << data->rpt[dataNum].offset <<
-		", length: " << data->rpt[dataNum].length <<
-		", transaction: " << record->transaction <<
-		", page: " << record->page <<
-		", line: " << record->line <<
-		", flags: " << hex << record->flags << dec <<
-		", format: " << int(record->format) <<
-		", size: " << (pt - static_cast<boost::uint8_t*>(recordBuffer)) << endl << "\t\t\t\t";
-
-	cout << hex;
-
-	for (boost::uint8_t* p = recordStart; p != recordEnd; ++p)
-		cout << " " << setw(2) << int(*p);
-
-	cout << endl << "\t\t\t\t";
-
-	for (recordEnd = pt, pt = static_cast<boost::uint8_t*>(recordBuffer); pt != recordEnd; ++pt)
-		cout << " " << setw(2) << int(*pt);
-
-	cout << dec;
-
-	cout << endl;
-	***/
-
-	return true;
-}
-
-void FullScanStream::readPointer()
-{
-	database->readPage(pointer->page[pointerNum], data);
-
-	/***
-	cout << "\tpage: " << pointer->page[pointerNum] << endl;
-	cout << "\t\ttype: " << int(data->pageHeader.type) <<
-		", sequence: " << data->sequence <<
-		", count: " << data->count << endl;
-	***/
 }
 
 
@@ -20,9 +20,7 @@
 #ifndef FBSTUFF_ODS_FULL_SCAN_STREAM_H
 #define FBSTUFF_ODS_FULL_SCAN_STREAM_H
 
-#include "Database.h"
-#include <string>
-#include <map>
+#include "PageListScanStream.h"
 #include <boost/scoped_array.hpp>
 
 namespace fbods
@@ -31,7 +29,13 @@ namespace fbods
 //------------------------------------------------------------------------------
 
 
-class FullScanStream
+// Reads the data pages of a relation along its chain of pointer pages, having the next pointer
+// page read in the background while the data pages of the current one are read. With
+// Database::queueDepth set, the data page list is resolved at once instead, see
+// Database::getDataPages, and its pages read ahead as by PageListScanStream: in physical order,
+// but returned in the order of the chain. RDB$PAGES, which the list is resolved from, is always
+// read along the chain.
+class FullScanStream : public PageListScanStream
 {
 public:
 	FullScanStream(Database* aDatabase, Database::RelationId aRelationId);
@@ -39,23 +43,16 @@ public:
 
 private:
 	void init();
+	void readPointer(unsigned number);
 
-public:
-	bool fetch(void* recordBuffer);
-
-private:
-	void readPointer();
+protected:
+	virtual bool readData();
 
 private:
-	Database* database;
 	Database::RelationId relationId;
-	bool first;
 	unsigned pointerNum;
-	unsigned dataNum;
 	boost::scoped_array<char> pointerScope;
-	boost::scoped_array<char> dataScope;
-	PointerPage* pointer;
-	DataPage* data;
+	PointerPage* pointer;	// NULL when reading the data page list
 };
 
 
@@ -0,0 +1,80 @@
+/*
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Initial Developer of the Original Code is Adriano dos Santos Fernandes.
+ * Portions created by the Initial Developer are Copyright (C) 2012 the Initial Developer.
+ * All Rights Reserved.
+ *
+ * Contributor(s):
+ *
+ */
+
+#ifndef FBSTUFF_ODS_HASH_H
+#define FBSTUFF_ODS_HASH_H
+
+#include <cstring>
+#include <boost/cstdint.hpp>
+
+namespace fbods
+{
+
+//------------------------------------------------------------------------------
+
+
+// 64-bit MurmurHash2 (MurmurHash64A).
+inline boost::uint64_t hash64(const void* key, unsigned length, boost::uint64_t seed = 0)
+{
+	const boost::uint64_t m = 0xC6A4A7935BD1E995ULL;
+	const int r = 47;
+
+	boost::uint64_t h = seed ^ (length * m);
+
+	const boost::uint8_t* p = static_cast<const boost::uint8_t*>(key);
+	const boost::uint8_t* end = p + (length & ~7u);
+
+	for (; p != end; p += 8)
+	{
+		boost::uint64_t k;
+		memcpy(&k, p, sizeof(k));
+
+		k *= m;
+		k ^= k >> r;
+		k *= m;
+
+		h ^= k;
+		h *= m;
+	}
+
+	switch (length & 7)
+	{
+		case 7: h ^= boost::uint64_t(p[6]) << 48;
+		case 6: h ^= boost::uint64_t(p[5]) << 40;
+		case 5: h ^= boost::uint64_t(p[4]) << 32;
+		case 4: h ^= boost::uint64_t(p[3]) << 24;
+		case 3: h ^= boost::uint64_t(p[2]) << 16;
+		case 2: h ^= boost::uint64_t(p[1]) << 8;
+		case 1: h ^= boost::uint64_t(p[0]);
+			h *= m;
+	}
+
+	h ^= h >> r;
+	h *= m;
+	h ^= h >> r;
+
+	return h;
+}
+
+
+//------------------------------------------------------------------------------
+
+}	// fbods
+
+#endif	// FBSTUFF_ODS_HASH_H
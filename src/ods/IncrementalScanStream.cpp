@@ -0,0 +1,361 @@
+/*
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Initial Developer of the Original Code is Adriano dos Santos Fernandes.
+ * Portions created by the Initial Developer are Copyright (C) 2012 the Initial Developer.
+ * All Rights Reserved.
+ *
+ * Contributor(s):
+ *
+ */
+
+#include "IncrementalScanStream.h"
+#include "Hash.h"
+#include "TransactionSnapshot.h"
+#include <algorithm>
+#include <cstddef>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+namespace fbods
+{
+
+using std::pair;
+using std::runtime_error;
+using std::string;
+using std::vector;
+
+//------------------------------------------------------------------------------
+
+
+// Each line has the page, its generation and sequence, and the lines and hashes of its records.
+void GenerationMap::load(const char* filename)
+{
+	std::ifstream file(filename);
+
+	if (!file)
+		return;
+
+	string text;
+
+	while (std::getline(file, text))
+	{
+		std::istringstream in(text);
+		unsigned page;
+		PageState state;
+
+		if (!(in >> page >> state.generation))
+			throw runtime_error(string("Invalid generation map ") + filename);
+
+		if (in >> state.sequence)
+		{
+			pair<unsigned, boost::uint64_t> record;
+
+			while (in >> std::dec >> record.first >> std::hex >> record.second)
+				state.records.push_back(record);
+		}
+
+		if (!in.eof())
+			throw runtime_error(string("Invalid generation map ") + filename);
+
+		PageState& saved = (*this)[page];
+		saved.generation = state.generation;
+		saved.sequence = state.sequence;
+		saved.records.swap(state.records);
+	}
+
+	if (file.bad())
+		throw runtime_error(string("Error reading ") + filename);
+}
+
+void GenerationMap::save(const char* filename) const
+{
+	string tempName = string(filename) + ".tmp";
+	FILE* file = fopen(tempName.c_str(), "w");
+
+	if (!file)
+		throw runtime_error("Cannot create " + tempName);
+
+	for (const_iterator i = begin(); i != end(); ++i)
+	{
+		const PageState& state = i->second;
+
+		fprintf(file, "%u %u %u", i->first, state.generation, state.sequence);
+
+		for (vector<pair<unsigned, boost::uint64_t> >::const_iterator j = state.records.begin();
+			 j != state.records.end();
+			 ++j)
+		{
+			fprintf(file, " %u %llx", j->first, static_cast<unsigned long long>(j->second));
+		}
+
+		fputc('\n', file);
+	}
+
+	if (fclose(file) != 0 || rename(tempName.c_str(), filename) != 0)
+		throw runtime_error(string("Cannot write ") + filename);
+}
+
+
+IncrementalScanStream::IncrementalScanStream(Database* aDatabase, const char* relationName,
+			boost::uint32_t aSinceScn, GenerationMap* aGenerations, bool aTrackRecords)
+	: PageListScanStream(aDatabase),
+	  sinceScn(aSinceScn),
+	  generations(aGenerations),
+	  trackRecords(aTrackRecords && aGenerations),
+	  watermark(aSinceScn),
+	  changedPages(0),
+	  scanned(false)
+{
+	Database::RelationId relationId = database->findRelation(relationName);
+	relation = relationId;
+	database->getDataPages(relationId, pages);
+
+	if (!trackRecords)
+		return;
+
+	// The records of the pages that left the relation are deleted.
+	vector<unsigned> current(pages);
+	std::sort(current.begin(), current.end());
+
+	for (GenerationMap::iterator i = generations->begin(); i != generations->end();)
+	{
+		if (std::binary_search(current.begin(), current.end(), i->first))
+			++i;
+		else
+		{
+			addDeleted(i->second, i->second.records.begin());
+			generations->erase(i++);
+		}
+	}
+}
+
+bool IncrementalScanStream::readData()
+{
+	while (pageNum < pages.size())
+	{
+		unsigned number = pages[pageNum++];
+		PageHeader header;
+
+		database->readPageHeader(number, &header);
+
+		if (header.scn > watermark)
+			watermark = header.scn;
+
+		bool changed = false;
+		PageState* state = NULL;
+
+		if (!generations)
+			changed = header.scn > sinceScn;
+		else
+		{
+			const std::pair<GenerationMap::iterator, bool> entry =
+				generations->insert(std::make_pair(number, PageState()));
+
+			state = &entry.first->second;
+			changed = entry.second || state->generation != header.generation;
+
+			if (!trackRecords)
+				state->generation = header.generation;
+		}
+
+		if (!changed)
+			continue;
+
+		const bool read = database->readPage(number, data, PageHeader::TYPE_DATA, relation);
+
+		if (read)
+			++changedPages;
+
+		if (trackRecords)
+		{
+			// Pages with records not yet readable keep their previous generation, or 0 when
+			// new, to be read again by the next run.
+			bool settled = true;
+			const bool left = read && compareRecords(*state, settled);
+
+			if (!read)
+			{
+				addDeleted(*state, state->records.begin());
+				state->records.clear();
+			}
+
+			if (settled)
+				state->generation = header.generation;
+
+			if (!left)
+				continue;
+		}
+
+		if (read)
+			return true;
+	}
+
+	if (trackRecords && !scanned)
+	{
+		removeMoved();
+		scanned = true;
+	}
+
+	return false;
+}
+
+// Replaces the saved records of the page read by the current ones, leaving in the data buffer
+// only the records new or changed. Returns false when there are none. Records whose version to
+// read isn't the primary one, as those of active transactions, are kept as saved and not
+// returned, and settled is cleared when that may change without the page being written.
+bool IncrementalScanStream::compareRecords(PageState& state, bool& settled)
+{
+	const unsigned pageSize = database->header.pageSize;
+	const TransactionSnapshot* snapshot = database->snapshot;
+	boost::uint8_t* raw = reinterpret_cast<boost::uint8_t*>(data);
+
+	// The record numbers change with the sequence.
+	if (state.sequence != boost::uint32_t(data->sequence))
+	{
+		addDeleted(state, state.records.begin());
+		state.records.clear();
+		state.sequence = data->sequence;
+	}
+
+	vector<pair<unsigned, boost::uint64_t> > records;
+	vector<pair<unsigned, boost::uint64_t> >::iterator old = state.records.begin();
+	bool left = false;
+
+	for (unsigned line = 0; line < data->count; ++line)
+	{
+		DataPage::Repeat& repeat = data->rpt[line];
+
+		while (old != state.records.end() && old->first < line)
+			deletedRecords.push_back(getNumber(state, (old++)->first));
+
+		const bool saved = old != state.records.end() && old->first == line;
+		const RecordHeader* record = reinterpret_cast<const RecordHeader*>(&raw[repeat.offset]);
+		const unsigned flags = record->flags;
+		bool present = false;	// a record is read from the line
+		bool primary = true;	// the version read is the primary one
+
+		// The records read are the ones of ScanStream::selectVersion.
+		if (repeat.length < offsetof(RecordHeader, data) ||
+			repeat.offset + repeat.length > pageSize ||
+			database->getRecordData(record) > raw + repeat.offset + repeat.length)
+		{
+		}
+		else if (snapshot)
+		{
+			const unsigned skipped = RecordHeader::FLAG_BLOB | RecordHeader::FLAG_CHAIN |
+				RecordHeader::FLAG_FRAGMENT;
+
+			present = !(flags & (skipped | RecordHeader::FLAG_DELETED));
+			primary = (flags & skipped) ||
+				snapshot->isVisible(database->getRecordTransaction(record));
+		}
+		else
+		{
+			present = !(flags & (RecordHeader::FLAG_DELETED | RecordHeader::FLAG_BLOB));
+			primary = !present || record->backPage == 0;
+		}
+
+		if (!primary)
+		{
+			if (saved)
+				records.push_back(*old++);
+
+			// Without a snapshot these are the records with back versions, and their page is
+			// written again when these are removed.
+			repeat.length = 0;
+			settled = settled && !snapshot;
+			continue;
+		}
+
+		if (!present)
+		{
+			if (saved)
+				deletedRecords.push_back(getNumber(state, (old++)->first));
+
+			continue;
+		}
+
+		// The data of incomplete records continues in fragments, so these are compared with their
+		// header, which has the transaction that wrote them.
+		const boost::uint8_t* recordData = database->getRecordData(record);
+		const boost::uint64_t hash = (flags & RecordHeader::FLAG_INCOMPLETE) ?
+			hash64(record, repeat.length) :
+			hash64(recordData, raw + repeat.offset + repeat.length - recordData, record->format);
+
+		records.push_back(std::make_pair(line, hash));
+
+		if (saved && (old++)->second == hash)
+			repeat.length = 0;
+		else
+			left = true;
+	}
+
+	addDeleted(state, old);
+	state.records.swap(records);
+
+	return left;
+}
+
+void IncrementalScanStream::addDeleted(const PageState& state,
+	vector<pair<unsigned, boost::uint64_t> >::const_iterator first)
+{
+	for (; first != state.records.end(); ++first)
+		deletedRecords.push_back(getNumber(state, first->first));
+}
+
+// A record number may be deleted from a page and be found in another one, when the sequence of
+// pages changed. These are not deleted.
+void IncrementalScanStream::removeMoved()
+{
+	std::sort(deletedRecords.begin(), deletedRecords.end());
+	deletedRecords.erase(std::unique(deletedRecords.begin(), deletedRecords.end()),
+		deletedRecords.end());
+
+	if (deletedRecords.empty())
+		return;
+
+	vector<bool> found(deletedRecords.size());
+
+	for (GenerationMap::const_iterator i = generations->begin(); i != generations->end(); ++i)
+	{
+		const PageState& state = i->second;
+
+		for (vector<pair<unsigned, boost::uint64_t> >::const_iterator j = state.records.begin();
+			 j != state.records.end();
+			 ++j)
+		{
+			vector<boost::uint64_t>::iterator record = std::lower_bound(deletedRecords.begin(),
+				deletedRecords.end(), getNumber(state, j->first));
+
+			if (record != deletedRecords.end() && *record == getNumber(state, j->first))
+				found[record - deletedRecords.begin()] = true;
+		}
+	}
+
+	vector<boost::uint64_t>::iterator out = deletedRecords.begin();
+
+	for (unsigned i = 0; i < found.size(); ++i)
+	{
+		if (!found[i])
+			*out++ = deletedRecords[i];
+	}
+
+	deletedRecords.erase(out, deletedRecords.end());
+}
+
+
+//------------------------------------------------------------------------------
+
+}	// fbods
@@ -0,0 +1,137 @@
+/*
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Initial Developer of the Original Code is Adriano dos Santos Fernandes.
+ * Portions created by the Initial Developer are Copyright (C) 2012 the Initial Developer.
+ * All Rights Reserved.
+ *
+ * Contributor(s):
+ *
+ */
+
+#ifndef FBSTUFF_ODS_INCREMENTAL_SCAN_STREAM_H
+#define FBSTUFF_ODS_INCREMENTAL_SCAN_STREAM_H
+
+#include "PageListScanStream.h"
+#include <map>
+#include <utility>
+#include <vector>
+#include <boost/cstdint.hpp>
+
+namespace fbods
+{
+
+//------------------------------------------------------------------------------
+
+
+// State of a data page when it was last read.
+struct PageState
+{
+	PageState()
+		: generation(0),
+		  sequence(0)
+	{
+	}
+
+	boost::uint32_t generation;
+	boost::uint32_t sequence;
+
+	// Line -> hash of the record, in line order. Only kept by the scans tracking records.
+	std::vector<std::pair<unsigned, boost::uint64_t> > records;
+};
+
+// Page number -> state of the page when it was last read.
+class GenerationMap : public std::map<unsigned, PageState>
+{
+public:
+	// A missing file is loaded as an empty map.
+	void load(const char* filename);
+	void save(const char* filename) const;
+};
+
+// Reads only the data pages of a relation changed since a previous run. Without a generation
+// map, a page is changed when its SCN is greater than the given one. With a map, when its
+// generation differs from the saved one. The SCN is only bumped by nbackup, so the map is what
+// detects changes between copies taken at the same backup level.
+//
+// Only the page headers are read to decide if a page changed. The map, when given, is updated
+// with the current generations of all relation data pages.
+//
+// All records of the changed pages are returned, unless records are tracked. The map then also
+// keeps a hash of each record, and only the records new or different from the saved ones are
+// returned. The records no longer found, in the changed pages or in the pages that left the
+// relation, are listed by getDeletedRecords once the scan ends, and these pages are removed
+// from the map.
+class IncrementalScanStream : public PageListScanStream
+{
+public:
+	IncrementalScanStream(Database* aDatabase, const char* relationName,
+		boost::uint32_t aSinceScn, GenerationMap* aGenerations = NULL, bool aTrackRecords = false);
+
+public:
+	// Highest SCN of the pages visited so far, to be passed to the next run.
+	boost::uint32_t getWatermark() const
+	{
+		return watermark;
+	}
+
+	unsigned getTotalPages() const
+	{
+		return pages.size();
+	}
+
+	// Data pages of the relation, changed or not.
+	const std::vector<unsigned>& getPages() const
+	{
+		return pages;
+	}
+
+	unsigned getChangedPages() const
+	{
+		return changedPages;
+	}
+
+	// Numbers of the records deleted, in order.
+	const std::vector<boost::uint64_t>& getDeletedRecords() const
+	{
+		return deletedRecords;
+	}
+
+protected:
+	virtual bool readData();
+
+private:
+	bool compareRecords(PageState& state, bool& settled);
+	void addDeleted(const PageState& state,
+		std::vector<std::pair<unsigned, boost::uint64_t> >::const_iterator first);
+	void removeMoved();
+
+	boost::uint64_t getNumber(const PageState& state, unsigned line) const
+	{
+		return boost::uint64_t(state.sequence) * database->getMaxRecords() + line;
+	}
+
+private:
+	boost::uint32_t sinceScn;
+	GenerationMap* generations;
+	bool trackRecords;
+	boost::uint32_t watermark;
+	unsigned changedPages;
+	std::vector<boost::uint64_t> deletedRecords;
+	bool scanned;
+};
+
+
+//------------------------------------------------------------------------------
+
+}	// fbods
+
+#endif	// FBSTUFF_ODS_INCREMENTAL_SCAN_STREAM_H
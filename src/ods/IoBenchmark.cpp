@@ -0,0 +1,96 @@
+/*
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Initial Developer of the Original Code is Adriano dos Santos Fernandes.
+ * Portions created by the Initial Developer are Copyright (C) 2012 the Initial Developer.
+ * All Rights Reserved.
+ *
+ * Contributor(s):
+ *
+ */
+
+#include "IoBenchmark.h"
+#include "PageSweep.h"
+#include <ctime>
+#include <vector>
+
+namespace fbods
+{
+
+using std::vector;
+
+//------------------------------------------------------------------------------
+
+
+namespace
+{
+	class CountVisitor : public PageVisitor
+	{
+	public:
+		CountVisitor()
+			: pages(0)
+		{
+		}
+
+		virtual void visit(unsigned /*number*/, const PageHeader* /*page*/)
+		{
+			++pages;
+		}
+
+	public:
+		unsigned pages;
+	};
+
+	double now()
+	{
+		timespec monotonic;
+		clock_gettime(CLOCK_MONOTONIC, &monotonic);
+		return monotonic.tv_sec + monotonic.tv_nsec / 1e9;
+	}
+}	// namespace
+
+
+IoBenchmarkResult runIoBenchmark(Database* database, bool direct, unsigned threads,
+	unsigned chunkPages)
+{
+	if (threads == 0)
+		threads = 1;
+
+	database->setDirectIo(direct);
+
+	IoBenchmarkResult result;
+	result.direct = direct;
+	result.cachedBefore = database->getCachedPages();
+
+	vector<CountVisitor> counters(threads);
+	vector<PageVisitor*> visitors;
+
+	for (unsigned i = 0; i < threads; ++i)
+		visitors.push_back(&counters[i]);
+
+	double start = now();
+	sweepPages(database, visitors, chunkPages);
+	result.seconds = now() - start;
+
+	result.pages = 0;
+
+	for (unsigned i = 0; i < threads; ++i)
+		result.pages += counters[i].pages;
+
+	result.cachedAfter = database->getCachedPages();
+
+	return result;
+}
+
+
+//------------------------------------------------------------------------------
+
+}	// fbods
@@ -0,0 +1,57 @@
+/*
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Initial Developer of the Original Code is Adriano dos Santos Fernandes.
+ * Portions created by the Initial Developer are Copyright (C) 2012 the Initial Developer.
+ * All Rights Reserved.
+ *
+ * Contributor(s):
+ *
+ */
+
+#ifndef FBSTUFF_ODS_IO_BENCHMARK_H
+#define FBSTUFF_ODS_IO_BENCHMARK_H
+
+#include "Database.h"
+#include <boost/cstdint.hpp>
+
+namespace fbods
+{
+
+//------------------------------------------------------------------------------
+
+
+// Throughput of a sweep over the whole file and its effect on the OS page cache, where the
+// pages cached before the sweep are the ones a server in the same host would hit.
+struct IoBenchmarkResult
+{
+	bool direct;
+	unsigned pages;
+	double seconds;
+	unsigned cachedBefore;
+	unsigned cachedAfter;
+
+	double getMegabytesPerSecond(unsigned pageSize) const
+	{
+		return seconds > 0 ? double(pages) * pageSize / (1024 * 1024) / seconds : 0;
+	}
+};
+
+// Sweeps the file with direct or buffered reads, leaving the database in the given mode.
+IoBenchmarkResult runIoBenchmark(Database* database, bool direct, unsigned threads,
+	unsigned chunkPages);
+
+
+//------------------------------------------------------------------------------
+
+}	// fbods
+
+#endif	// FBSTUFF_ODS_IO_BENCHMARK_H
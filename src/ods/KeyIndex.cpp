@@ -0,0 +1,1006 @@
+/*
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Initial Developer of the Original Code is Adriano dos Santos Fernandes.
+ * Portions created by the Initial Developer are Copyright (C) 2012 the Initial Developer.
+ * All Rights Reserved.
+ *
+ * Contributor(s):
+ *
+ */
+
+#include "KeyIndex.h"
+#include "BufferArena.h"
+#include "RecordView.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <queue>
+#include <stdexcept>
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace fbods
+{
+
+using std::runtime_error;
+using std::string;
+using std::vector;
+
+//------------------------------------------------------------------------------
+
+
+namespace
+{
+	const char MAGIC[8] = {'F', 'B', 'O', 'D', 'S', 'K', 'E', 'Y'};
+
+	// Of the block directory in the file, for its 64-bit offsets.
+	const unsigned DIRECTORY_ALIGNMENT = 8;
+
+	// Lower bound of the memory of each worker, which also bounds the number of runs merged.
+	const size_t MIN_WORKER_MEMORY = 4 * 1024 * 1024;
+
+	// Size of the run entries: key length, key, page and record number.
+	const unsigned RUN_OVERHEAD = sizeof(boost::uint16_t) + sizeof(boost::uint32_t) +
+		sizeof(boost::uint64_t);
+
+	template <typename T>
+	void appendBigEndian(string& key, T value)
+	{
+		for (int shift = (sizeof(T) - 1) * 8; shift >= 0; shift -= 8)
+			key += char(boost::uint8_t(value >> shift));
+	}
+
+	void appendVarint(string& out, boost::uint64_t value)
+	{
+		while (value >= 0x80)
+		{
+			out += char(boost::uint8_t(value) | 0x80);
+			value >>= 7;
+		}
+
+		out += char(value);
+	}
+
+	boost::uint64_t readVarint(const boost::uint8_t*& p, const boost::uint8_t* end)
+	{
+		boost::uint64_t value = 0;
+
+		for (unsigned shift = 0; ; shift += 7)
+		{
+			if (p == end || shift >= 64)
+				throw runtime_error("Damaged key index block");
+
+			const boost::uint8_t byte = *p++;
+			value |= boost::uint64_t(byte & 0x7F) << shift;
+
+			if (!(byte & 0x80))
+				return value;
+		}
+	}
+
+	int compareKeys(const char* key1, unsigned length1, const char* key2, unsigned length2)
+	{
+		const int n = memcmp(key1, key2, std::min(length1, length2));
+		return n != 0 ? n : length1 < length2 ? -1 : length1 > length2 ? 1 : 0;
+	}
+
+	void writeFile(FILE* file, const void* data, size_t length, const string& filename)
+	{
+		if (length != 0 && fwrite(data, 1, length, file) != length)
+			throw runtime_error("Error writing " + filename);
+	}
+
+	// Sorted entries, in memory or in a spill file, read in order by the merge.
+	class Run
+	{
+	public:
+		virtual ~Run()
+		{
+		}
+
+	public:
+		virtual bool next() = 0;
+
+	public:
+		const char* key;
+		unsigned keyLength;
+		boost::uint32_t page;
+		boost::uint64_t recordNumber;
+	};
+
+	// Entries serialized one after the other in an arena, as in the spill files.
+	class MemoryRun : public Run
+	{
+	public:
+		MemoryRun(const vector<char>& aArena, const vector<size_t>& aOffsets)
+			: arena(aArena),
+			  offsets(aOffsets),
+			  position(0)
+		{
+		}
+
+	public:
+		virtual bool next()
+		{
+			if (position == offsets.size())
+				return false;
+
+			const char* p = &arena[offsets[position++]];
+			boost::uint16_t length;
+
+			memcpy(&length, p, sizeof(length));
+			key = p + sizeof(length);
+			keyLength = length;
+			memcpy(&page, key + length, sizeof(page));
+			memcpy(&recordNumber, key + length + sizeof(page), sizeof(recordNumber));
+
+			return true;
+		}
+
+	private:
+		const vector<char>& arena;
+		const vector<size_t>& offsets;
+		size_t position;
+	};
+
+	class FileRun : public Run
+	{
+	public:
+		static const unsigned BUFFER_SIZE = 64 * 1024;
+
+	public:
+		explicit FileRun(const string& aFilename)
+			: filename(aFilename),
+			  file(fopen(aFilename.c_str(), "rb")),
+			  buffer(BUFFER_SIZE)
+		{
+			if (!file)
+				throw runtime_error("Cannot open " + filename);
+
+			setvbuf(file, &buffer.front(), _IOFBF, buffer.size());
+		}
+
+		virtual ~FileRun()
+		{
+			fclose(file);
+		}
+
+	public:
+		virtual bool next()
+		{
+			boost::uint16_t length;
+
+			if (fread(&length, sizeof(length), 1, file) != 1)
+			{
+				if (ferror(file))
+					throw runtime_error("Error reading " + filename);
+
+				return false;
+			}
+
+			keyBuffer.resize(length);
+
+			if ((length != 0 && fread(&keyBuffer[0], length, 1, file) != 1) ||
+				fread(&page, sizeof(page), 1, file) != 1 ||
+				fread(&recordNumber, sizeof(recordNumber), 1, file) != 1)
+			{
+				throw runtime_error("Error reading " + filename);
+			}
+
+			key = keyBuffer.data();
+			keyLength = length;
+
+			return true;
+		}
+
+	private:
+		string filename;
+		FILE* file;
+		vector<char> buffer;
+		string keyBuffer;
+	};
+
+	struct RunGreater
+	{
+		bool operator ()(const Run* run1, const Run* run2) const
+		{
+			const int n = compareKeys(run1->key, run1->keyLength, run2->key, run2->keyLength);
+			return n != 0 ? n > 0 : run1->recordNumber > run2->recordNumber;
+		}
+	};
+
+	struct ArenaLess
+	{
+		explicit ArenaLess(const vector<char>& aArena)
+			: arena(aArena)
+		{
+		}
+
+		bool operator ()(size_t offset1, size_t offset2) const
+		{
+			const char* p1 = &arena[offset1];
+			const char* p2 = &arena[offset2];
+			boost::uint16_t length1, length2;
+
+			memcpy(&length1, p1, sizeof(length1));
+			memcpy(&length2, p2, sizeof(length2));
+
+			const int n = compareKeys(p1 + sizeof(length1), length1, p2 + sizeof(length2), length2);
+
+			if (n != 0)
+				return n < 0;
+
+			boost::uint64_t recordNumber1, recordNumber2;
+			memcpy(&recordNumber1, p1 + RUN_OVERHEAD - sizeof(recordNumber1) + length1,
+				sizeof(recordNumber1));
+			memcpy(&recordNumber2, p2 + RUN_OVERHEAD - sizeof(recordNumber2) + length2,
+				sizeof(recordNumber2));
+
+			return recordNumber1 < recordNumber2;
+		}
+
+		const vector<char>& arena;
+	};
+
+	// Collects the entries of a slice of the data pages.
+	struct Worker
+	{
+		Worker(Database* aDatabase, int aRelation, const unsigned* aBegin, const unsigned* aEnd,
+				const KeyEncoder* aEncoder, KeyIndexSorter* aSorter)
+			: database(aDatabase),
+			  relation(aRelation),
+			  begin(aBegin),
+			  end(aEnd),
+			  encoder(aEncoder),
+			  sorter(aSorter)
+		{
+		}
+
+		void run(unsigned worker)
+		{
+			try
+			{
+				WorkerPlacement placement(database, worker);
+				PageListScanStream scan(database, begin, end, relation);
+				RecordView view(encoder->format);
+				string key;
+
+				while (scan.fetch(view))
+				{
+					key.clear();
+					encoder->encode(view, key);
+					sorter->add(key, scan.getPageNumber(), scan.getRecordNumber());
+				}
+
+				sorter->sort();
+			}
+			catch (const std::exception& e)
+			{
+				error = e.what();
+			}
+		}
+
+		Database* database;
+		int relation;
+		const unsigned* begin;
+		const unsigned* end;
+		const KeyEncoder* encoder;
+		KeyIndexSorter* sorter;
+		string error;
+	};
+
+	// Writes the front coded blocks and collects the directory.
+	class BlockWriter
+	{
+	public:
+		BlockWriter(FILE* aFile, const string& aFilename, boost::uint64_t aOffset)
+			: offset(aOffset),
+			  file(aFile),
+			  filename(aFilename),
+			  blockEntries(0)
+		{
+		}
+
+	public:
+		void add(const char* key, unsigned keyLength, boost::uint32_t page,
+			boost::uint64_t recordNumber)
+		{
+			if (block.length() >= KeyIndexHeader::BLOCK_LENGTH)
+				flush();
+
+			unsigned shared = 0;
+
+			if (blockEntries == 0)
+			{
+				KeyIndexBlock entry;
+				entry.offset = offset;
+				entry.keyOffset = firstKeys.length();
+				entry.keyLength = keyLength;
+				directory.push_back(entry);
+				firstKeys.append(key, keyLength);
+			}
+			else
+			{
+				const unsigned limit = std::min<unsigned>(keyLength, previous.length());
+
+				while (shared < limit && previous[shared] == key[shared])
+					++shared;
+			}
+
+			appendVarint(block, shared);
+			appendVarint(block, keyLength - shared);
+			block.append(key + shared, keyLength - shared);
+			appendVarint(block, page);
+			appendVarint(block, recordNumber);
+
+			previous.assign(key, keyLength);
+			++blockEntries;
+		}
+
+		void flush()
+		{
+			if (blockEntries == 0)
+				return;
+
+			writeFile(file, block.data(), block.length(), filename);
+
+			directory.back().length = block.length();
+			directory.back().entries = blockEntries;
+			offset += block.length();
+
+			block.clear();
+			blockEntries = 0;
+		}
+
+	public:
+		vector<KeyIndexBlock> directory;
+		string firstKeys;
+		boost::uint64_t offset;
+
+	private:
+		FILE* file;
+		string filename;
+		string block;
+		string previous;
+		unsigned blockEntries;
+	};
+
+}	// namespace
+
+
+KeyEncoder::KeyEncoder(const Format* aFormat, const vector<unsigned>& aFields)
+	: format(aFormat),
+	  fields(aFields)
+{
+	for (vector<unsigned>::const_iterator i = fields.begin(); i != fields.end(); ++i)
+	{
+		if (*i >= format->fields.size())
+			throw runtime_error("Invalid key field");
+
+		if (format->fields[*i].type == Format::TYPE_BLOB)
+			throw runtime_error("Blob fields can't be keys: " + format->fields[*i].name);
+	}
+}
+
+void KeyEncoder::encode(const void* record, string& key) const
+{
+	for (vector<unsigned>::const_iterator i = fields.begin(); i != fields.end(); ++i)
+	{
+		if (format->isNull(record, *i))
+			key += '\0';
+		else
+			encodeValue(*i, format->getPointer(record, *i), key);
+	}
+}
+
+void KeyEncoder::encode(RecordView& view, string& key) const
+{
+	for (vector<unsigned>::const_iterator i = fields.begin(); i != fields.end(); ++i)
+	{
+		if (view.isNull(*i))
+			key += '\0';
+		else
+			encodeValue(*i, view.getPointer(*i), key);
+	}
+}
+
+void KeyEncoder::encodeValue(unsigned n, const boost::uint8_t* value, string& key) const
+{
+	const Format::Field& field = format->fields[n];
+
+	key += '\1';
+
+	switch (field.type)
+	{
+		case Format::TYPE_SHORT:
+		{
+			boost::uint16_t v;
+			memcpy(&v, value, sizeof(v));
+			appendBigEndian(key, boost::uint16_t(v ^ 0x8000));
+			break;
+		}
+
+		case Format::TYPE_LONG:
+		case Format::TYPE_DATE:
+		{
+			boost::uint32_t v;
+			memcpy(&v, value, sizeof(v));
+			appendBigEndian(key, v ^ 0x80000000u);
+			break;
+		}
+
+		case Format::TYPE_INT64:
+		{
+			boost::uint64_t v;
+			memcpy(&v, value, sizeof(v));
+			appendBigEndian(key, v ^ 0x8000000000000000ULL);
+			break;
+		}
+
+		// Negative numbers have all the bits inverted, positive ones just the sign.
+		case Format::TYPE_FLOAT:
+		{
+			boost::uint32_t v;
+			memcpy(&v, value, sizeof(v));
+			appendBigEndian(key, (v & 0x80000000u) ? ~v : v ^ 0x80000000u);
+			break;
+		}
+
+		case Format::TYPE_DOUBLE:
+		{
+			boost::uint64_t v;
+			memcpy(&v, value, sizeof(v));
+			appendBigEndian(key, (v & 0x8000000000000000ULL) ? ~v : v ^ 0x8000000000000000ULL);
+			break;
+		}
+
+		case Format::TYPE_TIME:
+		{
+			boost::uint32_t v;
+			memcpy(&v, value, sizeof(v));
+			appendBigEndian(key, v);
+			break;
+		}
+
+		case Format::TYPE_TIMESTAMP:
+		{
+			boost::uint32_t date, time;
+			memcpy(&date, value, sizeof(date));
+			memcpy(&time, value + 4, sizeof(time));
+			appendBigEndian(key, date ^ 0x80000000u);
+			appendBigEndian(key, time);
+			break;
+		}
+
+		case Format::TYPE_TEXT:
+			key.append(reinterpret_cast<const char*>(value), field.length);
+			break;
+
+		case Format::TYPE_VARYING:
+		{
+			boost::uint16_t length;
+			memcpy(&length, value, sizeof(length));
+
+			// Damaged records may have lengths past the field.
+			const boost::uint8_t* const end = value + 2 +
+				std::min<unsigned>(length, field.length - sizeof(length));
+
+			for (const boost::uint8_t* p = value + 2; p != end; ++p)
+			{
+				key += char(*p);
+
+				if (*p == 0)
+					key += '\xFF';
+			}
+
+			key += '\0';
+			key += '\0';
+			break;
+		}
+
+		case Format::TYPE_BLOB:
+			break;
+	}
+}
+
+
+KeyIndex::KeyIndex(const char* filename)
+	: header(NULL),
+	  base(NULL),
+	  size(0),
+	  directory(NULL)
+{
+	const int handle = open(filename, O_RDONLY);
+
+	if (handle < 0)
+		throw runtime_error(string("Cannot open ") + filename);
+
+	struct stat st;
+
+	if (fstat(handle, &st) != 0 || size_t(st.st_size) < sizeof(KeyIndexHeader))
+	{
+		close(handle);
+		throw runtime_error(string("Invalid key index ") + filename);
+	}
+
+	size = st.st_size;
+	void* address = mmap(NULL, size, PROT_READ, MAP_SHARED, handle, 0);
+	close(handle);
+
+	if (address == MAP_FAILED)
+		throw runtime_error(string("Cannot map ") + filename);
+
+	base = static_cast<const char*>(address);
+	header = reinterpret_cast<const KeyIndexHeader*>(base);
+	directory = reinterpret_cast<const KeyIndexBlock*>(base + header->directoryOffset);
+
+	if (!isValid())
+	{
+		munmap(const_cast<char*>(base), size);
+		throw runtime_error(string("Invalid key index ") + filename);
+	}
+
+	const char* specs = base + sizeof(KeyIndexHeader);
+	formatSpec.assign(specs, header->formatLength);
+	keySpec.assign(specs + header->formatLength, header->keyLength);
+
+	// Blocks are read at random.
+	madvise(const_cast<char*>(base), size, MADV_RANDOM);
+}
+
+KeyIndex::~KeyIndex()
+{
+	munmap(const_cast<char*>(base), size);
+}
+
+// Checks the header and the directory against the file size, so lookups stay in the file.
+bool KeyIndex::isValid() const
+{
+	const boost::uint64_t dataOffset = boost::uint64_t(sizeof(KeyIndexHeader)) +
+		header->formatLength + header->keyLength;
+
+	if (memcmp(header->magic, MAGIC, sizeof(MAGIC)) != 0 ||
+		header->version != KeyIndexHeader::VERSION ||
+		dataOffset > header->directoryOffset ||
+		header->directoryOffset % DIRECTORY_ALIGNMENT != 0 ||
+		header->directoryOffset > size ||
+		header->blocks > (size - header->directoryOffset) / sizeof(KeyIndexBlock) ||
+		header->keysOffset < header->directoryOffset + header->blocks * sizeof(KeyIndexBlock) ||
+		header->keysOffset > size)
+	{
+		return false;
+	}
+
+	const boost::uint64_t keysLength = size - header->keysOffset;
+	boost::uint64_t blockEnd = dataOffset;
+
+	// Blocks follow each other, each one with at least an entry.
+	for (unsigned n = 0; n < header->blocks; ++n)
+	{
+		const KeyIndexBlock& block = directory[n];
+
+		if (block.offset != blockEnd ||
+			block.length > header->directoryOffset - block.offset ||
+			block.entries == 0 ||
+			block.keyOffset > keysLength ||
+			block.keyLength > keysLength - block.keyOffset)
+		{
+			return false;
+		}
+
+		blockEnd = block.offset + block.length;
+	}
+
+	return header->directoryOffset - blockEnd < DIRECTORY_ALIGNMENT;
+}
+
+void KeyIndex::check(Database* database) const
+{
+	if (header->databasePages != database->getPageCount() ||
+		header->headerGeneration != database->header.pageHeader.generation ||
+		header->nextTransaction != database->transactions.next)
+	{
+		throw runtime_error("The key index was built from another state of the database");
+	}
+}
+
+void KeyIndex::find(const string& key, vector<KeyIndexEntry>& entries) const
+{
+	const char* keys = base + header->keysOffset;
+
+	// First block starting at or after the key. Entries with the key may also be at the
+	// end of the previous one.
+	unsigned low = 0;
+	unsigned high = header->blocks;
+
+	while (low < high)
+	{
+		const unsigned middle = (low + high) / 2;
+		const KeyIndexBlock& block = directory[middle];
+
+		if (compareKeys(keys + block.keyOffset, block.keyLength, key.data(), key.length()) < 0)
+			low = middle + 1;
+		else
+			high = middle;
+	}
+
+	string current;
+
+	for (unsigned n = (low == 0 ? 0 : low - 1); n < header->blocks; ++n)
+	{
+		const KeyIndexBlock& block = directory[n];
+
+		if (n != low - 1 &&
+			compareKeys(keys + block.keyOffset, block.keyLength, key.data(), key.length()) > 0)
+		{
+			break;
+		}
+
+		const boost::uint8_t* p = reinterpret_cast<const boost::uint8_t*>(base + block.offset);
+		const boost::uint8_t* const end = p + block.length;
+
+		for (unsigned i = 0; i < block.entries; ++i)
+		{
+			const boost::uint64_t shared = readVarint(p, end);
+			const boost::uint64_t rest = readVarint(p, end);
+
+			if (shared > current.length() || rest > boost::uint64_t(end - p))
+				throw runtime_error("Damaged key index block");
+
+			current.resize(shared);
+			current.append(reinterpret_cast<const char*>(p), rest);
+			p += rest;
+
+			const unsigned page = readVarint(p, end);
+			const boost::uint64_t recordNumber = readVarint(p, end);
+			const int order = compareKeys(current.data(), current.length(), key.data(),
+				key.length());
+
+			if (order == 0)
+				entries.push_back(KeyIndexEntry(page, recordNumber));
+			else if (order > 0)
+				return;
+		}
+	}
+}
+
+
+KeyIndexScanStream::KeyIndexScanStream(Database* aDatabase, Database::RelationId relationId,
+			const vector<KeyIndexEntry>& aEntries)
+	: PageListScanStream(aDatabase),
+	  entries(aEntries),
+	  entryNum(0),
+	  aheadNum(0)
+{
+	relation = relationId;
+
+	for (vector<KeyIndexEntry>::const_iterator i = entries.begin(); i != entries.end(); ++i)
+	{
+		if (pages.empty() || pages.back() != i->page)
+			pages.push_back(i->page);
+	}
+}
+
+// Lines not looked up are cleared, so the scan skips them as empty. Half of the queue is left
+// for the back versions.
+bool KeyIndexScanStream::readData()
+{
+	const DataPage* page = NULL;
+
+	while (!page && pageNum < pages.size())
+	{
+		for (; aheadNum < pages.size() && aheadNum < pageNum + database->queueDepth / 2; ++aheadNum)
+		{
+			if (!queuePage(pages[aheadNum]))
+				break;
+		}
+
+		page = fetchPage(pages[pageNum++], relation);
+	}
+
+	if (!page)
+		return false;
+
+	memcpy(data, page, database->header.pageSize);
+
+	const unsigned number = getPageNumber();
+	const unsigned maxRecords = database->getMaxRecords();
+	const boost::uint64_t first = boost::uint64_t(data->sequence) * maxRecords;
+
+	while (entryNum < entries.size() && entries[entryNum].page < number)
+		++entryNum;
+
+	size_t n = entryNum;
+
+	for (unsigned line = 0; line < data->count; ++line)
+	{
+		while (n < entries.size() && entries[n].page == number &&
+			   entries[n].recordNumber < first + line)
+		{
+			++n;
+		}
+
+		if (!(n < entries.size() && entries[n].page == number &&
+			  entries[n].recordNumber == first + line))
+		{
+			data->rpt[line].length = 0;
+		}
+	}
+
+	return true;
+}
+
+
+KeyIndexSorter::KeyIndexSorter(const string& aRunName, size_t aMemory)
+	: runName(aRunName),
+	  memory(aMemory)
+{
+}
+
+void KeyIndexSorter::add(const string& key, unsigned page, boost::uint64_t recordNumber)
+{
+	if (key.length() > 0xFFFF)
+		throw runtime_error("Key longer than 65535 bytes");
+
+	const boost::uint16_t length = key.length();
+	const boost::uint32_t page32 = page;
+
+	offsets.push_back(arena.size());
+	arena.insert(arena.end(), reinterpret_cast<const char*>(&length),
+		reinterpret_cast<const char*>(&length) + sizeof(length));
+	arena.insert(arena.end(), key.begin(), key.end());
+	arena.insert(arena.end(), reinterpret_cast<const char*>(&page32),
+		reinterpret_cast<const char*>(&page32) + sizeof(page32));
+	arena.insert(arena.end(), reinterpret_cast<const char*>(&recordNumber),
+		reinterpret_cast<const char*>(&recordNumber) + sizeof(recordNumber));
+
+	if (arena.size() + offsets.size() * sizeof(size_t) >= memory)
+		spill();
+}
+
+void KeyIndexSorter::sort()
+{
+	std::sort(offsets.begin(), offsets.end(), ArenaLess(arena));
+}
+
+void KeyIndexSorter::removeRuns()
+{
+	for (vector<string>::const_iterator i = runFiles.begin(); i != runFiles.end(); ++i)
+		unlink(i->c_str());
+}
+
+void KeyIndexSorter::spill()
+{
+	sort();
+
+	char s[16];
+	sprintf(s, ".%u", unsigned(runFiles.size()));
+	runFiles.push_back(runName + s);
+
+	FILE* file = fopen(runFiles.back().c_str(), "wb");
+
+	if (!file)
+		throw runtime_error("Cannot create " + runFiles.back());
+
+	try
+	{
+		for (vector<size_t>::const_iterator i = offsets.begin(); i != offsets.end(); ++i)
+		{
+			boost::uint16_t length;
+			memcpy(&length, &arena[*i], sizeof(length));
+			writeFile(file, &arena[*i], RUN_OVERHEAD + length, runFiles.back());
+		}
+	}
+	catch (...)
+	{
+		fclose(file);
+		throw;
+	}
+
+	if (fclose(file) != 0)
+		throw runtime_error("Error writing " + runFiles.back());
+
+	arena.clear();
+	offsets.clear();
+}
+
+
+boost::uint64_t writeKeyIndex(KeyIndexHeader header, vector<KeyIndexSorter>& sorters,
+	const string& formatSpec, const string& keySpec, const string& filename)
+{
+	vector<Run*> runs;
+	std::priority_queue<Run*, vector<Run*>, RunGreater> queue;
+	FILE* file = NULL;
+
+	memcpy(header.magic, MAGIC, sizeof(header.magic));
+	header.version = KeyIndexHeader::VERSION;
+	header.blockLength = KeyIndexHeader::BLOCK_LENGTH;
+	header.entries = 0;
+	header.formatLength = formatSpec.length();
+	header.keyLength = keySpec.length();
+
+	try
+	{
+		for (vector<KeyIndexSorter>::iterator i = sorters.begin(); i != sorters.end(); ++i)
+		{
+			for (vector<string>::const_iterator j = i->runFiles.begin(); j != i->runFiles.end(); ++j)
+				runs.push_back(new FileRun(*j));
+
+			runs.push_back(new MemoryRun(i->arena, i->offsets));
+		}
+
+		for (vector<Run*>::iterator i = runs.begin(); i != runs.end(); ++i)
+		{
+			if ((*i)->next())
+				queue.push(*i);
+		}
+
+		file = fopen(filename.c_str(), "wb");
+
+		if (!file)
+			throw runtime_error("Cannot create " + filename);
+
+		writeFile(file, &header, sizeof(header), filename);
+		writeFile(file, formatSpec.data(), formatSpec.length(), filename);
+		writeFile(file, keySpec.data(), keySpec.length(), filename);
+
+		BlockWriter writer(file, filename,
+			sizeof(header) + formatSpec.length() + keySpec.length());
+
+		while (!queue.empty())
+		{
+			Run* run = queue.top();
+			queue.pop();
+
+			writer.add(run->key, run->keyLength, run->page, run->recordNumber);
+			++header.entries;
+
+			if (run->next())
+				queue.push(run);
+		}
+
+		writer.flush();
+
+		// The directory is read in place from the mapped file.
+		static const char padding[DIRECTORY_ALIGNMENT] = {0};
+		const size_t paddingLength = (DIRECTORY_ALIGNMENT - writer.offset % DIRECTORY_ALIGNMENT) %
+			DIRECTORY_ALIGNMENT;
+		writeFile(file, padding, paddingLength, filename);
+
+		header.blocks = writer.directory.size();
+		header.directoryOffset = writer.offset + paddingLength;
+		header.keysOffset = header.directoryOffset +
+			writer.directory.size() * sizeof(KeyIndexBlock);
+
+		if (!writer.directory.empty())
+		{
+			writeFile(file, &writer.directory.front(),
+				writer.directory.size() * sizeof(KeyIndexBlock), filename);
+		}
+
+		writeFile(file, writer.firstKeys.data(), writer.firstKeys.length(), filename);
+
+		// The header is completed last.
+		if (fseek(file, 0, SEEK_SET) != 0)
+			throw runtime_error("Error writing " + filename);
+
+		writeFile(file, &header, sizeof(header), filename);
+
+		const int result = fclose(file);
+		file = NULL;
+
+		if (result != 0)
+			throw runtime_error("Error writing " + filename);
+	}
+	catch (...)
+	{
+		if (file)
+			fclose(file);
+
+		for (vector<Run*>::iterator i = runs.begin(); i != runs.end(); ++i)
+			delete *i;
+
+		throw;
+	}
+
+	for (vector<Run*>::iterator i = runs.begin(); i != runs.end(); ++i)
+		delete *i;
+
+	return header.entries;
+}
+
+
+boost::uint64_t buildKeyIndex(Database* database, Database::RelationId relationId,
+	const KeyEncoder& encoder, const string& formatSpec, const string& keySpec,
+	const char* filename, unsigned threads, size_t memory)
+{
+	vector<unsigned> pages;
+	database->getDataPages(relationId, pages);
+
+	if (threads == 0)
+		threads = 1;
+
+	const string tempName = string(filename) + ".tmp";
+	vector<KeyIndexSorter> sorters;
+	vector<Worker> workers;
+	sorters.reserve(threads);
+	workers.reserve(threads);
+
+	for (unsigned i = 0; i < threads; ++i)
+	{
+		size_t begin = pages.size() * i / threads;
+		size_t end = pages.size() * (i + 1) / threads;
+
+		char runName[16];
+		sprintf(runName, ".run%u", i);
+
+		sorters.push_back(KeyIndexSorter(filename + string(runName),
+			std::max(memory / threads, MIN_WORKER_MEMORY)));
+
+		const unsigned* data = pages.empty() ? NULL : &pages.front();
+		workers.push_back(Worker(database, relationId, data + begin, data + end, &encoder,
+			&sorters.back()));
+	}
+
+	boost::thread_group group;
+
+	for (unsigned i = 1; i < threads; ++i)
+		group.create_thread(boost::bind(&Worker::run, &workers[i], i));
+
+	workers[0].run(0);
+	group.join_all();
+
+	KeyIndexHeader header;
+	memset(&header, 0, sizeof(header));
+	header.relationId = relationId;
+	header.databasePages = database->getPageCount();
+	header.headerGeneration = database->header.pageHeader.generation;
+	header.nextTransaction = database->transactions.next;
+
+	boost::uint64_t entries;
+
+	try
+	{
+		for (vector<Worker>::const_iterator i = workers.begin(); i != workers.end(); ++i)
+		{
+			if (!i->error.empty())
+				throw runtime_error(i->error);
+		}
+
+		entries = writeKeyIndex(header, sorters, formatSpec, keySpec, tempName);
+
+		if (rename(tempName.c_str(), filename) != 0)
+			throw runtime_error(string("Cannot write ") + filename);
+	}
+	catch (...)
+	{
+		for (vector<KeyIndexSorter>::iterator i = sorters.begin(); i != sorters.end(); ++i)
+			i->removeRuns();
+
+		unlink(tempName.c_str());
+		throw;
+	}
+
+	for (vector<KeyIndexSorter>::iterator i = sorters.begin(); i != sorters.end(); ++i)
+		i->removeRuns();
+
+	return entries;
+}
+
+
+//------------------------------------------------------------------------------
+
+}	// fbods
@@ -0,0 +1,223 @@
+/*
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Initial Developer of the Original Code is Adriano dos Santos Fernandes.
+ * Portions created by the Initial Developer are Copyright (C) 2012 the Initial Developer.
+ * All Rights Reserved.
+ *
+ * Contributor(s):
+ *
+ */
+
+#ifndef FBSTUFF_ODS_KEY_INDEX_H
+#define FBSTUFF_ODS_KEY_INDEX_H
+
+#include "Database.h"
+#include "Format.h"
+#include "PageListScanStream.h"
+#include <string>
+#include <vector>
+#include <boost/cstdint.hpp>
+
+namespace fbods
+{
+
+//------------------------------------------------------------------------------
+
+
+class RecordView;
+
+// Turns the values of some fields of a decoded record into a key whose byte order is the
+// order of the values, so keys of several fields are compared with memcmp. Each field is
+// a null marker followed, when not null, by the value: numbers big endian with the sign
+// flipped, char as is and varchar with the zeros escaped and a zero terminator.
+class KeyEncoder
+{
+public:
+	KeyEncoder(const Format* aFormat, const std::vector<unsigned>& aFields);
+
+public:
+	// Appends the key of a record in the format layout.
+	void encode(const void* record, std::string& key) const;
+
+	// Appends the key of a record, decompressing it only up to the last key field.
+	void encode(RecordView& view, std::string& key) const;
+
+private:
+	void encodeValue(unsigned n, const boost::uint8_t* value, std::string& key) const;
+
+public:
+	const Format* format;
+	std::vector<unsigned> fields;
+};
+
+// The index file has the header, the format and key specs, the data blocks and the block
+// directory, padded to 8 bytes, all in the native byte order.
+//
+// Entries are sorted by key and record number, and front coded in blocks of about BLOCK_LENGTH
+// bytes: the length of the prefix shared with the previous key and the length of the rest,
+// then the rest, the data page and the record number, numbers as varints. The first key of
+// a block is stored whole, so blocks are decoded independently.
+//
+// The directory has the offset and the first key of each block, and is binary searched in
+// the mapped file, so a lookup reads a single block unless its key repeats across blocks.
+struct KeyIndexHeader
+{
+	static const boost::uint32_t VERSION = 1;
+	static const unsigned BLOCK_LENGTH = 4096;
+
+	char magic[8];
+	boost::uint32_t version;
+	boost::uint32_t blockLength;
+	boost::uint64_t entries;
+	boost::uint64_t directoryOffset;	// KeyIndexBlock array
+	boost::uint64_t keysOffset;	// first keys of the blocks
+	boost::uint32_t blocks;
+	boost::uint32_t relationId;
+	boost::uint32_t formatLength;	// format spec after the header, followed by the key spec
+	boost::uint32_t keyLength;
+
+	// State of the database the index was built from, checked by lookups.
+	boost::uint32_t databasePages;
+	boost::uint32_t headerGeneration;
+	boost::uint64_t nextTransaction;
+};
+
+struct KeyIndexBlock
+{
+	boost::uint64_t offset;
+	boost::uint32_t length;
+	boost::uint32_t entries;
+	boost::uint32_t keyOffset;	// from KeyIndexHeader::keysOffset
+	boost::uint32_t keyLength;
+};
+
+struct KeyIndexEntry
+{
+	KeyIndexEntry(unsigned aPage, boost::uint64_t aRecordNumber)
+		: page(aPage),
+		  recordNumber(aRecordNumber)
+	{
+	}
+
+	bool operator <(const KeyIndexEntry& other) const
+	{
+		return page < other.page || (page == other.page && recordNumber < other.recordNumber);
+	}
+
+	bool operator ==(const KeyIndexEntry& other) const
+	{
+		return page == other.page && recordNumber == other.recordNumber;
+	}
+
+	unsigned page;
+	boost::uint64_t recordNumber;	// as in ScanStream::getRecordNumber
+};
+
+// Index file mapped in memory.
+class KeyIndex
+{
+public:
+	explicit KeyIndex(const char* filename);
+	~KeyIndex();
+
+private:
+	KeyIndex(const KeyIndex&);
+	KeyIndex& operator =(const KeyIndex&);
+
+public:
+	// Throws when the database is not in the state the index was built from.
+	void check(Database* database) const;
+
+	// Appends the entries with the given key.
+	void find(const std::string& key, std::vector<KeyIndexEntry>& entries) const;
+
+public:
+	const KeyIndexHeader* header;
+	std::string formatSpec;
+	std::string keySpec;	// comma separated field names
+
+private:
+	bool isValid() const;
+
+private:
+	const char* base;
+	size_t size;
+	const KeyIndexBlock* directory;
+};
+
+// Returns the records of the given entries, reading each data page once in page order. With
+// Database::queueDepth set, the pages of the next entries are read together, through
+// ScanStream::queuePage. Pages changed since the index was built may have lost their records,
+// which are then skipped.
+class KeyIndexScanStream : public PageListScanStream
+{
+public:
+	// Entries must be sorted.
+	KeyIndexScanStream(Database* aDatabase, Database::RelationId relationId,
+		const std::vector<KeyIndexEntry>& aEntries);
+
+protected:
+	virtual bool readData();
+
+private:
+	const std::vector<KeyIndexEntry>& entries;
+	size_t entryNum;
+	unsigned aheadNum;	// next page to queue
+};
+
+// Entries of an index sorted by key and record number, spilling sorted runs to files named
+// after runName when they take more than the given memory.
+class KeyIndexSorter
+{
+public:
+	KeyIndexSorter(const std::string& aRunName, size_t aMemory);
+
+public:
+	void add(const std::string& key, unsigned page, boost::uint64_t recordNumber);
+
+	// Sorts the entries left in memory, the last run.
+	void sort();
+
+	void removeRuns();
+
+private:
+	void spill();
+
+public:
+	std::vector<char> arena;	// key length, key, page and record number of each entry
+	std::vector<size_t> offsets;	// of the entries in the arena
+	std::vector<std::string> runFiles;
+
+private:
+	std::string runName;
+	size_t memory;
+};
+
+// Merges the runs of the sorters into the index file, returning the number of entries. The
+// fields of the header with the state of the database are the caller's.
+boost::uint64_t writeKeyIndex(KeyIndexHeader header, std::vector<KeyIndexSorter>& sorters,
+	const std::string& formatSpec, const std::string& keySpec, const std::string& filename);
+
+// Builds the index of a relation, scanning it with the given number of threads. Each one
+// sorts its entries, spilling them to temporary files next to the index when they don't fit
+// in its share of the memory, and the sorted runs are merged into the index file. Returns the
+// number of entries.
+boost::uint64_t buildKeyIndex(Database* database, Database::RelationId relationId,
+	const KeyEncoder& encoder, const std::string& formatSpec, const std::string& keySpec,
+	const char* filename, unsigned threads, size_t memory);
+
+
+//------------------------------------------------------------------------------
+
+}	// fbods
+
+#endif	// FBSTUFF_ODS_KEY_INDEX_H
@@ -19,14 +19,61 @@
 
 #include "Ods.h"
 #include "Database.h"
+#include "BlobAnalyzer.h"
+#include "BloomFilter.h"
+#include "BufferArena.h"
+#include "CacheServer.h"
+#include "Expression.h"
+#include "Format.h"
 #include "FullScanStream.h"
+#include "IncrementalScanStream.h"
+#include "IoBenchmark.h"
+#include "KeyIndex.h"
+#include "MultiFileScan.h"
+#include "PageDiff.h"
+#include "PageListScanStream.h"
+#include "ParquetWriter.h"
+#include "RecordBatch.h"
+#include "RecordView.h"
+#include "SampleScanStream.h"
+#include "ScanMetrics.h"
+#include "SpaceAnalyzer.h"
+#include "Statistics.h"
+#include "TextExporter.h"
+#include "TransactionSnapshot.h"
+#include "TransactionMonitor.h"
+#include "Validator.h"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
 #include <iostream>
+#include <map>
+#include <sstream>
 #include <stdexcept>
+#include <string>
+#include <vector>
+#include <boost/algorithm/string.hpp>
+#include <boost/program_options/options_description.hpp>
+#include <boost/program_options/parsers.hpp>
+#include <boost/program_options/positional_options.hpp>
+#include <boost/program_options/variables_map.hpp>
+#include <boost/scoped_array.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <fcntl.h>
+#include <unistd.h>
 
+namespace po = boost::program_options;
 using std::cerr;
 using std::cout;
 using std::endl;
 using std::exception;
+using std::map;
+using std::ostream;
+using std::runtime_error;
+using std::string;
+using std::vector;
 
 namespace fbods
 {
@@ -34,10 +81,217 @@ namespace fbods
 //------------------------------------------------------------------------------
 
 
-void run()
+static string databaseName;
+static string relationName;
+static string formatSpec;
+
+
+//--------------------------------------
+
+
+// Numbers of the fields of a comma separated list of names.
+static vector<unsigned> findFields(const Format& format, const string& list)
+{
+	vector<string> names;
+	boost::algorithm::split(names, list, boost::algorithm::is_any_of(","));
+
+	vector<unsigned> fields;
+
+	for (vector<string>::iterator name = names.begin(); name != names.end(); ++name)
+	{
+		boost::algorithm::trim(*name);
+		unsigned n = 0;
+
+		while (n < format.fields.size() && !boost::algorithm::iequals(format.fields[n].name, *name))
+			++n;
+
+		if (n == format.fields.size())
+			throw runtime_error("Field " + *name + " not found in the format");
+
+		fields.push_back(n);
+	}
+
+	return fields;
+}
+
+// Parses the comma separated values of the given fields into a record of the format.
+static void parseKey(const Format& format, const vector<unsigned>& fields, const string& text,
+	char* record)
+{
+	vector<string> values;
+	boost::algorithm::split(values, text, boost::algorithm::is_any_of(","));
+
+	if (values.size() != fields.size())
+		throw runtime_error("Key value " + text + " doesn't match the key fields");
+
+	memset(record, 0, format.length);
+
+	for (unsigned i = 0; i < values.size(); ++i)
+	{
+		const unsigned n = fields[i];
+		format.parse(n, boost::algorithm::trim_copy(values[i]), record + format.fields[n].offset);
+	}
+}
+
+// Copies the fields of a record to the ones of another format starting at the given field.
+static void copyFields(const Format& from, const void* in, const Format& to, unsigned firstField,
+	void* out)
+{
+	boost::uint8_t* p = static_cast<boost::uint8_t*>(out);
+
+	for (unsigned n = 0; n < from.fields.size(); ++n)
+	{
+		const unsigned f = firstField + n;
+
+		if (from.isNull(in, n))
+			p[f >> 3] |= 1 << (f & 7);
+		else
+			memcpy(p + to.fields[f].offset, from.getPointer(in, n), from.fields[n].length);
+	}
+}
+
+
+//--------------------------------------
+
+
+// Filter, condition and computed columns of the records of exports, changes and lookups.
+struct ExportOptions
+{
+	ExportOptions()
+		: bloomFilter(NULL)
+	{
+	}
+
+	const BloomFilter* bloomFilter;
+	string bloomKeySpec;	// fields matched with the filter, by default the ones it was built from
+	string whereSpec;
+	vector<string> columnSpecs;
+};
+
+// Records of an export scan, kept by the Bloom filter and the condition of the options, and
+// with their computed columns appended. The records rejected by the filter are decompressed
+// only up to their key fields.
+class ExportScan
 {
-	Database database("t.fdb");
+public:
+	// Without report, the Bloom filter counters are left to the caller.
+	ExportScan(ScanStream& aScan, const string& aSpec, const ExportOptions& options,
+			bool aReport = true)
+		: scan(&aScan),
+		  spec(aSpec),
+		  format(aSpec),
+		  record(new char[ScanStream::MAX_RECORD_SIZE]),
+		  view(&format),
+		  outputNum(0),
+		  report(aReport)
+	{
+		if (options.bloomFilter)
+		{
+			semiJoin.reset(new SemiJoinFilter(options.bloomFilter, &format, findFields(format,
+				(options.bloomKeySpec.empty() ? options.bloomFilter->keySpec :
+					options.bloomKeySpec))));
+		}
+
+		if (!options.whereSpec.empty() || !options.columnSpecs.empty())
+			projection.reset(new Projection(aSpec, options.whereSpec, options.columnSpecs));
+	}
+
+	~ExportScan()
+	{
+		// Records may be going to stdout.
+		if (semiJoin && report)
+		{
+			cerr << "bloom filter: " << semiJoin->passed << " passed, " << semiJoin->rejected <<
+				" rejected" << endl;
+		}
+	}
+
+public:
+	// Goes on with the records of another scan, once all of the current one are fetched.
+	void setScan(ScanStream& aScan)
+	{
+		scan = &aScan;
+	}
+
+	const Format& getFormat() const
+	{
+		return projection ? projection->getFormat() : format;
+	}
+
+	const string& getSpec() const
+	{
+		return projection ? projection->getSpec() : spec;
+	}
+
+	// Number of the record last fetched.
+	boost::uint64_t getRecordNumber() const
+	{
+		return projection ? numbers[projection->getOutputRow(outputNum - 1)] :
+			scan->getRecordNumber();
+	}
+
+	const SemiJoinFilter* getSemiJoin() const
+	{
+		return semiJoin.get();
+	}
+
+	const void* fetch()
+	{
+		if (!projection)
+			return fetchInput();
+
+		// Records are evaluated in batches.
+		while (outputNum == projection->getOutputCount())
+		{
+			const void* input = NULL;
+			numbers.clear();
+
+			while (!projection->isFull() && (input = fetchInput()))
+			{
+				projection->add(input);
+				numbers.push_back(scan->getRecordNumber());
+			}
+
+			if (projection->isEmpty())
+				return NULL;
+
+			projection->run();
+			outputNum = 0;
+		}
+
+		return projection->getOutput(outputNum++);
+	}
+
+private:
+	const void* fetchInput()
+	{
+		if (!semiJoin)
+			return scan->fetch(record.get()) ? record.get() : NULL;
+
+		while (scan->fetch(view))
+		{
+			if (semiJoin->matches(view))
+				return view.getRecord();
+		}
+
+		return NULL;
+	}
 
+private:
+	ScanStream* scan;
+	string spec;
+	Format format;
+	boost::scoped_array<char> record;
+	RecordView view;
+	boost::scoped_ptr<SemiJoinFilter> semiJoin;
+	boost::scoped_ptr<Projection> projection;
+	vector<boost::uint64_t> numbers;	// of the records in the projection batch
+	unsigned outputNum;
+	bool report;
+};
+
+static void count(Database& database)
+{
 	/***
 	{
 		FullScanStream scan(&database, Database::RELATION_ID_PAGES);
@@ -125,43 +379,1464 @@ void run()
 	***/
 
 	{
-		FullScanStream scan(&database, "T");
+		WorkerPlacement placement(&database, 0);
+		FullScanStream scan(&database, relationName.c_str());
+
+		RecordView record(NULL);
+		unsigned count = 0;
+
+		while (scan.fetch(record))
+			++count;
+
+		cout << "count: " << count << endl;
+	}
+}
+
+static void sample(Database& database, const SampleOptions& options)
+{
+	boost::scoped_ptr<Format> format(formatSpec.empty() ? NULL : new Format(formatSpec));
+	SampleScanStream scan(&database, relationName.c_str(), options, format.get());
+
+	boost::scoped_array<char> record(new char[ScanStream::MAX_RECORD_SIZE]);
+
+	while (scan.fetch(record.get()))
+		;
+
+	cout << "pages: " << scan.getSampledPages() << " of " << scan.getTotalPages() << endl;
+	cout << "records: " << scan.getSampledRecords() << " sampled, " <<
+		std::fixed << std::setprecision(0) << scan.getEstimatedRecords() << " estimated" << endl;
+
+	if (!format)
+		return;
+
+	for (unsigned i = 0; i < format->fields.size(); ++i)
+	{
+		const SampleScanStream::FieldEstimate& estimate = scan.getFieldEstimate(i);
 
-		struct T
+		cout << format->fields[i].name << ": nulls " << std::setprecision(4) <<
+			scan.getNullFraction(i);
+
+		if (!estimate.min.empty())
 		{
-			boost::uint32_t nullFlags[1];
-			boost::int32_t n;
-		} t;
+			cout << ", min ";
+			format->print(cout, i, estimate.min.data());
+			cout << ", max ";
+			format->print(cout, i, estimate.max.data());
+		}
 
-		unsigned count = 0;
+		cout << endl;
+	}
+}
+
+static void statistics(Database& database, const vector<string>& indexSpecs, unsigned threads,
+	unsigned buckets)
+{
+	if (formatSpec.empty())
+		throw runtime_error("Statistics require a record format");
+
+	Format format(formatSpec);
+	vector<vector<unsigned> > indices;
+
+	for (vector<string>::const_iterator i = indexSpecs.begin(); i != indexSpecs.end(); ++i)
+		indices.push_back(findFields(format, *i));
+
+	RelationStatistics stats(&format, indices);
+	collectStatistics(&database, database.findRelation(relationName.c_str()), threads, stats);
+
+	cout << "records: " << stats.records << endl;
+
+	for (unsigned i = 0; i < format.fields.size(); ++i)
+	{
+		const ColumnStatistics& column = stats.columns[i];
+		double distinct = column.distinct.estimate();
 
-		while (scan.fetch(&t))
+		cout << format.fields[i].name <<
+			": nulls " << column.nulls <<
+			", distinct " << std::fixed << std::setprecision(0) << distinct <<
+			", selectivity " << std::scientific << std::setprecision(6) <<
+				(distinct < 1 ? 0 : 1 / distinct) <<
+			", average length " << std::fixed << std::setprecision(2) <<
+				stats.getAverageLength(i) << endl;
+
+		vector<string> bounds;
+		stats.getHistogram(i, buckets, bounds);
+
+		if (!bounds.empty())
 		{
-			++count;
-			///cout << "n: " << t.n <<
-			///	endl;
+			cout << "\thistogram:";
+
+			for (vector<string>::const_iterator bound = bounds.begin(); bound != bounds.end(); ++bound)
+			{
+				cout << (bound == bounds.begin() ? " " : " | ");
+				format.print(cout, i, bound->data());
+			}
+
+			cout << endl;
 		}
+	}
 
-		cout << "count: " << count << endl;
+	for (unsigned i = 0; i < indices.size(); ++i)
+	{
+		cout << "index " << indexSpecs[i] << endl;
+
+		for (unsigned j = 0; j < indices[i].size(); ++j)
+		{
+			cout << "\tsegment " << j << " " << format.fields[indices[i][j]].name <<
+				": statistics " << std::scientific << std::setprecision(6) <<
+				stats.getSelectivity(i, j) << endl;
+		}
 	}
 }
 
+static void exportParquet(Database& database, const string& output, unsigned rowGroupSize,
+	unsigned threads, const ExportOptions& options)
+{
+	if (formatSpec.empty())
+		throw runtime_error("Export requires a record format");
+
+	if (output.empty())
+		throw runtime_error("Export requires an output file");
 
-//------------------------------------------------------------------------------
+	FullScanStream scan(&database, relationName.c_str());
+	ExportScan records(scan, formatSpec, options);
+	const Format& format = records.getFormat();
+	RecordBatch batch(&format, rowGroupSize);
+	ParquetWriter writer(output.c_str(), &format, threads);
 
-}	// fbods
+	boost::uint64_t count = 0;
+
+	while (const void* record = records.fetch())
+	{
+		batch.add(record);
+		++count;
+
+		if (batch.isFull())
+		{
+			writer.write(batch);
+			batch.clear();
+		}
+	}
+
+	writer.write(batch);
+	writer.close();
+
+	cout << "exported: " << count << endl;
+}
 
+// Descriptor of the output of text exports, stdout for - or no file.
+static int openOutput(const string& output)
+{
+	int handle = 1;
+
+	if (!output.empty() && output != "-")
+	{
+		handle = open(output.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+		if (handle < 0)
+			throw runtime_error("Cannot create " + output);
+	}
+
+	return handle;
+}
 
-int main()
+static void exportText(ScanStream& scan, const string& spec, const string& output,
+	TextExporter::Style style, bool header, unsigned threads, const ExportOptions& options)
 {
+	const int handle = openOutput(output);
+
 	try
 	{
-		fbods::run();
+		ExportScan records(scan, spec, options);
+		TextExporter exporter(&records.getFormat(), handle, style, threads);
+
+		if (header)
+			exporter.writeHeader();
+
+		while (const void* record = records.fetch())
+			exporter.add(record);
+
+		exporter.finish();
 	}
-	catch (exception& e)
+	catch (...)
 	{
-		cerr << e.what() << endl;
+		if (handle != 1)
+			close(handle);
+
+		throw;
+	}
+
+	if (handle != 1 && close(handle) != 0)
+		throw runtime_error("Error closing " + output);
+}
+
+static void exportText(Database& database, const string& output, TextExporter::Style style,
+	bool header, unsigned threads, const ExportOptions& options)
+{
+	if (formatSpec.empty())
+		throw runtime_error("Export requires a record format");
+
+	FullScanStream scan(&database, relationName.c_str());
+
+	exportText(scan, formatSpec, output, style, header, threads, options);
+}
+
+// Exports the records of the chunks scanned by a thread, prefixed with the name of their file.
+// The input format, projection and filter are built for the first chunk and kept for the others.
+class FileExportVisitor : public ChunkVisitor
+{
+public:
+	FileExportVisitor(const vector<string>& aFilenames, const Format& aFormat,
+			const ExportOptions& aOptions, TextExporter& aExporter, boost::mutex& aMutex)
+		: filenames(aFilenames),
+		  format(aFormat),
+		  options(aOptions),
+		  exporter(aExporter),
+		  mutex(aMutex),
+		  records(0),
+		  passed(0),
+		  rejected(0)
+	{
+	}
+
+public:
+	virtual void visit(unsigned file, ScanStream& scan)
+	{
+		if (input)
+			input->setScan(scan);
+		else
+			input.reset(new ExportScan(scan, formatSpec, options, false));
+
+		const Format& inputFormat = input->getFormat();
+		const string& filename = filenames[file];
+		const unsigned length = format.length;
+
+		buffer.clear();
+
+		while (const void* record = input->fetch())
+		{
+			buffer.resize(buffer.size() + length);
+			tag(filename, inputFormat, record, &buffer[buffer.size() - length]);
+		}
+
+		if (const SemiJoinFilter* semiJoin = input->getSemiJoin())
+		{
+			passed = semiJoin->passed;
+			rejected = semiJoin->rejected;
+		}
+
+		const size_t count = buffer.size() / length;
+		records += count;
+
+		boost::mutex::scoped_lock lock(mutex);
+
+		for (size_t i = 0; i < count; ++i)
+			exporter.add(&buffer[i * length]);
+	}
+
+private:
+	void tag(const string& filename, const Format& inputFormat, const void* in, char* out) const
+	{
+		boost::uint8_t* p = reinterpret_cast<boost::uint8_t*>(out);
+		memset(p, 0, format.length);
+
+		const boost::uint16_t nameLength = boost::uint16_t(filename.length());
+		memcpy(p + format.fields[0].offset, &nameLength, sizeof(nameLength));
+		memcpy(p + format.fields[0].offset + sizeof(nameLength), filename.data(), nameLength);
+
+		copyFields(inputFormat, in, format, 1, p);
+	}
+
+private:
+	const vector<string>& filenames;
+	const Format& format;
+	const ExportOptions& options;
+	TextExporter& exporter;
+	boost::mutex& mutex;
+	boost::scoped_ptr<ExportScan> input;
+	vector<char> buffer;
+
+public:
+	boost::uint64_t records;
+	boost::uint64_t passed;
+	boost::uint64_t rejected;
+};
+
+// Exports the relation from the databases of a list file, the name of each one in a first
+// source field of its records. Databases that can't be read are reported and skipped, and
+// their number returned.
+static unsigned exportFiles(const string& listFile, const string& output, TextExporter::Style style,
+	bool header, unsigned threads, const MultiFileOptions& options,
+	const ExportOptions& exportOptions)
+{
+	if (formatSpec.empty())
+		throw runtime_error("Export requires a record format");
+
+	std::ifstream list(listFile.c_str());
+
+	if (!list)
+		throw runtime_error("Cannot open " + listFile);
+
+	vector<string> filenames;
+	size_t maxLength = 1;
+	string line;
+
+	while (std::getline(list, line))
+	{
+		boost::algorithm::trim(line);
+
+		if (!line.empty() && line[0] != '#')
+		{
+			filenames.push_back(line);
+			maxLength = std::max(maxLength, line.length());
+		}
 	}
 
-	return 0;
+	if (filenames.empty())
+		throw runtime_error("No databases in " + listFile);
+
+	std::ostringstream spec;
+	spec << "source varchar(" << maxLength << "), " <<
+		(exportOptions.whereSpec.empty() && exportOptions.columnSpecs.empty() ? formatSpec :
+			Projection(formatSpec, exportOptions.whereSpec, exportOptions.columnSpecs).getSpec());
+
+	const Format format(spec.str());
+	const int handle = openOutput(output);
+	vector<FileExportVisitor*> visitors;
+	vector<string> errors;
+
+	try
+	{
+		TextExporter exporter(&format, handle, style, threads);
+		boost::mutex mutex;
+
+		if (header)
+			exporter.writeHeader();
+
+		for (unsigned i = 0; i < std::max(threads, 1u); ++i)
+		{
+			visitors.push_back(
+				new FileExportVisitor(filenames, format, exportOptions, exporter, mutex));
+		}
+
+		scanFiles(filenames, relationName,
+			vector<ChunkVisitor*>(visitors.begin(), visitors.end()), options, errors);
+
+		exporter.finish();
+	}
+	catch (...)
+	{
+		for (vector<FileExportVisitor*>::iterator i = visitors.begin(); i != visitors.end(); ++i)
+			delete *i;
+
+		if (handle != 1)
+			close(handle);
+
+		throw;
+	}
+
+	boost::uint64_t records = 0, passed = 0, rejected = 0;
+
+	for (vector<FileExportVisitor*>::iterator i = visitors.begin(); i != visitors.end(); ++i)
+	{
+		records += (*i)->records;
+		passed += (*i)->passed;
+		rejected += (*i)->rejected;
+		delete *i;
+	}
+
+	if (handle != 1 && close(handle) != 0)
+		throw runtime_error("Error closing " + output);
+
+	// Records may be going to stdout.
+	for (vector<string>::const_iterator i = errors.begin(); i != errors.end(); ++i)
+		cerr << "skipped " << *i << endl;
+
+	cerr << "databases: " << filenames.size() << ", skipped: " << errors.size() <<
+		", records: " << records << endl;
+
+	if (exportOptions.bloomFilter)
+		cerr << "bloom filter: " << passed << " passed, " << rejected << " rejected" << endl;
+
+	return errors.size();
+}
+
+// Decoded records of a data page, by record number.
+static void readPageRecords(Database& database, unsigned page, Database::RelationId relationId,
+	const Format& format, map<boost::uint64_t, string>& records)
+{
+	PageListScanStream scan(&database, &page, &page + 1, relationId);
+	boost::scoped_array<char> record(new char[ScanStream::MAX_RECORD_SIZE]);
+
+	while (scan.fetch(record.get()))
+		records[scan.getRecordNumber()].assign(record.get(), format.length);
+}
+
+// Writes the records of the relation that differ in the changed data pages, the old version
+// marked with - and the new with +, followed by the record number.
+static void diffRecords(Database& base, Database& database, const PageDiff& diff,
+	const string& output, TextExporter::Style style, bool header, ostream& report)
+{
+	if (relationName.empty() || formatSpec.empty())
+		throw runtime_error("Record diffs require a relation and its format");
+
+	const int baseRelationId = base.findRelation(relationName.c_str());
+	const int relationId = database.findRelation(relationName.c_str());
+	const Format format(formatSpec);
+	const Format outputFormat("change char(1), record bigint, " + formatSpec);
+	const int handle = openOutput(output);
+	boost::uint64_t deleted = 0, inserted = 0, updated = 0;
+
+	try
+	{
+		TextExporter exporter(&outputFormat, handle, style);
+		boost::scoped_array<char> out(new char[outputFormat.length]);
+
+		if (header)
+			exporter.writeHeader();
+
+		for (vector<PageChange>::const_iterator i = diff.changes.begin(); i != diff.changes.end();
+			 ++i)
+		{
+			if (i->kind == PageChange::KIND_REWRITTEN)
+				continue;
+
+			map<boost::uint64_t, string> oldRecords, newRecords;
+
+			if (i->oldType == PageHeader::TYPE_DATA && i->oldRelation == baseRelationId)
+			{
+				readPageRecords(base, i->number,
+					static_cast<Database::RelationId>(baseRelationId), format, oldRecords);
+			}
+
+			if (i->newType == PageHeader::TYPE_DATA && i->newRelation == relationId)
+			{
+				readPageRecords(database, i->number, static_cast<Database::RelationId>(relationId),
+					format, newRecords);
+			}
+
+			map<boost::uint64_t, string>::const_iterator oldRecord = oldRecords.begin();
+			map<boost::uint64_t, string>::const_iterator newRecord = newRecords.begin();
+
+			while (oldRecord != oldRecords.end() || newRecord != newRecords.end())
+			{
+				const bool isOld = newRecord == newRecords.end() ||
+					(oldRecord != oldRecords.end() && oldRecord->first <= newRecord->first);
+				const bool isNew = oldRecord == oldRecords.end() ||
+					(newRecord != newRecords.end() && newRecord->first <= oldRecord->first);
+
+				if (isOld && isNew && oldRecord->second == newRecord->second)
+				{
+					++oldRecord;
+					++newRecord;
+					continue;
+				}
+
+				for (unsigned side = 0; side < 2; ++side)
+				{
+					if (side == 0 ? !isOld : !isNew)
+						continue;
+
+					const map<boost::uint64_t, string>::const_iterator& record =
+						(side == 0 ? oldRecord : newRecord);
+					const boost::int64_t number = record->first;
+
+					memset(out.get(), 0, outputFormat.length);
+					out[outputFormat.fields[0].offset] = (side == 0 ? '-' : '+');
+					memcpy(&out[outputFormat.fields[1].offset], &number, sizeof(number));
+					copyFields(format, record->second.data(), outputFormat, 2, out.get());
+					exporter.add(out.get());
+				}
+
+				if (isOld && isNew)
+					++updated;
+				else if (isOld)
+					++deleted;
+				else
+					++inserted;
+
+				if (isOld)
+					++oldRecord;
+
+				if (isNew)
+					++newRecord;
+			}
+		}
+
+		exporter.finish();
+	}
+	catch (...)
+	{
+		if (handle != 1)
+			close(handle);
+
+		throw;
+	}
+
+	if (handle != 1 && close(handle) != 0)
+		throw runtime_error("Error closing " + output);
+
+	report << "records: " << updated << " updated, " << inserted << " inserted, " << deleted <<
+		" deleted" << endl;
+}
+
+static void writeDiffCounts(ostream& out, const PageDiffCounts& counts)
+{
+	out << "unchanged " << counts.unchanged <<
+		", rewritten " << counts.rewritten <<
+		", changed " << counts.changed <<
+		", added " << counts.added <<
+		", removed " << counts.removed << endl;
+}
+
+// Compares the database with an older copy of it. The changed pages, or the changed records of
+// the relation with records, are written to output.
+static void diff(Database& database, const string& baseName, const string& output, bool records,
+	TextExporter::Style style, bool header, unsigned threads, unsigned chunkPages)
+{
+	static const char* const TYPE_NAMES[] = {
+		"undefined",
+		"header",
+		"page inventory",
+		"transaction inventory",
+		"pointer",
+		"data",
+		"index root",
+		"index b-tree",
+		"blob",
+		"generator",
+		"scn inventory",
+		"invalid"
+	};
+
+	if (baseName.empty())
+		throw runtime_error("Diff requires the base database");
+
+	Database base(baseName.c_str());
+	base.setDirectIo(database.isDirectIo());
+
+	PageDiff diff(&base, &database);
+	diff.run(threads, chunkPages);
+
+	// Pages or records may be going to stdout.
+	ostream& report = output == "-" ? cerr : cout;
+	const unsigned pageSize = database.header.pageSize;
+
+	map<Database::RelationId, string> names;
+	base.getRelationNames(names);
+	database.getRelationNames(names);
+
+	report << "pages: " << diff.oldPages << " in the base, " << diff.newPages <<
+		" in the database" << endl;
+	writeDiffCounts(report << "total: ", diff.total);
+	report << "delta: " << diff.total.getDelta() << " pages, " << std::fixed <<
+		std::setprecision(1) << double(diff.total.getDelta()) * pageSize / (1024 * 1024) << " MB" <<
+		endl;
+
+	for (unsigned i = 0; i < diff.byType.size(); ++i)
+	{
+		const PageDiffCounts& counts = diff.byType[i];
+
+		if (counts.unchanged + counts.getDelta() + counts.removed != 0)
+			writeDiffCounts(report << "\t" << TYPE_NAMES[i] << ": ", counts);
+	}
+
+	for (map<int, PageDiffCounts>::const_iterator i = diff.byRelation.begin();
+		 i != diff.byRelation.end();
+		 ++i)
+	{
+		map<Database::RelationId, string>::const_iterator name =
+			names.find(static_cast<Database::RelationId>(i->first));
+
+		writeDiffCounts(report << (name == names.end() ? string("?") : name->second) << " (" <<
+			i->first << "): ", i->second);
+	}
+
+	if (records)
+	{
+		diffRecords(base, database, diff, output, style, header, report);
+		return;
+	}
+
+	if (output.empty())
+		return;
+
+	std::ofstream file;
+
+	if (output != "-")
+	{
+		file.open(output.c_str());
+
+		if (!file)
+			throw runtime_error("Cannot create " + output);
+	}
+
+	ostream& out = file.is_open() ? file : cout;
+
+	if (header)
+		out << "page,change,type,relation" << endl;
+
+	for (vector<PageChange>::const_iterator i = diff.changes.begin(); i != diff.changes.end(); ++i)
+	{
+		static const char* const KIND_NAMES[] = {"unchanged", "rewritten", "changed", "added",
+			"removed"};
+
+		const bool removed = i->kind == PageChange::KIND_REMOVED;
+		const unsigned type = std::min<unsigned>(boost::uint8_t(removed ? i->oldType : i->newType),
+			PageHeader::TYPE_MAX + 1);
+		const int relation = removed ? i->oldRelation : i->newRelation;
+
+		out << i->number << "," << KIND_NAMES[i->kind] << "," << TYPE_NAMES[type] << ",";
+
+		if (relation >= 0)
+			out << relation;
+
+		out << endl;
+	}
+
+	if (!out.flush())
+		throw runtime_error("Error writing " + output);
+}
+
+// Writes the records of the pages changed since a previous run, marked with + and followed by
+// their record number. With the generation map, only the new and changed records are written,
+// and the deleted ones too, marked with - and with null fields.
+static void changes(Database& database, boost::uint32_t sinceScn, const string& generationMap,
+	const string& output, TextExporter::Style style, bool header, unsigned threads,
+	const ExportOptions& options)
+{
+	if (formatSpec.empty())
+		throw runtime_error("Changes require a record format");
+
+	GenerationMap generations;
+
+	if (!generationMap.empty())
+		generations.load(generationMap.c_str());
+
+	IncrementalScanStream scan(&database, relationName.c_str(), sinceScn,
+		(generationMap.empty() ? NULL : &generations), true);
+
+	const int handle = openOutput(output);
+	boost::uint64_t changed = 0;
+
+	try
+	{
+		ExportScan records(scan, formatSpec, options);
+		const Format& format = records.getFormat();
+		const Format outputFormat("change char(1), record bigint, " + records.getSpec());
+		TextExporter exporter(&outputFormat, handle, style, threads);
+		boost::scoped_array<char> out(new char[outputFormat.length]);
+
+		if (header)
+			exporter.writeHeader();
+
+		while (const void* record = records.fetch())
+		{
+			const boost::int64_t number = records.getRecordNumber();
+
+			memset(out.get(), 0, outputFormat.length);
+			out[outputFormat.fields[0].offset] = '+';
+			memcpy(&out[outputFormat.fields[1].offset], &number, sizeof(number));
+			copyFields(format, record, outputFormat, 2, out.get());
+			exporter.add(out.get());
+			++changed;
+		}
+
+		// Deleted records can't be checked by the filters.
+		const vector<boost::uint64_t>& deleted = scan.getDeletedRecords();
+
+		for (vector<boost::uint64_t>::const_iterator i = deleted.begin(); i != deleted.end(); ++i)
+		{
+			const boost::int64_t number = *i;
+
+			memset(out.get(), 0, outputFormat.length);
+			out[outputFormat.fields[0].offset] = '-';
+			memcpy(&out[outputFormat.fields[1].offset], &number, sizeof(number));
+
+			for (unsigned f = 2; f < outputFormat.fields.size(); ++f)
+				out[f >> 3] |= 1 << (f & 7);
+
+			exporter.add(out.get());
+		}
+
+		exporter.finish();
+	}
+	catch (...)
+	{
+		if (handle != 1)
+			close(handle);
+
+		throw;
+	}
+
+	if (handle != 1 && close(handle) != 0)
+		throw runtime_error("Error closing " + output);
+
+	if (!generationMap.empty())
+		generations.save(generationMap.c_str());
+
+	// Records may be going to stdout.
+	cerr << "changed pages: " << scan.getChangedPages() << " of " << scan.getTotalPages() << endl;
+	cerr << "records: " << changed << " changed, " << scan.getDeletedRecords().size() <<
+		" deleted" << endl;
+	cerr << "watermark: " << scan.getWatermark() << endl;
+}
+
+static void buildIndex(Database& database, const string& keySpec, const string& indexFile,
+	unsigned threads, unsigned sortMemory)
+{
+	if (formatSpec.empty())
+		throw runtime_error("Key indexes require a record format");
+
+	if (keySpec.empty() || indexFile.empty())
+		throw runtime_error("Key indexes require the key fields and the index file");
+
+	Format format(formatSpec);
+	KeyEncoder encoder(&format, findFields(format, keySpec));
+
+	const boost::uint64_t entries = buildKeyIndex(&database,
+		database.findRelation(relationName.c_str()), encoder, formatSpec, keySpec,
+		indexFile.c_str(), threads, size_t(sortMemory) * 1024 * 1024);
+
+	cout << "entries: " << entries << endl;
+}
+
+// Builds the filter from the keys of a text file, one per line with the values of the fields
+// comma separated, or else from the keys of the relation.
+static void buildBloomFilter(Database* database, const string& keySpec, const string& keyFile,
+	const string& bloomFile, double falsePositiveRate)
+{
+	if (formatSpec.empty())
+		throw runtime_error("Bloom filters require a record format");
+
+	if (keySpec.empty() || bloomFile.empty())
+		throw runtime_error("Bloom filters require the key fields and the filter file");
+
+	Format format(formatSpec);
+	KeyHasher hasher(&format, findFields(format, keySpec));
+	vector<boost::uint64_t> hashes;
+	boost::uint64_t hash;
+
+	if (!keyFile.empty())
+	{
+		std::ifstream in(keyFile.c_str());
+
+		if (!in)
+			throw runtime_error("Cannot open " + keyFile);
+
+		boost::scoped_array<char> record(new char[format.length]);
+		string line;
+
+		while (std::getline(in, line))
+		{
+			boost::algorithm::trim_right_if(line, boost::algorithm::is_any_of("\r"));
+
+			if (line.empty())
+				continue;
+
+			parseKey(format, hasher.fields, line, record.get());
+
+			if (hasher.hash(record.get(), hash))
+				hashes.push_back(hash);
+		}
+
+		if (in.bad())
+			throw runtime_error("Error reading " + keyFile);
+	}
+	else
+	{
+		FullScanStream scan(database, relationName.c_str());
+		RecordView view(&format);
+
+		while (scan.fetch(view))
+		{
+			if (hasher.hash(view, hash))
+				hashes.push_back(hash);
+		}
+	}
+
+	// Repeated keys would make the filter larger than needed.
+	std::sort(hashes.begin(), hashes.end());
+	hashes.erase(std::unique(hashes.begin(), hashes.end()), hashes.end());
+
+	BloomFilter filter(hashes.size(), falsePositiveRate);
+	filter.keySpec = keySpec;
+	filter.signature = hasher.getSignature();
+
+	for (vector<boost::uint64_t>::const_iterator i = hashes.begin(); i != hashes.end(); ++i)
+		filter.add(*i);
+
+	filter.save(bloomFile.c_str());
+
+	cout << "keys: " << filter.keys << ", bytes: " << filter.getSize() << endl;
+}
+
+// Each value has the comma separated values of the key fields.
+static void lookup(Database& database, const string& indexFile, const vector<string>& keyValues,
+	const string& output, TextExporter::Style style, bool header, const ExportOptions& options)
+{
+	if (indexFile.empty())
+		throw runtime_error("Lookups require the index file");
+
+	KeyIndex index(indexFile.c_str());
+	const Database::RelationId relationId = database.findRelation(relationName.c_str());
+
+	if (index.header->relationId != unsigned(relationId))
+		throw runtime_error("The key index is of another relation");
+
+	index.check(&database);
+
+	const string spec(formatSpec.empty() ? index.formatSpec : formatSpec);
+	Format format(spec);
+	KeyEncoder encoder(&format, findFields(format, index.keySpec));
+
+	boost::scoped_array<char> record(new char[format.length]);
+	vector<KeyIndexEntry> entries;
+	string key;
+
+	for (vector<string>::const_iterator i = keyValues.begin(); i != keyValues.end(); ++i)
+	{
+		parseKey(format, encoder.fields, *i, record.get());
+
+		key.clear();
+		encoder.encode(record.get(), key);
+		index.find(key, entries);
+	}
+
+	std::sort(entries.begin(), entries.end());
+	entries.erase(std::unique(entries.begin(), entries.end()), entries.end());
+
+	KeyIndexScanStream scan(&database, relationId, entries);
+	exportText(scan, spec, output, style, header, 1, options);
+
+	// Records may be going to stdout.
+	cerr << "index entries: " << entries.size() << endl;
+}
+
+// Each cache spec is "relation:format".
+static void serve(Database& database, const string& socketName, const vector<string>& caches,
+	double interval)
+{
+	if (socketName.empty())
+		throw runtime_error("The cache server requires the socket file");
+
+	if (caches.empty() && (relationName.empty() || formatSpec.empty()))
+		throw runtime_error("The cache server requires relations with their record formats");
+
+	CacheServer server(&database, socketName);
+
+	if (!relationName.empty() && !formatSpec.empty())
+		server.addRelation(relationName, formatSpec);
+
+	for (vector<string>::const_iterator i = caches.begin(); i != caches.end(); ++i)
+	{
+		const string::size_type colon = i->find(':');
+
+		if (colon == string::npos)
+			throw runtime_error("Invalid cache " + *i + ", expected relation:format");
+
+		server.addRelation(boost::algorithm::trim_copy(i->substr(0, colon)), i->substr(colon + 1));
+	}
+
+	server.run(interval);
+}
+
+static void space(Database& database, unsigned threads, unsigned chunkPages)
+{
+	SpaceAnalyzer analyzer(&database);
+	analyzer.run(threads, chunkPages);
+
+	map<Database::RelationId, string> names;
+	database.getRelationNames(names);
+
+	const unsigned relationId = relationName.empty() ? 0 : database.findRelation(relationName.c_str());
+	const unsigned pageSize = database.header.pageSize;
+
+	for (map<unsigned, RelationSpace>::const_iterator i = analyzer.relations.begin();
+		 i != analyzer.relations.end();
+		 ++i)
+	{
+		const RelationSpace& space = i->second;
+
+		if (!relationName.empty() && i->first != relationId)
+			continue;
+
+		map<Database::RelationId, string>::const_iterator name =
+			names.find(static_cast<Database::RelationId>(i->first));
+
+		cout << (name == names.end() ? string("?") : name->second) << " (" << i->first << ")" <<
+			endl;
+
+		cout << std::fixed << std::setprecision(2) <<
+			"\tpointer pages: " << space.pointerPages <<
+			", data pages: " << space.dataPages <<
+			", average fill: " << space.getAverageFill(pageSize) << "%" << endl <<
+			"\trecords: " << space.records <<
+			", deleted stubs: " << space.deletedStubs << " (" <<
+				(space.records == 0 ? 0 : 100.0 * space.deletedStubs / space.records) << "%)" <<
+			", fragmented: " << space.fragmentedRecords << " (" <<
+				(space.records == 0 ? 0 : 100.0 * space.fragmentedRecords / space.records) << "%)" <<
+			", fragments: " << space.fragments <<
+			", blobs: " << space.blobs << endl <<
+			"\taverage record length: " << space.getAverageRecordLength() <<
+			", compressed: " << space.getAverageCompressedLength() <<
+			", compression ratio: " << space.getCompressionRatio() << endl <<
+			"\tversions: " << space.versions <<
+			", average version length: " <<
+				(space.versions == 0 ? 0 : double(space.versionLength) / space.versions) <<
+			", versioned records: " << space.versionedRecords <<
+			", average chain length: " << space.getAverageChainLength() <<
+			", max chain length: " << space.maxChainLength << endl <<
+			"\tfill distribution:" << endl;
+
+		for (unsigned j = 0; j < RelationSpace::FILL_BUCKETS; ++j)
+		{
+			unsigned low = j * 100 / RelationSpace::FILL_BUCKETS;
+			unsigned high = (j + 1) * 100 / RelationSpace::FILL_BUCKETS - 1;
+
+			cout << "\t\t" << std::setw(2) << low << " - " << std::setw(2) <<
+				(j == RelationSpace::FILL_BUCKETS - 1 ? 100 : high) << "% = " <<
+				space.fillHistogram[j] << endl;
+		}
+	}
+}
+
+// Owners of the largest blobs of the relation, from a scan of it reading the blob fields of the
+// format. They are named by the blob field and the key fields, or the record number without
+// key fields.
+static void findBlobOwners(Database& database, const string& keySpec,
+	const vector<BlobInfo>& blobs, vector<string>& owners)
+{
+	const Format format(formatSpec);
+	const vector<unsigned> keyFields(keySpec.empty() ? vector<unsigned>() :
+		findFields(format, keySpec));
+	vector<unsigned> blobFields;
+
+	for (unsigned n = 0; n < format.fields.size(); ++n)
+	{
+		if (format.fields[n].type == Format::TYPE_BLOB)
+			blobFields.push_back(n);
+	}
+
+	if (blobFields.empty())
+		throw runtime_error("The format has no blob fields");
+
+	const unsigned relationId = database.findRelation(relationName.c_str());
+	map<boost::uint64_t, unsigned> numbers;
+
+	for (unsigned i = 0; i < blobs.size(); ++i)
+	{
+		if (blobs[i].relation == relationId)
+			numbers[blobs[i].number] = i;
+	}
+
+	owners.assign(blobs.size(), string());
+
+	FullScanStream scan(&database, relationName.c_str());
+	boost::scoped_array<char> record(new char[ScanStream::MAX_RECORD_SIZE]);
+	unsigned found = 0;
+
+	while (found < numbers.size() && scan.fetch(record.get()))
+	{
+		for (vector<unsigned>::const_iterator i = blobFields.begin(); i != blobFields.end(); ++i)
+		{
+			if (format.isNull(record.get(), *i))
+				continue;
+
+			// The relation in the first 2 bytes of the blob id and the record number in the
+			// fourth and last 4.
+			const boost::uint8_t* id = format.getPointer(record.get(), *i);
+			boost::uint16_t relation;
+			boost::uint32_t number;
+			memcpy(&relation, id, sizeof(relation));
+			memcpy(&number, id + 4, sizeof(number));
+
+			map<boost::uint64_t, unsigned>::const_iterator blob =
+				numbers.find((boost::uint64_t(id[3]) << 32) | number);
+
+			if (relation != relationId || blob == numbers.end() || !owners[blob->second].empty())
+				continue;
+
+			std::ostringstream owner;
+			owner << format.fields[*i].name << " of ";
+
+			if (keyFields.empty())
+				owner << "record " << scan.getRecordNumber();
+
+			for (vector<unsigned>::const_iterator j = keyFields.begin(); j != keyFields.end(); ++j)
+			{
+				owner << (j == keyFields.begin() ? "" : ", ") << format.fields[*j].name << " = ";
+
+				if (format.isNull(record.get(), *j))
+					owner << "null";
+				else
+					format.print(owner, *j, format.getPointer(record.get(), *j));
+			}
+
+			owners[blob->second] = owner.str();
+			++found;
+		}
+	}
+}
+
+static void blobs(Database& database, const string& keySpec, unsigned top, unsigned threads,
+	unsigned chunkPages)
+{
+	const int relationId = relationName.empty() ? -1 : database.findRelation(relationName.c_str());
+
+	BlobAnalyzer analyzer(&database, top, relationId);
+	analyzer.run(threads, chunkPages);
+
+	vector<string> owners(analyzer.largest.size());
+
+	if (!relationName.empty() && !formatSpec.empty())
+		findBlobOwners(database, keySpec, analyzer.largest, owners);
+
+	map<Database::RelationId, string> names;
+	database.getRelationNames(names);
+
+	const unsigned pageSize = database.header.pageSize;
+	const double mb = 1024.0 * 1024.0;
+
+	cout << std::fixed << std::setprecision(2);
+
+	for (map<unsigned, RelationBlobs>::const_iterator i = analyzer.relations.begin();
+		 i != analyzer.relations.end();
+		 ++i)
+	{
+		const RelationBlobs& blobs = i->second;
+
+		if (relationId >= 0 && i->first != unsigned(relationId))
+			continue;
+
+		map<Database::RelationId, string>::const_iterator name =
+			names.find(static_cast<Database::RelationId>(i->first));
+
+		cout << (name == names.end() ? string("?") : name->second) << " (" << i->first << ")" <<
+			endl;
+
+		boost::uint64_t count = 0;
+		boost::uint64_t length = 0;
+
+		for (unsigned j = 0; j < RelationBlobs::LEVELS; ++j)
+		{
+			count += blobs.blobs[j];
+			length += blobs.length[j];
+		}
+
+		cout << "\tblobs: " << count << ", length: " << length / mb << " MB" <<
+			", average length: " << (count == 0 ? 0 : double(length) / count) <<
+			", max length: " << blobs.maxLength << endl;
+
+		for (unsigned j = 0; j < RelationBlobs::LEVELS; ++j)
+		{
+			cout << "\tlevel " << j << ": " << blobs.blobs[j] << " (" <<
+				(count == 0 ? 0 : 100.0 * blobs.blobs[j] / count) << "%)" <<
+				", length: " << blobs.length[j] / mb << " MB" << endl;
+		}
+
+		cout << "\tin data pages: " << blobs.headerLength / mb << " MB" <<
+			", blob pages: " << blobs.blobPages <<
+			", pointer pages: " << blobs.pointerPages <<
+			", page overhead: " << blobs.getPageOverhead(pageSize) << "%" << endl <<
+			"\tsize distribution:" << endl;
+
+		for (unsigned j = 0; j < RelationBlobs::SIZE_BUCKETS; ++j)
+		{
+			const bool last = j == RelationBlobs::SIZE_BUCKETS - 1;
+			const unsigned limit = 1024u << (2 * (last ? j - 1 : j));	// bytes
+
+			cout << "\t\t" << (last ? ">= " : "< ") << std::setw(3) <<
+				(limit < 1024 * 1024 ? limit >> 10 : limit >> 20) <<
+				(limit < 1024 * 1024 ? " KB" : " MB") << " = " << blobs.sizeHistogram[j] << endl;
+		}
+	}
+
+	if (analyzer.orphanPages != 0)
+		cout << "blob pages of no blob: " << analyzer.orphanPages << endl;
+
+	if (analyzer.largest.empty())
+		return;
+
+	cout << "largest blobs:" << endl;
+
+	for (unsigned i = 0; i < analyzer.largest.size(); ++i)
+	{
+		const BlobInfo& blob = analyzer.largest[i];
+		map<Database::RelationId, string>::const_iterator name =
+			names.find(static_cast<Database::RelationId>(blob.relation));
+
+		cout << "\t" << (name == names.end() ? string("?") : name->second) <<
+			" blob " << blob.number <<
+			": length " << blob.length <<
+			", level " << blob.level <<
+			", pages " << blob.pages;
+
+		if (!owners[i].empty())
+			cout << ", " << owners[i];
+
+		cout << endl;
+	}
+}
+
+// Polls the header page every interval seconds, forever when samples is 0.
+static void watch(Database& database, const string& output, double interval, unsigned samples)
+{
+	std::ofstream file;
+
+	if (!output.empty() && output != "-")
+	{
+		file.open(output.c_str());
+
+		if (!file)
+			throw runtime_error("Cannot create " + output);
+	}
+
+	TransactionMonitor monitor(&database, (file.is_open() ? file : cout));
+	monitor.writeHeader();
+
+	for (unsigned i = 0; samples == 0 || i < samples; ++i)
+	{
+		if (i != 0)
+			usleep(useconds_t(interval * 1000000));
+
+		monitor.poll();
+	}
+}
+
+// Direct reads go first, so the buffered sweep doesn't find the file already cached by them.
+static void benchmark(Database& database, unsigned threads, unsigned chunkPages)
+{
+	const bool direct = database.isDirectIo();
+	const unsigned pageSize = database.header.pageSize;
+
+	cout << "io,pages,seconds,mb_per_second,cached_before,cached_after,cached_growth" << endl;
+
+	for (unsigned i = 0; i < 2; ++i)
+	{
+		IoBenchmarkResult result = runIoBenchmark(&database, i == 0, threads, chunkPages);
+
+		cout << (result.direct ? "direct" : "buffered") << "," <<
+			result.pages << "," <<
+			std::fixed << std::setprecision(3) << result.seconds << "," <<
+			std::setprecision(1) << result.getMegabytesPerSecond(pageSize) << "," <<
+			result.cachedBefore << "," <<
+			result.cachedAfter << "," <<
+			int(result.cachedAfter - result.cachedBefore) << endl;
+	}
+
+	database.setDirectIo(direct);
+}
+
+// Returns 0 when no problems are found, 2 otherwise.
+static int validate(Database& database, const string& output, unsigned threads,
+	unsigned chunkPages)
+{
+	Validator validator(&database);
+	validator.run(threads, chunkPages);
+
+	if (output.empty() || output == "-")
+		validator.writeReport(cout, databaseName.c_str());
+	else
+	{
+		std::ofstream out(output.c_str());
+		validator.writeReport(out, databaseName.c_str());
+
+		if (!out.flush())
+			throw runtime_error("Error writing " + output);
+	}
+
+	return validator.errorCount == 0 ? 0 : 2;
+}
+
+static int start(int argc, char* argv[])
+{
+	string mode("count");
+	string sampleMethod("random");
+	SampleOptions sampleOptions;
+	vector<string> indexSpecs;
+	unsigned threads = 1;
+	unsigned buckets = 10;
+	string output;
+	unsigned rowGroupSize = 1024 * 1024;
+	string outputFormat("parquet");
+	boost::uint32_t sinceScn = 0;
+	string generationMap;
+	unsigned chunkPages = 256;
+	string databaseList;
+	string baseName;
+	unsigned deviceReads = 4;
+	unsigned top = 10;
+	double interval = 10;
+	unsigned samples = 0;
+	LiveOptions live;
+	string delta;
+	string io("buffered");
+	unsigned queueDepth = 0;
+	string metricsOutput;
+	string keySpec;
+	string indexFile;
+	vector<string> keyValues;
+	unsigned sortMemory = 256;
+	string keyFile;
+	string bloomFile;
+	double falsePositiveRate = 0.01;
+	ExportOptions exportOptions;
+	string socketName;
+	vector<string> caches;
+
+	po::options_description options("Options");
+	options.add_options()
+		("help", "help")
+		("mode", po::value<string>(&mode), "count | sample | stats | export | changes | validate | space | watch | bench | index | lookup | bloom | serve | diff | blobs")
+		("database", po::value<string>(&databaseName), "database file")
+		("database-list", po::value<string>(&databaseList),
+			"text file of database files, one per line, whose relations export scans together")
+		("device-reads", po::value<unsigned>(&deviceReads),
+			"files of a database list read at once from the same disk")
+		("delta", po::value<string>(&delta), "nbackup delta file of the locked database")
+		("base-database", po::value<string>(&baseName), "older copy of the database diff compares with")
+		("records", "write the changed records of the relation instead of the changed pages in diff")
+		("relation", po::value<string>(&relationName), "relation name")
+		("format", po::value<string>(&formatSpec),
+			"record format, e.g. \"id integer, name varchar(20), d date\"")
+		("sample-method", po::value<string>(&sampleMethod), "random | stratified")
+		("sample-percent", po::value<double>(&sampleOptions.percent), "percent of data pages")
+		("sample-pages", po::value<unsigned>(&sampleOptions.pages), "number of data pages")
+		("seed", po::value<unsigned>(&sampleOptions.seed), "random seed")
+		("index", po::value<vector<string> >(&indexSpecs),
+			"comma separated index segments to compute statistics for, may be repeated")
+		("histogram-buckets", po::value<unsigned>(&buckets), "number of histogram buckets")
+		("top", po::value<unsigned>(&top), "number of the largest blobs listed by blobs")
+		("threads", po::value<unsigned>(&threads), "number of threads")
+		("output", po::value<string>(&output), "output file, - for stdout in text formats")
+		("output-format", po::value<string>(&outputFormat), "parquet | csv | tsv")
+		("header", "write field names in the first line of text formats")
+		("since-scn", po::value<boost::uint32_t>(&sinceScn), "watermark of the previous changes run")
+		("generation-map", po::value<string>(&generationMap),
+			"file with the page generations and record hashes of the previous changes run, updated "
+			"by this one")
+		("row-group-size", po::value<unsigned>(&rowGroupSize), "records per parquet row group")
+		("interval", po::value<double>(&interval), "seconds between watch polls or cache refreshes")
+		("samples", po::value<unsigned>(&samples), "number of watch polls, 0 for no limit")
+		("live", "the database is in use: check and retry pages that change while being read")
+		("retries", po::value<unsigned>(&live.retries), "retries of a changing page in live mode")
+		("backoff", po::value<unsigned>(&live.backoff),
+			"microseconds before the first retry in live mode, doubled on each one")
+		("snapshot", "read the record versions committed when the scan starts")
+		("chunk-pages", po::value<unsigned>(&chunkPages),
+			"pages read at once by validate, space, blobs, bench, diff and database list exports")
+		("pin-threads", "pin scan threads to the CPUs of the NUMA node of the database file")
+		("huge-pages", "allocate scan buffers in 2 MB huge pages when available")
+		("io", po::value<string>(&io), "buffered | direct, the latter bypassing the OS page cache")
+		("queue-depth", po::value<unsigned>(&queueDepth),
+			"data pages read ahead through io_uring by the relation scans and lookups, and back "
+			"versions read together by snapshots, 0 for synchronous reads")
+		("metrics", po::value<string>(&metricsOutput),
+			"file, or - for stderr, to write the scan counters to as JSON at the end and on SIGUSR1")
+		("key", po::value<string>(&keySpec),
+			"comma separated fields of the key index built by index, of the filter built by bloom "
+			"or naming the owners of the largest blobs")
+		("index-file", po::value<string>(&indexFile), "key index file written by index and read by lookup")
+		("key-value", po::value<vector<string> >(&keyValues),
+			"comma separated key values to look up, may be repeated")
+		("sort-memory", po::value<unsigned>(&sortMemory),
+			"megabytes of sorted entries kept in memory by index before spilling them to disk")
+		("key-file", po::value<string>(&keyFile),
+			"text file of keys, one per line, the filter of bloom is built from instead of the relation")
+		("bloom-filter", po::value<string>(&bloomFile),
+			"Bloom filter file written by bloom, or read by export and changes to keep only its keys")
+		("bloom-key", po::value<string>(&exportOptions.bloomKeySpec),
+			"comma separated fields matched with the Bloom filter, by default the ones it was built from")
+		("false-positive-rate", po::value<double>(&falsePositiveRate),
+			"false positive rate of the filter built by bloom")
+		("where", po::value<string>(&exportOptions.whereSpec),
+			"condition on the fields of the format the records of export, changes and lookup must meet")
+		("column", po::value<vector<string> >(&exportOptions.columnSpecs),
+			"name = expression computed column appended to the records exported, may be repeated")
+		("socket", po::value<string>(&socketName), "Unix socket the cache server listens on")
+		("cache", po::value<vector<string> >(&caches),
+			"relation:format kept in memory by serve, may be repeated")
+	;
+
+	po::positional_options_description positional;
+	positional.add("mode", 1);
+
+	po::variables_map optionsMap;
+	po::store(po::command_line_parser(argc, argv).options(options).positional(positional).run(),
+		optionsMap);
+	po::notify(optionsMap);
+
+	// Validation, space and blob analysis, watch, benchmark and diff work on the whole file, the
+	// cache server on the relations of --cache, and filters of key files don't read any.
+	const bool keyFileOnly = mode == "bloom" && !keyFile.empty();
+
+	if (optionsMap.count("help") ||
+		(databaseName.empty() && databaseList.empty() && !keyFileOnly) ||
+		(relationName.empty() && mode != "validate" && mode != "space" && mode != "blobs" &&
+			mode != "watch" && mode != "bench" && mode != "serve" && mode != "diff" &&
+			!keyFileOnly))
+	{
+		cout << "fbods [mode] --database <file> --relation <name> [options]" << endl <<
+			options << endl;
+		return 1;
+	}
+
+	if (sampleMethod == "random")
+		sampleOptions.method = SampleOptions::METHOD_RANDOM;
+	else if (sampleMethod == "stratified")
+		sampleOptions.method = SampleOptions::METHOD_STRATIFIED;
+	else
+		throw runtime_error("Invalid sample method: " + sampleMethod);
+
+	if (keyFileOnly)
+	{
+		buildBloomFilter(NULL, keySpec, keyFile, bloomFile, falsePositiveRate);
+		return 0;
+	}
+
+	boost::scoped_ptr<BloomFilter> filter(
+		(bloomFile.empty() || mode == "bloom") ? NULL : new BloomFilter(bloomFile.c_str()));
+	exportOptions.bloomFilter = filter.get();
+
+	// Started before the worker threads, for them to leave SIGUSR1 to the metrics thread.
+	boost::scoped_ptr<ScanMetrics> metrics(metricsOutput.empty() ? NULL : new ScanMetrics);
+
+	if (metrics)
+		metrics->writeOnSignal(metricsOutput);
+
+	live.enabled = optionsMap.count("live") != 0;
+
+	if (!databaseList.empty())
+	{
+		if (mode != "export" || (outputFormat != "csv" && outputFormat != "tsv"))
+			throw runtime_error("Database lists are exported in csv or tsv output formats");
+
+		MultiFileOptions multiFileOptions;
+		multiFileOptions.deviceReads = deviceReads;
+		multiFileOptions.chunkPages = chunkPages;
+		multiFileOptions.directIo = io == "direct";
+		multiFileOptions.live = live;
+		multiFileOptions.placement.pinThreads = optionsMap.count("pin-threads") != 0;
+		multiFileOptions.placement.hugePages = optionsMap.count("huge-pages") != 0;
+
+		const unsigned skipped = exportFiles(databaseList, output,
+			(outputFormat == "csv" ? TextExporter::STYLE_CSV : TextExporter::STYLE_TSV),
+			optionsMap.count("header") != 0, threads, multiFileOptions, exportOptions);
+
+		if (metrics)
+			metrics->write(metricsOutput);
+
+		return skipped == 0 ? 0 : 1;
+	}
+
+	Database database(databaseName.c_str());
+
+	if (!delta.empty())
+		database.openDelta(delta.c_str());
+
+	database.live = live;
+
+	database.placement.pinThreads = optionsMap.count("pin-threads") != 0;
+	database.placement.hugePages = optionsMap.count("huge-pages") != 0;
+
+	if (io == "direct")
+		database.setDirectIo(true);
+	else if (io != "buffered")
+		throw runtime_error("Invalid io: " + io);
+
+	database.queueDepth = queueDepth;
+
+	boost::scoped_ptr<TransactionSnapshot> snapshot(
+		optionsMap.count("snapshot") ? new TransactionSnapshot(&database) : NULL);
+	database.snapshot = snapshot.get();
+
+	int result = 0;
+
+	if (mode == "count")
+		count(database);
+	else if (mode == "sample")
+		sample(database, sampleOptions);
+	else if (mode == "stats")
+		statistics(database, indexSpecs, threads, buckets);
+	else if (mode == "export" && outputFormat == "parquet")
+		exportParquet(database, output, rowGroupSize, threads, exportOptions);
+	else if (mode == "export" && (outputFormat == "csv" || outputFormat == "tsv"))
+	{
+		exportText(database, output,
+			(outputFormat == "csv" ? TextExporter::STYLE_CSV : TextExporter::STYLE_TSV),
+			optionsMap.count("header") != 0, threads, exportOptions);
+	}
+	else if (mode == "export")
+		throw runtime_error("Invalid output format: " + outputFormat);
+	else if (mode == "changes" && (outputFormat == "csv" || outputFormat == "tsv"))
+	{
+		changes(database, sinceScn, generationMap, output,
+			(outputFormat == "csv" ? TextExporter::STYLE_CSV : TextExporter::STYLE_TSV),
+			optionsMap.count("header") != 0, threads, exportOptions);
+	}
+	else if (mode == "changes")
+		throw runtime_error("Changes are written in csv or tsv output formats");
+	else if (mode == "validate")
+		result = validate(database, output, threads, chunkPages);
+	else if (mode == "space")
+		space(database, threads, chunkPages);
+	else if (mode == "blobs")
+		blobs(database, keySpec, top, threads, chunkPages);
+	else if (mode == "watch")
+		watch(database, output, interval, samples);
+	else if (mode == "bench")
+		benchmark(database, threads, chunkPages);
+	else if (mode == "index")
+		buildIndex(database, keySpec, indexFile, threads, sortMemory);
+	else if (mode == "lookup" && (outputFormat == "csv" || outputFormat == "tsv"))
+	{
+		lookup(database, indexFile, keyValues, output,
+			(outputFormat == "csv" ? TextExporter::STYLE_CSV : TextExporter::STYLE_TSV),
+			optionsMap.count("header") != 0, exportOptions);
+	}
+	else if (mode == "lookup")
+		throw runtime_error("Lookups are written in csv or tsv output formats");
+	else if (mode == "bloom")
+		buildBloomFilter(&database, keySpec, keyFile, bloomFile, falsePositiveRate);
+	else if (mode == "serve")
+		serve(database, socketName, caches, interval);
+	else if (mode == "diff")
+	{
+		diff(database, baseName, output, optionsMap.count("records") != 0,
+			(outputFormat == "tsv" ? TextExporter::STYLE_TSV : TextExporter::STYLE_CSV),
+			optionsMap.count("header") != 0, threads, chunkPages);
+	}
+	else
+		throw runtime_error("Invalid mode: " + mode);
+
+	if (live.enabled || snapshot)
+	{
+		cerr << "retried reads: " << database.retriedReads <<
+			", skipped pages: " << database.skippedPages <<
+			", unresolved versions: " << database.unresolvedVersions << endl;
+	}
+
+	if (metrics)
+		metrics->write(metricsOutput);
+
+	return result;
+}
+
+
+//------------------------------------------------------------------------------
+
+}	// fbods
+
+
+int main(int argc, char* argv[])
+{
+	try
+	{
+		return fbods::start(argc, argv);
+	}
+	catch (const exception& e)
+	{
+		cerr << e.what() << endl;
+		return 1;
+	}
 }
@@ -0,0 +1,245 @@
+/*
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Initial Developer of the Original Code is Adriano dos Santos Fernandes.
+ * Portions created by the Initial Developer are Copyright (C) 2012 the Initial Developer.
+ * All Rights Reserved.
+ *
+ * Contributor(s):
+ *
+ */
+
+#ifndef FBSTUFF_ODS_MESSAGE_H
+#define FBSTUFF_ODS_MESSAGE_H
+
+#include "Database.h"
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <boost/cstdint.hpp>
+#include <boost/mpl/if.hpp>
+#include <boost/preprocessor/cat.hpp>
+#include <boost/preprocessor/control/expr_if.hpp>
+#include <boost/preprocessor/seq/for_each_i.hpp>
+#include <boost/preprocessor/seq/size.hpp>
+#include <boost/preprocessor/stringize.hpp>
+#include <boost/preprocessor/tuple/elem.hpp>
+
+namespace fbods
+{
+
+//------------------------------------------------------------------------------
+
+
+// Records with a layout known at compile time, declared the way FB_UDR_MESSAGE does:
+//
+//	FBODS_MESSAGE(Account,
+//		(FBODS_INTEGER, id)
+//		(FBODS_VARCHAR(20), name)
+//		(FBODS_NUMERIC(18, 2), amount)
+//	);
+//
+// The struct has the engine layout, so scans decompress records straight into it with
+// ScanStream::fetchMessage, without the runtime descriptor of Format. getSpec returns the
+// equivalent Format specification.
+
+template <int LENGTH>
+struct MessageChar
+{
+	char data[LENGTH];
+};
+
+struct MessageTimestamp
+{
+	boost::int32_t date;
+	boost::uint32_t time;
+};
+
+struct MessageQuad
+{
+	boost::uint32_t high;
+	boost::uint32_t low;
+};
+
+// Storage of numeric and decimal fields, as chosen by Format.
+template <int PRECISION>
+struct MessageNumeric
+{
+	typedef typename boost::mpl::if_c<(PRECISION < 5), boost::int16_t,
+		typename boost::mpl::if_c<(PRECISION < 10), boost::int32_t, boost::int64_t>::type>::type Type;
+};
+
+template <int PRECISION>
+struct MessageDecimal
+{
+	typedef typename boost::mpl::if_c<(PRECISION < 10), boost::int32_t, boost::int64_t>::type Type;
+};
+
+// Field types: the C++ type and the Format type specification.
+#define FBODS_SMALLINT			(boost::int16_t, "smallint")
+#define FBODS_INTEGER			(boost::int32_t, "integer")
+#define FBODS_BIGINT			(boost::int64_t, "bigint")
+#define FBODS_FLOAT				(float, "float")
+#define FBODS_DOUBLE			(double, "double precision")
+#define FBODS_DATE				(boost::int32_t, "date")
+#define FBODS_TIME				(boost::uint32_t, "time")
+#define FBODS_TIMESTAMP			(::fbods::MessageTimestamp, "timestamp")
+#define FBODS_BLOB				(::fbods::MessageQuad, "blob")
+#define FBODS_CHAR(length)		(::fbods::MessageChar<length>, "char(" #length ")")
+#define FBODS_VARCHAR(length)	(::fbods::VarChar<length>, "varchar(" #length ")")
+#define FBODS_NUMERIC(precision, scale)	\
+	(::fbods::MessageNumeric<precision>::Type, "numeric(" #precision ", " #scale ")")
+#define FBODS_DECIMAL(precision, scale)	\
+	(::fbods::MessageDecimal<precision>::Type, "decimal(" #precision ", " #scale ")")
+
+// Turns the (type, name)(type, name) list into a sequence of ((type, name)) elements.
+#define FBODS_MESSAGE_X(type, name)	((type, name)) FBODS_MESSAGE_Y
+#define FBODS_MESSAGE_Y(type, name)	((type, name)) FBODS_MESSAGE_X
+#define FBODS_MESSAGE_X0
+#define FBODS_MESSAGE_Y0
+
+#define FBODS_MESSAGE_FIELD_TYPE(field)	BOOST_PP_TUPLE_ELEM(2, 0, BOOST_PP_TUPLE_ELEM(2, 0, field))
+#define FBODS_MESSAGE_FIELD_NAME(field)	BOOST_PP_TUPLE_ELEM(2, 1, field)
+
+#define FBODS_MESSAGE_FIELD(r, _, i, field)	\
+	FBODS_MESSAGE_FIELD_TYPE(field) FBODS_MESSAGE_FIELD_NAME(field);
+
+#define FBODS_MESSAGE_SPEC(r, _, i, field)	\
+	BOOST_PP_EXPR_IF(i, ", ") BOOST_PP_STRINGIZE(FBODS_MESSAGE_FIELD_NAME(field)) " "	\
+		BOOST_PP_TUPLE_ELEM(2, 1, BOOST_PP_TUPLE_ELEM(2, 0, field))
+
+#define FBODS_MESSAGE_END(r, name, i, field)	\
+	offsetof(name, FBODS_MESSAGE_FIELD_NAME(field)) + sizeof(FBODS_MESSAGE_FIELD_TYPE(field)),
+
+#define FBODS_MESSAGE(name, fields)	\
+	FBODS_MESSAGE_I(name, BOOST_PP_CAT(FBODS_MESSAGE_X fields, 0))
+
+#define FBODS_MESSAGE_I(name, fields)	\
+	struct name	\
+	{	\
+		static const unsigned FIELD_COUNT = BOOST_PP_SEQ_SIZE(fields);	\
+		\
+		static const char* getSpec()	\
+		{	\
+			return BOOST_PP_SEQ_FOR_EACH_I(FBODS_MESSAGE_SPEC, _, fields);	\
+		}	\
+		\
+		/* Offset of the end of each field. */	\
+		static unsigned getFieldEnd(unsigned n)	\
+		{	\
+			static const unsigned ends[] = {	\
+				BOOST_PP_SEQ_FOR_EACH_I(FBODS_MESSAGE_END, name, fields)	\
+			};	\
+			return ends[n];	\
+		}	\
+		\
+		bool isNull(unsigned n) const	\
+		{	\
+			return (reinterpret_cast<const boost::uint8_t*>(nullFlags)[n >> 3] & (1 << (n & 7))) != 0;	\
+		}	\
+		\
+		boost::uint32_t nullFlags[(BOOST_PP_SEQ_SIZE(fields) + 32) / 32];	\
+		BOOST_PP_SEQ_FOR_EACH_I(FBODS_MESSAGE_FIELD, _, fields)	\
+	}
+
+// Decompresses a record into [pt, limit), returning where the output stopped. The loop bound
+// is the message size, known at compile time, so there's no intermediate buffer and nothing
+// past the message is decoded. Damaged records are cut where their data ends.
+template <Compression COMPRESSION>
+inline boost::uint8_t* decodeRecord(const boost::uint8_t* p, const boost::uint8_t* end,
+	boost::uint8_t* pt, boost::uint8_t* limit)
+{
+	if (COMPRESSION == COMPRESSION_NONE)
+	{
+		const size_t length = std::min<size_t>(end - p, limit - pt);
+		memcpy(pt, p, length);
+		return pt + length;
+	}
+
+	while (p < end && pt < limit)
+	{
+		const boost::int8_t control = boost::int8_t(*p++);
+
+		// Runs are short, so plain loops beat the memset and memcpy calls.
+		if (control < 0)
+		{
+			if (getRunLengthSize<COMPRESSION>(control) >= size_t(end - p))
+				break;
+
+			const unsigned length = getRunLength<COMPRESSION>(control, p);
+			const boost::uint8_t value = *p++;
+
+			for (boost::uint8_t* runEnd = pt + std::min<size_t>(length, limit - pt); pt < runEnd; ++pt)
+				*pt = value;
+		}
+		else
+		{
+			const size_t length = std::min<size_t>(control, end - p);
+			const boost::uint8_t* runEnd = p + length;
+
+			for (boost::uint8_t* copyEnd = pt + std::min<size_t>(length, limit - pt); pt < copyEnd; )
+				*pt++ = *p++;
+
+			p = runEnd;
+		}
+	}
+
+	return pt;
+}
+
+// Decompresses a record into a message. A shorter record, stored in an older format, leaves
+// the missing fields null. Returns the bytes decoded.
+template <typename Message>
+inline size_t decodeMessage(const boost::uint8_t* p, const boost::uint8_t* end, Message& message,
+	Compression compression = COMPRESSION_RLE)
+{
+	boost::uint8_t* const start = reinterpret_cast<boost::uint8_t*>(&message);
+	boost::uint8_t* const limit = start + sizeof(Message);
+	boost::uint8_t* pt;
+
+	switch (compression)
+	{
+		case COMPRESSION_RLE_LONG_RUNS:
+			pt = decodeRecord<COMPRESSION_RLE_LONG_RUNS>(p, end, start, limit);
+			break;
+
+		case COMPRESSION_NONE:
+			pt = decodeRecord<COMPRESSION_NONE>(p, end, start, limit);
+			break;
+
+		default:
+			pt = decodeRecord<COMPRESSION_RLE>(p, end, start, limit);
+			break;
+	}
+
+	const size_t decoded = pt - start;
+
+	if (pt < limit)
+	{
+		memset(pt, 0, limit - pt);
+
+		boost::uint8_t* nullFlags = reinterpret_cast<boost::uint8_t*>(message.nullFlags);
+
+		for (unsigned i = 0; i < Message::FIELD_COUNT; ++i)
+		{
+			if (Message::getFieldEnd(i) > decoded || decoded <= (i >> 3))
+				nullFlags[i >> 3] |= 1 << (i & 7);
+		}
+	}
+
+	return decoded;
+}
+
+//------------------------------------------------------------------------------
+
+}	// fbods
+
+#endif	// FBSTUFF_ODS_MESSAGE_H
@@ -0,0 +1,517 @@
+/*
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Initial Developer of the Original Code is Adriano dos Santos Fernandes.
+ * Portions created by the Initial Developer are Copyright (C) 2012 the Initial Developer.
+ * All Rights Reserved.
+ *
+ * Contributor(s):
+ *
+ */
+
+#include "MultiFileScan.h"
+#include "BufferArena.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <map>
+#include <stdexcept>
+#include <boost/bind.hpp>
+#include <boost/scoped_array.hpp>
+#include <boost/thread.hpp>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+
+namespace fbods
+{
+
+using std::map;
+using std::runtime_error;
+using std::string;
+using std::vector;
+
+//------------------------------------------------------------------------------
+
+
+namespace
+{
+	// Disk holding a file as major:minor, the one of the whole disk for partitions.
+	string getDevice(const string& filename)
+	{
+		struct stat st;
+
+		if (stat(filename.c_str(), &st) != 0)
+			throw runtime_error("Cannot open " + filename);
+
+		char path[96];
+		sprintf(path, "/sys/dev/block/%u:%u/partition", major(st.st_dev), minor(st.st_dev));
+
+		if (access(path, F_OK) == 0)
+		{
+			sprintf(path, "/sys/dev/block/%u:%u/../dev", major(st.st_dev), minor(st.st_dev));
+
+			std::ifstream file(path);
+			string device;
+
+			if (file >> device)
+				return device;
+		}
+
+		sprintf(path, "%u:%u", major(st.st_dev), minor(st.st_dev));
+		return path;
+	}
+
+	// Records of data pages already read into memory.
+	class ChunkScanStream : public ScanStream
+	{
+	public:
+		ChunkScanStream(Database* aDatabase, char* aPages, unsigned aCount)
+			: ScanStream(aDatabase),
+			  pages(aPages),
+			  count(aCount),
+			  pageNum(0)
+		{
+		}
+
+	protected:
+		virtual bool readData()
+		{
+			if (pageNum == count)
+				return false;
+
+			const size_t offset = size_t(pageNum++) * database->header.pageSize;
+			data = reinterpret_cast<DataPage*>(pages + offset);
+			return true;
+		}
+
+	private:
+		char* pages;
+		unsigned count;
+		unsigned pageNum;
+	};
+
+	struct SourceFile
+	{
+		SourceFile()
+			: device(0),
+			  database(NULL),
+			  relationId(Database::RELATION_ID_PAGES),
+			  nextPage(0),
+			  activeChunks(0)
+		{
+		}
+
+		string filename;
+		string error;	// of the file being skipped
+		unsigned device;
+		Database* database;	// while its chunks are being scanned
+		Database::RelationId relationId;
+		vector<unsigned> pages;
+		size_t nextPage;	// first one not handed out
+		unsigned activeChunks;
+	};
+
+	struct Device
+	{
+		Device()
+			: inFlight(0),
+			  nextOpen(0),
+			  opening(0)
+		{
+		}
+
+		vector<unsigned> files;
+		unsigned inFlight;	// threads opening files or reading pages of the device
+		size_t nextOpen;	// in files
+		unsigned opening;
+		std::deque<unsigned> open;	// files with pages not yet handed out
+	};
+
+	struct Task
+	{
+		unsigned file;
+		bool open;	// or read the pages from begin to end
+		size_t begin;
+		size_t end;
+	};
+
+	class Scan
+	{
+	public:
+		Scan(const vector<string>& filenames, const string& aRelationName,
+				const MultiFileOptions& aOptions)
+			: relationName(aRelationName),
+			  options(aOptions),
+			  files(filenames.size()),
+			  lastDevice(0)
+		{
+			if (options.deviceReads == 0)
+				options.deviceReads = 1;
+
+			if (options.chunkPages == 0)
+				options.chunkPages = 1;
+
+			map<string, unsigned> deviceNumbers;
+
+			for (unsigned i = 0; i < files.size(); ++i)
+			{
+				files[i].filename = filenames[i];
+				string device;
+
+				try
+				{
+					device = getDevice(filenames[i]);
+				}
+				catch (const std::exception& e)
+				{
+					files[i].error = e.what();
+					continue;
+				}
+
+				map<string, unsigned>::iterator number = deviceNumbers.find(device);
+
+				if (number == deviceNumbers.end())
+				{
+					number = deviceNumbers.insert(std::make_pair(device, devices.size())).first;
+					devices.push_back(Device());
+				}
+
+				files[i].device = number->second;
+				devices[number->second].files.push_back(i);
+			}
+		}
+
+		~Scan()
+		{
+			for (vector<SourceFile>::iterator i = files.begin(); i != files.end(); ++i)
+				delete i->database;
+		}
+
+	public:
+		void run(ChunkVisitor* visitor, unsigned worker)
+		{
+			WorkerPlacement placement(options.placement, worker);
+			boost::scoped_array<char> bufferScope;
+			char* buffer = NULL;
+			size_t bufferSize = 0;
+			Task task;
+
+			while (next(task))
+			{
+				SourceFile& file = files[task.file];
+
+				if (task.open)
+				{
+					openFile(file);
+					continue;
+				}
+
+				unsigned count;
+
+				try
+				{
+					const unsigned pageSize = file.database->header.pageSize;
+					const size_t size = size_t(options.chunkPages) * pageSize;
+
+					if (size > bufferSize)
+					{
+						buffer = allocateBuffer(size, bufferScope);
+						bufferSize = size;
+					}
+
+					count = readChunk(file, task, buffer);
+				}
+				catch (const std::exception& e)
+				{
+					skip(file, e.what());
+					continue;
+				}
+
+				release(file.device);
+
+				try
+				{
+					ChunkScanStream scan(file.database, buffer, count);
+					visitor->visit(task.file, scan);
+				}
+				catch (const std::exception& e)
+				{
+					fail(file.filename + ": " + e.what());
+				}
+
+				finish(file);
+			}
+		}
+
+		// Errors of the skipped files, in their order.
+		void getErrors(vector<string>& errors) const
+		{
+			for (vector<SourceFile>::const_iterator i = files.begin(); i != files.end(); ++i)
+			{
+				if (!i->error.empty())
+					errors.push_back(i->filename + ": " + i->error);
+			}
+		}
+
+	private:
+		// Hands out the next chunk of the first open file of a device, or the next file of the
+		// device to open, from the devices round robin. Waits while the devices with work are
+		// busy or files are still being opened.
+		bool next(Task& task)
+		{
+			boost::mutex::scoped_lock lock(mutex);
+
+			while (error.empty())
+			{
+				bool pending = false;
+
+				for (unsigned n = 1; n <= devices.size(); ++n)
+				{
+					const unsigned number = (lastDevice + n) % devices.size();
+					Device& device = devices[number];
+					const bool hasWork = !device.open.empty() ||
+						device.nextOpen < device.files.size();
+
+					pending |= hasWork || device.opening > 0;
+
+					if (!hasWork || device.inFlight >= options.deviceReads)
+						continue;
+
+					++device.inFlight;
+					lastDevice = number;
+
+					if (device.open.empty())
+					{
+						task.file = device.files[device.nextOpen++];
+						task.open = true;
+						++device.opening;
+						return true;
+					}
+
+					SourceFile& file = files[device.open.front()];
+
+					task.file = device.open.front();
+					task.open = false;
+					task.begin = file.nextPage;
+					task.end = std::min(file.pages.size(), file.nextPage + options.chunkPages);
+
+					file.nextPage = task.end;
+					++file.activeChunks;
+
+					if (file.nextPage == file.pages.size())
+						device.open.pop_front();
+
+					return true;
+				}
+
+				if (!pending)
+					break;
+
+				condition.wait(lock);
+			}
+
+			return false;
+		}
+
+		// Files that fail to open are skipped.
+		void openFile(SourceFile& file)
+		{
+			Database* database = NULL;
+			Database::RelationId relationId = Database::RELATION_ID_PAGES;
+			vector<unsigned> pages;
+			string message;
+
+			try
+			{
+				database = new Database(file.filename.c_str());
+				database->live = options.live;
+				database->placement = options.placement;
+				database->setDirectIo(options.directIo);
+
+				relationId = database->findRelation(relationName.c_str());
+				database->getDataPages(relationId, pages);
+			}
+			catch (const std::exception& e)
+			{
+				message = e.what();
+				pages.clear();
+			}
+
+			boost::mutex::scoped_lock lock(mutex);
+			Device& device = devices[file.device];
+
+			--device.opening;
+			--device.inFlight;
+			file.error = message;
+
+			if (pages.empty())
+				delete database;
+			else
+			{
+				file.database = database;
+				file.relationId = relationId;
+				file.pages.swap(pages);
+				device.open.push_back(&file - &files[0]);
+			}
+
+			condition.notify_all();
+		}
+
+		// Reads the pages of a chunk, runs of consecutive ones at once, dropping those that
+		// are no longer data pages of the relation. Returns the number kept.
+		unsigned readChunk(SourceFile& file, const Task& task, char* buffer)
+		{
+			Database* database = file.database;
+			const unsigned pageSize = database->header.pageSize;
+			unsigned count = 0;
+
+			for (size_t i = task.begin; i < task.end;)
+			{
+				size_t end = i + 1;
+
+				while (end < task.end && file.pages[end] == file.pages[end - 1] + 1)
+					++end;
+
+				const unsigned read = database->readPages(file.pages[i], end - i,
+					buffer + size_t(count) * pageSize);
+
+				count += checkRun(file, i, read, buffer + size_t(count) * pageSize);
+				i = end;
+			}
+
+			return count;
+		}
+
+		// Keeps the pages of a run that are still data pages of the relation, moving them down.
+		unsigned checkRun(SourceFile& file, size_t first, unsigned read, char* run)
+		{
+			Database* database = file.database;
+			const unsigned pageSize = database->header.pageSize;
+			unsigned kept = 0;
+
+			for (unsigned n = 0; n < read; ++n)
+			{
+				char* page = run + size_t(n) * pageSize;
+
+				if (!database->checkPage(file.pages[first + n], page, PageHeader::TYPE_DATA,
+						file.relationId))
+				{
+					continue;
+				}
+
+				if (kept != n)
+					memcpy(run + size_t(kept) * pageSize, page, pageSize);
+
+				++kept;
+			}
+
+			return kept;
+		}
+
+		void release(unsigned device)
+		{
+			boost::mutex::scoped_lock lock(mutex);
+
+			--devices[device].inFlight;
+			condition.notify_all();
+		}
+
+		void finish(SourceFile& file)
+		{
+			boost::mutex::scoped_lock lock(mutex);
+			finishChunk(file);
+		}
+
+		// Stops handing out the chunks of a file that failed to be read, keeping the first
+		// error. The chunks already handed out are still read.
+		void skip(SourceFile& file, const string& message)
+		{
+			boost::mutex::scoped_lock lock(mutex);
+			Device& device = devices[file.device];
+
+			--device.inFlight;
+
+			if (file.error.empty())
+				file.error = message;
+
+			if (file.nextPage != file.pages.size())
+			{
+				device.open.erase(std::find(device.open.begin(), device.open.end(),
+					unsigned(&file - &files[0])));
+				file.nextPage = file.pages.size();
+			}
+
+			finishChunk(file);
+			condition.notify_all();
+		}
+
+		// Closes the file once all its chunks are done. Called with the mutex locked.
+		void finishChunk(SourceFile& file)
+		{
+			if (--file.activeChunks == 0 && file.nextPage == file.pages.size())
+			{
+				delete file.database;
+				file.database = NULL;
+			}
+		}
+
+		void fail(const string& message)
+		{
+			boost::mutex::scoped_lock lock(mutex);
+
+			if (error.empty())
+				error = message;
+
+			condition.notify_all();
+		}
+
+	public:
+		string error;
+
+	private:
+		string relationName;
+		MultiFileOptions options;
+		vector<SourceFile> files;
+		vector<Device> devices;
+		unsigned lastDevice;
+		boost::mutex mutex;
+		boost::condition_variable condition;
+	};
+}	// namespace
+
+
+void scanFiles(const vector<string>& filenames, const string& relationName,
+	const vector<ChunkVisitor*>& visitors, const MultiFileOptions& options,
+	vector<string>& errors)
+{
+	Scan scan(filenames, relationName, options);
+	boost::thread_group group;
+
+	for (unsigned i = 1; i < visitors.size(); ++i)
+		group.create_thread(boost::bind(&Scan::run, &scan, visitors[i], i));
+
+	if (!visitors.empty())
+		scan.run(visitors[0], 0);
+
+	group.join_all();
+
+	if (!scan.error.empty())
+		throw runtime_error(scan.error);
+
+	scan.getErrors(errors);
+}
+
+
+//------------------------------------------------------------------------------
+
+}	// fbods
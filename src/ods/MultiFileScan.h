@@ -0,0 +1,82 @@
+/*
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Initial Developer of the Original Code is Adriano dos Santos Fernandes.
+ * Portions created by the Initial Developer are Copyright (C) 2012 the Initial Developer.
+ * All Rights Reserved.
+ *
+ * Contributor(s):
+ *
+ */
+
+#ifndef FBSTUFF_ODS_MULTI_FILE_SCAN_H
+#define FBSTUFF_ODS_MULTI_FILE_SCAN_H
+
+#include "Database.h"
+#include "ScanStream.h"
+#include <string>
+#include <vector>
+
+namespace fbods
+{
+
+//------------------------------------------------------------------------------
+
+
+struct MultiFileOptions
+{
+	MultiFileOptions()
+		: deviceReads(4),
+		  chunkPages(256),
+		  directIo(false)
+	{
+	}
+
+	unsigned deviceReads;	// reads in flight per device
+	unsigned chunkPages;	// data pages read at once
+	bool directIo;
+	LiveOptions live;
+	PlacementOptions placement;	// of the threads, round robin as the files are on any node
+};
+
+class ChunkVisitor
+{
+public:
+	virtual ~ChunkVisitor()
+	{
+	}
+
+	// Receives the records of a chunk of data pages of the file with the given index.
+	virtual void visit(unsigned file, ScanStream& scan) = 0;
+};
+
+// Scans a relation in many database files, with one thread per visitor. Files are opened when
+// their turn comes and closed once their chunks are done, so only a few are open at a time.
+//
+// Files are grouped by the disk holding them, partitions counting as their whole disk. The
+// threads take work from the disks round robin, but no more than deviceReads of them read
+// from the same disk at once, so the disks are kept busy without thrashing them. A chunk is
+// decoded after its pages are read, leaving the disk to another thread meanwhile.
+//
+// Files that can't be opened or read, or lack the relation, are skipped, and their errors,
+// prefixed with the filename, appended to errors in the order of the files. The chunks of a
+// file visited before a read error are not undone. Errors of the visitors stop the scan and
+// are thrown.
+void scanFiles(const std::vector<std::string>& filenames, const std::string& relationName,
+	const std::vector<ChunkVisitor*>& visitors, const MultiFileOptions& options,
+	std::vector<std::string>& errors);
+
+
+//------------------------------------------------------------------------------
+
+}	// fbods
+
+#endif	// FBSTUFF_ODS_MULTI_FILE_SCAN_H
@@ -30,18 +30,41 @@ namespace fbods
 
 struct PageHeader
 {
+	static const boost::int8_t TYPE_UNDEFINED = 0;
+	static const boost::int8_t TYPE_HEADER = 1;
+	static const boost::int8_t TYPE_PAGE_INVENTORY = 2;
+	static const boost::int8_t TYPE_TRANSACTION_INVENTORY = 3;
 	static const boost::int8_t TYPE_POINTER = 4;
+	static const boost::int8_t TYPE_DATA = 5;
+	static const boost::int8_t TYPE_INDEX_ROOT = 6;
+	static const boost::int8_t TYPE_INDEX_BTREE = 7;
+	static const boost::int8_t TYPE_BLOB = 8;
+	static const boost::int8_t TYPE_GENERATOR = 9;
+	static const boost::int8_t TYPE_SCN_INVENTORY = 10;
+	static const boost::int8_t TYPE_MAX = 10;
+
+	// ODS 11 doesn't calculate checksums, but stamps all pages with this value.
+	static const boost::uint16_t CHECKSUM_STAMP = 12345;
 
 	boost::int8_t type;
 	boost::int8_t flags;
 	boost::uint16_t checksum;
 	boost::uint32_t generation;
 	boost::uint32_t scn;
-	boost::uint32_t reserved;
+	boost::uint32_t reserved;	// page number since ODS 12
 };
 
+// Header page of ODS 11. The fields up to flags are the same in all the versions.
 struct HeaderPage
 {
+	static const boost::uint16_t ODS_FIREBIRD_FLAG = 0x8000;
+
+	// nbackup state in flags.
+	static const boost::uint16_t BACKUP_MASK = 0x0C00;
+	static const boost::uint16_t BACKUP_NORMAL = 0x0000;
+	static const boost::uint16_t BACKUP_STALLED = 0x0400;	// locked, changes go to the delta
+	static const boost::uint16_t BACKUP_MERGE = 0x0800;
+
 	PageHeader pageHeader;
 	boost::uint16_t pageSize;
 	boost::uint16_t odsVersion;
@@ -67,6 +90,57 @@ struct HeaderPage
 	boost::uint8_t data[];
 };
 
+// Header page of ODS 12 (Firebird 3), unchanged in ODS 13 (Firebird 4 and 5). Transaction
+// numbers have 48 bits, the high words being kept apart.
+struct HeaderPage12
+{
+	static const unsigned TRA_HIGH_NEXT = 0;
+	static const unsigned TRA_HIGH_OLDEST = 1;
+	static const unsigned TRA_HIGH_OLDEST_ACTIVE = 2;
+	static const unsigned TRA_HIGH_OLDEST_SNAPSHOT = 3;
+
+	PageHeader pageHeader;
+	boost::uint16_t pageSize;
+	boost::uint16_t odsVersion;
+	boost::uint32_t pages;
+	boost::uint32_t nextPage;
+	boost::uint32_t oldestTransaction;
+	boost::uint32_t oldestActive;
+	boost::uint32_t nextTransaction;
+	boost::uint16_t sequence;
+	boost::uint16_t flags;
+	boost::int32_t creationDate[2];
+	boost::uint32_t attachmentId;
+	boost::int32_t shadowCount;
+	boost::uint8_t cpu;
+	boost::uint8_t os;
+	boost::uint8_t cc;
+	boost::uint8_t compatibilityFlags;
+	boost::uint16_t odsMinor;
+	boost::uint16_t end;
+	boost::uint32_t pageBuffers;
+	boost::uint32_t oldestSnapshot;
+	boost::int32_t backupPages;
+	boost::uint32_t cryptPage;
+	boost::uint32_t topCrypt;
+	char cryptPlugin[32];
+	boost::uint32_t attachmentHigh;
+	boost::uint16_t transactionHigh[4];
+	boost::uint8_t data[];
+};
+
+struct TransactionInventoryPage
+{
+	static const unsigned STATE_ACTIVE = 0;
+	static const unsigned STATE_LIMBO = 1;
+	static const unsigned STATE_DEAD = 2;
+	static const unsigned STATE_COMMITTED = 3;
+
+	PageHeader pageHeader;
+	boost::int32_t next;
+	boost::uint8_t transactions[];	// 2 bits per transaction
+};
+
 struct PointerPage
 {
 	PageHeader pageHeader;
@@ -92,28 +166,101 @@ struct DataPage
 	} rpt[];
 };
 
+// Only the fields common to the supported versions.
+struct IndexRootPage
+{
+	PageHeader pageHeader;
+	boost::uint16_t relation;
+	boost::uint16_t count;
+};
+
+struct BTreePage
+{
+	PageHeader pageHeader;
+	boost::int32_t sibling;
+	boost::int32_t leftSibling;
+	boost::int32_t prefixTotal;
+	boost::uint16_t relation;
+	boost::uint16_t length;
+	boost::uint8_t id;
+	boost::uint8_t level;
+};
+
+// Pages of blobs of level 1 and 2, the latter also in pointer pages listing the others.
+struct BlobPage
+{
+	static const boost::int8_t FLAG_POINTERS = 0x01;
+
+	PageHeader pageHeader;
+	boost::uint32_t leadPage;	// first page of the blob
+	boost::uint32_t sequence;
+	boost::uint16_t length;		// bytes in data, or in page of pointer pages
+	boost::uint16_t pad;
+	boost::uint8_t data[];
+	/***
+	boost::uint32_t page[];
+	***/
+};
+
+// Blob stored in a data page, in place of a record header with FLAG_BLOB. Level 0 blobs have
+// their data after it, level 1 the numbers of their blob pages and level 2 the numbers of their
+// pointer pages.
+struct BlobHeader
+{
+	static const unsigned MAX_LEVEL = 2;
+
+	boost::uint32_t leadPage;
+	boost::uint32_t maxSequence;
+	boost::uint16_t maxSegment;
+	boost::uint16_t flags;		// as in RecordHeader
+	boost::uint8_t level;
+	boost::uint32_t count;		// segments
+	boost::uint32_t length;
+	boost::uint16_t subType;
+	boost::uint8_t charset;
+	boost::uint8_t unused;
+	boost::uint8_t data[];
+	/***
+	boost::uint32_t page[];
+	***/
+};
+
 struct RecordHeader
 {
-	static const unsigned FLAG_DELETED	= 0x01;
-	static const unsigned FLAG_BLOB		= 0x10;
+	static const unsigned FLAG_DELETED		= 0x01;
+	static const unsigned FLAG_CHAIN		= 0x02;	// back version
+	static const unsigned FLAG_FRAGMENT		= 0x04;
+	static const unsigned FLAG_INCOMPLETE	= 0x08;	// continued in a fragment
+	static const unsigned FLAG_BLOB			= 0x10;
+	static const unsigned FLAG_DELTA		= 0x20;	// back version stored as differences
+	static const unsigned FLAG_LARGE		= 0x40;
+	static const unsigned FLAG_DAMAGED		= 0x80;
+	static const unsigned FLAG_LONG_TRANSACTION	= 0x400;	// since ODS 12, see EXTENDED_HEADER_SIZE
+	static const unsigned FLAG_NOT_PACKED	= 0x800;	// since ODS 12, data is not compressed
+
+	// Size of the header of incomplete records, which also stores the fragment page and line.
+	// Since ODS 12 it also has the transaction high word, in the padding after format.
+	static const unsigned FRAGMENTED_HEADER_SIZE = 22;
+
+	// Size of the header of records with FLAG_LONG_TRANSACTION, with the transaction high word
+	// after format.
+	static const unsigned EXTENDED_HEADER_SIZE = 16;
+	static const unsigned TRANSACTION_HIGH_OFFSET = 14;
 
 	boost::int32_t transaction;
 	boost::int32_t backPage;
 	boost::uint16_t backLine;
 	boost::uint16_t flags;
 	boost::uint8_t format;
-	union
+	boost::uint8_t data[];	// of records with the basic header
+	/***
+	struct
 	{
+		boost::int32_t page;
+		boost::uint16_t line;
 		boost::uint8_t data[];
-		/***
-		struct
-		{
-			boost::int32_t page;
-			boost::uint16_t line;
-			boost::uint8_t data[];
-		} fragment;
-		***/
-	};
+	} fragment;
+	***/
 };
 
 
@@ -0,0 +1,282 @@
+/*
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Initial Developer of the Original Code is Adriano dos Santos Fernandes.
+ * Portions created by the Initial Developer are Copyright (C) 2012 the Initial Developer.
+ * All Rights Reserved.
+ *
+ * Contributor(s):
+ *
+ */
+
+#include "PageDiff.h"
+#include "BufferArena.h"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <boost/bind.hpp>
+#include <boost/scoped_array.hpp>
+#include <boost/thread.hpp>
+
+namespace fbods
+{
+
+using std::map;
+using std::min;
+using std::runtime_error;
+using std::string;
+using std::vector;
+
+//------------------------------------------------------------------------------
+
+
+void PageDiffCounts::merge(const PageDiffCounts& other)
+{
+	unchanged += other.unchanged;
+	rewritten += other.rewritten;
+	changed += other.changed;
+	added += other.added;
+	removed += other.removed;
+}
+
+
+//--------------------------------------
+
+
+// Compares the chunks of pages handed out by the diff, keeping its own counts.
+class PageDiff::Worker
+{
+public:
+	Worker(PageDiff* aDiff)
+		: diff(aDiff),
+		  byType(PageHeader::TYPE_MAX + 2)
+	{
+	}
+
+public:
+	void run(unsigned worker);
+
+private:
+	void compare(unsigned number, const PageHeader* oldPage, const PageHeader* newPage);
+
+public:
+	PageDiff* diff;
+	PageDiffCounts total;
+	vector<PageDiffCounts> byType;
+	map<int, PageDiffCounts> byRelation;
+	vector<PageChange> changes;
+	string error;
+};
+
+void PageDiff::Worker::run(unsigned worker)
+{
+	try
+	{
+		WorkerPlacement placement(diff->newDatabase, worker);
+		const unsigned pageSize = diff->newDatabase->header.pageSize;
+		const unsigned pageCount = std::max(diff->oldPages, diff->newPages);
+		boost::scoped_array<char> oldScope, newScope;
+		const unsigned chunkPages = diff->chunkPages;
+		char* oldBuffer = allocateBuffer(size_t(chunkPages) * pageSize, oldScope);
+		char* newBuffer = allocateBuffer(size_t(chunkPages) * pageSize, newScope);
+
+		for (;;)
+		{
+			unsigned first;
+
+			{	// scope
+				boost::mutex::scoped_lock lock(diff->mutex);
+
+				first = diff->nextPage;
+				diff->nextPage = min(pageCount, first + chunkPages);
+			}
+
+			if (first >= pageCount)
+				break;
+
+			const unsigned count = min(chunkPages, pageCount - first);
+			const unsigned oldRead = first >= diff->oldPages ? 0 :
+				diff->oldDatabase->readPages(first, min(count, diff->oldPages - first),
+					oldBuffer);
+			const unsigned newRead = first >= diff->newPages ? 0 :
+				diff->newDatabase->readPages(first, min(count, diff->newPages - first),
+					newBuffer);
+
+			for (unsigned i = 0; i < count; ++i)
+			{
+				const size_t offset = size_t(i) * pageSize;
+
+				compare(first + i,
+					(i < oldRead ? reinterpret_cast<const PageHeader*>(oldBuffer + offset) : NULL),
+					(i < newRead ? reinterpret_cast<const PageHeader*>(newBuffer + offset) : NULL));
+			}
+		}
+	}
+	catch (const std::exception& e)
+	{
+		boost::mutex::scoped_lock lock(diff->mutex);
+
+		error = e.what();
+		diff->nextPage = std::max(diff->oldPages, diff->newPages);
+	}
+}
+
+void PageDiff::Worker::compare(unsigned number, const PageHeader* oldPage,
+	const PageHeader* newPage)
+{
+	const unsigned pageSize = diff->newDatabase->header.pageSize;
+	PageChange change;
+
+	change.number = number;
+	change.oldType = oldPage ? oldPage->type : PageHeader::TYPE_UNDEFINED;
+	change.newType = newPage ? newPage->type : PageHeader::TYPE_UNDEFINED;
+	change.oldRelation = oldPage ? getRelation(oldPage) : -1;
+	change.newRelation = newPage ? getRelation(newPage) : -1;
+
+	if (!oldPage)
+		change.kind = PageChange::KIND_ADDED;
+	else if (!newPage)
+		change.kind = PageChange::KIND_REMOVED;
+	else if (oldPage->generation == newPage->generation && oldPage->scn == newPage->scn)
+	{
+		// Pages not written since the copies diverged are not read past the header.
+		change.kind = PageChange::KIND_UNCHANGED;
+	}
+	else if (oldPage->type == newPage->type && oldPage->flags == newPage->flags &&
+		memcmp(oldPage + 1, newPage + 1, pageSize - sizeof(PageHeader)) == 0)
+	{
+		change.kind = PageChange::KIND_REWRITTEN;
+	}
+	else
+		change.kind = PageChange::KIND_CHANGED;
+
+	const bool removed = change.kind == PageChange::KIND_REMOVED;
+	const unsigned type = std::min<unsigned>(
+		boost::uint8_t(removed ? change.oldType : change.newType), PageHeader::TYPE_MAX + 1);
+	const int relation = removed ? change.oldRelation : change.newRelation;
+	PageDiffCounts* counts[3] = {&total, &byType[type], NULL};
+
+	if (relation >= 0)
+		counts[2] = &byRelation[relation];
+
+	for (unsigned i = 0; i < 3 && counts[i]; ++i)
+	{
+		switch (change.kind)
+		{
+			case PageChange::KIND_UNCHANGED:
+				++counts[i]->unchanged;
+				break;
+
+			case PageChange::KIND_REWRITTEN:
+				++counts[i]->rewritten;
+				break;
+
+			case PageChange::KIND_CHANGED:
+				++counts[i]->changed;
+				break;
+
+			case PageChange::KIND_ADDED:
+				++counts[i]->added;
+				break;
+
+			case PageChange::KIND_REMOVED:
+				++counts[i]->removed;
+				break;
+		}
+	}
+
+	if (change.kind != PageChange::KIND_UNCHANGED)
+		changes.push_back(change);
+}
+
+
+//--------------------------------------
+
+
+PageDiff::PageDiff(Database* aOldDatabase, Database* aNewDatabase)
+	: oldPages(0),
+	  newPages(0),
+	  byType(PageHeader::TYPE_MAX + 2),
+	  oldDatabase(aOldDatabase),
+	  newDatabase(aNewDatabase),
+	  nextPage(0),
+	  chunkPages(1)
+{
+	if (oldDatabase->header.pageSize != newDatabase->header.pageSize)
+		throw runtime_error("The databases have different page sizes");
+}
+
+void PageDiff::run(unsigned threads, unsigned aChunkPages)
+{
+	oldPages = oldDatabase->getPageCount();
+	newPages = newDatabase->getPageCount();
+
+	nextPage = 0;
+	chunkPages = std::max(aChunkPages, 1u);
+
+	vector<Worker> workers(std::max(threads, 1u), Worker(this));
+	boost::thread_group group;
+
+	for (unsigned i = 1; i < workers.size(); ++i)
+		group.create_thread(boost::bind(&Worker::run, &workers[i], i));
+
+	workers[0].run(0);
+	group.join_all();
+
+	for (vector<Worker>::iterator i = workers.begin(); i != workers.end(); ++i)
+	{
+		if (!i->error.empty())
+			throw runtime_error(i->error);
+
+		total.merge(i->total);
+
+		for (unsigned j = 0; j < byType.size(); ++j)
+			byType[j].merge(i->byType[j]);
+
+		for (map<int, PageDiffCounts>::const_iterator j = i->byRelation.begin();
+			 j != i->byRelation.end();
+			 ++j)
+		{
+			byRelation[j->first].merge(j->second);
+		}
+
+		changes.insert(changes.end(), i->changes.begin(), i->changes.end());
+	}
+
+	std::sort(changes.begin(), changes.end());
+}
+
+int PageDiff::getRelation(const PageHeader* page)
+{
+	switch (page->type)
+	{
+		case PageHeader::TYPE_POINTER:
+			return reinterpret_cast<const PointerPage*>(page)->relation;
+
+		case PageHeader::TYPE_DATA:
+			return reinterpret_cast<const DataPage*>(page)->relation;
+
+		case PageHeader::TYPE_INDEX_ROOT:
+			return reinterpret_cast<const IndexRootPage*>(page)->relation;
+
+		case PageHeader::TYPE_INDEX_BTREE:
+			return reinterpret_cast<const BTreePage*>(page)->relation;
+
+		default:
+			return -1;
+	}
+}
+
+
+//------------------------------------------------------------------------------
+
+}	// fbods
@@ -0,0 +1,125 @@
+/*
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Initial Developer of the Original Code is Adriano dos Santos Fernandes.
+ * Portions created by the Initial Developer are Copyright (C) 2012 the Initial Developer.
+ * All Rights Reserved.
+ *
+ * Contributor(s):
+ *
+ */
+
+#ifndef FBSTUFF_ODS_PAGE_DIFF_H
+#define FBSTUFF_ODS_PAGE_DIFF_H
+
+#include "Database.h"
+#include <map>
+#include <vector>
+#include <boost/cstdint.hpp>
+#include <boost/thread/mutex.hpp>
+
+namespace fbods
+{
+
+//------------------------------------------------------------------------------
+
+
+struct PageDiffCounts
+{
+	PageDiffCounts()
+		: unchanged(0),
+		  rewritten(0),
+		  changed(0),
+		  added(0),
+		  removed(0)
+	{
+	}
+
+	void merge(const PageDiffCounts& other);
+
+	// Pages a delta of the new copy over the old one has to carry.
+	boost::uint64_t getDelta() const
+	{
+		return rewritten + changed + added;
+	}
+
+	boost::uint64_t unchanged;	// same generation and SCN
+	boost::uint64_t rewritten;	// written again with the same contents
+	boost::uint64_t changed;
+	boost::uint64_t added;		// past the end of the old copy
+	boost::uint64_t removed;	// past the end of the new copy
+};
+
+struct PageChange
+{
+	enum Kind
+	{
+		KIND_UNCHANGED,
+		KIND_REWRITTEN,
+		KIND_CHANGED,
+		KIND_ADDED,
+		KIND_REMOVED
+	};
+
+	bool operator <(const PageChange& other) const
+	{
+		return number < other.number;
+	}
+
+	unsigned number;
+	Kind kind;
+	boost::int8_t oldType;	// undefined when the page is not in the copy
+	boost::int8_t newType;
+	int oldRelation;	// of pointer, data and index pages, -1 for others
+	int newRelation;
+};
+
+// Compares two copies of a database page by page, in one parallel pass over both files. Pages
+// with the same generation and SCN are taken as unchanged without looking further; the others
+// are compared byte by byte after the page header, telling pages written again with the same
+// contents from the changed ones.
+//
+// Pages are counted by the type and relation they have in the new copy, or in the old one when
+// they were removed.
+class PageDiff
+{
+public:
+	PageDiff(Database* aOldDatabase, Database* aNewDatabase);
+
+public:
+	void run(unsigned threads, unsigned chunkPages);
+
+	static int getRelation(const PageHeader* page);
+
+public:
+	unsigned oldPages;
+	unsigned newPages;
+	PageDiffCounts total;
+	std::vector<PageDiffCounts> byType;	// the one after TYPE_MAX for invalid types
+	std::map<int, PageDiffCounts> byRelation;
+	std::vector<PageChange> changes;	// in page order, but for the unchanged pages
+
+private:
+	class Worker;
+
+	Database* oldDatabase;
+	Database* newDatabase;
+	boost::mutex mutex;
+	unsigned nextPage;	// first of the next chunk handed out to the workers
+	unsigned chunkPages;
+};
+
+
+//------------------------------------------------------------------------------
+
+}	// fbods
+
+#endif	// FBSTUFF_ODS_PAGE_DIFF_H
@@ -0,0 +1,98 @@
+/*
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Initial Developer of the Original Code is Adriano dos Santos Fernandes.
+ * Portions created by the Initial Developer are Copyright (C) 2012 the Initial Developer.
+ * All Rights Reserved.
+ *
+ * Contributor(s):
+ *
+ */
+
+#include "PageListScanStream.h"
+#include "BufferArena.h"
+
+namespace fbods
+{
+
+using std::vector;
+
+//------------------------------------------------------------------------------
+
+
+bool PageListScanStream::readData()
+{
+	if (database->queueDepth > 0)
+		return readAhead();
+
+	while (pageNum < pages.size())
+	{
+		if (database->readPage(pages[pageNum++], data, PageHeader::TYPE_DATA, relation))
+			return true;
+	}
+
+	return false;
+}
+
+// Keeps the window full and waits for the next page of the list. The current page is moved
+// to its window slot, which is only reused once the page is done.
+bool PageListScanStream::readAhead()
+{
+	const unsigned pageSize = database->header.pageSize;
+	const unsigned depth = database->queueDepth;
+
+	if (!reader)
+	{
+		reader.reset(new PageReader(database, depth));
+		window = allocateBuffer(size_t(depth) * pageSize, windowScope);
+		ready.resize(depth);
+	}
+
+	vector<size_t> tags;
+
+	while (pageNum < pages.size())
+	{
+		for (; queuedNum < pages.size() && queuedNum < pageNum + depth; ++queuedNum)
+		{
+			reader->queue(pages[queuedNum], &window[size_t(queuedNum % depth) * pageSize],
+				queuedNum);
+		}
+
+		reader->submit();
+
+		while (!ready[pageNum % depth])
+		{
+			tags.clear();
+			reader->complete(tags);
+
+			for (vector<size_t>::const_iterator i = tags.begin(); i != tags.end(); ++i)
+				ready[*i % depth] = true;
+		}
+
+		const unsigned number = pages[pageNum];
+		char* page = &window[size_t(pageNum % depth) * pageSize];
+
+		ready[pageNum++ % depth] = false;
+
+		if (database->checkPage(number, page, PageHeader::TYPE_DATA, relation))
+		{
+			data = reinterpret_cast<DataPage*>(page);
+			return true;
+		}
+	}
+
+	return false;
+}
+
+
+//------------------------------------------------------------------------------
+
+}	// fbods
@@ -0,0 +1,92 @@
+/*
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Initial Developer of the Original Code is Adriano dos Santos Fernandes.
+ * Portions created by the Initial Developer are Copyright (C) 2012 the Initial Developer.
+ * All Rights Reserved.
+ *
+ * Contributor(s):
+ *
+ */
+
+#ifndef FBSTUFF_ODS_PAGE_LIST_SCAN_STREAM_H
+#define FBSTUFF_ODS_PAGE_LIST_SCAN_STREAM_H
+
+#include "ScanStream.h"
+#include "PageReader.h"
+#include <vector>
+#include <boost/scoped_array.hpp>
+#include <boost/scoped_ptr.hpp>
+
+namespace fbods
+{
+
+//------------------------------------------------------------------------------
+
+
+// Reads the records of a given list of data pages. Used to split a relation between threads.
+// With Database::queueDepth set, that many pages of the list are read ahead, in list order.
+class PageListScanStream : public ScanStream
+{
+public:
+	PageListScanStream(Database* aDatabase, const unsigned* begin, const unsigned* end,
+			int aRelation = -1)
+		: ScanStream(aDatabase),
+		  pages(begin, end),
+		  pageNum(0),
+		  relation(aRelation),
+		  window(NULL),
+		  queuedNum(0)
+	{
+	}
+
+protected:
+	explicit PageListScanStream(Database* aDatabase)
+		: ScanStream(aDatabase),
+		  pageNum(0),
+		  relation(-1),
+		  window(NULL),
+		  queuedNum(0)
+	{
+	}
+
+public:
+	// Data page of the last record fetched.
+	unsigned getPageNumber() const
+	{
+		return pages[pageNum - 1];
+	}
+
+protected:
+	virtual bool readData();
+
+private:
+	bool readAhead();
+
+protected:
+	std::vector<unsigned> pages;
+	unsigned pageNum;
+	int relation;	// checked in the pages read from a live file, unless negative
+
+private:
+	boost::scoped_ptr<PageReader> reader;
+	boost::scoped_array<char> windowScope;
+	char* window;	// queueDepth pages, the one of a list entry at its index modulo the depth
+	std::vector<bool> ready;
+	unsigned queuedNum;	// next list entry to queue
+};
+
+
+//------------------------------------------------------------------------------
+
+}	// fbods
+
+#endif	// FBSTUFF_ODS_PAGE_LIST_SCAN_STREAM_H
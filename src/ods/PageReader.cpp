@@ -0,0 +1,512 @@
+/*
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Initial Developer of the Original Code is Adriano dos Santos Fernandes.
+ * Portions created by the Initial Developer are Copyright (C) 2012 the Initial Developer.
+ * All Rights Reserved.
+ *
+ * Contributor(s):
+ *
+ */
+
+#include "PageReader.h"
+#include "BufferArena.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+namespace fbods
+{
+
+using std::runtime_error;
+using std::string;
+using std::vector;
+
+//------------------------------------------------------------------------------
+
+
+namespace
+{
+	void throwReadError(unsigned number, int error)
+	{
+		char s[32];
+		sprintf(s, "%u", number);
+		throw runtime_error(string("Cannot read page ") + s + ": " + strerror(error));
+	}
+}	// namespace
+
+
+PageReader::PageReader(Database* aDatabase, unsigned aDepth)
+	: database(aDatabase),
+	  depth(std::max(aDepth, 1u)),
+	  pending(0),
+	  inFlight(0),
+	  ring(-1),
+	  ringEntries(0),
+	  sqRing(MAP_FAILED),
+	  sqRingSize(0),
+	  cqRing(MAP_FAILED),
+	  cqRingSize(0),
+	  sqes(static_cast<io_uring_sqe*>(MAP_FAILED)),
+	  sqesSize(0),
+	  sqTail(NULL),
+	  sqArray(NULL),
+	  sqMask(0),
+	  cqHead(NULL),
+	  cqTail(NULL),
+	  cqMask(0),
+	  cqes(NULL)
+{
+	setup();
+}
+
+PageReader::~PageReader()
+{
+	// The kernel may still be writing to the buffers of the requests in flight.
+	while (ring >= 0 && inFlight > 0)
+	{
+		if (syscall(__NR_io_uring_enter, ring, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0) < 0 &&
+			errno != EINTR)
+		{
+			break;
+		}
+
+		unsigned head = *cqHead;
+		const unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+
+		inFlight -= tail - head;
+		__atomic_store_n(cqHead, tail, __ATOMIC_RELEASE);
+	}
+
+	if (sqes != MAP_FAILED)
+		munmap(sqes, sqesSize);
+
+	if (cqRing != MAP_FAILED && cqRing != sqRing)
+		munmap(cqRing, cqRingSize);
+
+	if (sqRing != MAP_FAILED)
+		munmap(sqRing, sqRingSize);
+
+	if (ring >= 0)
+		close(ring);
+
+	for (vector<Request*>::iterator i = requests.begin(); i != requests.end(); ++i)
+		delete *i;
+}
+
+// Maps the rings as the kernel describes them in the setup parameters. Any failure leaves
+// the reader with synchronous reads.
+void PageReader::setup()
+{
+	io_uring_params params;
+	memset(&params, 0, sizeof(params));
+
+	ring = syscall(__NR_io_uring_setup, std::min(depth, 4096u), &params);
+
+	if (ring < 0)
+		return;
+
+	ringEntries = params.sq_entries;
+	sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+	sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+
+	const bool singleMap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+
+	if (singleMap)
+		sqRingSize = cqRingSize = std::max(sqRingSize, cqRingSize);
+
+	sqRing = mmap(NULL, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring,
+		IORING_OFF_SQ_RING);
+
+	if (sqRing != MAP_FAILED)
+	{
+		cqRing = singleMap ? sqRing : mmap(NULL, cqRingSize, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, ring, IORING_OFF_CQ_RING);
+	}
+
+	if (cqRing != MAP_FAILED)
+	{
+		sqes = static_cast<io_uring_sqe*>(mmap(NULL, sqesSize, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, ring, IORING_OFF_SQES));
+	}
+
+	if (sqes == MAP_FAILED)
+	{
+		if (cqRing != MAP_FAILED && cqRing != sqRing)
+			munmap(cqRing, cqRingSize);
+
+		if (sqRing != MAP_FAILED)
+			munmap(sqRing, sqRingSize);
+
+		sqRing = cqRing = MAP_FAILED;
+		close(ring);
+		ring = -1;
+		return;
+	}
+
+	char* sq = static_cast<char*>(sqRing);
+	char* cq = static_cast<char*>(cqRing);
+
+	sqTail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+	sqArray = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+	sqMask = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+	cqHead = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+	cqTail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+	cqMask = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+	cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+}
+
+void PageReader::queue(unsigned number, void* buffer, size_t tag)
+{
+	Page page;
+	page.position = number;
+	page.file = database->getReadHandle(database->locatePage(page.position), buffer);
+	page.number = number;
+	page.buffer = buffer;
+	page.tag = tag;
+
+	queued.push_back(page);
+	++pending;
+}
+
+void PageReader::submit()
+{
+	if (queued.empty())
+		return;
+
+	std::sort(queued.begin(), queued.end());
+
+	const unsigned pageSize = database->header.pageSize;
+	ScanCounters* counters = ScanMetrics::getCounters();
+	unsigned toSubmit = 0;
+	size_t i = 0;
+
+	while (i < queued.size() && (ring < 0 || inFlight < ringEntries))
+	{
+		size_t j = i + 1;
+
+		while (j < queued.size() && j - i < MAX_COALESCED && queued[j].file == queued[i].file &&
+			queued[j].position == queued[i].position + (j - i))
+		{
+			++j;
+		}
+
+		Request* request;
+
+		if (freeRequests.empty())
+		{
+			request = new Request;
+			requests.push_back(request);
+		}
+		else
+		{
+			request = freeRequests.back();
+			freeRequests.pop_back();
+		}
+
+		request->pages.assign(queued.begin() + i, queued.begin() + j);
+		request->vectors.resize(j - i);
+		request->start = counters ? ScanCounters::now() : 0;
+
+		for (size_t k = 0; k < request->pages.size(); ++k)
+		{
+			request->vectors[k].iov_base = request->pages[k].buffer;
+			request->vectors[k].iov_len = pageSize;
+		}
+
+		if (ring < 0)
+			read(request);
+		else
+		{
+			const unsigned tail = *sqTail;
+			const unsigned index = tail & sqMask;
+			io_uring_sqe* sqe = &sqes[index];
+
+			memset(sqe, 0, sizeof(*sqe));
+			sqe->opcode = IORING_OP_READV;
+			sqe->fd = request->pages.front().file;
+			sqe->off = off_t(pageSize) * request->pages.front().position;
+			sqe->addr = reinterpret_cast<size_t>(&request->vectors.front());
+			sqe->len = request->vectors.size();
+			sqe->user_data = reinterpret_cast<size_t>(request);
+
+			sqArray[index] = index;
+			__atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+
+			++inFlight;
+			++toSubmit;
+		}
+
+		i = j;
+	}
+
+	// The ones that didn't fit in the ring are submitted as others complete.
+	queued.erase(queued.begin(), queued.begin() + i);
+
+	if (toSubmit > 0)
+		enter(toSubmit, 0);
+}
+
+void PageReader::complete(vector<size_t>& tags, bool wait)
+{
+	submit();
+
+	if (ring < 0)
+	{
+		tags.insert(tags.end(), completed.begin(), completed.end());
+		completed.clear();
+		return;
+	}
+
+	const size_t start = tags.size();
+	reap(tags);
+
+	while (wait && tags.size() == start && inFlight > 0)
+	{
+		enter(0, 1);
+		reap(tags);
+	}
+
+	submit();
+}
+
+// Synchronous read of a request, when there is no io_uring.
+void PageReader::read(Request* request)
+{
+	const Page& first = request->pages.front();
+	ssize_t n;
+
+	do
+	{
+		n = preadv(first.file, &request->vectors.front(), request->vectors.size(),
+			off_t(database->header.pageSize) * first.position);
+	} while (n < 0 && errno == EINTR);
+
+	finish(request, n < 0 ? -errno : int(n), completed);
+}
+
+// Completes a request with the bytes read or a negated errno, reading synchronously what a
+// short read left.
+void PageReader::finish(Request* request, int result, vector<size_t>& tags)
+{
+	const unsigned pageSize = database->header.pageSize;
+	const size_t count = request->pages.size();
+
+	freeRequests.push_back(request);
+	pending -= count;
+
+	if (result < 0)
+		throwReadError(request->pages.front().number, -result);
+
+	for (size_t done = result; done < count * pageSize;)
+	{
+		const Page& page = request->pages[done / pageSize];
+		const size_t offset = done % pageSize;
+		const ssize_t n = pread(page.file, static_cast<char*>(page.buffer) + offset,
+			pageSize - offset, off_t(pageSize) * page.position + offset);
+
+		if (n < 0 && errno == EINTR)
+			continue;
+
+		if (n <= 0)
+			throwReadError(page.number, n < 0 ? errno : EIO);
+
+		done += n;
+	}
+
+	ScanCounters* counters = ScanMetrics::getCounters();
+
+	if (counters)
+		counters->readLatency.add(ScanCounters::now() - request->start);
+
+	for (size_t i = 0; i < count; ++i)
+	{
+		if (counters)
+			counters->addPages(request->pages[i].buffer, 1, pageSize);
+
+		tags.push_back(request->pages[i].tag);
+	}
+}
+
+void PageReader::reap(vector<size_t>& tags)
+{
+	unsigned head = *cqHead;
+	const unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+
+	while (head != tail)
+	{
+		const io_uring_cqe& cqe = cqes[head & cqMask];
+		Request* request = reinterpret_cast<Request*>(cqe.user_data);
+		const int result = cqe.res;
+
+		__atomic_store_n(cqHead, ++head, __ATOMIC_RELEASE);
+		--inFlight;
+
+		finish(request, result, tags);
+	}
+}
+
+void PageReader::enter(unsigned toSubmit, unsigned minComplete)
+{
+	for (;;)
+	{
+		const long n = syscall(__NR_io_uring_enter, ring, toSubmit, minComplete,
+			minComplete > 0 ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+
+		if (n < 0)
+		{
+			// Only the wait is interrupted, after the submission.
+			if (errno == EINTR)
+			{
+				toSubmit = 0;
+				continue;
+			}
+
+			throw runtime_error(string("Cannot submit page reads: ") + strerror(errno));
+		}
+
+		if (unsigned(n) >= toSubmit)
+			break;
+
+		toSubmit -= n;
+	}
+}
+
+
+
+//--------------------------------------
+
+
+PageFetcher::PageFetcher(Database* aDatabase, unsigned aDepth)
+	: database(aDatabase),
+	  depth(aDepth),
+	  buffers(allocateBuffer(size_t(aDepth + 1) * aDatabase->header.pageSize, buffersScope)),
+	  ready(aDepth + 1),
+	  fetchedNumber(0),
+	  fetchedSlot(0)
+{
+	if (depth > 0)
+		reader.reset(new PageReader(database, depth));
+
+	for (unsigned slot = depth + 1; slot-- > 0; )
+		freeSlots.push_back(slot);
+}
+
+bool PageFetcher::queue(unsigned number)
+{
+	if (!reader)
+		return false;
+
+	if (number == fetchedNumber || queued.find(number) != queued.end())
+		return true;
+
+	// A slot is kept for the pages fetched without being queued.
+	if (freeSlots.size() < 2)
+	{
+		reap(false);
+
+		std::deque<unsigned>::iterator oldest = order.begin();
+
+		while (oldest != order.end() && !ready[queued[*oldest]])
+			++oldest;
+
+		if (oldest == order.end())
+			return false;
+
+		freeSlots.push_back(queued[*oldest]);
+		queued.erase(*oldest);
+		order.erase(oldest);
+	}
+
+	const unsigned slot = freeSlots.back();
+	freeSlots.pop_back();
+
+	ready[slot] = false;
+	reader->queue(number, getBuffer(slot), slot);
+	queued.insert(std::make_pair(number, slot));
+	order.push_back(number);
+
+	return true;
+}
+
+const char* PageFetcher::fetch(unsigned number, boost::int8_t type, int relation)
+{
+	// Versions of neighbour records are often in the same page, which doesn't change unless
+	// the file is in use.
+	if (number == fetchedNumber && !database->live.enabled)
+	{
+		ScanCounters* counters = ScanMetrics::getCounters();
+
+		if (counters)
+			++counters->cacheHits;
+
+		return getBuffer(fetchedSlot);
+	}
+
+	if (fetchedNumber != 0)
+	{
+		freeSlots.push_back(fetchedSlot);
+		fetchedNumber = 0;
+	}
+
+	const std::map<unsigned, unsigned>::iterator page = queued.find(number);
+	unsigned slot;
+	bool valid;
+
+	if (page != queued.end())
+	{
+		slot = page->second;
+		queued.erase(page);
+		order.erase(std::find(order.begin(), order.end(), number));
+
+		while (!ready[slot])
+			reap(true);
+
+		valid = database->checkPage(number, getBuffer(slot), type, relation);
+	}
+	else
+	{
+		slot = freeSlots.back();
+		freeSlots.pop_back();
+
+		valid = database->readPage(number, getBuffer(slot), type, relation);
+	}
+
+	if (!valid)
+	{
+		freeSlots.push_back(slot);
+		return NULL;
+	}
+
+	fetchedNumber = number;
+	fetchedSlot = slot;
+
+	return getBuffer(slot);
+}
+
+void PageFetcher::reap(bool wait)
+{
+	vector<size_t> tags;
+	reader->complete(tags, wait);
+
+	for (vector<size_t>::const_iterator i = tags.begin(); i != tags.end(); ++i)
+		ready[*i] = true;
+}
+
+
+//------------------------------------------------------------------------------
+
+}	// fbods
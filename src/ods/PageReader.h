@@ -0,0 +1,183 @@
+/*
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Initial Developer of the Original Code is Adriano dos Santos Fernandes.
+ * Portions created by the Initial Developer are Copyright (C) 2012 the Initial Developer.
+ * All Rights Reserved.
+ *
+ * Contributor(s):
+ *
+ */
+
+#ifndef FBSTUFF_ODS_PAGE_READER_H
+#define FBSTUFF_ODS_PAGE_READER_H
+
+#include "Database.h"
+#include <deque>
+#include <map>
+#include <vector>
+#include <boost/scoped_array.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <linux/io_uring.h>
+#include <sys/uio.h>
+
+namespace fbods
+{
+
+//------------------------------------------------------------------------------
+
+
+// Reads many pages at once through io_uring, keeping up to depth requests outstanding.
+// Adjacent pages queued together are read with a single vectored request. When io_uring
+// is not available, the requests are read synchronously at submit time. A reader is used
+// by a single thread.
+class PageReader
+{
+public:
+	static const unsigned DEFAULT_DEPTH = 256;
+	static const unsigned MAX_COALESCED = 64;	// pages per request
+
+public:
+	explicit PageReader(Database* aDatabase, unsigned aDepth = DEFAULT_DEPTH);
+	~PageReader();
+
+private:
+	PageReader(const PageReader&);
+	PageReader& operator =(const PageReader&);
+
+public:
+	bool isAsync() const
+	{
+		return ring >= 0;
+	}
+
+	// Number of pages queued or being read.
+	unsigned getPending() const
+	{
+		return pending;
+	}
+
+	// Queues the read of a page into a buffer of the page size, aligned as allocateBuffer does
+	// for the reads to be direct. The tag is returned on completion.
+	void queue(unsigned number, void* buffer, size_t tag);
+
+	// Starts the reads of the queued pages, in as few requests as possible.
+	void submit();
+
+	// Appends the tags of the pages read, waiting for at least one when asked and there are
+	// pending pages. Throws when a page could not be read.
+	void complete(std::vector<size_t>& tags, bool wait = true);
+
+private:
+	struct Page
+	{
+		bool operator <(const Page& other) const
+		{
+			return file != other.file ? file < other.file : position < other.position;
+		}
+
+		int file;
+		unsigned position;	// in the file
+		unsigned number;
+		void* buffer;
+		size_t tag;
+	};
+
+	struct Request
+	{
+		std::vector<Page> pages;
+		std::vector<iovec> vectors;
+		boost::uint64_t start;	// for the metrics
+	};
+
+	void setup();
+	void read(Request* request);
+	void finish(Request* request, int result, std::vector<size_t>& tags);
+	void reap(std::vector<size_t>& tags);
+	void enter(unsigned toSubmit, unsigned minComplete);
+
+private:
+	Database* database;
+	unsigned depth;
+	unsigned pending;
+	std::vector<Page> queued;
+	std::vector<Request*> freeRequests;
+	std::vector<Request*> requests;	// all of them, owned
+	std::vector<size_t> completed;	// by the synchronous reads
+	unsigned inFlight;
+
+	// io_uring, not available when ring is negative
+	int ring;
+	unsigned ringEntries;
+	void* sqRing;
+	size_t sqRingSize;
+	void* cqRing;
+	size_t cqRingSize;
+	io_uring_sqe* sqes;
+	size_t sqesSize;
+	unsigned* sqTail;
+	unsigned* sqArray;
+	unsigned sqMask;
+	unsigned* cqHead;
+	unsigned* cqTail;
+	unsigned cqMask;
+	io_uring_cqe* cqes;
+};
+
+// Single pages read out of order, as the ones of back versions or looked up records. The pages
+// queued are read together through a PageReader and kept until fetched, up to depth of them,
+// the oldest read being dropped for new ones. The others are read when fetched. The page last
+// fetched is valid until another one is fetched. A fetcher is used by a single thread.
+class PageFetcher
+{
+public:
+	// Nothing is queued with depth zero.
+	PageFetcher(Database* aDatabase, unsigned aDepth);
+
+private:
+	PageFetcher(const PageFetcher&);
+	PageFetcher& operator =(const PageFetcher&);
+
+public:
+	// Returns false when the page is not queued, for lack of room.
+	bool queue(unsigned number);
+
+	// Returns the page, or NULL when it fails the checks of Database::readPage.
+	const char* fetch(unsigned number, boost::int8_t type, int relation);
+
+private:
+	char* getBuffer(unsigned slot)
+	{
+		return &buffers[size_t(slot) * database->header.pageSize];
+	}
+
+	void reap(bool wait);
+
+private:
+	Database* database;
+	unsigned depth;
+	boost::scoped_array<char> buffersScope;
+	char* buffers;	// depth + 1 pages, the one fetched being kept apart from the queued
+	boost::scoped_ptr<PageReader> reader;	// after the buffers, to be destroyed first
+	std::map<unsigned, unsigned> queued;	// page number -> slot
+	std::deque<unsigned> order;		// of the queued pages, oldest first
+	std::vector<unsigned> freeSlots;
+	std::vector<bool> ready;
+	unsigned fetchedNumber;	// zero when none
+	unsigned fetchedSlot;
+};
+
+
+//------------------------------------------------------------------------------
+
+}	// fbods
+
+#endif	// FBSTUFF_ODS_PAGE_READER_H
@@ -0,0 +1,131 @@
+/*
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Initial Developer of the Original Code is Adriano dos Santos Fernandes.
+ * Portions created by the Initial Developer are Copyright (C) 2012 the Initial Developer.
+ * All Rights Reserved.
+ *
+ * Contributor(s):
+ *
+ */
+
+#include "PageSweep.h"
+#include "BufferArena.h"
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include <boost/bind.hpp>
+#include <boost/scoped_array.hpp>
+#include <boost/thread.hpp>
+
+namespace fbods
+{
+
+using std::string;
+using std::vector;
+
+//------------------------------------------------------------------------------
+
+
+namespace
+{
+	class Sweep
+	{
+	public:
+		Sweep(Database* aDatabase, unsigned aChunkPages)
+			: database(aDatabase),
+			  chunkPages(aChunkPages == 0 ? 1 : aChunkPages),
+			  pageCount(aDatabase->getPageCount()),
+			  nextPage(0)
+		{
+		}
+
+	public:
+		void run(PageVisitor* visitor, unsigned worker)
+		{
+			try
+			{
+				WorkerPlacement placement(database, worker);
+				const unsigned pageSize = database->header.pageSize;
+				boost::scoped_array<char> bufferScope;
+				char* buffer = allocateBuffer(size_t(chunkPages) * pageSize, bufferScope);
+				unsigned first;
+
+				while ((first = nextChunk()) < pageCount)
+				{
+					unsigned count = database->readPages(first,
+						std::min(chunkPages, pageCount - first), buffer);
+
+					for (unsigned i = 0; i < count; ++i)
+					{
+						visitor->visit(first + i,
+							reinterpret_cast<const PageHeader*>(&buffer[size_t(i) * pageSize]));
+					}
+				}
+			}
+			catch (const std::exception& e)
+			{
+				boost::mutex::scoped_lock lock(mutex);
+
+				if (error.empty())
+					error = e.what();
+
+				nextPage = pageCount;
+			}
+		}
+
+	private:
+		unsigned nextChunk()
+		{
+			boost::mutex::scoped_lock lock(mutex);
+
+			unsigned first = nextPage;
+
+			if (nextPage < pageCount)
+				nextPage = std::min(pageCount, nextPage + chunkPages);
+
+			return first;
+		}
+
+	public:
+		string error;
+
+	private:
+		Database* database;
+		unsigned chunkPages;
+		unsigned pageCount;
+		unsigned nextPage;
+		boost::mutex mutex;
+	};
+}	// namespace
+
+
+void sweepPages(Database* database, const vector<PageVisitor*>& visitors, unsigned chunkPages)
+{
+	Sweep sweep(database, chunkPages);
+	boost::thread_group group;
+
+	for (unsigned i = 1; i < visitors.size(); ++i)
+		group.create_thread(boost::bind(&Sweep::run, &sweep, visitors[i], i));
+
+	if (!visitors.empty())
+		sweep.run(visitors[0], 0);
+
+	group.join_all();
+
+	if (!sweep.error.empty())
+		throw std::runtime_error(sweep.error);
+}
+
+
+//------------------------------------------------------------------------------
+
+}	// fbods
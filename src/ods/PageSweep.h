@@ -0,0 +1,52 @@
+/*
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Initial Developer of the Original Code is Adriano dos Santos Fernandes.
+ * Portions created by the Initial Developer are Copyright (C) 2012 the Initial Developer.
+ * All Rights Reserved.
+ *
+ * Contributor(s):
+ *
+ */
+
+#ifndef FBSTUFF_ODS_PAGE_SWEEP_H
+#define FBSTUFF_ODS_PAGE_SWEEP_H
+
+#include "Database.h"
+#include <vector>
+
+namespace fbods
+{
+
+//------------------------------------------------------------------------------
+
+
+class PageVisitor
+{
+public:
+	virtual ~PageVisitor()
+	{
+	}
+
+	virtual void visit(unsigned number, const PageHeader* page) = 0;
+};
+
+// Reads the whole database file in chunks of consecutive pages, with one thread per visitor.
+// Chunks are handed out in file order, so each thread still reads large sequential blocks.
+void sweepPages(Database* database, const std::vector<PageVisitor*>& visitors,
+	unsigned chunkPages = 256);
+
+
+//------------------------------------------------------------------------------
+
+}	// fbods
+
+#endif	// FBSTUFF_ODS_PAGE_SWEEP_H
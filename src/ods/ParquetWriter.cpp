@@ -0,0 +1,754 @@
+/*
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Initial Developer of the Original Code is Adriano dos Santos Fernandes.
+ * Portions created by the Initial Developer are Copyright (C) 2012 the Initial Developer.
+ * All Rights Reserved.
+ *
+ * Contributor(s):
+ *
+ */
+
+#include "ParquetWriter.h"
+#include <cstring>
+#include <stack>
+#include <stdexcept>
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+#include <boost/unordered_map.hpp>
+
+namespace fbods
+{
+
+using std::runtime_error;
+using std::string;
+using std::vector;
+
+//------------------------------------------------------------------------------
+
+
+namespace
+{
+	// parquet.thrift enumerations.
+	enum Type
+	{
+		TYPE_INT32 = 1,
+		TYPE_INT64 = 2,
+		TYPE_FLOAT = 4,
+		TYPE_DOUBLE = 5,
+		TYPE_BYTE_ARRAY = 6
+	};
+
+	enum ConvertedType
+	{
+		CONVERTED_NONE = -1,
+		CONVERTED_UTF8 = 0,
+		CONVERTED_DECIMAL = 5,
+		CONVERTED_DATE = 6,
+		CONVERTED_TIME_MILLIS = 7,
+		CONVERTED_TIMESTAMP_MICROS = 10,
+		CONVERTED_INT_16 = 16
+	};
+
+	enum Encoding
+	{
+		ENCODING_PLAIN = 0,
+		ENCODING_RLE = 3,
+		ENCODING_RLE_DICTIONARY = 8
+	};
+
+	enum PageType
+	{
+		PAGE_DATA = 0,
+		PAGE_DICTIONARY = 2
+	};
+
+	const int REPETITION_OPTIONAL = 1;
+	const int CODEC_UNCOMPRESSED = 0;
+
+	// Days between 1858-11-17 and 1970-01-01.
+	const boost::int32_t UNIX_EPOCH_DATE = 40587;
+
+	// Thrift compact protocol, just what is needed to write the file metadata.
+	class ThriftWriter
+	{
+	public:
+		enum FieldType
+		{
+			FIELD_BOOLEAN_TRUE = 1,
+			FIELD_BOOLEAN_FALSE = 2,
+			FIELD_I32 = 5,
+			FIELD_I64 = 6,
+			FIELD_BINARY = 8,
+			FIELD_LIST = 9,
+			FIELD_STRUCT = 12
+		};
+
+	public:
+		explicit ThriftWriter(vector<boost::uint8_t>& aOut)
+			: out(aOut),
+			  lastField(0)
+		{
+		}
+
+	public:
+		void writeI32(unsigned id, boost::int32_t value)
+		{
+			writeField(id, FIELD_I32);
+			writeVarInt(zigZag(value));
+		}
+
+		void writeI64(unsigned id, boost::int64_t value)
+		{
+			writeField(id, FIELD_I64);
+			writeVarInt(zigZag(value));
+		}
+
+		void writeString(unsigned id, const string& value)
+		{
+			writeField(id, FIELD_BINARY);
+			writeListString(value);
+		}
+
+		void beginStruct(unsigned id)
+		{
+			writeField(id, FIELD_STRUCT);
+			beginListStruct();
+		}
+
+		void endStruct()
+		{
+			out.push_back(0);
+			lastField = fields.top();
+			fields.pop();
+		}
+
+		void beginList(unsigned id, FieldType type, unsigned size)
+		{
+			writeField(id, FIELD_LIST);
+
+			if (size < 15)
+				out.push_back((size << 4) | type);
+			else
+			{
+				out.push_back(0xF0 | type);
+				writeVarInt(size);
+			}
+		}
+
+		void beginListStruct()
+		{
+			fields.push(lastField);
+			lastField = 0;
+		}
+
+		void writeListI32(boost::int32_t value)
+		{
+			writeVarInt(zigZag(value));
+		}
+
+		void writeListString(const string& value)
+		{
+			writeVarInt(value.length());
+			out.insert(out.end(), value.begin(), value.end());
+		}
+
+		void end()
+		{
+			out.push_back(0);
+		}
+
+	private:
+		static boost::uint64_t zigZag(boost::int64_t n)
+		{
+			return (boost::uint64_t(n) << 1) ^ boost::uint64_t(n >> 63);
+		}
+
+		void writeField(unsigned id, FieldType type)
+		{
+			if (id > lastField && id - lastField <= 15)
+				out.push_back(((id - lastField) << 4) | type);
+			else
+			{
+				out.push_back(type);
+				writeVarInt(zigZag(id));
+			}
+
+			lastField = id;
+		}
+
+		void writeVarInt(boost::uint64_t n)
+		{
+			while (n >= 0x80)
+			{
+				out.push_back(boost::uint8_t(n) | 0x80);
+				n >>= 7;
+			}
+
+			out.push_back(boost::uint8_t(n));
+		}
+
+	private:
+		vector<boost::uint8_t>& out;
+		unsigned lastField;
+		std::stack<unsigned> fields;
+	};
+
+	void putVarInt(vector<boost::uint8_t>& out, boost::uint32_t n)
+	{
+		while (n >= 0x80)
+		{
+			out.push_back(boost::uint8_t(n) | 0x80);
+			n >>= 7;
+		}
+
+		out.push_back(boost::uint8_t(n));
+	}
+
+	template <typename T>
+	void putValue(vector<boost::uint8_t>& out, T value)
+	{
+		const boost::uint8_t* p = reinterpret_cast<const boost::uint8_t*>(&value);
+		out.insert(out.end(), p, p + sizeof(value));
+	}
+
+	template <typename T>
+	T getValue(const boost::uint8_t* p)
+	{
+		T value;
+		memcpy(&value, p, sizeof(value));
+		return value;
+	}
+
+	// RLE / bit packing hybrid: runs of at least 8 equal values are run length encoded and
+	// everything else is bit packed in groups of 8.
+	void encodeHybrid(const vector<boost::uint32_t>& values, unsigned bitWidth,
+		vector<boost::uint8_t>& out)
+	{
+		const unsigned n = values.size();
+		const unsigned byteWidth = (bitWidth + 7) / 8;
+		unsigned i = 0;
+
+		while (i < n)
+		{
+			unsigned run = 1;
+
+			while (i + run < n && values[i + run] == values[i])
+				++run;
+
+			if (run >= 8)
+			{
+				putVarInt(out, run << 1);
+
+				for (unsigned j = 0; j < byteWidth; ++j)
+					out.push_back(boost::uint8_t(values[i] >> (j * 8)));
+
+				i += run;
+				continue;
+			}
+
+			// Bit packed groups, until a long run starts at a group boundary.
+			unsigned start = i;
+			unsigned groups = 0;
+
+			do
+			{
+				i += 8;
+				++groups;
+
+				if (i >= n)
+					break;
+
+				run = 1;
+
+				while (i + run < n && run < 8 && values[i + run] == values[i])
+					++run;
+			} while (run < 8);
+
+			putVarInt(out, (groups << 1) | 1);
+
+			boost::uint64_t buffer = 0;
+			unsigned bits = 0;
+
+			for (unsigned j = start; j < start + groups * 8; ++j)
+			{
+				buffer |= boost::uint64_t(j < n ? values[j] : 0) << bits;
+				bits += bitWidth;
+
+				while (bits >= 8)
+				{
+					out.push_back(boost::uint8_t(buffer));
+					buffer >>= 8;
+					bits -= 8;
+				}
+			}
+
+			if (bits > 0)
+				out.push_back(boost::uint8_t(buffer));
+		}
+	}
+
+	unsigned bitsNeeded(unsigned n)
+	{
+		unsigned bits = 1;
+
+		while (bits < 32 && (n >> bits) != 0)
+			++bits;
+
+		return bits;
+	}
+
+	void getParquetType(const Format::Field& field, int& type, int& convertedType, int& precision)
+	{
+		convertedType = CONVERTED_NONE;
+		precision = 0;
+
+		switch (field.type)
+		{
+			case Format::TYPE_SHORT:
+				type = TYPE_INT32;
+				convertedType = field.scale != 0 ? CONVERTED_DECIMAL : CONVERTED_INT_16;
+				precision = 4;
+				break;
+
+			case Format::TYPE_LONG:
+				type = TYPE_INT32;
+				convertedType = field.scale != 0 ? CONVERTED_DECIMAL : CONVERTED_NONE;
+				precision = 9;
+				break;
+
+			case Format::TYPE_INT64:
+				type = TYPE_INT64;
+				convertedType = field.scale != 0 ? CONVERTED_DECIMAL : CONVERTED_NONE;
+				precision = 18;
+				break;
+
+			case Format::TYPE_FLOAT:
+				type = TYPE_FLOAT;
+				break;
+
+			case Format::TYPE_DOUBLE:
+				type = TYPE_DOUBLE;
+				break;
+
+			case Format::TYPE_DATE:
+				type = TYPE_INT32;
+				convertedType = CONVERTED_DATE;
+				break;
+
+			case Format::TYPE_TIME:
+				type = TYPE_INT32;
+				convertedType = CONVERTED_TIME_MILLIS;
+				break;
+
+			case Format::TYPE_TIMESTAMP:
+				type = TYPE_INT64;
+				convertedType = CONVERTED_TIMESTAMP_MICROS;
+				break;
+
+			case Format::TYPE_TEXT:
+			case Format::TYPE_VARYING:
+				type = TYPE_BYTE_ARRAY;
+				convertedType = CONVERTED_UTF8;
+				break;
+
+			case Format::TYPE_BLOB:
+				type = TYPE_INT64;
+				break;
+		}
+	}
+
+	// Appends the plain encoding of the not null values of rows [start, end).
+	void encodePlain(const Format::Field& field, const RecordBatch::Column& column,
+		unsigned start, unsigned end, vector<boost::uint8_t>& out)
+	{
+		for (unsigned row = start; row < end; ++row)
+		{
+			if (column.nulls[row])
+				continue;
+
+			if (RecordBatch::isText(field))
+			{
+				boost::uint32_t length = column.offsets[row + 1] - column.offsets[row];
+				putValue(out, length);
+				out.insert(out.end(), column.values.begin() + column.offsets[row],
+					column.values.begin() + column.offsets[row + 1]);
+				continue;
+			}
+
+			const boost::uint8_t* p = &column.values[row * field.length];
+
+			switch (field.type)
+			{
+				case Format::TYPE_SHORT:
+					putValue<boost::int32_t>(out, getValue<boost::int16_t>(p));
+					break;
+
+				case Format::TYPE_DATE:
+					putValue<boost::int32_t>(out, getValue<boost::int32_t>(p) - UNIX_EPOCH_DATE);
+					break;
+
+				case Format::TYPE_TIME:
+					putValue<boost::int32_t>(out, getValue<boost::uint32_t>(p) / 10);
+					break;
+
+				case Format::TYPE_TIMESTAMP:
+					putValue<boost::int64_t>(out,
+						boost::int64_t(getValue<boost::int32_t>(p) - UNIX_EPOCH_DATE) * 86400000000LL +
+						boost::int64_t(getValue<boost::uint32_t>(p + 4)) * 100);
+					break;
+
+				default:
+					out.insert(out.end(), p, p + field.length);
+					break;
+			}
+		}
+	}
+
+	void writePageHeader(vector<boost::uint8_t>& out, PageType pageType, unsigned size,
+		unsigned values, Encoding encoding)
+	{
+		ThriftWriter writer(out);
+		writer.writeI32(1, pageType);
+		writer.writeI32(2, size);
+		writer.writeI32(3, size);
+
+		if (pageType == PAGE_DICTIONARY)
+		{
+			writer.beginStruct(7);
+			writer.writeI32(1, values);
+			writer.writeI32(2, ENCODING_PLAIN);
+			writer.endStruct();
+		}
+		else
+		{
+			writer.beginStruct(5);
+			writer.writeI32(1, values);
+			writer.writeI32(2, encoding);
+			writer.writeI32(3, ENCODING_RLE);
+			writer.writeI32(4, ENCODING_RLE);
+			writer.endStruct();
+		}
+
+		writer.end();
+	}
+}	// namespace
+
+
+struct ParquetWriter::ColumnChunk
+{
+	ColumnChunk()
+		: dictionaryPageOffset(-1),
+		  dataPageOffset(0)
+	{
+	}
+
+	vector<boost::uint8_t> data;
+	boost::int64_t dictionaryPageOffset;	// relative to the chunk start
+	boost::int64_t dataPageOffset;
+};
+
+
+ParquetWriter::ParquetWriter(const char* filename, const Format* aFormat, unsigned aThreads)
+	: file(filename, std::ios::out | std::ios::binary | std::ios::trunc),
+	  format(aFormat),
+	  threads(aThreads == 0 ? 1 : aThreads),
+	  offset(0),
+	  rows(0),
+	  closed(false)
+{
+	if (file.fail())
+		throw runtime_error(string("Cannot create ") + filename);
+
+	file.write("PAR1", 4);
+	offset = 4;
+}
+
+ParquetWriter::~ParquetWriter()
+{
+	try
+	{
+		close();
+	}
+	catch (...)
+	{
+	}
+}
+
+void ParquetWriter::write(const RecordBatch& batch)
+{
+	if (batch.count == 0)
+		return;
+
+	vector<ColumnChunk> chunks(format->fields.size());
+
+	boost::thread_group group;
+
+	for (unsigned i = 1; i < threads && i < chunks.size(); ++i)
+		group.create_thread(boost::bind(&ParquetWriter::encodeColumns, this, &batch, &chunks, i));
+
+	encodeColumns(&batch, &chunks, 0);
+	group.join_all();
+
+	RowGroup rowGroup;
+	rowGroup.rows = batch.count;
+	rowGroup.size = 0;
+
+	for (vector<ColumnChunk>::iterator chunk = chunks.begin(); chunk != chunks.end(); ++chunk)
+	{
+		ColumnMetadata metadata;
+		metadata.dictionaryPageOffset = chunk->dictionaryPageOffset < 0 ? -1 :
+			offset + chunk->dictionaryPageOffset;
+		metadata.dataPageOffset = offset + chunk->dataPageOffset;
+		metadata.size = chunk->data.size();
+
+		file.write(reinterpret_cast<const char*>(&chunk->data.front()), chunk->data.size());
+		offset += chunk->data.size();
+
+		rowGroup.size += metadata.size;
+		rowGroup.columns.push_back(metadata);
+	}
+
+	if (file.fail())
+		throw runtime_error("Error writing parquet file");
+
+	rowGroups.push_back(rowGroup);
+	rows += batch.count;
+}
+
+void ParquetWriter::close()
+{
+	if (closed)
+		return;
+
+	closed = true;
+	writeMetadata();
+	file.close();
+
+	if (file.fail())
+		throw runtime_error("Error writing parquet file");
+}
+
+void ParquetWriter::encodeColumns(const RecordBatch* batch, vector<ColumnChunk>* chunks,
+	unsigned first)
+{
+	vector<boost::uint32_t> levels;
+	vector<boost::uint32_t> indices;
+	vector<boost::uint8_t> body;
+
+	for (unsigned i = first; i < chunks->size(); i += threads)
+	{
+		const Format::Field& field = format->fields[i];
+		const RecordBatch::Column& column = batch->columns[i];
+		ColumnChunk& chunk = (*chunks)[i];
+
+		bool dictionary = false;
+		unsigned bitWidth = 0;
+		indices.clear();
+
+		if (RecordBatch::isText(field))
+		{
+			typedef boost::unordered_map<string, boost::uint32_t> Dictionary;
+			Dictionary entries;
+			vector<const string*> order;
+			size_t size = 0;
+
+			dictionary = true;
+
+			for (unsigned row = 0; row < batch->count && dictionary; ++row)
+			{
+				if (column.nulls[row])
+					continue;
+
+				string value(column.values.begin() + column.offsets[row],
+					column.values.begin() + column.offsets[row + 1]);
+
+				std::pair<Dictionary::iterator, bool> ret =
+					entries.insert(std::make_pair(value, boost::uint32_t(order.size())));
+
+				if (ret.second)
+				{
+					order.push_back(&ret.first->first);
+					size += sizeof(boost::uint32_t) + value.length();
+					dictionary = size <= MAX_DICTIONARY_SIZE;
+				}
+
+				indices.push_back(ret.first->second);
+			}
+
+			if (dictionary)
+			{
+				body.clear();
+
+				for (vector<const string*>::iterator j = order.begin(); j != order.end(); ++j)
+				{
+					putValue<boost::uint32_t>(body, (*j)->length());
+					body.insert(body.end(), (*j)->begin(), (*j)->end());
+				}
+
+				chunk.dictionaryPageOffset = 0;
+				writePageHeader(chunk.data, PAGE_DICTIONARY, body.size(), order.size(),
+					ENCODING_PLAIN);
+				chunk.data.insert(chunk.data.end(), body.begin(), body.end());
+
+				bitWidth = bitsNeeded(order.empty() ? 0 : order.size() - 1);
+			}
+		}
+
+		chunk.dataPageOffset = chunk.data.size();
+
+		unsigned index = 0;
+
+		for (unsigned start = 0; start < batch->count; start += PAGE_ROWS)
+		{
+			unsigned end = std::min(start + PAGE_ROWS, batch->count);
+
+			// Definition levels: 1 when not null.
+			levels.clear();
+
+			for (unsigned row = start; row < end; ++row)
+				levels.push_back(!column.nulls[row]);
+
+			body.assign(4, 0);
+			encodeHybrid(levels, 1, body);
+
+			boost::uint32_t levelsSize = body.size() - 4;
+			memcpy(&body.front(), &levelsSize, sizeof(levelsSize));
+
+			if (dictionary)
+			{
+				unsigned count = 0;
+
+				for (unsigned row = start; row < end; ++row)
+					count += levels[row - start];
+
+				levels.assign(indices.begin() + index, indices.begin() + index + count);
+				index += count;
+
+				body.push_back(bitWidth);
+				encodeHybrid(levels, bitWidth, body);
+			}
+			else
+				encodePlain(field, column, start, end, body);
+
+			writePageHeader(chunk.data, PAGE_DATA, body.size(), end - start,
+				(dictionary ? ENCODING_RLE_DICTIONARY : ENCODING_PLAIN));
+			chunk.data.insert(chunk.data.end(), body.begin(), body.end());
+		}
+	}
+}
+
+void ParquetWriter::writeMetadata()
+{
+	vector<boost::uint8_t> out;
+	ThriftWriter writer(out);
+
+	writer.writeI32(1, 1);	// version
+
+	writer.beginList(2, ThriftWriter::FIELD_STRUCT, format->fields.size() + 1);
+
+	writer.beginListStruct();
+	writer.writeString(4, "schema");
+	writer.writeI32(5, format->fields.size());
+	writer.endStruct();
+
+	for (vector<Format::Field>::const_iterator field = format->fields.begin();
+		 field != format->fields.end();
+		 ++field)
+	{
+		int type, convertedType, precision;
+		getParquetType(*field, type, convertedType, precision);
+
+		writer.beginListStruct();
+		writer.writeI32(1, type);
+		writer.writeI32(3, REPETITION_OPTIONAL);
+		writer.writeString(4, field->name);
+
+		if (convertedType != CONVERTED_NONE)
+			writer.writeI32(6, convertedType);
+
+		if (convertedType == CONVERTED_DECIMAL)
+		{
+			writer.writeI32(7, -field->scale);
+			writer.writeI32(8, precision);
+		}
+
+		writer.endStruct();
+	}
+
+	writer.writeI64(3, rows);
+
+	writer.beginList(4, ThriftWriter::FIELD_STRUCT, rowGroups.size());
+
+	for (vector<RowGroup>::const_iterator rowGroup = rowGroups.begin();
+		 rowGroup != rowGroups.end();
+		 ++rowGroup)
+	{
+		writer.beginListStruct();
+		writer.beginList(1, ThriftWriter::FIELD_STRUCT, rowGroup->columns.size());
+
+		for (unsigned i = 0; i < rowGroup->columns.size(); ++i)
+		{
+			const Format::Field& field = format->fields[i];
+			const ColumnMetadata& column = rowGroup->columns[i];
+			bool dictionary = column.dictionaryPageOffset >= 0;
+
+			int type, convertedType, precision;
+			getParquetType(field, type, convertedType, precision);
+
+			writer.beginListStruct();
+			writer.writeI64(2, dictionary ? column.dictionaryPageOffset : column.dataPageOffset);
+
+			writer.beginStruct(3);
+			writer.writeI32(1, type);
+
+			writer.beginList(2, ThriftWriter::FIELD_I32, dictionary ? 3 : 2);
+			writer.writeListI32(ENCODING_PLAIN);
+			writer.writeListI32(ENCODING_RLE);
+
+			if (dictionary)
+				writer.writeListI32(ENCODING_RLE_DICTIONARY);
+
+			writer.beginList(3, ThriftWriter::FIELD_BINARY, 1);
+			writer.writeListString(field.name);
+
+			writer.writeI32(4, CODEC_UNCOMPRESSED);
+			writer.writeI64(5, rowGroup->rows);
+			writer.writeI64(6, column.size);
+			writer.writeI64(7, column.size);
+			writer.writeI64(9, column.dataPageOffset);
+
+			if (dictionary)
+				writer.writeI64(11, column.dictionaryPageOffset);
+
+			writer.endStruct();
+			writer.endStruct();
+		}
+
+		writer.writeI64(2, rowGroup->size);
+		writer.writeI64(3, rowGroup->rows);
+		writer.endStruct();
+	}
+
+	writer.writeString(6, "fbods");
+	writer.end();
+
+	boost::uint32_t length = out.size();
+	putValue(out, length);
+	out.insert(out.end(), "PAR1", "PAR1" + 4);
+
+	file.write(reinterpret_cast<const char*>(&out.front()), out.size());
+}
+
+
+//------------------------------------------------------------------------------
+
+}	// fbods
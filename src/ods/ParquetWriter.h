@@ -0,0 +1,93 @@
+/*
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Initial Developer of the Original Code is Adriano dos Santos Fernandes.
+ * Portions created by the Initial Developer are Copyright (C) 2012 the Initial Developer.
+ * All Rights Reserved.
+ *
+ * Contributor(s):
+ *
+ */
+
+#ifndef FBSTUFF_ODS_PARQUET_WRITER_H
+#define FBSTUFF_ODS_PARQUET_WRITER_H
+
+#include "Format.h"
+#include "RecordBatch.h"
+#include <fstream>
+#include <string>
+#include <vector>
+#include <boost/cstdint.hpp>
+
+namespace fbods
+{
+
+//------------------------------------------------------------------------------
+
+
+// Writes record batches as a Parquet file, one row group per batch. Columns are encoded in
+// parallel; text columns are dictionary encoded, with RLE / bit packed indices, unless the
+// dictionary grows too large. Pages are not compressed.
+class ParquetWriter
+{
+public:
+	static const unsigned PAGE_ROWS = 65536;
+	static const unsigned MAX_DICTIONARY_SIZE = 1024 * 1024;
+
+private:
+	struct ColumnChunk;
+
+	struct ColumnMetadata
+	{
+		boost::int64_t dictionaryPageOffset;	// -1 when the column is not dictionary encoded
+		boost::int64_t dataPageOffset;
+		boost::int64_t size;
+	};
+
+	struct RowGroup
+	{
+		boost::int64_t rows;
+		boost::int64_t size;
+		std::vector<ColumnMetadata> columns;
+	};
+
+public:
+	ParquetWriter(const char* filename, const Format* aFormat, unsigned aThreads = 1);
+	~ParquetWriter();
+
+private:
+	ParquetWriter(const ParquetWriter&);
+	ParquetWriter& operator =(const ParquetWriter&);
+
+public:
+	void write(const RecordBatch& batch);
+	void close();
+
+private:
+	void encodeColumns(const RecordBatch* batch, std::vector<ColumnChunk>* chunks, unsigned first);
+	void writeMetadata();
+
+private:
+	std::ofstream file;
+	const Format* format;
+	unsigned threads;
+	boost::int64_t offset;
+	boost::int64_t rows;
+	std::vector<RowGroup> rowGroups;
+	bool closed;
+};
+
+
+//------------------------------------------------------------------------------
+
+}	// fbods
+
+#endif	// FBSTUFF_ODS_PARQUET_WRITER_H
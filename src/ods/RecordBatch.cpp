@@ -0,0 +1,106 @@
+/*
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Initial Developer of the Original Code is Adriano dos Santos Fernandes.
+ * Portions created by the Initial Developer are Copyright (C) 2012 the Initial Developer.
+ * All Rights Reserved.
+ *
+ * Contributor(s):
+ *
+ */
+
+#include "RecordBatch.h"
+#include <cstring>
+
+namespace fbods
+{
+
+//------------------------------------------------------------------------------
+
+
+RecordBatch::RecordBatch(const Format* aFormat, unsigned aCapacity)
+	: format(aFormat),
+	  capacity(aCapacity),
+	  count(0),
+	  columns(aFormat->fields.size())
+{
+	for (unsigned i = 0; i < columns.size(); ++i)
+	{
+		const Format::Field& field = format->fields[i];
+		Column& column = columns[i];
+
+		column.nulls.reserve(capacity);
+
+		if (isText(field))
+		{
+			column.offsets.reserve(capacity + 1);
+			column.offsets.push_back(0);
+		}
+		else
+			column.values.reserve(capacity * field.length);
+	}
+}
+
+void RecordBatch::add(const void* record)
+{
+	for (unsigned i = 0; i < columns.size(); ++i)
+	{
+		const Format::Field& field = format->fields[i];
+		Column& column = columns[i];
+		bool null = format->isNull(record, i);
+
+		column.nulls.push_back(null);
+
+		const boost::uint8_t* value = format->getPointer(record, i);
+
+		if (isText(field))
+		{
+			if (!null)
+			{
+				unsigned length = format->getValueLength(record, i);
+
+				if (field.type == Format::TYPE_VARYING)
+					value += 2;
+
+				column.values.insert(column.values.end(), value, value + length);
+			}
+
+			column.offsets.push_back(column.values.size());
+		}
+		else if (null)
+			column.values.resize(column.values.size() + field.length);
+		else
+			column.values.insert(column.values.end(), value, value + field.length);
+	}
+
+	++count;
+}
+
+void RecordBatch::clear()
+{
+	for (unsigned i = 0; i < columns.size(); ++i)
+	{
+		Column& column = columns[i];
+
+		column.nulls.clear();
+		column.values.clear();
+
+		if (!column.offsets.empty())
+			column.offsets.resize(1);
+	}
+
+	count = 0;
+}
+
+
+//------------------------------------------------------------------------------
+
+}	// fbods
@@ -0,0 +1,74 @@
+/*
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Initial Developer of the Original Code is Adriano dos Santos Fernandes.
+ * Portions created by the Initial Developer are Copyright (C) 2012 the Initial Developer.
+ * All Rights Reserved.
+ *
+ * Contributor(s):
+ *
+ */
+
+#ifndef FBSTUFF_ODS_RECORD_BATCH_H
+#define FBSTUFF_ODS_RECORD_BATCH_H
+
+#include "Format.h"
+#include <vector>
+#include <boost/cstdint.hpp>
+
+namespace fbods
+{
+
+//------------------------------------------------------------------------------
+
+
+// Decoded records stored column by column. Buffers keep their capacity when the batch is
+// cleared, so a batch reused for a whole scan stops allocating after it has been filled once.
+class RecordBatch
+{
+public:
+	struct Column
+	{
+		std::vector<boost::uint8_t> nulls;		// one byte per row, 1 when null
+		std::vector<boost::uint8_t> values;		// fixed length values, or text bytes
+		std::vector<boost::uint32_t> offsets;	// text columns: start of each row in values, plus end
+	};
+
+public:
+	RecordBatch(const Format* aFormat, unsigned aCapacity);
+
+public:
+	void add(const void* record);
+	void clear();
+
+	bool isFull() const
+	{
+		return count >= capacity;
+	}
+
+	static bool isText(const Format::Field& field)
+	{
+		return field.type == Format::TYPE_TEXT || field.type == Format::TYPE_VARYING;
+	}
+
+public:
+	const Format* format;
+	unsigned capacity;
+	unsigned count;
+	std::vector<Column> columns;
+};
+
+
+//------------------------------------------------------------------------------
+
+}	// fbods
+
+#endif	// FBSTUFF_ODS_RECORD_BATCH_H
@@ -0,0 +1,142 @@
+/*
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Initial Developer of the Original Code is Adriano dos Santos Fernandes.
+ * Portions created by the Initial Developer are Copyright (C) 2012 the Initial Developer.
+ * All Rights Reserved.
+ *
+ * Contributor(s):
+ *
+ */
+
+#include "RecordView.h"
+#include "BufferArena.h"
+#include "ScanStream.h"
+#include <algorithm>
+#include <stdexcept>
+
+namespace fbods
+{
+
+//------------------------------------------------------------------------------
+
+
+RecordView::RecordView(const Format* aFormat)
+	: format(aFormat),
+	  buffer(reinterpret_cast<boost::uint8_t*>(
+		allocateBuffer(ScanStream::MAX_RECORD_SIZE, bufferScope))),
+	  position(NULL),
+	  end(NULL),
+	  compression(COMPRESSION_RLE),
+	  decoded(0)
+{
+}
+
+const char* RecordView::getText(unsigned n, unsigned& length)
+{
+	const boost::uint8_t* p = getPointer(n);
+
+	if (format->fields[n].type == Format::TYPE_VARYING)
+	{
+		// Damaged records may have lengths past the field.
+		boost::uint16_t varyingLength;
+		memcpy(&varyingLength, p, sizeof(varyingLength));
+		length = std::min<unsigned>(varyingLength,
+			format->fields[n].length - sizeof(varyingLength));
+		return reinterpret_cast<const char*>(p + sizeof(varyingLength));
+	}
+
+	length = format->fields[n].length;
+	return reinterpret_cast<const char*>(p);
+}
+
+// Decompresses whole runs until the given length is reached.
+void RecordView::decode(unsigned length)
+{
+	boost::uint8_t* pt = buffer + decoded;
+
+	ScanCounters* counters = ScanMetrics::getCounters();
+	const boost::uint64_t start = counters ? ScanCounters::now() : 0;
+
+	switch (compression)
+	{
+		case COMPRESSION_RLE_LONG_RUNS:
+			pt = decodeRuns<COMPRESSION_RLE_LONG_RUNS>(pt, length);
+			break;
+
+		case COMPRESSION_NONE:
+			pt = decodeRuns<COMPRESSION_NONE>(pt, length);
+			break;
+
+		default:
+			pt = decodeRuns<COMPRESSION_RLE>(pt, length);
+			break;
+	}
+
+	if (counters)
+		counters->addDecode(pt - buffer - decoded, start);
+
+	decoded = pt - buffer;
+}
+
+template <Compression COMPRESSION>
+boost::uint8_t* RecordView::decodeRuns(boost::uint8_t* pt, unsigned length)
+{
+	const boost::uint8_t* const bufferEnd = buffer + ScanStream::MAX_RECORD_SIZE;
+
+	if (COMPRESSION == COMPRESSION_NONE)
+	{
+		const size_t n = std::min<size_t>(end - position, bufferEnd - pt);
+
+		memcpy(pt, position, n);
+		position += n;
+		return pt + n;
+	}
+
+	// Damaged records are cut where their data or the buffer ends, as by ScanStream::fetch.
+	while (position < end && unsigned(pt - buffer) < length)
+	{
+		const boost::int8_t control = boost::int8_t(*position++);
+
+		if (control < 0)
+		{
+			if (getRunLengthSize<COMPRESSION>(control) >= unsigned(end - position))
+			{
+				position = end;
+				break;
+			}
+
+			const size_t n = std::min<size_t>(getRunLength<COMPRESSION>(control, position),
+				bufferEnd - pt);
+
+			memset(pt, *position++, n);
+			pt += n;
+		}
+		else
+		{
+			const size_t available = std::min<size_t>(control, end - position);
+			const size_t n = std::min<size_t>(available, bufferEnd - pt);
+
+			memcpy(pt, position, n);
+			position += available;
+			pt += n;
+		}
+
+		if (pt == bufferEnd)
+			position = end;
+	}
+
+	return pt;
+}
+
+//------------------------------------------------------------------------------
+
+}	// fbods
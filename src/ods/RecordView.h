@@ -0,0 +1,145 @@
+/*
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Initial Developer of the Original Code is Adriano dos Santos Fernandes.
+ * Portions created by the Initial Developer are Copyright (C) 2012 the Initial Developer.
+ * All Rights Reserved.
+ *
+ * Contributor(s):
+ *
+ */
+
+#ifndef FBSTUFF_ODS_RECORD_VIEW_H
+#define FBSTUFF_ODS_RECORD_VIEW_H
+
+#include "Compression.h"
+#include "Format.h"
+#include <cstring>
+#include <boost/cstdint.hpp>
+#include <boost/scoped_array.hpp>
+
+namespace fbods
+{
+
+//------------------------------------------------------------------------------
+
+
+// Record fetched by a scan without decompressing it. Fields are decompressed on demand, the
+// cursor staying where the last access stopped, so a filter on the first fields doesn't pay
+// for the rest of the record. The view is valid until the next fetch and doesn't allocate
+// memory after its construction.
+class RecordView
+{
+public:
+	explicit RecordView(const Format* aFormat);
+
+public:
+	// Starts a new record from its compressed bytes.
+	void reset(const boost::uint8_t* aBegin, const boost::uint8_t* aEnd,
+		Compression aCompression = COMPRESSION_RLE)
+	{
+		position = aBegin;
+		end = aEnd;
+		compression = aCompression;
+		decoded = 0;
+	}
+
+	bool isNull(unsigned n)
+	{
+		ensure((n >> 3) + 1);
+		return format->isNull(buffer, n);
+	}
+
+	// Pointer to the field value in the format layout.
+	const boost::uint8_t* getPointer(unsigned n)
+	{
+		const Format::Field& field = format->fields[n];
+		ensure(field.offset + field.length);
+		return buffer + field.offset;
+	}
+
+	boost::int16_t getShort(unsigned n)
+	{
+		return getValue<boost::int16_t>(n);
+	}
+
+	// Also for dates and times.
+	boost::int32_t getLong(unsigned n)
+	{
+		return getValue<boost::int32_t>(n);
+	}
+
+	boost::int64_t getInt64(unsigned n)
+	{
+		return getValue<boost::int64_t>(n);
+	}
+
+	float getFloat(unsigned n)
+	{
+		return getValue<float>(n);
+	}
+
+	double getDouble(unsigned n)
+	{
+		return getValue<double>(n);
+	}
+
+	// Text of char and varchar fields.
+	const char* getText(unsigned n, unsigned& length);
+
+	// Decompresses the rest of the record, returning it in the format layout.
+	const void* getRecord()
+	{
+		ensure(~0u);
+		return buffer;
+	}
+
+	unsigned getDecodedLength() const
+	{
+		return decoded;
+	}
+
+private:
+	template <typename T>
+	T getValue(unsigned n)
+	{
+		T value;
+		memcpy(&value, getPointer(n), sizeof(value));
+		return value;
+	}
+
+	void ensure(unsigned length)
+	{
+		if (decoded < length && position != end)
+			decode(length);
+	}
+
+	void decode(unsigned length);
+
+	template <Compression COMPRESSION>
+	boost::uint8_t* decodeRuns(boost::uint8_t* pt, unsigned length);
+
+private:
+	const Format* format;
+	boost::scoped_array<char> bufferScope;
+	boost::uint8_t* buffer;
+	const boost::uint8_t* position;
+	const boost::uint8_t* end;
+	Compression compression;
+	unsigned decoded;
+};
+
+
+//------------------------------------------------------------------------------
+
+}	// fbods
+
+#endif	// FBSTUFF_ODS_RECORD_VIEW_H
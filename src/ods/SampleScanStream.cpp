@@ -0,0 +1,133 @@
+/*
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Initial Developer of the Original Code is Adriano dos Santos Fernandes.
+ * Portions created by the Initial Developer are Copyright (C) 2012 the Initial Developer.
+ * All Rights Reserved.
+ *
+ * Contributor(s):
+ *
+ */
+
+#include "SampleScanStream.h"
+#include <algorithm>
+#include <cmath>
+#include <boost/random/mersenne_twister.hpp>
+#include <boost/random/uniform_int_distribution.hpp>
+
+namespace fbods
+{
+
+using std::string;
+using std::vector;
+
+//------------------------------------------------------------------------------
+
+
+SampleScanStream::SampleScanStream(Database* aDatabase, Database::RelationId relationId,
+			const SampleOptions& options, const Format* aFormat)
+	: PageListScanStream(aDatabase),
+	  format(aFormat)
+{
+	init(relationId, options);
+}
+
+SampleScanStream::SampleScanStream(Database* aDatabase, const char* relationName,
+			const SampleOptions& options, const Format* aFormat)
+	: PageListScanStream(aDatabase),
+	  format(aFormat)
+{
+	init(aDatabase->findRelation(relationName), options);
+}
+
+void SampleScanStream::init(Database::RelationId relationId, const SampleOptions& options)
+{
+	records = 0;
+	relation = relationId;
+
+	if (format)
+		fields.resize(format->fields.size());
+
+	database->getDataPages(relationId, pages);
+	totalPages = pages.size();
+
+	unsigned count = options.pages != 0 ? options.pages :
+		unsigned(ceil(totalPages * options.percent / 100));
+	count = std::min(std::max(count, 1u), totalPages);
+
+	boost::random::mt19937 generator(options.seed);
+
+	switch (options.method)
+	{
+		case SampleOptions::METHOD_RANDOM:
+			// Partial Fisher-Yates: the first count entries end up as the sample.
+			for (unsigned i = 0; i < count; ++i)
+			{
+				boost::random::uniform_int_distribution<unsigned> dist(i, totalPages - 1);
+				std::swap(pages[i], pages[dist(generator)]);
+			}
+
+			pages.resize(count);
+			break;
+
+		case SampleOptions::METHOD_STRATIFIED:
+			for (unsigned i = 0; i < count; ++i)
+			{
+				unsigned start = unsigned(boost::uint64_t(i) * totalPages / count);
+				unsigned end = unsigned(boost::uint64_t(i + 1) * totalPages / count);
+				boost::random::uniform_int_distribution<unsigned> dist(start, end - 1);
+				pages[i] = pages[dist(generator)];
+			}
+
+			pages.resize(count);
+			break;
+	}
+
+	// Read the sample in file order.
+	std::sort(pages.begin(), pages.end());
+}
+
+bool SampleScanStream::fetch(void* recordBuffer)
+{
+	if (!ScanStream::fetch(recordBuffer))
+		return false;
+
+	++records;
+
+	if (!format)
+		return true;
+
+	for (unsigned i = 0; i < fields.size(); ++i)
+	{
+		FieldEstimate& field = fields[i];
+
+		if (format->isNull(recordBuffer, i))
+		{
+			++field.nulls;
+			continue;
+		}
+
+		const char* value = reinterpret_cast<const char*>(format->getPointer(recordBuffer, i));
+
+		if (field.min.empty() || format->compare(i, value, field.min.data()) < 0)
+			field.min.assign(value, format->fields[i].length);
+
+		if (field.max.empty() || format->compare(i, value, field.max.data()) > 0)
+			field.max.assign(value, format->fields[i].length);
+	}
+
+	return true;
+}
+
+
+//------------------------------------------------------------------------------
+
+}	// fbods
@@ -0,0 +1,131 @@
+/*
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Initial Developer of the Original Code is Adriano dos Santos Fernandes.
+ * Portions created by the Initial Developer are Copyright (C) 2012 the Initial Developer.
+ * All Rights Reserved.
+ *
+ * Contributor(s):
+ *
+ */
+
+#ifndef FBSTUFF_ODS_SAMPLE_SCAN_STREAM_H
+#define FBSTUFF_ODS_SAMPLE_SCAN_STREAM_H
+
+#include "PageListScanStream.h"
+#include "Format.h"
+#include <string>
+#include <vector>
+#include <boost/cstdint.hpp>
+
+namespace fbods
+{
+
+//------------------------------------------------------------------------------
+
+
+struct SampleOptions
+{
+	enum Method
+	{
+		METHOD_RANDOM,		// pages picked uniformly from the whole relation
+		METHOD_STRATIFIED	// one page picked from each of equally sized page ranges
+	};
+
+	SampleOptions()
+		: method(METHOD_RANDOM),
+		  percent(1),
+		  pages(0),
+		  seed(0)
+	{
+	}
+
+	Method method;
+	double percent;
+	unsigned pages;		// when not zero, takes precedence over percent
+	unsigned seed;
+};
+
+// Reads a subset of a relation data pages, chosen from its pointer pages. Records fetched
+// are accounted in the estimates, scaled to the whole relation.
+class SampleScanStream : public PageListScanStream
+{
+public:
+	struct FieldEstimate
+	{
+		FieldEstimate()
+			: nulls(0)
+		{
+		}
+
+		boost::uint64_t nulls;
+		std::string min;	// raw values, empty when all sampled values are null
+		std::string max;
+	};
+
+public:
+	SampleScanStream(Database* aDatabase, Database::RelationId relationId,
+		const SampleOptions& options, const Format* aFormat = NULL);
+	SampleScanStream(Database* aDatabase, const char* relationName,
+		const SampleOptions& options, const Format* aFormat = NULL);
+
+private:
+	void init(Database::RelationId relationId, const SampleOptions& options);
+
+public:
+	// Records fetched as views are not accounted in the estimates.
+	using ScanStream::fetch;
+
+	bool fetch(void* recordBuffer);
+
+	unsigned getTotalPages() const
+	{
+		return totalPages;
+	}
+
+	unsigned getSampledPages() const
+	{
+		return pages.size();
+	}
+
+	boost::uint64_t getSampledRecords() const
+	{
+		return records;
+	}
+
+	double getEstimatedRecords() const
+	{
+		return pages.empty() ? 0 : double(records) * totalPages / pages.size();
+	}
+
+	double getNullFraction(unsigned field) const
+	{
+		return records == 0 ? 0 : double(fields[field].nulls) / records;
+	}
+
+	const FieldEstimate& getFieldEstimate(unsigned field) const
+	{
+		return fields[field];
+	}
+
+private:
+	const Format* format;
+	unsigned totalPages;
+	boost::uint64_t records;
+	std::vector<FieldEstimate> fields;
+};
+
+
+//------------------------------------------------------------------------------
+
+}	// fbods
+
+#endif	// FBSTUFF_ODS_SAMPLE_SCAN_STREAM_H
@@ -0,0 +1,306 @@
+/*
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Initial Developer of the Original Code is Adriano dos Santos Fernandes.
+ * Portions created by the Initial Developer are Copyright (C) 2012 the Initial Developer.
+ * All Rights Reserved.
+ *
+ * Contributor(s):
+ *
+ */
+
+#include "ScanMetrics.h"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <boost/bind.hpp>
+#include <pthread.h>
+#include <signal.h>
+
+namespace fbods
+{
+
+using std::endl;
+using std::ostream;
+using std::string;
+using std::vector;
+
+//------------------------------------------------------------------------------
+
+
+namespace
+{
+	const char* const TYPE_NAMES[] = {
+		"undefined",
+		"header",
+		"page inventory",
+		"transaction inventory",
+		"pointer",
+		"data",
+		"index root",
+		"index b-tree",
+		"blob",
+		"generator",
+		"scn inventory",
+		"invalid"
+	};
+
+	const char* const SKIP_NAMES[] = {
+		"deleted",
+		"blob",
+		"version",
+		"fragment"
+	};
+}	// namespace
+
+
+LatencyHistogram::LatencyHistogram()
+	: count(0),
+	  sum(0),
+	  min(~boost::uint64_t(0)),
+	  max(0)
+{
+	memset(counts, 0, sizeof(counts));
+}
+
+void LatencyHistogram::merge(const LatencyHistogram& other)
+{
+	for (unsigned i = 0; i < BUCKETS; ++i)
+		counts[i] += other.counts[i];
+
+	count += other.count;
+	sum += other.sum;
+	min = std::min(min, other.min);
+	max = std::max(max, other.max);
+}
+
+boost::uint64_t LatencyHistogram::getPercentile(double percent) const
+{
+	const boost::uint64_t rank = boost::uint64_t(percent / 100 * count + 0.5);
+	boost::uint64_t seen = 0;
+
+	for (unsigned i = 0; i < BUCKETS; ++i)
+	{
+		seen += counts[i];
+
+		if (seen >= std::max(rank, boost::uint64_t(1)))
+			return std::min(i + 1 < BUCKETS ? getLowest(i + 1) - 1 : max, max);
+	}
+
+	return max;
+}
+
+void LatencyHistogram::write(ostream& out) const
+{
+	out << "{\"count\": " << count;
+
+	if (count != 0)
+	{
+		out << ", \"min\": " << min <<
+			", \"mean\": " << sum / count <<
+			", \"p50\": " << getPercentile(50) <<
+			", \"p90\": " << getPercentile(90) <<
+			", \"p99\": " << getPercentile(99) <<
+			", \"p999\": " << getPercentile(99.9) <<
+			", \"max\": " << max;
+	}
+
+	// Lowest value and count of the buckets in use.
+	out << ", \"buckets\": [";
+
+	bool first = true;
+
+	for (unsigned i = 0; i < BUCKETS; ++i)
+	{
+		if (counts[i] != 0)
+		{
+			out << (first ? "" : ", ") << "[" << getLowest(i) << ", " << counts[i] << "]";
+			first = false;
+		}
+	}
+
+	out << "]}";
+}
+
+
+//--------------------------------------
+
+
+ScanCounters::ScanCounters()
+	: bytesRead(0),
+	  cacheHits(0),
+	  records(0),
+	  decompressedBytes(0),
+	  pageDecodeTime(0)
+{
+	memset(pagesByType, 0, sizeof(pagesByType));
+	memset(skipped, 0, sizeof(skipped));
+}
+
+void ScanCounters::merge(const ScanCounters& other)
+{
+	for (unsigned i = 0; i < sizeof(pagesByType) / sizeof(pagesByType[0]); ++i)
+		pagesByType[i] += other.pagesByType[i];
+
+	for (unsigned i = 0; i < SKIP_REASONS; ++i)
+		skipped[i] += other.skipped[i];
+
+	bytesRead += other.bytesRead;
+	cacheHits += other.cacheHits;
+	records += other.records;
+	decompressedBytes += other.decompressedBytes;
+	readLatency.merge(other.readLatency);
+	decodeTime.merge(other.decodeTime);
+}
+
+
+//--------------------------------------
+
+
+ScanMetrics* ScanMetrics::instance = NULL;
+__thread ScanCounters* ScanMetrics::threadCounters = NULL;
+
+ScanMetrics::ScanMetrics()
+	: stopping(false)
+{
+	if (instance)
+		throw std::logic_error("There are scan metrics already");
+
+	instance = this;
+}
+
+ScanMetrics::~ScanMetrics()
+{
+	if (signalThread)
+	{
+		stopping = true;
+		pthread_kill(signalThread->native_handle(), SIGUSR1);
+		signalThread->join();
+	}
+
+	instance = NULL;
+	threadCounters = NULL;
+
+	for (vector<ScanCounters*>::iterator i = counters.begin(); i != counters.end(); ++i)
+		delete *i;
+}
+
+// Counters of threads still running are read while they change, so a report written on a
+// signal is only approximate.
+void ScanMetrics::write(ostream& out)
+{
+	ScanCounters total;
+	unsigned threads;
+
+	{
+		boost::mutex::scoped_lock lock(mutex);
+
+		for (vector<ScanCounters*>::const_iterator i = counters.begin(); i != counters.end(); ++i)
+			total.merge(**i);
+
+		threads = counters.size();
+	}
+
+	out << "{" << endl;
+	out << "\t\"threads\": " << threads << "," << endl;
+	out << "\t\"pagesRead\": {";
+
+	for (unsigned i = 0; i < sizeof(total.pagesByType) / sizeof(total.pagesByType[0]); ++i)
+	{
+		out << (i == 0 ? "" : ",") << endl << "\t\t\"" << TYPE_NAMES[i] << "\": " <<
+			total.pagesByType[i];
+	}
+
+	out << endl << "\t}," << endl;
+	out << "\t\"bytesRead\": " << total.bytesRead << "," << endl;
+	out << "\t\"cacheHits\": " << total.cacheHits << "," << endl;
+	out << "\t\"records\": " << total.records << "," << endl;
+	out << "\t\"skippedRecords\": {";
+
+	for (unsigned i = 0; i < ScanCounters::SKIP_REASONS; ++i)
+	{
+		out << (i == 0 ? "" : ",") << endl << "\t\t\"" << SKIP_NAMES[i] << "\": " <<
+			total.skipped[i];
+	}
+
+	out << endl << "\t}," << endl;
+	out << "\t\"decompressedBytes\": " << total.decompressedBytes << "," << endl;
+	out << "\t\"readLatencyNs\": ";
+	total.readLatency.write(out);
+	out << "," << endl;
+	out << "\t\"pageDecodeTimeNs\": ";
+	total.decodeTime.write(out);
+	out << endl << "}" << endl;
+}
+
+void ScanMetrics::write(const string& output)
+{
+	if (output == "-")
+	{
+		write(std::cerr);
+		return;
+	}
+
+	std::ofstream out(output.c_str());
+
+	if (!out)
+		throw std::runtime_error("Cannot write " + output);
+
+	write(out);
+}
+
+void ScanMetrics::writeOnSignal(const string& output)
+{
+	sigset_t signals;
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGUSR1);
+	pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+	signalThread.reset(new boost::thread(boost::bind(&ScanMetrics::waitSignal, this, output)));
+}
+
+ScanCounters* ScanMetrics::addThread()
+{
+	boost::mutex::scoped_lock lock(mutex);
+
+	threadCounters = new ScanCounters;
+	counters.push_back(threadCounters);
+
+	return threadCounters;
+}
+
+void ScanMetrics::waitSignal(const string& output)
+{
+	sigset_t signals;
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGUSR1);
+
+	int signal;
+
+	while (sigwait(&signals, &signal) == 0 && !stopping)
+	{
+		try
+		{
+			write(output);
+		}
+		catch (const std::exception& e)
+		{
+			std::cerr << e.what() << endl;
+		}
+	}
+}
+
+
+//------------------------------------------------------------------------------
+
+}	// fbods
@@ -0,0 +1,211 @@
+/*
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Initial Developer of the Original Code is Adriano dos Santos Fernandes.
+ * Portions created by the Initial Developer are Copyright (C) 2012 the Initial Developer.
+ * All Rights Reserved.
+ *
+ * Contributor(s):
+ *
+ */
+
+#ifndef FBSTUFF_ODS_SCAN_METRICS_H
+#define FBSTUFF_ODS_SCAN_METRICS_H
+
+#include "Ods.h"
+#include <ctime>
+#include <ostream>
+#include <string>
+#include <vector>
+#include <boost/cstdint.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread.hpp>
+
+namespace fbods
+{
+
+//------------------------------------------------------------------------------
+
+
+// Log-linear histogram of nanoseconds, as in HdrHistogram: values keep their 4 most
+// significant bits, so buckets are within 6% of them over the whole 64 bit range.
+class LatencyHistogram
+{
+public:
+	static const unsigned SUB_BITS = 4;
+	static const unsigned SUB_BUCKETS = 1 << SUB_BITS;
+	static const unsigned BUCKETS = (64 - SUB_BITS + 1) * SUB_BUCKETS;
+
+public:
+	LatencyHistogram();
+
+	void add(boost::uint64_t value)
+	{
+		++counts[getIndex(value)];
+		++count;
+		sum += value;
+
+		if (value < min)
+			min = value;
+
+		if (value > max)
+			max = value;
+	}
+
+	void merge(const LatencyHistogram& other);
+
+	// Upper bound of the bucket of the value at the given percentile.
+	boost::uint64_t getPercentile(double percent) const;
+
+	void write(std::ostream& out) const;
+
+	static unsigned getIndex(boost::uint64_t value)
+	{
+		if (value < SUB_BUCKETS)
+			return unsigned(value);
+
+		const unsigned exponent = 63 - __builtin_clzll(value);
+		return (exponent - SUB_BITS) * SUB_BUCKETS + unsigned(value >> (exponent - SUB_BITS));
+	}
+
+	static boost::uint64_t getLowest(unsigned index)
+	{
+		if (index < SUB_BUCKETS)
+			return index;
+
+		const unsigned exponent = index / SUB_BUCKETS + SUB_BITS - 1;
+		return boost::uint64_t(index % SUB_BUCKETS + SUB_BUCKETS) << (exponent - SUB_BITS);
+	}
+
+public:
+	boost::uint64_t counts[BUCKETS];
+	boost::uint64_t count;
+	boost::uint64_t sum;
+	boost::uint64_t min;
+	boost::uint64_t max;
+};
+
+// Counters of the scans of one thread. They are plain fields, updated without atomics.
+struct ScanCounters
+{
+	enum SkipReason
+	{
+		SKIP_DELETED,
+		SKIP_BLOB,
+		SKIP_VERSION,	// the version returned is another one in the chain, or none is visible
+		SKIP_FRAGMENT,
+		SKIP_REASONS
+	};
+
+	ScanCounters();
+
+	void merge(const ScanCounters& other);
+
+	static boost::uint64_t now()
+	{
+		timespec monotonic;
+		clock_gettime(CLOCK_MONOTONIC, &monotonic);
+		return boost::uint64_t(monotonic.tv_sec) * 1000000000 + monotonic.tv_nsec;
+	}
+
+	// Counts the pages of a read request, started at the given time.
+	void addRead(const void* pages, unsigned count, unsigned pageSize, boost::uint64_t start)
+	{
+		readLatency.add(now() - start);
+		addPages(pages, count, pageSize);
+	}
+
+	void addPages(const void* pages, unsigned count, unsigned pageSize)
+	{
+		bytesRead += boost::uint64_t(count) * pageSize;
+
+		for (unsigned i = 0; i < count; ++i)
+		{
+			const unsigned type = reinterpret_cast<const PageHeader*>(
+				static_cast<const char*>(pages) + size_t(i) * pageSize)->type;
+			++pagesByType[type <= unsigned(PageHeader::TYPE_MAX) ? type : PageHeader::TYPE_MAX + 1];
+		}
+	}
+
+	void addDecode(size_t bytes, boost::uint64_t start)
+	{
+		decompressedBytes += bytes;
+		pageDecodeTime += now() - start;
+	}
+
+	// Ends the decode time of the records of a page.
+	void finishPage()
+	{
+		if (pageDecodeTime != 0)
+		{
+			decodeTime.add(pageDecodeTime);
+			pageDecodeTime = 0;
+		}
+	}
+
+	boost::uint64_t pagesByType[PageHeader::TYPE_MAX + 2];	// the last one for invalid types
+	boost::uint64_t bytesRead;
+	boost::uint64_t cacheHits;	// back version pages fetched again, see PageFetcher
+	boost::uint64_t records;
+	boost::uint64_t skipped[SKIP_REASONS];
+	boost::uint64_t decompressedBytes;
+	boost::uint64_t pageDecodeTime;	// of the current page
+	LatencyHistogram readLatency;	// per read request
+	LatencyHistogram decodeTime;	// per data page
+};
+
+// Scan counters of the process, kept per thread while an instance exists.
+class ScanMetrics
+{
+public:
+	ScanMetrics();
+	~ScanMetrics();
+
+private:
+	ScanMetrics(const ScanMetrics&);
+	ScanMetrics& operator =(const ScanMetrics&);
+
+public:
+	// Counters of the calling thread, NULL when there are no metrics.
+	static ScanCounters* getCounters()
+	{
+		return threadCounters || !instance ? threadCounters : instance->addThread();
+	}
+
+	void write(std::ostream& out);
+
+	// Writes the metrics as JSON to a file, or to stderr with "-".
+	void write(const std::string& output);
+
+	// Writes the metrics to output on each SIGUSR1. Must be called before starting other
+	// threads, as it blocks the signal for the ones started later.
+	void writeOnSignal(const std::string& output);
+
+private:
+	ScanCounters* addThread();
+	void waitSignal(const std::string& output);
+
+private:
+	static ScanMetrics* instance;
+	static __thread ScanCounters* threadCounters;
+
+	boost::mutex mutex;
+	std::vector<ScanCounters*> counters;
+	boost::scoped_ptr<boost::thread> signalThread;
+	volatile bool stopping;
+};
+
+
+//------------------------------------------------------------------------------
+
+}	// fbods
+
+#endif	// FBSTUFF_ODS_SCAN_METRICS_H
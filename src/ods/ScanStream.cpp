@@ -0,0 +1,333 @@
+/*
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Initial Developer of the Original Code is Adriano dos Santos Fernandes.
+ * Portions created by the Initial Developer are Copyright (C) 2012 the Initial Developer.
+ * All Rights Reserved.
+ *
+ * Contributor(s):
+ *
+ */
+
+#include "ScanStream.h"
+#include "BufferArena.h"
+#include "PageReader.h"
+#include "RecordView.h"
+#include "TransactionSnapshot.h"
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+
+namespace fbods
+{
+
+//------------------------------------------------------------------------------
+
+
+namespace
+{
+	// Decompresses the whole record into [pt, limit), returning the end of the output. Damaged
+	// records with more data are cut at the limit.
+	template <Compression COMPRESSION>
+	boost::uint8_t* unpack(const boost::uint8_t* p, const boost::uint8_t* end, boost::uint8_t* pt,
+		boost::uint8_t* limit)
+	{
+		if (COMPRESSION == COMPRESSION_NONE)
+		{
+			const size_t n = std::min<size_t>(end - p, limit - pt);
+			memcpy(pt, p, n);
+			return pt + n;
+		}
+
+		while (p < end && pt < limit)
+		{
+			const boost::int8_t control = boost::int8_t(*p++);
+
+			if (control < 0)
+			{
+				if (getRunLengthSize<COMPRESSION>(control) >= size_t(end - p))
+					break;
+
+				const unsigned n = getRunLength<COMPRESSION>(control, p);
+
+				for (boost::uint8_t* runEnd = pt + std::min<size_t>(n, limit - pt); pt < runEnd; )
+					*pt++ = *p;
+
+				++p;
+			}
+			else
+			{
+				const size_t n = std::min<size_t>(std::min<size_t>(control, end - p), limit - pt);
+
+				for (const boost::uint8_t* copyEnd = p + n; p < copyEnd; )
+					*pt++ = *p++;
+			}
+		}
+
+		return pt;
+	}
+}
+
+
+ScanStream::ScanStream(Database* aDatabase)
+	: database(aDatabase),
+	  data(reinterpret_cast<DataPage*>(allocateBuffer(aDatabase->header.pageSize, dataScope))),
+	  first(true),
+	  dataNum(0)
+{
+	// Make the first fetch ask for a page.
+	memset(data, 0, sizeof(DataPage));
+}
+
+ScanStream::~ScanStream()
+{
+}
+
+bool ScanStream::fetch(void* recordBuffer)
+{
+	const RecordHeader* record;
+	unsigned length;
+
+	if (!next(record, length))
+		return false;
+
+	const boost::uint8_t* recordStart = database->getRecordData(record);
+	const boost::uint8_t* recordEnd = reinterpret_cast<const boost::uint8_t*>(record) + length;
+
+	ScanCounters* counters = ScanMetrics::getCounters();
+	const boost::uint64_t start = counters ? ScanCounters::now() : 0;
+
+	boost::uint8_t* pt = static_cast<boost::uint8_t*>(recordBuffer);
+	boost::uint8_t* const limit = pt + MAX_RECORD_SIZE;
+
+	switch (database->getCompression(record))
+	{
+		case COMPRESSION_RLE_LONG_RUNS:
+			pt = unpack<COMPRESSION_RLE_LONG_RUNS>(recordStart, recordEnd, pt, limit);
+			break;
+
+		case COMPRESSION_NONE:
+			pt = unpack<COMPRESSION_NONE>(recordStart, recordEnd, pt, limit);
+			break;
+
+		default:
+			pt = unpack<COMPRESSION_RLE>(recordStart, recordEnd, pt, limit);
+			break;
+	}
+
+	if (counters)
+		counters->addDecode(pt - static_cast<boost::uint8_t*>(recordBuffer), start);
+
+	/***
+	cout << "\t\t\toffset: " << data->rpt[dataNum].offset <<
+		", length: " << data->rpt[dataNum].length <<
+		", transaction: " << record->transaction <<
+		", page: " << record->page <<
+		", line: " << record->line <<
+		", flags: " << hex << record->flags << dec <<
+		", format: " << int(record->format) <<
+		", size: " << (pt - static_cast<boost::uint8_t*>(recordBuffer)) << endl << "\t\t\t\t";
+
+	cout << hex;
+
+	for (boost::uint8_t* p = recordStart; p != recordEnd; ++p)
+		cout << " " << setw(2) << int(*p);
+
+	cout << endl << "\t\t\t\t";
+
+	for (recordEnd = pt, pt = static_cast<boost::uint8_t*>(recordBuffer); pt != recordEnd; ++pt)
+		cout << " " << setw(2) << int(*pt);
+
+	cout << dec;
+
+	cout << endl;
+	***/
+
+	return true;
+}
+
+bool ScanStream::queuePage(unsigned number)
+{
+	if (!fetcher)
+		fetcher.reset(new PageFetcher(database, database->queueDepth));
+
+	return fetcher->queue(number);
+}
+
+const DataPage* ScanStream::fetchPage(unsigned number, int relation)
+{
+	if (!fetcher)
+		fetcher.reset(new PageFetcher(database, database->queueDepth));
+
+	return reinterpret_cast<const DataPage*>(
+		fetcher->fetch(number, PageHeader::TYPE_DATA, relation));
+}
+
+bool ScanStream::fetch(RecordView& view)
+{
+	const RecordHeader* record;
+	unsigned length;
+
+	if (!next(record, length))
+		return false;
+
+	view.reset(database->getRecordData(record),
+		reinterpret_cast<const boost::uint8_t*>(record) + length, database->getCompression(record));
+
+	return true;
+}
+
+// Finds the next record to return, leaving its version in record.
+bool ScanStream::next(const RecordHeader*& record, unsigned& length)
+{
+	ScanCounters* counters = ScanMetrics::getCounters();
+
+	for (;;)
+	{
+		if (first)
+			first = false;
+		else
+			++dataNum;
+
+		while (!(dataNum < data->count))
+		{
+			if (counters)
+				counters->finishPage();
+
+			if (!readData())
+				return false;
+
+			dataNum = 0;
+
+			if (database->snapshot && database->queueDepth > 0)
+				queueVersions();
+		}
+
+		// Readers may have moved data to another buffer.
+		const boost::uint8_t* raw = reinterpret_cast<const boost::uint8_t*>(data);
+		record = reinterpret_cast<const RecordHeader*>(&raw[data->rpt[dataNum].offset]);
+		length = data->rpt[dataNum].length;
+
+		if (selectVersion(record, length))
+			break;
+
+		if (counters && length != 0)
+		{
+			const boost::uint16_t flags = record->flags;
+
+			++counters->skipped[
+				(flags & RecordHeader::FLAG_BLOB) ? ScanCounters::SKIP_BLOB :
+				(flags & RecordHeader::FLAG_FRAGMENT) ? ScanCounters::SKIP_FRAGMENT :
+				(flags & RecordHeader::FLAG_DELETED) ? ScanCounters::SKIP_DELETED :
+				ScanCounters::SKIP_VERSION];
+		}
+	}
+
+	if (counters)
+		++counters->records;
+
+	return true;
+}
+
+// Queues the pages of the back versions to be read in the new data page, for them to be read
+// together.
+void ScanStream::queueVersions()
+{
+	const TransactionSnapshot* snapshot = database->snapshot;
+	const unsigned pageSize = database->header.pageSize;
+	const boost::uint8_t* raw = reinterpret_cast<const boost::uint8_t*>(data);
+
+	for (unsigned line = 0; line < data->count; ++line)
+	{
+		const DataPage::Repeat& repeat = data->rpt[line];
+
+		if (repeat.length < offsetof(RecordHeader, data) || repeat.offset + repeat.length > pageSize)
+			continue;
+
+		const RecordHeader* record = reinterpret_cast<const RecordHeader*>(&raw[repeat.offset]);
+
+		if (record->backPage != 0 &&
+			!(record->flags & (RecordHeader::FLAG_BLOB | RecordHeader::FLAG_CHAIN |
+				RecordHeader::FLAG_FRAGMENT)) &&
+			!snapshot->isVisible(database->getRecordTransaction(record)) &&
+			!queuePage(record->backPage))
+		{
+			break;
+		}
+	}
+}
+
+// Replaces the record by the version to be read, returning false when there is none.
+bool ScanStream::selectVersion(const RecordHeader*& record, unsigned& length)
+{
+	if (length == 0)
+		return false;
+
+	const TransactionSnapshot* snapshot = database->snapshot;
+
+	if (!snapshot)
+	{
+		return record->backPage == 0 &&
+			!(record->flags & (RecordHeader::FLAG_DELETED | RecordHeader::FLAG_BLOB));
+	}
+
+	if (record->flags & (RecordHeader::FLAG_BLOB | RecordHeader::FLAG_CHAIN |
+			RecordHeader::FLAG_FRAGMENT))
+	{
+		return false;
+	}
+
+	// Back versions stored as differences or in fragments are not rebuilt, so records
+	// with them as the visible version are skipped and counted.
+	for (unsigned depth = 0; !snapshot->isVisible(database->getRecordTransaction(record)); ++depth)
+	{
+		const unsigned backPage = record->backPage;
+		const unsigned backLine = record->backLine;
+
+		if (backPage == 0)
+			return false;	// created after the snapshot
+
+		const DataPage* version = (depth == MAX_VERSION_DEPTH ? NULL :
+			fetchPage(backPage, data->relation));
+
+		if (!version ||
+			backLine >= version->count ||
+			version->rpt[backLine].length < offsetof(RecordHeader, data) ||
+			version->rpt[backLine].offset + version->rpt[backLine].length > database->header.pageSize)
+		{
+			__sync_fetch_and_add(&database->unresolvedVersions, 1);
+			return false;
+		}
+
+		record = reinterpret_cast<const RecordHeader*>(
+			reinterpret_cast<const char*>(version) + version->rpt[backLine].offset);
+		length = version->rpt[backLine].length;
+
+		if (record->flags & RecordHeader::FLAG_DELTA)
+		{
+			__sync_fetch_and_add(&database->unresolvedVersions, 1);
+			return false;
+		}
+	}
+
+	if (record->flags & RecordHeader::FLAG_INCOMPLETE)
+	{
+		__sync_fetch_and_add(&database->unresolvedVersions, 1);
+		return false;
+	}
+
+	return !(record->flags & RecordHeader::FLAG_DELETED);
+}
+
+
+//------------------------------------------------------------------------------
+
+}	// fbods
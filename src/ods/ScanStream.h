@@ -0,0 +1,122 @@
+/*
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Initial Developer of the Original Code is Adriano dos Santos Fernandes.
+ * Portions created by the Initial Developer are Copyright (C) 2012 the Initial Developer.
+ * All Rights Reserved.
+ *
+ * Contributor(s):
+ *
+ */
+
+#ifndef FBSTUFF_ODS_SCAN_STREAM_H
+#define FBSTUFF_ODS_SCAN_STREAM_H
+
+#include "Database.h"
+#include "Message.h"
+#include <boost/scoped_array.hpp>
+#include <boost/scoped_ptr.hpp>
+
+namespace fbods
+{
+
+//------------------------------------------------------------------------------
+
+
+class PageFetcher;
+class RecordView;
+
+// Walks the records of a sequence of data pages, decompressing the primary versions.
+// Derived classes decide which data pages are read and in which order.
+class ScanStream
+{
+public:
+	static const unsigned MAX_RECORD_SIZE = 65536;
+	static const unsigned MAX_VERSION_DEPTH = 1000;
+
+public:
+	virtual ~ScanStream();
+
+protected:
+	explicit ScanStream(Database* aDatabase);
+
+public:
+	// Decompresses the record into a buffer of MAX_RECORD_SIZE bytes.
+	bool fetch(void* recordBuffer);
+
+	// Returns the record without decompressing it.
+	bool fetch(RecordView& view);
+
+	// Decompresses the record into a message declared with FBODS_MESSAGE.
+	template <typename Message>
+	bool fetchMessage(Message& message)
+	{
+		const RecordHeader* record;
+		unsigned length;
+
+		if (!next(record, length))
+			return false;
+
+		ScanCounters* counters = ScanMetrics::getCounters();
+		const boost::uint64_t start = counters ? ScanCounters::now() : 0;
+
+		const size_t decoded = decodeMessage(database->getRecordData(record),
+			reinterpret_cast<const boost::uint8_t*>(record) + length, message,
+			database->getCompression(record));
+
+		if (counters)
+			counters->addDecode(decoded, start);
+
+		return true;
+	}
+
+	// Reads of single data pages out of the scan order, as the ones of back versions. With
+	// Database::queueDepth set, the pages queued are read together, see PageFetcher. Returns
+	// false when the page is not queued.
+	bool queuePage(unsigned number);
+
+	// Returns a data page of the relation, or NULL when it isn't one. It's valid until the next
+	// page fetched.
+	const DataPage* fetchPage(unsigned number, int relation);
+
+	// Number of the record last fetched, the one encoded in RDB$DB_KEY: the data page sequence
+	// times Database::getMaxRecords plus the line.
+	boost::uint64_t getRecordNumber() const
+	{
+		return boost::uint64_t(data->sequence) * database->getMaxRecords() + dataNum;
+	}
+
+protected:
+	// Reads the next data page in the data buffer. Returns false when there are no more pages.
+	virtual bool readData() = 0;
+
+protected:
+	Database* database;
+	boost::scoped_array<char> dataScope;
+	DataPage* data;
+
+private:
+	bool next(const RecordHeader*& record, unsigned& length);
+	void queueVersions();
+	bool selectVersion(const RecordHeader*& record, unsigned& length);
+
+private:
+	bool first;
+	unsigned dataNum;
+	boost::scoped_ptr<PageFetcher> fetcher;
+};
+
+
+//------------------------------------------------------------------------------
+
+}	// fbods
+
+#endif	// FBSTUFF_ODS_SCAN_STREAM_H
@@ -0,0 +1,317 @@
+/*
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Initial Developer of the Original Code is Adriano dos Santos Fernandes.
+ * Portions created by the Initial Developer are Copyright (C) 2012 the Initial Developer.
+ * All Rights Reserved.
+ *
+ * Contributor(s):
+ *
+ */
+
+#include "SpaceAnalyzer.h"
+#include "PageSweep.h"
+#include <algorithm>
+#include <cstddef>
+
+namespace fbods
+{
+
+using std::map;
+using std::vector;
+
+//------------------------------------------------------------------------------
+
+
+RelationSpace::RelationSpace()
+	: pointerPages(0),
+	  dataPages(0),
+	  usedBytes(0),
+	  records(0),
+	  deletedStubs(0),
+	  fragmentedRecords(0),
+	  fragments(0),
+	  recordLength(0),
+	  compressedLength(0),
+	  versions(0),
+	  versionLength(0),
+	  versionedRecords(0),
+	  chainLength(0),
+	  maxChainLength(0),
+	  blobs(0)
+{
+	std::fill(fillHistogram, fillHistogram + FILL_BUCKETS, 0);
+}
+
+void RelationSpace::merge(const RelationSpace& other)
+{
+	pointerPages += other.pointerPages;
+	dataPages += other.dataPages;
+
+	for (unsigned i = 0; i < FILL_BUCKETS; ++i)
+		fillHistogram[i] += other.fillHistogram[i];
+
+	usedBytes += other.usedBytes;
+	records += other.records;
+	deletedStubs += other.deletedStubs;
+	fragmentedRecords += other.fragmentedRecords;
+	fragments += other.fragments;
+	recordLength += other.recordLength;
+	compressedLength += other.compressedLength;
+	versions += other.versions;
+	versionLength += other.versionLength;
+	versionedRecords += other.versionedRecords;
+	chainLength += other.chainLength;
+	maxChainLength = std::max(maxChainLength, other.maxChainLength);
+	blobs += other.blobs;
+}
+
+double RelationSpace::getAverageRecordLength() const
+{
+	return records == deletedStubs ? 0 : double(recordLength) / (records - deletedStubs);
+}
+
+double RelationSpace::getAverageCompressedLength() const
+{
+	return records == deletedStubs ? 0 : double(compressedLength) / (records - deletedStubs);
+}
+
+double RelationSpace::getCompressionRatio() const
+{
+	return compressedLength == 0 ? 0 : double(recordLength) / compressedLength;
+}
+
+double RelationSpace::getAverageFill(unsigned pageSize) const
+{
+	return dataPages == 0 ? 0 : 100.0 * usedBytes / (double(dataPages) * pageSize);
+}
+
+double RelationSpace::getAverageChainLength() const
+{
+	return versionedRecords == 0 ? 0 : double(chainLength) / versionedRecords;
+}
+
+
+//--------------------------------------
+
+
+class SpaceAnalyzer::Visitor : public PageVisitor
+{
+public:
+	explicit Visitor(Database* aDatabase)
+		: database(aDatabase),
+		  pageSize(aDatabase->header.pageSize)
+	{
+	}
+
+public:
+	virtual void visit(unsigned number, const PageHeader* page)
+	{
+		if (page->type == PageHeader::TYPE_POINTER)
+			++relations[reinterpret_cast<const PointerPage*>(page)->relation].pointerPages;
+		else if (page->type == PageHeader::TYPE_DATA)
+			visitData(number, reinterpret_cast<const DataPage*>(page));
+	}
+
+private:
+	void visitData(unsigned number, const DataPage* data)
+	{
+		const boost::uint8_t* raw = reinterpret_cast<const boost::uint8_t*>(data);
+		RelationSpace& space = relations[data->relation];
+		unsigned used = offsetof(DataPage, rpt) + data->count * sizeof(data->rpt[0]);
+
+		++space.dataPages;
+
+		// Damaged pages are for the validation to report.
+		if (used > pageSize)
+			return;
+
+		for (unsigned i = 0; i < data->count; ++i)
+		{
+			const DataPage::Repeat& line = data->rpt[i];
+
+			if (line.length < offsetof(RecordHeader, data) || line.offset + line.length > pageSize)
+				continue;
+
+			const RecordHeader* record = reinterpret_cast<const RecordHeader*>(&raw[line.offset]);
+			const unsigned headerSize = database->getRecordHeaderSize(record);
+
+			used += line.length;
+
+			if (record->flags & RecordHeader::FLAG_BLOB)
+				++space.blobs;
+			else if (record->flags & RecordHeader::FLAG_FRAGMENT)
+			{
+				++space.fragments;
+				addLength(space, record, headerSize, line.length);
+			}
+			else if (record->flags & RecordHeader::FLAG_CHAIN)
+			{
+				++space.versions;
+				space.versionLength += line.length;
+				addLink(number, i, record, data->relation, false);
+			}
+			else
+			{
+				++space.records;
+
+				if (record->flags & RecordHeader::FLAG_DELETED)
+					++space.deletedStubs;
+				else
+				{
+					if (record->flags & RecordHeader::FLAG_INCOMPLETE)
+						++space.fragmentedRecords;
+
+					addLength(space, record, headerSize, line.length);
+				}
+
+				addLink(number, i, record, data->relation, true);
+			}
+		}
+
+		++space.fillHistogram[std::min(used * RelationSpace::FILL_BUCKETS / pageSize,
+			RelationSpace::FILL_BUCKETS - 1)];
+		space.usedBytes += used;
+	}
+
+	// Adds the stored and, walking the compression runs, the uncompressed length of a record
+	// or fragment.
+	void addLength(RelationSpace& space, const RecordHeader* record, unsigned headerSize,
+		unsigned length)
+	{
+		if (length <= headerSize)
+			return;
+
+		const boost::uint8_t* begin = reinterpret_cast<const boost::uint8_t*>(record) + headerSize;
+		const boost::uint8_t* end = begin + (length - headerSize);
+		size_t unpacked;
+
+		switch (database->getCompression(record))
+		{
+			case COMPRESSION_RLE_LONG_RUNS:
+				unpacked = getUnpackedLength<COMPRESSION_RLE_LONG_RUNS>(begin, end);
+				break;
+
+			case COMPRESSION_NONE:
+				unpacked = getUnpackedLength<COMPRESSION_NONE>(begin, end);
+				break;
+
+			default:
+				unpacked = getUnpackedLength<COMPRESSION_RLE>(begin, end);
+				break;
+		}
+
+		space.compressedLength += length - headerSize;
+		space.recordLength += unpacked;
+	}
+
+	void addLink(unsigned page, unsigned line, const RecordHeader* record,
+		boost::uint16_t relation, bool primary)
+	{
+		if (record->backPage == 0)
+			return;
+
+		Link link;
+		link.key = (boost::uint64_t(page) << 16) | line;
+		link.back = (boost::uint64_t(boost::uint32_t(record->backPage)) << 16) | record->backLine;
+		link.relation = relation;
+		link.primary = primary;
+		links.push_back(link);
+	}
+
+public:
+	map<unsigned, RelationSpace> relations;
+	vector<Link> links;
+
+private:
+	Database* database;
+	unsigned pageSize;
+};
+
+
+SpaceAnalyzer::SpaceAnalyzer(Database* aDatabase)
+	: database(aDatabase)
+{
+}
+
+void SpaceAnalyzer::run(unsigned threads, unsigned chunkPages)
+{
+	vector<Visitor*> visitors;
+
+	for (unsigned i = 0; i < std::max(threads, 1u); ++i)
+		visitors.push_back(new Visitor(database));
+
+	try
+	{
+		sweepPages(database, vector<PageVisitor*>(visitors.begin(), visitors.end()), chunkPages);
+	}
+	catch (...)
+	{
+		for (vector<Visitor*>::iterator i = visitors.begin(); i != visitors.end(); ++i)
+			delete *i;
+
+		throw;
+	}
+
+	vector<Link> links;
+
+	for (vector<Visitor*>::iterator i = visitors.begin(); i != visitors.end(); ++i)
+	{
+		Visitor* visitor = *i;
+
+		for (map<unsigned, RelationSpace>::const_iterator j = visitor->relations.begin();
+			 j != visitor->relations.end();
+			 ++j)
+		{
+			relations[j->first].merge(j->second);
+		}
+
+		links.insert(links.end(), visitor->links.begin(), visitor->links.end());
+		delete visitor;
+	}
+
+	std::sort(links.begin(), links.end());
+
+	// The chain ends at the first back version without a back pointer. Its length is limited
+	// to the number of links so a damaged database can't make it loop.
+	for (vector<Link>::const_iterator i = links.begin(); i != links.end(); ++i)
+	{
+		if (!i->primary)
+			continue;
+
+		unsigned length = 0;
+		Link search;
+		search.back = i->back;
+
+		do
+		{
+			++length;
+			search.key = search.back;
+
+			vector<Link>::const_iterator next = std::lower_bound(links.begin(), links.end(), search);
+
+			if (next == links.end() || next->key != search.key)
+				break;
+
+			search.back = next->back;
+		} while (length <= links.size());
+
+		RelationSpace& space = relations[i->relation];
+		++space.versionedRecords;
+		space.chainLength += length;
+		space.maxChainLength = std::max(space.maxChainLength, length);
+	}
+}
+
+
+//------------------------------------------------------------------------------
+
+}	// fbods
@@ -0,0 +1,106 @@
+/*
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Initial Developer of the Original Code is Adriano dos Santos Fernandes.
+ * Portions created by the Initial Developer are Copyright (C) 2012 the Initial Developer.
+ * All Rights Reserved.
+ *
+ * Contributor(s):
+ *
+ */
+
+#ifndef FBSTUFF_ODS_SPACE_ANALYZER_H
+#define FBSTUFF_ODS_SPACE_ANALYZER_H
+
+#include "Database.h"
+#include <map>
+#include <vector>
+#include <boost/cstdint.hpp>
+
+namespace fbods
+{
+
+//------------------------------------------------------------------------------
+
+
+// Space usage of one relation, as found in its pointer and data pages.
+struct RelationSpace
+{
+	static const unsigned FILL_BUCKETS = 5;	// 0 - 19%, 20 - 39%, ..., 80 - 100%
+
+	RelationSpace();
+
+	void merge(const RelationSpace& other);
+
+	// Record lengths are averaged over the primary versions that are not deleted stubs.
+	double getAverageRecordLength() const;
+	double getAverageCompressedLength() const;
+	double getCompressionRatio() const;
+	double getAverageFill(unsigned pageSize) const;	// percent
+	double getAverageChainLength() const;
+
+	unsigned pointerPages;
+	unsigned dataPages;
+	boost::uint64_t fillHistogram[FILL_BUCKETS];
+	boost::uint64_t usedBytes;
+	boost::uint64_t records;			// primary versions, including deleted stubs
+	boost::uint64_t deletedStubs;
+	boost::uint64_t fragmentedRecords;
+	boost::uint64_t fragments;
+	boost::uint64_t recordLength;		// uncompressed, fragments included
+	boost::uint64_t compressedLength;	// stored, fragments included
+	boost::uint64_t versions;			// back versions
+	boost::uint64_t versionLength;
+	boost::uint64_t versionedRecords;	// primary versions with a back version chain
+	boost::uint64_t chainLength;
+	unsigned maxChainLength;
+	boost::uint64_t blobs;				// level 0 blobs stored in data pages
+};
+
+// Computes the space usage of all relations in one parallel sweep over the database file.
+// Back version chains are followed after the sweep, from the back pointers collected in it.
+class SpaceAnalyzer
+{
+public:
+	explicit SpaceAnalyzer(Database* aDatabase);
+
+public:
+	void run(unsigned threads, unsigned chunkPages);
+
+public:
+	std::map<unsigned, RelationSpace> relations;
+
+private:
+	class Visitor;
+
+	// Back pointer of a record, both keyed as page << 16 | line.
+	struct Link
+	{
+		bool operator <(const Link& other) const
+		{
+			return key < other.key;
+		}
+
+		boost::uint64_t key;
+		boost::uint64_t back;
+		boost::uint16_t relation;
+		bool primary;
+	};
+
+	Database* database;
+};
+
+
+//------------------------------------------------------------------------------
+
+}	// fbods
+
+#endif	// FBSTUFF_ODS_SPACE_ANALYZER_H
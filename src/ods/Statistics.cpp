@@ -0,0 +1,366 @@
+/*
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Initial Developer of the Original Code is Adriano dos Santos Fernandes.
+ * Portions created by the Initial Developer are Copyright (C) 2012 the Initial Developer.
+ * All Rights Reserved.
+ *
+ * Contributor(s):
+ *
+ */
+
+#include "Statistics.h"
+#include "BufferArena.h"
+#include "Hash.h"
+#include "PageListScanStream.h"
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <utility>
+#include <boost/bind.hpp>
+#include <boost/random/uniform_01.hpp>
+#include <boost/random/uniform_int_distribution.hpp>
+#include <boost/scoped_array.hpp>
+#include <boost/thread.hpp>
+
+namespace fbods
+{
+
+using std::pair;
+using std::runtime_error;
+using std::string;
+using std::vector;
+
+//------------------------------------------------------------------------------
+
+
+namespace
+{
+	const boost::uint64_t NULL_HASH = 0x9E3779B97F4A7C15ULL;
+
+	struct FormatLess
+	{
+		FormatLess(const Format* aFormat, unsigned aField)
+			: format(aFormat),
+			  field(aField)
+		{
+		}
+
+		bool operator ()(const string& value1, const string& value2) const
+		{
+			return format->compare(field, value1.data(), value2.data()) < 0;
+		}
+
+		const Format* format;
+		unsigned field;
+	};
+
+	struct Worker
+	{
+		Worker(Database* aDatabase, int aRelation, const unsigned* aBegin, const unsigned* aEnd,
+				RelationStatistics* aStatistics)
+			: database(aDatabase),
+			  relation(aRelation),
+			  begin(aBegin),
+			  end(aEnd),
+			  statistics(aStatistics)
+		{
+		}
+
+		void run(unsigned worker)
+		{
+			try
+			{
+				WorkerPlacement placement(database, worker);
+				PageListScanStream scan(database, begin, end, relation);
+				boost::scoped_array<char> recordScope;
+				char* record = allocateBuffer(ScanStream::MAX_RECORD_SIZE, recordScope);
+
+				while (scan.fetch(record))
+					statistics->add(record);
+			}
+			catch (const std::exception& e)
+			{
+				error = e.what();
+			}
+		}
+
+		Database* database;
+		int relation;
+		const unsigned* begin;
+		const unsigned* end;
+		RelationStatistics* statistics;
+		string error;
+	};
+}	// namespace
+
+
+void HyperLogLog::merge(const HyperLogLog& other)
+{
+	for (unsigned i = 0; i < REGISTERS; ++i)
+		registers[i] = std::max(registers[i], other.registers[i]);
+}
+
+double HyperLogLog::estimate() const
+{
+	const double m = REGISTERS;
+	double sum = 0;
+	unsigned zeros = 0;
+
+	for (unsigned i = 0; i < REGISTERS; ++i)
+	{
+		sum += ldexp(1.0, -registers[i]);
+
+		if (registers[i] == 0)
+			++zeros;
+	}
+
+	double estimate = 0.7213 / (1 + 1.079 / m) * m * m / sum;
+
+	// Small range correction.
+	if (estimate <= 2.5 * m && zeros != 0)
+		estimate = m * log(m / zeros);
+
+	return estimate;
+}
+
+
+void Reservoir::add(const void* value, unsigned length, boost::random::mt19937& generator)
+{
+	++seen;
+
+	if (values.size() < CAPACITY)
+		values.push_back(string(static_cast<const char*>(value), length));
+	else
+	{
+		boost::random::uniform_int_distribution<boost::uint64_t> dist(0, seen - 1);
+		boost::uint64_t n = dist(generator);
+
+		if (n < CAPACITY)
+			values[n].assign(static_cast<const char*>(value), length);
+	}
+}
+
+void Reservoir::merge(const Reservoir& other, boost::random::mt19937& generator)
+{
+	if (other.values.empty())
+		return;
+
+	if (values.empty())
+	{
+		seen = other.seen;
+		values = other.values;
+		return;
+	}
+
+	// Weighted sampling without replacement: each kept value stands for seen / size rows
+	// of its reservoir, and the values with the greatest u ^ (1 / weight) keys win.
+	boost::random::uniform_01<double> dist;
+	vector<pair<double, const string*> > keys;
+	keys.reserve(values.size() + other.values.size());
+
+	double weight = double(seen) / values.size();
+
+	for (vector<string>::const_iterator i = values.begin(); i != values.end(); ++i)
+		keys.push_back(std::make_pair(pow(dist(generator), 1 / weight), &*i));
+
+	weight = double(other.seen) / other.values.size();
+
+	for (vector<string>::const_iterator i = other.values.begin(); i != other.values.end(); ++i)
+		keys.push_back(std::make_pair(pow(dist(generator), 1 / weight), &*i));
+
+	unsigned count = std::min<unsigned>(CAPACITY, keys.size());
+	std::partial_sort(keys.begin(), keys.begin() + count, keys.end(),
+		std::greater<pair<double, const string*> >());
+
+	vector<string> newValues;
+	newValues.reserve(count);
+
+	for (unsigned i = 0; i < count; ++i)
+		newValues.push_back(*keys[i].second);
+
+	values.swap(newValues);
+	seen += other.seen;
+}
+
+
+RelationStatistics::RelationStatistics(const Format* aFormat,
+			const vector<vector<unsigned> >& aIndices, unsigned seed)
+	: format(aFormat),
+	  indices(aIndices),
+	  records(0),
+	  columns(aFormat->fields.size()),
+	  hashes(aFormat->fields.size()),
+	  generator(seed)
+{
+	for (vector<vector<unsigned> >::const_iterator i = indices.begin(); i != indices.end(); ++i)
+	{
+		for (vector<unsigned>::const_iterator j = i->begin(); j != i->end(); ++j)
+		{
+			if (*j >= format->fields.size())
+				throw runtime_error("Invalid index segment");
+		}
+
+		segments.push_back(vector<HyperLogLog>(i->size()));
+	}
+}
+
+void RelationStatistics::add(const void* record)
+{
+	++records;
+
+	for (unsigned i = 0; i < columns.size(); ++i)
+	{
+		ColumnStatistics& column = columns[i];
+
+		if (format->isNull(record, i))
+		{
+			++column.nulls;
+			hashes[i] = NULL_HASH;
+			continue;
+		}
+
+		const Format::Field& field = format->fields[i];
+		const boost::uint8_t* value = format->getPointer(record, i);
+		unsigned length = format->getValueLength(record, i);
+
+		column.totalLength += length;
+		column.sample.add(value, field.length, generator);
+
+		hashes[i] = field.type == Format::TYPE_VARYING ?
+			hash64(value + 2, length) : hash64(value, length);
+
+		column.distinct.add(hashes[i]);
+	}
+
+	for (unsigned i = 0; i < indices.size(); ++i)
+	{
+		const vector<unsigned>& index = indices[i];
+		boost::uint64_t hash = 0;
+
+		for (unsigned j = 0; j < index.size(); ++j)
+		{
+			hash = hash64(&hashes[index[j]], sizeof(boost::uint64_t), hash);
+			segments[i][j].add(hash);
+		}
+	}
+}
+
+void RelationStatistics::merge(const RelationStatistics& other)
+{
+	records += other.records;
+
+	for (unsigned i = 0; i < columns.size(); ++i)
+	{
+		ColumnStatistics& column = columns[i];
+		const ColumnStatistics& otherColumn = other.columns[i];
+
+		column.nulls += otherColumn.nulls;
+		column.totalLength += otherColumn.totalLength;
+		column.distinct.merge(otherColumn.distinct);
+		column.sample.merge(otherColumn.sample, generator);
+	}
+
+	for (unsigned i = 0; i < segments.size(); ++i)
+	{
+		for (unsigned j = 0; j < segments[i].size(); ++j)
+			segments[i][j].merge(other.segments[i][j]);
+	}
+}
+
+double RelationStatistics::getAverageLength(unsigned field) const
+{
+	boost::uint64_t count = records - columns[field].nulls;
+	return count == 0 ? 0 : double(columns[field].totalLength) / count;
+}
+
+void RelationStatistics::getHistogram(unsigned field, unsigned buckets, vector<string>& bounds) const
+{
+	vector<string> values(columns[field].sample.values);
+
+	if (values.empty() || buckets == 0)
+		return;
+
+	std::sort(values.begin(), values.end(), FormatLess(format, field));
+
+	for (unsigned i = 1; i <= buckets; ++i)
+	{
+		unsigned n = unsigned(boost::uint64_t(i) * values.size() / buckets);
+		const string& bound = values[n == 0 ? 0 : n - 1];
+
+		if (bounds.empty() || bounds.back() != bound)
+			bounds.push_back(bound);
+	}
+}
+
+double RelationStatistics::getSelectivity(unsigned index, unsigned segment) const
+{
+	double distinct = segments[index][segment].estimate();
+	return distinct < 1 ? 0 : 1 / distinct;
+}
+
+
+void collectStatistics(Database* database, Database::RelationId relationId, unsigned threads,
+	RelationStatistics& statistics)
+{
+	vector<unsigned> pages;
+	database->getDataPages(relationId, pages);
+
+	if (threads == 0)
+		threads = 1;
+
+	vector<RelationStatistics*> partials;
+	vector<Worker> workers;
+	workers.reserve(threads);
+
+	for (unsigned i = 0; i < threads; ++i)
+	{
+		size_t begin = pages.size() * i / threads;
+		size_t end = pages.size() * (i + 1) / threads;
+
+		RelationStatistics* partial = i == 0 ? &statistics :
+			new RelationStatistics(statistics.format, statistics.indices, i);
+		partials.push_back(partial);
+
+		const unsigned* data = pages.empty() ? NULL : &pages.front();
+		workers.push_back(Worker(database, relationId, data + begin, data + end, partial));
+	}
+
+	boost::thread_group group;
+
+	for (unsigned i = 1; i < threads; ++i)
+		group.create_thread(boost::bind(&Worker::run, &workers[i], i));
+
+	workers[0].run(0);
+	group.join_all();
+
+	string error;
+
+	for (unsigned i = 0; i < threads; ++i)
+	{
+		if (error.empty())
+			error = workers[i].error;
+
+		if (i != 0)
+		{
+			statistics.merge(*partials[i]);
+			delete partials[i];
+		}
+	}
+
+	if (!error.empty())
+		throw runtime_error(error);
+}
+
+
+//------------------------------------------------------------------------------
+
+}	// fbods
@@ -0,0 +1,143 @@
+/*
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Initial Developer of the Original Code is Adriano dos Santos Fernandes.
+ * Portions created by the Initial Developer are Copyright (C) 2012 the Initial Developer.
+ * All Rights Reserved.
+ *
+ * Contributor(s):
+ *
+ */
+
+#ifndef FBSTUFF_ODS_STATISTICS_H
+#define FBSTUFF_ODS_STATISTICS_H
+
+#include "Database.h"
+#include "Format.h"
+#include <string>
+#include <vector>
+#include <boost/cstdint.hpp>
+#include <boost/random/mersenne_twister.hpp>
+
+namespace fbods
+{
+
+//------------------------------------------------------------------------------
+
+
+// Distinct count estimator. Sketches built over different parts of the data may be merged.
+class HyperLogLog
+{
+public:
+	static const unsigned PRECISION = 14;
+	static const unsigned REGISTERS = 1 << PRECISION;
+
+public:
+	HyperLogLog()
+		: registers(REGISTERS, 0)
+	{
+	}
+
+public:
+	void add(boost::uint64_t hash)
+	{
+		unsigned index = unsigned(hash >> (64 - PRECISION));
+		boost::uint8_t rank = __builtin_clzll((hash << PRECISION) | (1ULL << (PRECISION - 1))) + 1;
+
+		if (rank > registers[index])
+			registers[index] = rank;
+	}
+
+	void merge(const HyperLogLog& other);
+	double estimate() const;
+
+private:
+	std::vector<boost::uint8_t> registers;
+};
+
+// Fixed size uniform sample of raw values, used to build the histograms.
+class Reservoir
+{
+public:
+	static const unsigned CAPACITY = 4096;
+
+public:
+	Reservoir()
+		: seen(0)
+	{
+	}
+
+public:
+	void add(const void* value, unsigned length, boost::random::mt19937& generator);
+	void merge(const Reservoir& other, boost::random::mt19937& generator);
+
+public:
+	boost::uint64_t seen;
+	std::vector<std::string> values;
+};
+
+struct ColumnStatistics
+{
+	ColumnStatistics()
+		: nulls(0),
+		  totalLength(0)
+	{
+	}
+
+	boost::uint64_t nulls;
+	boost::uint64_t totalLength;
+	HyperLogLog distinct;
+	Reservoir sample;
+};
+
+// Per column statistics of a relation plus, for each index given as a list of field numbers,
+// the distinct count of every segment prefix.
+class RelationStatistics
+{
+public:
+	RelationStatistics(const Format* aFormat, const std::vector<std::vector<unsigned> >& aIndices,
+		unsigned seed = 0);
+
+public:
+	void add(const void* record);
+	void merge(const RelationStatistics& other);
+
+	double getAverageLength(unsigned field) const;
+
+	// Upper bounds of an equi-depth histogram.
+	void getHistogram(unsigned field, unsigned buckets, std::vector<std::string>& bounds) const;
+
+	// Selectivity of the index key up to the given segment, as in RDB$INDEX_SEGMENTS.RDB$STATISTICS.
+	double getSelectivity(unsigned index, unsigned segment) const;
+
+public:
+	const Format* format;
+	std::vector<std::vector<unsigned> > indices;
+	boost::uint64_t records;
+	std::vector<ColumnStatistics> columns;
+	std::vector<std::vector<HyperLogLog> > segments;
+
+private:
+	std::vector<boost::uint64_t> hashes;
+	boost::random::mt19937 generator;
+};
+
+// Scans the relation with the given number of threads, each one accumulating its own
+// statistics over a slice of the data pages, merged at the end.
+void collectStatistics(Database* database, Database::RelationId relationId, unsigned threads,
+	RelationStatistics& statistics);
+
+
+//------------------------------------------------------------------------------
+
+}	// fbods
+
+#endif	// FBSTUFF_ODS_STATISTICS_H
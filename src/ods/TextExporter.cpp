@@ -0,0 +1,431 @@
+/*
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Initial Developer of the Original Code is Adriano dos Santos Fernandes.
+ * Portions created by the Initial Developer are Copyright (C) 2012 the Initial Developer.
+ * All Rights Reserved.
+ *
+ * Contributor(s):
+ *
+ */
+
+#include "TextExporter.h"
+#include "TextFormat.h"
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <boost/bind.hpp>
+#include <unistd.h>
+
+namespace fbods
+{
+
+using std::runtime_error;
+using std::vector;
+
+//------------------------------------------------------------------------------
+
+
+namespace
+{
+	template <typename T>
+	T readValue(const char* p)
+	{
+		T value;
+		memcpy(&value, p, sizeof(value));
+		return value;
+	}
+}	// namespace
+
+
+TextExporter::TextExporter(const Format* aFormat, int aHandle, Style aStyle, unsigned threads)
+	: format(aFormat),
+	  handle(aHandle),
+	  style(aStyle),
+	  delimiter(aStyle == STYLE_CSV ? ',' : '\t'),
+	  maxRecordLength(1),
+	  buffer(NULL),
+	  bufferLength(0),
+	  batches(threads > 1 ? threads * 2 : 1),
+	  nextFill(0),
+	  nextFormat(0),
+	  nextWrite(0),
+	  finishing(false)
+{
+	for (vector<Format::Field>::const_iterator field = format->fields.begin();
+		 field != format->fields.end();
+		 ++field)
+	{
+		if (field->type == Format::TYPE_TEXT || field->type == Format::TYPE_VARYING)
+			maxRecordLength += field->length * 2 + 3;
+		else
+			maxRecordLength += TextFormat::MAX_LENGTH + 1;
+	}
+
+	void* p;
+
+	if (posix_memalign(&p, 4096, BUFFER_SIZE) != 0)
+		throw std::bad_alloc();
+
+	buffer = static_cast<char*>(p);
+
+	for (vector<Batch>::iterator batch = batches.begin(); batch != batches.end(); ++batch)
+	{
+		batch->records.resize(BATCH_RECORDS * format->length);
+		batch->text.resize(BATCH_RECORDS * maxRecordLength);
+	}
+
+	if (threads > 1)
+	{
+		for (unsigned i = 0; i < threads; ++i)
+			workers.create_thread(boost::bind(&TextExporter::work, this));
+	}
+}
+
+TextExporter::~TextExporter()
+{
+	{	// scope
+		boost::mutex::scoped_lock lock(mutex);
+		finishing = true;
+		condition.notify_all();
+	}
+
+	workers.join_all();
+	free(buffer);
+}
+
+void TextExporter::writeHeader()
+{
+	char* out = &batches[0].text.front();
+	char* p = out;
+
+	for (unsigned i = 0; i < format->fields.size(); ++i)
+	{
+		const std::string& name = format->fields[i].name;
+
+		if (i != 0)
+			*p++ = delimiter;
+
+		p = formatText(p, name.data(), name.length());
+	}
+
+	*p++ = '\n';
+	write(out, p - out);
+}
+
+void TextExporter::add(const void* record)
+{
+	Batch& batch = batches[nextFill % batches.size()];
+
+	memcpy(&batch.records[batch.count * format->length], record, format->length);
+
+	if (++batch.count == BATCH_RECORDS)
+		submit();
+}
+
+void TextExporter::finish()
+{
+	if (batches[nextFill % batches.size()].count != 0)
+		submit();
+
+	while (nextWrite < nextFill)
+	{
+		Batch& batch = batches[nextWrite % batches.size()];
+
+		{	// scope
+			boost::mutex::scoped_lock lock(mutex);
+
+			while (batch.state != BATCH_FORMATTED)
+				condition.wait(lock);
+		}
+
+		writeBatch(batch);
+	}
+
+	flush();
+}
+
+char* TextExporter::formatText(char* out, const char* value, unsigned length) const
+{
+	const char* end = value + length;
+
+	if (style == STYLE_CSV)
+	{
+		const char* p = value;
+
+		while (p != end && *p != ',' && *p != '"' && *p != '\n' && *p != '\r')
+			++p;
+
+		if (p == end)
+		{
+			memcpy(out, value, length);
+			return out + length;
+		}
+
+		*out++ = '"';
+
+		for (p = value; p != end; ++p)
+		{
+			if (*p == '"')
+				*out++ = '"';
+
+			*out++ = *p;
+		}
+
+		*out++ = '"';
+	}
+	else
+	{
+		for (const char* p = value; p != end; ++p)
+		{
+			switch (*p)
+			{
+				case '\t':
+					*out++ = '\\';
+					*out++ = 't';
+					break;
+
+				case '\n':
+					*out++ = '\\';
+					*out++ = 'n';
+					break;
+
+				case '\r':
+					*out++ = '\\';
+					*out++ = 'r';
+					break;
+
+				case '\\':
+					*out++ = '\\';
+					*out++ = '\\';
+					break;
+
+				default:
+					*out++ = *p;
+					break;
+			}
+		}
+	}
+
+	return out;
+}
+
+char* TextExporter::formatRecord(char* out, const char* record) const
+{
+	for (unsigned i = 0; i < format->fields.size(); ++i)
+	{
+		const Format::Field& field = format->fields[i];
+
+		if (i != 0)
+			*out++ = delimiter;
+
+		if (format->isNull(record, i))
+		{
+			if (style == STYLE_TSV)
+			{
+				*out++ = '\\';
+				*out++ = 'N';
+			}
+
+			continue;
+		}
+
+		const char* p = record + field.offset;
+
+		switch (field.type)
+		{
+			case Format::TYPE_SHORT:
+				out = TextFormat::formatScaled(out, readValue<boost::int16_t>(p), field.scale);
+				break;
+
+			case Format::TYPE_LONG:
+				out = TextFormat::formatScaled(out, readValue<boost::int32_t>(p), field.scale);
+				break;
+
+			case Format::TYPE_INT64:
+				out = TextFormat::formatScaled(out, readValue<boost::int64_t>(p), field.scale);
+				break;
+
+			case Format::TYPE_FLOAT:
+				out = TextFormat::formatDouble(out, readValue<float>(p), 9);
+				break;
+
+			case Format::TYPE_DOUBLE:
+				out = TextFormat::formatDouble(out, readValue<double>(p), 17);
+				break;
+
+			case Format::TYPE_DATE:
+				out = TextFormat::formatDate(out, readValue<boost::int32_t>(p));
+				break;
+
+			case Format::TYPE_TIME:
+				out = TextFormat::formatTime(out, readValue<boost::uint32_t>(p));
+				break;
+
+			case Format::TYPE_TIMESTAMP:
+				out = TextFormat::formatDate(out, readValue<boost::int32_t>(p));
+				*out++ = ' ';
+				out = TextFormat::formatTime(out, readValue<boost::uint32_t>(p + 4));
+				break;
+
+			case Format::TYPE_TEXT:
+				out = formatText(out, p, field.length);
+				break;
+
+			case Format::TYPE_VARYING:
+				out = formatText(out, p + 2,
+					std::min<unsigned>(readValue<boost::uint16_t>(p), field.length - 2));
+				break;
+
+			case Format::TYPE_BLOB:
+				out = TextFormat::formatUnsigned(out, readValue<boost::uint32_t>(p));
+				*out++ = ':';
+				out = TextFormat::formatUnsigned(out, readValue<boost::uint32_t>(p + 4));
+				break;
+		}
+	}
+
+	*out++ = '\n';
+
+	return out;
+}
+
+void TextExporter::formatBatch(Batch& batch) const
+{
+	char* start = const_cast<char*>(&batch.text.front());
+	char* out = start;
+	const char* record = &batch.records.front();
+
+	for (unsigned i = 0; i < batch.count; ++i, record += format->length)
+		out = formatRecord(out, record);
+
+	batch.textLength = out - start;
+}
+
+// Hands the batch being filled over to the workers, and waits for the next one to be free,
+// writing the batches already formatted.
+void TextExporter::submit()
+{
+	Batch& batch = batches[nextFill % batches.size()];
+
+	if (workers.size() == 0)
+	{
+		formatBatch(batch);
+		batch.state = BATCH_FORMATTED;
+		++nextFill;
+		writeBatch(batch);
+		return;
+	}
+
+	{	// scope
+		boost::mutex::scoped_lock lock(mutex);
+		batch.state = BATCH_FILLED;
+		++nextFill;
+		condition.notify_all();
+	}
+
+	Batch& next = batches[nextFill % batches.size()];
+
+	// The next batch to fill is the oldest one, so it's the next to be written. Its state is
+	// set by the workers.
+	{	// scope
+		boost::mutex::scoped_lock lock(mutex);
+
+		if (next.state == BATCH_FREE)
+			return;
+
+		while (next.state != BATCH_FORMATTED)
+			condition.wait(lock);
+	}
+
+	writeBatch(next);
+}
+
+void TextExporter::writeBatch(Batch& batch)
+{
+	write(&batch.text.front(), batch.textLength);
+
+	boost::mutex::scoped_lock lock(mutex);
+	batch.count = 0;
+	batch.textLength = 0;
+	batch.state = BATCH_FREE;
+	++nextWrite;
+}
+
+void TextExporter::work()
+{
+	while (true)
+	{
+		Batch* batch;
+
+		{	// scope
+			boost::mutex::scoped_lock lock(mutex);
+
+			while (nextFormat == nextFill && !finishing)
+				condition.wait(lock);
+
+			if (nextFormat == nextFill)
+				return;
+
+			batch = &batches[nextFormat++ % batches.size()];
+		}
+
+		formatBatch(*batch);
+
+		boost::mutex::scoped_lock lock(mutex);
+		batch->state = BATCH_FORMATTED;
+		condition.notify_all();
+	}
+}
+
+void TextExporter::write(const char* data, size_t length)
+{
+	while (length > 0)
+	{
+		size_t n = std::min(length, BUFFER_SIZE - bufferLength);
+
+		memcpy(buffer + bufferLength, data, n);
+		bufferLength += n;
+		data += n;
+		length -= n;
+
+		if (bufferLength == BUFFER_SIZE)
+			flush();
+	}
+}
+
+void TextExporter::flush()
+{
+	const char* p = buffer;
+
+	while (bufferLength > 0)
+	{
+		ssize_t n = ::write(handle, p, bufferLength);
+
+		if (n < 0)
+		{
+			if (errno == EINTR)
+				continue;
+
+			throw runtime_error(std::string("Error writing export: ") + strerror(errno));
+		}
+
+		p += n;
+		bufferLength -= n;
+	}
+}
+
+
+//------------------------------------------------------------------------------
+
+}	// fbods
@@ -0,0 +1,117 @@
+/*
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Initial Developer of the Original Code is Adriano dos Santos Fernandes.
+ * Portions created by the Initial Developer are Copyright (C) 2012 the Initial Developer.
+ * All Rights Reserved.
+ *
+ * Contributor(s):
+ *
+ */
+
+#ifndef FBSTUFF_ODS_TEXT_EXPORTER_H
+#define FBSTUFF_ODS_TEXT_EXPORTER_H
+
+#include "Format.h"
+#include <vector>
+#include <boost/thread.hpp>
+
+namespace fbods
+{
+
+//------------------------------------------------------------------------------
+
+
+// Writes decoded records as CSV or TSV to a file descriptor. Records are grouped in batches
+// that may be formatted by worker threads; batches are written in the order they were added,
+// through a large page aligned buffer.
+class TextExporter
+{
+public:
+	enum Style
+	{
+		STYLE_CSV,	// RFC 4180 quoting, nulls as empty fields
+		STYLE_TSV	// backslash escapes, nulls as \N
+	};
+
+	static const unsigned BATCH_RECORDS = 4096;
+	static const unsigned BUFFER_SIZE = 4 * 1024 * 1024;
+
+public:
+	TextExporter(const Format* aFormat, int aHandle, Style aStyle, unsigned threads = 1);
+	~TextExporter();
+
+private:
+	TextExporter(const TextExporter&);
+	TextExporter& operator =(const TextExporter&);
+
+public:
+	void writeHeader();
+	void add(const void* record);
+	void finish();
+
+private:
+	enum BatchState
+	{
+		BATCH_FREE,
+		BATCH_FILLED,
+		BATCH_FORMATTED
+	};
+
+	struct Batch
+	{
+		Batch()
+			: count(0),
+			  textLength(0),
+			  state(BATCH_FREE)
+		{
+		}
+
+		std::vector<char> records;
+		unsigned count;
+		std::vector<char> text;
+		size_t textLength;
+		BatchState state;
+	};
+
+	char* formatText(char* out, const char* value, unsigned length) const;
+	char* formatRecord(char* out, const char* record) const;
+	void formatBatch(Batch& batch) const;
+	void submit();
+	void writeBatch(Batch& batch);
+	void work();
+	void write(const char* data, size_t length);
+	void flush();
+
+private:
+	const Format* format;
+	int handle;
+	Style style;
+	char delimiter;
+	unsigned maxRecordLength;
+	char* buffer;
+	size_t bufferLength;
+	std::vector<Batch> batches;
+	boost::uint64_t nextFill;
+	boost::uint64_t nextFormat;
+	boost::uint64_t nextWrite;
+	bool finishing;
+	boost::mutex mutex;
+	boost::condition_variable condition;
+	boost::thread_group workers;
+};
+
+
+//------------------------------------------------------------------------------
+
+}	// fbods
+
+#endif	// FBSTUFF_ODS_TEXT_EXPORTER_H
@@ -0,0 +1,172 @@
+/*
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Initial Developer of the Original Code is Adriano dos Santos Fernandes.
+ * Portions created by the Initial Developer are Copyright (C) 2012 the Initial Developer.
+ * All Rights Reserved.
+ *
+ * Contributor(s):
+ *
+ */
+
+#ifndef FBSTUFF_ODS_TEXT_FORMAT_H
+#define FBSTUFF_ODS_TEXT_FORMAT_H
+
+#include "Format.h"
+#include <cstdio>
+#include <algorithm>
+#include <cstring>
+#include <boost/cstdint.hpp>
+
+namespace fbods
+{
+
+//------------------------------------------------------------------------------
+
+
+// Number and date formatting routines writing to a caller buffer. They return the end of
+// the written text and never allocate.
+namespace TextFormat
+{
+	// Enough for any value but text.
+	const unsigned MAX_LENGTH = 48;
+
+	static const char DIGITS[] =
+		"00010203040506070809101112131415161718192021222324"
+		"25262728293031323334353637383940414243444546474849"
+		"50515253545556575859606162636465666768697071727374"
+		"75767778798081828384858687888990919293949596979899";
+
+	inline char* formatUnsigned(char* out, boost::uint64_t value)
+	{
+		char buffer[24];
+		char* p = buffer + sizeof(buffer);
+
+		while (value >= 100)
+		{
+			unsigned n = unsigned(value % 100) * 2;
+			value /= 100;
+			*--p = DIGITS[n + 1];
+			*--p = DIGITS[n];
+		}
+
+		if (value >= 10)
+		{
+			unsigned n = unsigned(value) * 2;
+			*--p = DIGITS[n + 1];
+			*--p = DIGITS[n];
+		}
+		else
+			*--p = char('0' + value);
+
+		unsigned length = buffer + sizeof(buffer) - p;
+		memcpy(out, p, length);
+
+		return out + length;
+	}
+
+	inline char* formatInteger(char* out, boost::int64_t value)
+	{
+		if (value < 0)
+		{
+			*out++ = '-';
+			return formatUnsigned(out, -boost::uint64_t(value));
+		}
+
+		return formatUnsigned(out, value);
+	}
+
+	// Writes exactly width digits.
+	inline char* formatFixed(char* out, boost::uint64_t value, unsigned width)
+	{
+		for (char* p = out + width; p != out;)
+		{
+			*--p = char('0' + value % 10);
+			value /= 10;
+		}
+
+		return out + width;
+	}
+
+	inline char* formatScaled(char* out, boost::int64_t value, int scale)
+	{
+		if (scale >= 0)
+		{
+			out = formatInteger(out, value);
+
+			for (int i = 0; i < scale; ++i)
+				*out++ = '0';
+
+			return out;
+		}
+
+		static const boost::uint64_t POWERS[] = {
+			1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL, 10000000ULL,
+			100000000ULL, 1000000000ULL, 10000000000ULL, 100000000000ULL, 1000000000000ULL,
+			10000000000000ULL, 100000000000000ULL, 1000000000000000ULL, 10000000000000000ULL,
+			100000000000000000ULL, 1000000000000000000ULL, 10000000000000000000ULL
+		};
+
+		unsigned decimals = std::min(-scale, 19);
+		boost::uint64_t absValue = value < 0 ? -boost::uint64_t(value) : value;
+
+		if (value < 0)
+			*out++ = '-';
+
+		out = formatUnsigned(out, absValue / POWERS[decimals]);
+		*out++ = '.';
+
+		return formatFixed(out, absValue % POWERS[decimals], decimals);
+	}
+
+	inline char* formatDate(char* out, boost::int32_t date)
+	{
+		int year, month, day;
+		Format::decodeDate(date, year, month, day);
+
+		if (year < 0 || year > 9999)
+		{
+			out = formatInteger(out, year);
+			return out + sprintf(out, "-%02d-%02d", month, day);
+		}
+
+		out = formatFixed(out, year, 4);
+		*out++ = '-';
+		out = formatFixed(out, month, 2);
+		*out++ = '-';
+
+		return formatFixed(out, day, 2);
+	}
+
+	inline char* formatTime(char* out, boost::uint32_t time)
+	{
+		out = formatFixed(out, time / 36000000, 2);
+		*out++ = ':';
+		out = formatFixed(out, time / 600000 % 60, 2);
+		*out++ = ':';
+		out = formatFixed(out, time / 10000 % 60, 2);
+		*out++ = '.';
+
+		return formatFixed(out, time % 10000, 4);
+	}
+
+	inline char* formatDouble(char* out, double value, int precision)
+	{
+		return out + snprintf(out, MAX_LENGTH, "%.*g", precision, value);
+	}
+}	// TextFormat
+
+
+//------------------------------------------------------------------------------
+
+}	// fbods
+
+#endif	// FBSTUFF_ODS_TEXT_FORMAT_H
@@ -0,0 +1,95 @@
+/*
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Initial Developer of the Original Code is Adriano dos Santos Fernandes.
+ * Portions created by the Initial Developer are Copyright (C) 2012 the Initial Developer.
+ * All Rights Reserved.
+ *
+ * Contributor(s):
+ *
+ */
+
+#include "TransactionMonitor.h"
+#include <iomanip>
+#include <ctime>
+
+namespace fbods
+{
+
+using std::endl;
+
+//------------------------------------------------------------------------------
+
+
+TransactionMonitor::TransactionMonitor(Database* aDatabase, std::ostream& aOut)
+	: database(aDatabase),
+	  out(aOut),
+	  hasPrevious(false)
+{
+}
+
+void TransactionMonitor::writeHeader()
+{
+	out << "time,next,oit,oat,ost,oit_gap,oat_gap,ost_gap,"
+		"transactions_per_second,oit_gap_growth,oat_gap_growth,ost_gap_growth" << endl;
+}
+
+void TransactionMonitor::poll()
+{
+	database->refreshHeader();
+
+	timespec monotonic;
+	clock_gettime(CLOCK_MONOTONIC, &monotonic);
+
+	Sample sample;
+	sample.time = monotonic.tv_sec + monotonic.tv_nsec / 1e9;
+	sample.next = database->transactions.next;
+	sample.oldest = database->transactions.oldest;
+	sample.oldestActive = database->transactions.oldestActive;
+	sample.oldestSnapshot = database->transactions.oldestSnapshot;
+
+	time_t now = time(NULL);
+	tm utc;
+	char timestamp[32];
+	strftime(timestamp, sizeof(timestamp), "%Y-%m-%dT%H:%M:%SZ", gmtime_r(&now, &utc));
+
+	out << timestamp << "," <<
+		sample.next << "," << sample.oldest << "," << sample.oldestActive << "," <<
+		sample.oldestSnapshot << "," <<
+		(sample.next - sample.oldest) << "," <<
+		(sample.next - sample.oldestActive) << "," <<
+		(sample.next - sample.oldestSnapshot);
+
+	if (hasPrevious && sample.time > previous.time)
+	{
+		double elapsed = sample.time - previous.time;
+
+		out << std::fixed << std::setprecision(2) << "," <<
+			(sample.next - previous.next) / elapsed << "," <<
+			((sample.next - sample.oldest) - (previous.next - previous.oldest)) / elapsed << "," <<
+			((sample.next - sample.oldestActive) - (previous.next - previous.oldestActive)) /
+				elapsed << "," <<
+			((sample.next - sample.oldestSnapshot) - (previous.next - previous.oldestSnapshot)) /
+				elapsed;
+	}
+	else
+		out << ",,,,";
+
+	out << endl;
+
+	previous = sample;
+	hasPrevious = true;
+}
+
+
+//------------------------------------------------------------------------------
+
+}	// fbods
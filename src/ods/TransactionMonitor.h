@@ -0,0 +1,67 @@
+/*
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Initial Developer of the Original Code is Adriano dos Santos Fernandes.
+ * Portions created by the Initial Developer are Copyright (C) 2012 the Initial Developer.
+ * All Rights Reserved.
+ *
+ * Contributor(s):
+ *
+ */
+
+#ifndef FBSTUFF_ODS_TRANSACTION_MONITOR_H
+#define FBSTUFF_ODS_TRANSACTION_MONITOR_H
+
+#include "Database.h"
+#include <ostream>
+#include <boost/cstdint.hpp>
+
+namespace fbods
+{
+
+//------------------------------------------------------------------------------
+
+
+// Writes the header page transaction counters as a CSV time series, one line per poll.
+// Gaps are the distances from the next transaction to the oldest interesting (OIT), oldest
+// active (OAT) and oldest snapshot (OST) transactions; growths are their changes per second
+// since the previous poll. Only sizeof(HeaderPage) bytes are read, without attaching.
+class TransactionMonitor
+{
+public:
+	TransactionMonitor(Database* aDatabase, std::ostream& aOut);
+
+public:
+	void writeHeader();
+	void poll();
+
+private:
+	struct Sample
+	{
+		double time;
+		boost::int64_t next;
+		boost::int64_t oldest;
+		boost::int64_t oldestActive;
+		boost::int64_t oldestSnapshot;
+	};
+
+	Database* database;
+	std::ostream& out;
+	bool hasPrevious;
+	Sample previous;
+};
+
+
+//------------------------------------------------------------------------------
+
+}	// fbods
+
+#endif	// FBSTUFF_ODS_TRANSACTION_MONITOR_H
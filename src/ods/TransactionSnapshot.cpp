@@ -0,0 +1,83 @@
+/*
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Initial Developer of the Original Code is Adriano dos Santos Fernandes.
+ * Portions created by the Initial Developer are Copyright (C) 2012 the Initial Developer.
+ * All Rights Reserved.
+ *
+ * Contributor(s):
+ *
+ */
+
+#include "TransactionSnapshot.h"
+#include <cstddef>
+#include <cstdio>
+#include <stdexcept>
+#include <string>
+#include <boost/scoped_array.hpp>
+
+namespace fbods
+{
+
+using std::runtime_error;
+using std::string;
+using std::vector;
+
+//------------------------------------------------------------------------------
+
+
+TransactionSnapshot::TransactionSnapshot(Database* database)
+{
+	const unsigned pageSize = database->header.pageSize;
+	boost::scoped_array<char> buffer(new char[pageSize]);
+
+	database->refreshHeader();
+	oldest = database->transactions.oldest;
+	next = database->transactions.next;
+
+	if (next < oldest)
+		return;
+
+	vector<unsigned> inventoryPages;
+	database->getSystemPages(PageHeader::TYPE_TRANSACTION_INVENTORY, inventoryPages);
+
+	const TransactionInventoryPage* inventory =
+		reinterpret_cast<const TransactionInventoryPage*>(buffer.get());
+	const unsigned perPage = (pageSize - offsetof(TransactionInventoryPage, transactions)) * 4;
+	boost::uint64_t sequence = ~boost::uint64_t(0);
+
+	states.reserve(next - oldest + 1);
+
+	for (boost::uint64_t transaction = oldest; transaction <= next; ++transaction)
+	{
+		if (transaction / perPage != sequence)
+		{
+			sequence = transaction / perPage;
+
+			if (sequence >= inventoryPages.size() ||
+				!database->readPage(inventoryPages[sequence], buffer.get(),
+					PageHeader::TYPE_TRANSACTION_INVENTORY, -1))
+			{
+				char s[32];
+				sprintf(s, "%llu", (unsigned long long) sequence);
+				throw runtime_error(string("Transaction inventory page ") + s + " not found");
+			}
+		}
+
+		const unsigned n = transaction % perPage;
+		states.push_back((inventory->transactions[n / 4] >> ((n % 4) * 2)) & 3);
+	}
+}
+
+
+//------------------------------------------------------------------------------
+
+}	// fbods
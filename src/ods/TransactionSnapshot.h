@@ -0,0 +1,66 @@
+/*
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Initial Developer of the Original Code is Adriano dos Santos Fernandes.
+ * Portions created by the Initial Developer are Copyright (C) 2012 the Initial Developer.
+ * All Rights Reserved.
+ *
+ * Contributor(s):
+ *
+ */
+
+#ifndef FBSTUFF_ODS_TRANSACTION_SNAPSHOT_H
+#define FBSTUFF_ODS_TRANSACTION_SNAPSHOT_H
+
+#include "Database.h"
+#include <vector>
+#include <boost/cstdint.hpp>
+
+namespace fbods
+{
+
+//------------------------------------------------------------------------------
+
+
+// Transactions committed when the snapshot was taken, from the header and the transaction
+// inventory pages. Scans of a database with a snapshot return the record versions it sees.
+class TransactionSnapshot
+{
+public:
+	explicit TransactionSnapshot(Database* database);
+
+public:
+	bool isVisible(boost::uint64_t transaction) const
+	{
+		// Transactions older than the oldest interesting one are all committed.
+		if (transaction < oldest)
+			return true;
+
+		if (transaction > next)
+			return false;
+
+		return states[transaction - oldest] == TransactionInventoryPage::STATE_COMMITTED;
+	}
+
+public:
+	boost::uint64_t oldest;
+	boost::uint64_t next;	// the last transaction started
+
+private:
+	std::vector<boost::uint8_t> states;	// from oldest to next
+};
+
+
+//------------------------------------------------------------------------------
+
+}	// fbods
+
+#endif	// FBSTUFF_ODS_TRANSACTION_SNAPSHOT_H
@@ -0,0 +1,361 @@
+/*
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Initial Developer of the Original Code is Adriano dos Santos Fernandes.
+ * Portions created by the Initial Developer are Copyright (C) 2012 the Initial Developer.
+ * All Rights Reserved.
+ *
+ * Contributor(s):
+ *
+ */
+
+#include "Validator.h"
+#include "PageSweep.h"
+#include <algorithm>
+#include <cstddef>
+#include <cstdio>
+#include <utility>
+
+namespace fbods
+{
+
+using std::ostream;
+using std::pair;
+using std::string;
+using std::vector;
+
+//------------------------------------------------------------------------------
+
+
+namespace
+{
+	const char* const TYPE_NAMES[] = {
+		"undefined",
+		"header",
+		"page inventory",
+		"transaction inventory",
+		"pointer",
+		"data",
+		"index root",
+		"index b-tree",
+		"blob",
+		"generator",
+		"scn inventory"
+	};
+
+	void writeJsonString(ostream& out, const string& s)
+	{
+		out << '"';
+
+		for (string::const_iterator i = s.begin(); i != s.end(); ++i)
+		{
+			if (*i == '"' || *i == '\\')
+				out << '\\' << *i;
+			else if (static_cast<unsigned char>(*i) < 0x20)
+			{
+				char buffer[8];
+				sprintf(buffer, "\\u%04x", unsigned(static_cast<unsigned char>(*i)));
+				out << buffer;
+			}
+			else
+				out << *i;
+		}
+
+		out << '"';
+	}
+}	// namespace
+
+
+class Validator::Visitor : public PageVisitor
+{
+public:
+	Visitor(Validator* aValidator)
+		: validator(aValidator),
+		  database(aValidator->database),
+		  pageSize(aValidator->database->header.pageSize),
+		  odsMajor(aValidator->database->getOdsMajor()),
+		  pagesByType(PageHeader::TYPE_MAX + 2),
+		  errorCount(0)
+	{
+	}
+
+public:
+	virtual void visit(unsigned number, const PageHeader* page)
+	{
+		int type = page->type;
+
+		validator->pageTypes[number] = page->type;
+		++pagesByType[type >= 0 && type <= PageHeader::TYPE_MAX ? type : PageHeader::TYPE_MAX + 1];
+
+		if (number == 0 && type != PageHeader::TYPE_HEADER)
+			addError(number, type, "first page is not a header page");
+		else if (number != 0 && type == PageHeader::TYPE_HEADER)
+			addError(number, type, "header page out of place");
+
+		if (type < 0 || type > PageHeader::TYPE_MAX)
+		{
+			addError(number, type, "invalid page type");
+			return;
+		}
+
+		if (type == PageHeader::TYPE_UNDEFINED)
+			return;
+
+		if (odsMajor == 11 && page->checksum != PageHeader::CHECKSUM_STAMP)
+			addError(number, type, "invalid checksum");
+		else if (odsMajor >= 12 && page->reserved != number)
+			addError(number, type, "page number in header doesn't match its position");
+
+		switch (type)
+		{
+			case PageHeader::TYPE_POINTER:
+				checkPointer(number, reinterpret_cast<const PointerPage*>(page));
+				break;
+
+			case PageHeader::TYPE_DATA:
+				checkData(number, reinterpret_cast<const DataPage*>(page));
+				break;
+		}
+	}
+
+private:
+	void checkPointer(unsigned number, const PointerPage* pointer)
+	{
+		validator->pageRelations[number] = pointer->relation;
+
+		if (offsetof(PointerPage, page) + pointer->count * sizeof(pointer->page[0]) > pageSize)
+		{
+			addError(number, PageHeader::TYPE_POINTER, "page count exceeds the page size");
+			return;
+		}
+
+		for (unsigned i = 0; i < pointer->count; ++i)
+		{
+			unsigned dataPage = pointer->page[i];
+
+			if (dataPage == 0)
+				continue;
+
+			if (dataPage >= validator->pageCount)
+			{
+				char s[96];
+				sprintf(s, "slot %u references page %u beyond the end of file", i, dataPage);
+				addError(number, PageHeader::TYPE_POINTER, s);
+				continue;
+			}
+
+			Reference reference;
+			reference.pointerPage = number;
+			reference.dataPage = dataPage;
+			reference.relation = pointer->relation;
+			reference.slot = i;
+			references.push_back(reference);
+		}
+	}
+
+	void checkData(unsigned number, const DataPage* data)
+	{
+		validator->pageRelations[number] = data->relation;
+
+		const unsigned linesEnd = offsetof(DataPage, rpt) + data->count * sizeof(data->rpt[0]);
+
+		if (linesEnd > pageSize)
+		{
+			addError(number, PageHeader::TYPE_DATA, "record count exceeds the page size");
+			return;
+		}
+
+		lines.clear();
+
+		for (unsigned i = 0; i < data->count; ++i)
+		{
+			const DataPage::Repeat& line = data->rpt[i];
+			char s[96];
+
+			if (line.length == 0)
+				continue;
+
+			if (line.offset < linesEnd || line.offset + line.length > pageSize)
+			{
+				sprintf(s, "record %u (offset %u, length %u) out of the page bounds",
+					i, line.offset, line.length);
+				addError(number, PageHeader::TYPE_DATA, s);
+			}
+			else if (line.length < offsetof(RecordHeader, data))
+			{
+				sprintf(s, "record %u is shorter than a record header", i);
+				addError(number, PageHeader::TYPE_DATA, s);
+			}
+			else
+				lines.push_back(std::make_pair(line.offset, i));
+		}
+
+		std::sort(lines.begin(), lines.end());
+
+		for (unsigned i = 1; i < lines.size(); ++i)
+		{
+			const DataPage::Repeat& previous = data->rpt[lines[i - 1].second];
+
+			if (previous.offset + previous.length > lines[i].first)
+			{
+				char s[96];
+				sprintf(s, "records %u and %u overlap", lines[i - 1].second, lines[i].second);
+				addError(number, PageHeader::TYPE_DATA, s);
+			}
+		}
+	}
+
+	void addError(unsigned page, int type, const string& message)
+	{
+		if (++errorCount > MAX_REPORTED_ERRORS)
+			return;
+
+		Error error;
+		error.page = page;
+		error.type = type;
+		error.message = message;
+		errors.push_back(error);
+	}
+
+public:
+	Validator* validator;
+	Database* database;
+	unsigned pageSize;
+	unsigned odsMajor;
+	vector<boost::uint64_t> pagesByType;
+	boost::uint64_t errorCount;
+	vector<Error> errors;
+	vector<Reference> references;
+
+private:
+	vector<pair<unsigned, unsigned> > lines;
+};
+
+
+Validator::Validator(Database* aDatabase)
+	: pageCount(0),
+	  pagesByType(PageHeader::TYPE_MAX + 2),
+	  errorCount(0),
+	  database(aDatabase)
+{
+}
+
+void Validator::run(unsigned threads, unsigned chunkPages)
+{
+	pageCount = database->getPageCount();
+	pageTypes.assign(pageCount, PageHeader::TYPE_UNDEFINED);
+	pageRelations.assign(pageCount, 0);
+
+	// Each visitor only touches the entries of the pages it reads.
+	vector<Visitor*> visitors;
+
+	for (unsigned i = 0; i < std::max(threads, 1u); ++i)
+		visitors.push_back(new Visitor(this));
+
+	try
+	{
+		sweepPages(database, vector<PageVisitor*>(visitors.begin(), visitors.end()), chunkPages);
+	}
+	catch (...)
+	{
+		for (vector<Visitor*>::iterator i = visitors.begin(); i != visitors.end(); ++i)
+			delete *i;
+
+		throw;
+	}
+
+	for (vector<Visitor*>::iterator i = visitors.begin(); i != visitors.end(); ++i)
+	{
+		Visitor* visitor = *i;
+
+		for (unsigned j = 0; j < pagesByType.size(); ++j)
+			pagesByType[j] += visitor->pagesByType[j];
+
+		errorCount += visitor->errorCount;
+		errors.insert(errors.end(), visitor->errors.begin(), visitor->errors.end());
+
+		for (vector<Reference>::const_iterator reference = visitor->references.begin();
+			 reference != visitor->references.end();
+			 ++reference)
+		{
+			int type = pageTypes[reference->dataPage];
+			char s[128];
+
+			if (type != PageHeader::TYPE_DATA)
+			{
+				sprintf(s, "slot %u references page %u of type %d",
+					reference->slot, reference->dataPage, type);
+			}
+			else if (pageRelations[reference->dataPage] != reference->relation)
+			{
+				sprintf(s, "slot %u references data page %u of relation %u",
+					reference->slot, reference->dataPage, pageRelations[reference->dataPage]);
+			}
+			else
+				continue;
+
+			if (++errorCount <= MAX_REPORTED_ERRORS)
+			{
+				Error error;
+				error.page = reference->pointerPage;
+				error.type = PageHeader::TYPE_POINTER;
+				error.message = s;
+				errors.push_back(error);
+			}
+		}
+
+		delete visitor;
+	}
+
+	std::stable_sort(errors.begin(), errors.end());
+
+	if (errors.size() > MAX_REPORTED_ERRORS)
+		errors.resize(MAX_REPORTED_ERRORS);
+}
+
+void Validator::writeReport(ostream& out, const char* filename) const
+{
+	out << "{" << std::endl;
+	out << "\t\"file\": ";
+	writeJsonString(out, filename);
+	out << "," << std::endl;
+	out << "\t\"pageSize\": " << database->header.pageSize << "," << std::endl;
+	out << "\t\"odsVersion\": " << database->getOdsMajor() << "." << database->odsMinor <<
+		"," << std::endl;
+	out << "\t\"pages\": " << pageCount << "," << std::endl;
+	out << "\t\"pagesByType\": {";
+
+	for (unsigned i = 0; i < pagesByType.size(); ++i)
+	{
+		out << (i == 0 ? "" : ",") << std::endl << "\t\t\"" <<
+			(i <= unsigned(PageHeader::TYPE_MAX) ? TYPE_NAMES[i] : "invalid") << "\": " <<
+			pagesByType[i];
+	}
+
+	out << std::endl << "\t}," << std::endl;
+	out << "\t\"errorCount\": " << errorCount << "," << std::endl;
+	out << "\t\"errors\": [";
+
+	for (vector<Error>::const_iterator i = errors.begin(); i != errors.end(); ++i)
+	{
+		out << (i == errors.begin() ? "" : ",") << std::endl <<
+			"\t\t{\"page\": " << i->page << ", \"type\": " << i->type << ", \"message\": ";
+		writeJsonString(out, i->message);
+		out << "}";
+	}
+
+	out << std::endl << "\t]" << std::endl << "}" << std::endl;
+}
+
+
+//------------------------------------------------------------------------------
+
+}	// fbods
@@ -0,0 +1,91 @@
+/*
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Initial Developer of the Original Code is Adriano dos Santos Fernandes.
+ * Portions created by the Initial Developer are Copyright (C) 2012 the Initial Developer.
+ * All Rights Reserved.
+ *
+ * Contributor(s):
+ *
+ */
+
+#ifndef FBSTUFF_ODS_VALIDATOR_H
+#define FBSTUFF_ODS_VALIDATOR_H
+
+#include "Database.h"
+#include <ostream>
+#include <string>
+#include <vector>
+#include <boost/cstdint.hpp>
+
+namespace fbods
+{
+
+//------------------------------------------------------------------------------
+
+
+// Page level validation of a database file, made in one parallel sweep. Checks page types,
+// the ODS 11 checksum stamp or the ODS 12 page number, the data page line tables and, once
+// all pages are known, that pointer pages only reference data pages of their relation.
+class Validator
+{
+public:
+	static const unsigned MAX_REPORTED_ERRORS = 10000;
+
+	struct Error
+	{
+		bool operator <(const Error& other) const
+		{
+			return page < other.page;
+		}
+
+		unsigned page;
+		int type;
+		std::string message;
+	};
+
+public:
+	explicit Validator(Database* aDatabase);
+
+public:
+	void run(unsigned threads, unsigned chunkPages);
+
+	// Writes the result as JSON.
+	void writeReport(std::ostream& out, const char* filename) const;
+
+public:
+	unsigned pageCount;
+	std::vector<boost::uint64_t> pagesByType;
+	boost::uint64_t errorCount;
+	std::vector<Error> errors;	// up to MAX_REPORTED_ERRORS, in page order
+
+private:
+	class Visitor;
+
+	struct Reference
+	{
+		unsigned pointerPage;
+		unsigned dataPage;
+		boost::uint16_t relation;
+		boost::uint16_t slot;
+	};
+
+	Database* database;
+	std::vector<boost::int8_t> pageTypes;
+	std::vector<boost::uint16_t> pageRelations;
+};
+
+
+//------------------------------------------------------------------------------
+
+}	// fbods
+
+#endif	// FBSTUFF_ODS_VALIDATOR_H
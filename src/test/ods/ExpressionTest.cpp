@@ -0,0 +1,331 @@
+/*
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Initial Developer of the Original Code is Adriano dos Santos Fernandes.
+ * Portions created by the Initial Developer are Copyright (C) 2012 the Initial Developer.
+ * All Rights Reserved.
+ *
+ * Contributor(s):
+ *
+ */
+
+
+#include "../../ods/Expression.h"
+#include "../../ods/Format.h"
+#include "../../ods/RecordBatch.h"
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <boost/test/unit_test.hpp>
+
+using namespace fbods;
+using std::string;
+using std::vector;
+
+//------------------------------------------------------------------------------
+
+namespace
+{
+	// Batch of records of up to four fields, given as text and NULL for nulls.
+	class TestBatch
+	{
+	public:
+		explicit TestBatch(const string& spec)
+			: format(spec),
+			  batch(&format, 64),
+			  record(format.length)
+		{
+		}
+
+	public:
+		void add(const char* value0, const char* value1 = NULL, const char* value2 = NULL,
+			const char* value3 = NULL)
+		{
+			const char* const values[] = {value0, value1, value2, value3};
+
+			std::fill(record.begin(), record.end(), 0);
+
+			for (unsigned n = 0; n < format.fields.size(); ++n)
+			{
+				if (values[n])
+					format.parse(n, values[n], &record[format.fields[n].offset]);
+				else
+					record[n >> 3] |= 1 << (n & 7);
+			}
+
+			batch.add(&record.front());
+		}
+
+		// Values of all the rows.
+		const ExpressionVector& evaluate(Expression& expression)
+		{
+			selection.selectAll(batch.count);
+			return expression.evaluate(batch, selection);
+		}
+
+		// Rows where the condition is true, as a string of row numbers.
+		string select(const string& condition)
+		{
+			Expression expression(condition, &format);
+			selection.selectAll(batch.count);
+			expression.select(batch, selection);
+
+			string rows;
+
+			for (vector<boost::uint32_t>::const_iterator i = selection.rows.begin();
+				 i != selection.rows.end();
+				 ++i)
+			{
+				rows += char('0' + *i);
+			}
+
+			return rows;
+		}
+
+	public:
+		Format format;
+		RecordBatch batch;
+		vector<unsigned char> record;
+		Selection selection;
+	};
+
+	string getText(const ExpressionVector& values, unsigned row)
+	{
+		return string(values.texts[row], values.lengths[row]);
+	}
+}
+
+
+BOOST_AUTO_TEST_SUITE(ods)
+
+
+BOOST_AUTO_TEST_CASE(expressionScaled)
+{
+	TestBatch batch("a numeric(18, 2), b numeric(9, 3), i integer");
+	batch.add("1.25", "0.500", "3");
+	batch.add("-2.50", "1.250", "-4");
+
+	{
+		// Sums have the smallest scale of their operands.
+		Expression expression("a + b", &batch.format);
+		const ExpressionVector& values = batch.evaluate(expression);
+
+		BOOST_CHECK_EQUAL(expression.getKind(), Expression::KIND_INTEGER);
+		BOOST_CHECK_EQUAL(expression.getScale(), -3);
+		BOOST_CHECK_EQUAL(values.integers[0], 1750);
+		BOOST_CHECK_EQUAL(values.integers[1], -1250);
+	}
+
+	{
+		Expression expression("a - i", &batch.format);
+		const ExpressionVector& values = batch.evaluate(expression);
+
+		BOOST_CHECK_EQUAL(expression.getScale(), -2);
+		BOOST_CHECK_EQUAL(values.integers[0], -175);
+		BOOST_CHECK_EQUAL(values.integers[1], 150);
+	}
+
+	{
+		// Products add the scales.
+		Expression expression("a * b", &batch.format);
+		const ExpressionVector& values = batch.evaluate(expression);
+
+		BOOST_CHECK_EQUAL(expression.getScale(), -5);
+		BOOST_CHECK_EQUAL(values.integers[0], 62500);
+		BOOST_CHECK_EQUAL(values.integers[1], -312500);
+	}
+
+	{
+		// Quotients have the scale of the dividend and are truncated.
+		Expression expression("a / i", &batch.format);
+		const ExpressionVector& values = batch.evaluate(expression);
+
+		BOOST_CHECK_EQUAL(expression.getScale(), -2);
+		BOOST_CHECK_EQUAL(values.integers[0], 41);
+		BOOST_CHECK_EQUAL(values.integers[1], 62);
+	}
+
+	{
+		Expression expression("a / b", &batch.format);
+		const ExpressionVector& values = batch.evaluate(expression);
+
+		BOOST_CHECK_EQUAL(expression.getScale(), -2);
+		BOOST_CHECK_EQUAL(values.integers[0], 250);
+		BOOST_CHECK_EQUAL(values.integers[1], -200);
+	}
+
+	{
+		Expression expression("a * 2 + 0.5", &batch.format);
+		const ExpressionVector& values = batch.evaluate(expression);
+
+		BOOST_CHECK_EQUAL(expression.getScale(), -2);
+		BOOST_CHECK_EQUAL(values.integers[0], 300);
+		BOOST_CHECK_EQUAL(values.integers[1], -450);
+		BOOST_CHECK_EQUAL(expression.getTypeSpec(), "numeric(18, 2)");
+	}
+
+	BOOST_CHECK_EQUAL(batch.select("a * b > 0.6"), "0");
+	BOOST_CHECK_EQUAL(batch.select("a + b = -1.25"), "1");
+}
+
+BOOST_AUTO_TEST_CASE(expressionDivisionByZero)
+{
+	TestBatch batch("a numeric(18, 2), i integer");
+	batch.add("1.00", "0");
+	batch.add("1.00", "2");
+	batch.add(NULL, "2");
+
+	{
+		Expression expression("a / i", &batch.format);
+		const ExpressionVector& values = batch.evaluate(expression);
+
+		BOOST_CHECK(values.nulls[0]);
+		BOOST_CHECK(!values.nulls[1]);
+		BOOST_CHECK_EQUAL(values.integers[1], 50);
+		BOOST_CHECK(values.nulls[2]);
+	}
+
+	{
+		Expression expression("i / 0", &batch.format);
+		const ExpressionVector& values = batch.evaluate(expression);
+
+		for (unsigned i = 0; i < batch.batch.count; ++i)
+			BOOST_CHECK(values.nulls[i]);
+	}
+
+	BOOST_CHECK_EQUAL(batch.select("a / i > 0"), "1");
+	BOOST_CHECK_EQUAL(batch.select("a / i IS NULL"), "02");
+	BOOST_CHECK_EQUAL(batch.select("NOT (a / i > 0)"), "");
+}
+
+// Overflows wrap instead of trapping, and literals must fit in the integers and scales.
+BOOST_AUTO_TEST_CASE(expressionOverflow)
+{
+	TestBatch batch("a bigint, i integer");
+	batch.add("-9223372036854775808", "-1");
+	batch.add("7", "-1");
+
+	{
+		Expression expression("a / i", &batch.format);
+		const ExpressionVector& values = batch.evaluate(expression);
+
+		BOOST_CHECK(!values.nulls[0]);
+		BOOST_CHECK_EQUAL(values.integers[0], boost::int64_t(-9223372036854775807LL - 1));
+		BOOST_CHECK_EQUAL(values.integers[1], -7);
+	}
+
+	BOOST_CHECK_EQUAL(batch.select("a < 9223372036854775807"), "01");
+	BOOST_CHECK_EQUAL(batch.select("a = -9223372036854775807 - 1"), "0");
+	BOOST_CHECK_THROW(Expression("a < 9223372036854775808", &batch.format), std::runtime_error);
+	BOOST_CHECK_THROW(Expression("a < 0.1234567890123456789", &batch.format),
+		std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(expressionCase)
+{
+	TestBatch batch("i integer");
+	batch.add("5");
+	batch.add("1");
+	batch.add("0");
+	batch.add(NULL);
+
+	{
+		// A null condition isn't true, so the row takes ELSE.
+		Expression expression(
+			"CASE WHEN i > 2 THEN 'big' WHEN i > 0 THEN 'small' ELSE 'none' END", &batch.format);
+		const ExpressionVector& values = batch.evaluate(expression);
+
+		BOOST_CHECK_EQUAL(expression.getKind(), Expression::KIND_TEXT);
+		BOOST_CHECK_EQUAL(getText(values, 0), "big");
+		BOOST_CHECK_EQUAL(getText(values, 1), "small");
+		BOOST_CHECK_EQUAL(getText(values, 2), "none");
+		BOOST_CHECK_EQUAL(getText(values, 3), "none");
+	}
+
+	{
+		Expression expression("case when i > 2 then i * 10 end", &batch.format);
+		const ExpressionVector& values = batch.evaluate(expression);
+
+		BOOST_CHECK_EQUAL(expression.getKind(), Expression::KIND_INTEGER);
+		BOOST_CHECK(!values.nulls[0]);
+		BOOST_CHECK_EQUAL(values.integers[0], 50);
+		BOOST_CHECK(values.nulls[1]);
+		BOOST_CHECK(values.nulls[2]);
+		BOOST_CHECK(values.nulls[3]);
+	}
+
+	BOOST_CHECK_EQUAL(batch.select("CASE WHEN i IS NULL THEN TRUE ELSE i < 2 END"), "123");
+	BOOST_CHECK_THROW(Expression("CASE WHEN i > 2 THEN 1 ELSE 'x' END", &batch.format),
+		std::runtime_error);
+	BOOST_CHECK_THROW(Expression("CASE WHEN i THEN 1 END", &batch.format), std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(expressionStartingWith)
+{
+	TestBatch batch("c char(6), v varchar(10)");
+	batch.add("abc", "abcdef");
+	batch.add("abd", "ab");
+	batch.add("xab", "a");
+	batch.add(NULL, NULL);
+
+	BOOST_CHECK_EQUAL(batch.select("c STARTING WITH 'ab'"), "01");
+	BOOST_CHECK_EQUAL(batch.select("v STARTING 'abc'"), "0");
+	BOOST_CHECK_EQUAL(batch.select("v starting with ''"), "012");
+	BOOST_CHECK_EQUAL(batch.select("v NOT STARTING WITH 'ab'"), "2");
+	BOOST_CHECK_EQUAL(batch.select("c STARTING WITH v"), "1");
+
+	// Char values are compared without their trailing spaces.
+	BOOST_CHECK_EQUAL(batch.select("c = 'abc'"), "0");
+	BOOST_CHECK_THROW(Expression("c STARTING WITH 1", &batch.format), std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(expressionDates)
+{
+	TestBatch batch("d date, i integer");
+	batch.add("1999-12-31", "1");
+	batch.add("2000-01-01", "2");
+	batch.add("2024-02-29", "3");
+	batch.add(NULL, "4");
+
+	BOOST_CHECK_EQUAL(batch.select("d > '2000-01-01'"), "2");
+	BOOST_CHECK_EQUAL(batch.select("d >= '2000-01-01'"), "12");
+	BOOST_CHECK_EQUAL(batch.select("d = '1999-12-31'"), "0");
+	BOOST_CHECK_EQUAL(batch.select("'2000-01-01' > d"), "0");
+	BOOST_CHECK_EQUAL(batch.select("d <> '2000-01-01'"), "02");
+	BOOST_CHECK_EQUAL(batch.select("d < '2000-01-01' OR d IS NULL"), "03");
+	BOOST_CHECK_EQUAL(batch.select("d + 1 = '2000-01-01'"), "0");
+	BOOST_CHECK_EQUAL(batch.select("d + i > '2000-01-03'"), "2");
+
+	{
+		Expression expression("d + 1", &batch.format);
+		const ExpressionVector& values = batch.evaluate(expression);
+
+		BOOST_CHECK_EQUAL(expression.getKind(), Expression::KIND_DATE);
+		BOOST_CHECK_EQUAL(values.integers[0], Format::encodeDate(2000, 1, 1));
+		BOOST_CHECK_EQUAL(values.integers[2], Format::encodeDate(2024, 3, 1));
+		BOOST_CHECK(values.nulls[3]);
+	}
+
+	{
+		Expression expression("d - d", &batch.format);
+		const ExpressionVector& values = batch.evaluate(expression);
+
+		BOOST_CHECK_EQUAL(expression.getKind(), Expression::KIND_INTEGER);
+		BOOST_CHECK_EQUAL(values.integers[1], 0);
+	}
+
+	BOOST_CHECK_THROW(Expression("d > 'yesterday'", &batch.format), std::runtime_error);
+	BOOST_CHECK_THROW(Expression("d + 0.5", &batch.format), std::runtime_error);
+}
+
+
+BOOST_AUTO_TEST_SUITE_END()
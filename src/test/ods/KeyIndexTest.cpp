@@ -0,0 +1,364 @@
+/*
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Initial Developer of the Original Code is Adriano dos Santos Fernandes.
+ * Portions created by the Initial Developer are Copyright (C) 2012 the Initial Developer.
+ * All Rights Reserved.
+ *
+ * Contributor(s):
+ *
+ */
+
+
+#include "../../ods/KeyIndex.h"
+#include "../../ods/Format.h"
+#include <algorithm>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <boost/test/unit_test.hpp>
+#include <unistd.h>
+
+using namespace fbods;
+using std::string;
+using std::vector;
+
+//------------------------------------------------------------------------------
+
+namespace
+{
+	// Record of a format, built field by field.
+	class TestRecord
+	{
+	public:
+		explicit TestRecord(const Format& aFormat)
+			: format(aFormat),
+			  buffer(aFormat.length)
+		{
+		}
+
+	public:
+		TestRecord& set(unsigned n, const string& text)
+		{
+			format.parse(n, text, &buffer[format.fields[n].offset]);
+			buffer[n >> 3] &= ~(1 << (n & 7));
+			return *this;
+		}
+
+		TestRecord& setNull(unsigned n)
+		{
+			buffer[n >> 3] |= 1 << (n & 7);
+			return *this;
+		}
+
+		string encode(const KeyEncoder& encoder) const
+		{
+			string key;
+			encoder.encode(&buffer.front(), key);
+			return key;
+		}
+
+	private:
+		const Format& format;
+		vector<unsigned char> buffer;
+	};
+
+	bool keyLess(const string& key1, const string& key2)
+	{
+		const int n = memcmp(key1.data(), key2.data(), std::min(key1.length(), key2.length()));
+		return n < 0 || (n == 0 && key1.length() < key2.length());
+	}
+
+	// Checks that the keys of the values of a single field, NULL first and the others in
+	// ascending order, are in ascending byte order.
+	void checkOrder(const string& spec, const char* const* values, unsigned count)
+	{
+		const Format format(spec);
+		const KeyEncoder encoder(&format, vector<unsigned>(1, 0));
+
+		string previous = TestRecord(format).setNull(0).encode(encoder);
+
+		for (unsigned i = 0; i < count; ++i)
+		{
+			const string key = TestRecord(format).set(0, values[i]).encode(encoder);
+
+			BOOST_CHECK_MESSAGE(keyLess(previous, key), spec << ": " << values[i]);
+			previous = key;
+		}
+	}
+
+	string getTempName(const char* suffix)
+	{
+		char s[64];
+		sprintf(s, "/tmp/fbodstest%u%s", unsigned(getpid()), suffix);
+		return s;
+	}
+}
+
+
+BOOST_AUTO_TEST_SUITE(ods)
+
+
+BOOST_AUTO_TEST_CASE(keyEncoderIntegers)
+{
+	const char* const shorts[] = {"-32768", "-256", "-1", "0", "1", "255", "256", "32767"};
+	checkOrder("n smallint", shorts, sizeof(shorts) / sizeof(shorts[0]));
+
+	const char* const longs[] = {"-2147483648", "-65536", "-1", "0", "1", "65536", "2147483647"};
+	checkOrder("n integer", longs, sizeof(longs) / sizeof(longs[0]));
+
+	const char* const int64s[] = {"-9223372036854775808", "-4294967296", "-1", "0", "1",
+		"4294967296", "9223372036854775807"};
+	checkOrder("n bigint", int64s, sizeof(int64s) / sizeof(int64s[0]));
+}
+
+BOOST_AUTO_TEST_CASE(keyEncoderScaled)
+{
+	const char* const numerics[] = {"-1000.50", "-1.01", "-1.00", "-0.01", "0.00", "0.01",
+		"0.99", "12.34", "1000.00"};
+	checkOrder("n numeric(18, 2)", numerics, sizeof(numerics) / sizeof(numerics[0]));
+
+	const char* const decimals[] = {"-2147.483", "-0.001", "0", "0.001", "1.5", "2147.483"};
+	checkOrder("n numeric(9, 3)", decimals, sizeof(decimals) / sizeof(decimals[0]));
+
+	const char* const doubles[] = {"-1e300", "-2.5", "-0.5", "0", "0.5", "2.5", "1e300"};
+	checkOrder("n double precision", doubles, sizeof(doubles) / sizeof(doubles[0]));
+}
+
+BOOST_AUTO_TEST_CASE(keyEncoderDates)
+{
+	// Days before 1858-11-17 are negative.
+	const char* const dates[] = {"0001-01-01", "1858-11-16", "1858-11-17", "1858-11-18",
+		"1999-12-31", "2000-01-01", "9999-12-31"};
+	checkOrder("d date", dates, sizeof(dates) / sizeof(dates[0]));
+
+	const char* const timestamps[] = {"1800-01-01 23:59:59", "1858-11-17 00:00:00",
+		"1858-11-17 00:00:01", "2000-01-01 12:00:00", "2000-01-02 00:00:00"};
+	checkOrder("t timestamp", timestamps, sizeof(timestamps) / sizeof(timestamps[0]));
+}
+
+BOOST_AUTO_TEST_CASE(keyEncoderTexts)
+{
+	const string texts[] = {"", "a", string("a\0", 2), string("a\0b", 3), "a\1", "ab", "b"};
+	const Format format("s varchar(10)");
+	const KeyEncoder encoder(&format, vector<unsigned>(1, 0));
+
+	string previous = TestRecord(format).setNull(0).encode(encoder);
+
+	for (unsigned i = 0; i < sizeof(texts) / sizeof(texts[0]); ++i)
+	{
+		const string key = TestRecord(format).set(0, texts[i]).encode(encoder);
+
+		BOOST_CHECK_MESSAGE(keyLess(previous, key), i);
+		previous = key;
+	}
+}
+
+// Lengths of damaged records past the field are cut at it.
+BOOST_AUTO_TEST_CASE(keyEncoderDamagedText)
+{
+	const Format format("s varchar(3)");
+	const KeyEncoder encoder(&format, vector<unsigned>(1, 0));
+
+	vector<unsigned char> record(format.length);
+	format.parse(0, "abc", &record[format.fields[0].offset]);
+
+	const boost::uint16_t length = 0xFFFF;
+	memcpy(&record[format.fields[0].offset], &length, sizeof(length));
+
+	string key;
+	encoder.encode(&record.front(), key);
+	BOOST_CHECK(key == TestRecord(format).set(0, "abc").encode(encoder));
+}
+
+// Fields are compared in the order of the key, NULL being the lowest value of each.
+BOOST_AUTO_TEST_CASE(keyEncoderNulls)
+{
+	const Format format("n integer, s varchar(10), d date");
+	vector<unsigned> fields;
+	fields.push_back(0);
+	fields.push_back(2);
+	fields.push_back(1);
+	const KeyEncoder encoder(&format, fields);
+
+	string keys[6];
+	keys[0] = TestRecord(format).setNull(0).setNull(1).setNull(2).encode(encoder);
+	keys[1] = TestRecord(format).setNull(0).set(1, "z").set(2, "2000-01-01").encode(encoder);
+	keys[2] = TestRecord(format).set(0, "-5").setNull(1).setNull(2).encode(encoder);
+	keys[3] = TestRecord(format).set(0, "-5").set(1, "b").setNull(2).encode(encoder);
+	keys[4] = TestRecord(format).set(0, "-5").setNull(1).set(2, "1858-01-01").encode(encoder);
+	keys[5] = TestRecord(format).set(0, "-5").set(1, "a").set(2, "1858-01-01").encode(encoder);
+
+	for (unsigned i = 1; i < 6; ++i)
+		BOOST_CHECK_MESSAGE(keyLess(keys[i - 1], keys[i]), i);
+}
+
+// Runs spilled by several sorters are merged into an index whose lookups find every entry.
+BOOST_AUTO_TEST_CASE(keyIndexSpillMerge)
+{
+	const unsigned ENTRIES = 6000;
+	const unsigned KEYS = 1000;
+
+	const Format format("n integer");
+	const KeyEncoder encoder(&format, vector<unsigned>(1, 0));
+	const string filename = getTempName(".key");
+
+	vector<KeyIndexSorter> sorters;
+	sorters.push_back(KeyIndexSorter(filename + ".run0", 4096));
+	sorters.push_back(KeyIndexSorter(filename + ".run1", 4096));
+
+	// Keys from -KEYS / 2, repeated, added out of order.
+	vector<string> keys;
+
+	for (unsigned i = 0; i < KEYS; ++i)
+	{
+		char s[16];
+		sprintf(s, "%d", int(i) - int(KEYS / 2));
+		keys.push_back(TestRecord(format).set(0, s).encode(encoder));
+	}
+
+	for (unsigned i = 0; i < ENTRIES; ++i)
+	{
+		const unsigned n = (i * 7919) % ENTRIES;
+		sorters[n % 2].add(keys[n % KEYS], 100 + n / 64, n);
+	}
+
+	for (vector<KeyIndexSorter>::iterator i = sorters.begin(); i != sorters.end(); ++i)
+	{
+		i->sort();
+		BOOST_CHECK_GT(i->runFiles.size(), 1u);
+	}
+
+	KeyIndexHeader header;
+	memset(&header, 0, sizeof(header));
+	header.relationId = 128;
+
+	try
+	{
+		BOOST_REQUIRE_EQUAL(writeKeyIndex(header, sorters, "n integer", "n", filename), ENTRIES);
+	}
+	catch (...)
+	{
+		for (vector<KeyIndexSorter>::iterator i = sorters.begin(); i != sorters.end(); ++i)
+			i->removeRuns();
+
+		unlink(filename.c_str());
+		throw;
+	}
+
+	for (vector<KeyIndexSorter>::iterator i = sorters.begin(); i != sorters.end(); ++i)
+		i->removeRuns();
+
+	{
+		const KeyIndex index(filename.c_str());
+
+		BOOST_CHECK_EQUAL(index.formatSpec, "n integer");
+		BOOST_CHECK_EQUAL(index.keySpec, "n");
+		BOOST_CHECK_EQUAL(index.header->entries, ENTRIES);
+		BOOST_CHECK_GT(index.header->blocks, 1u);
+
+		for (unsigned k = 0; k < KEYS; ++k)
+		{
+			vector<KeyIndexEntry> entries;
+			index.find(keys[k], entries);
+
+			BOOST_REQUIRE_EQUAL(entries.size(), size_t(ENTRIES / KEYS));
+
+			for (unsigned i = 0; i < entries.size(); ++i)
+			{
+				const unsigned n = k + i * KEYS;
+
+				BOOST_CHECK_EQUAL(entries[i].recordNumber, n);
+				BOOST_CHECK_EQUAL(entries[i].page, 100 + n / 64);
+			}
+		}
+
+		vector<KeyIndexEntry> entries;
+		index.find(TestRecord(format).set(0, "1000000").encode(encoder), entries);
+		BOOST_CHECK(entries.empty());
+	}
+
+	unlink(filename.c_str());
+}
+
+// Directory entries pointing out of the blocks are rejected when the index is opened.
+BOOST_AUTO_TEST_CASE(keyIndexDamaged)
+{
+	const Format format("n integer");
+	const KeyEncoder encoder(&format, vector<unsigned>(1, 0));
+	const string filename = getTempName(".key");
+
+	vector<KeyIndexSorter> sorters;
+	sorters.push_back(KeyIndexSorter(filename + ".run0", 1024 * 1024));
+
+	for (unsigned i = 0; i < 2000; ++i)
+	{
+		char s[16];
+		sprintf(s, "%u", i);
+		sorters[0].add(TestRecord(format).set(0, s).encode(encoder), 100, i);
+	}
+
+	sorters[0].sort();
+
+	KeyIndexHeader header;
+	memset(&header, 0, sizeof(header));
+	writeKeyIndex(header, sorters, "n integer", "n", filename);
+
+	vector<char> data;
+	{
+		const KeyIndex index(filename.c_str());
+		const char* base = reinterpret_cast<const char*>(index.header);
+		data.assign(base, base + index.header->keysOffset);
+		BOOST_REQUIRE_GT(index.header->blocks, 1u);
+	}
+
+	const KeyIndexHeader* copy = reinterpret_cast<const KeyIndexHeader*>(&data.front());
+	const size_t directoryOffset = copy->directoryOffset;
+	const size_t keysOffset = copy->keysOffset;
+
+	BOOST_CHECK_EQUAL(directoryOffset % 8, 0u);
+
+	// Each damage is written over the file up to the first keys.
+	struct Damage
+	{
+		size_t offset;
+		boost::uint64_t value;
+		unsigned size;
+	} damages[] = {
+		{directoryOffset + offsetof(KeyIndexBlock, offset), 1u << 30, 8},
+		{directoryOffset + sizeof(KeyIndexBlock) + offsetof(KeyIndexBlock, length), 1u << 20, 4},
+		{directoryOffset + offsetof(KeyIndexBlock, keyOffset), 1u << 20, 4},
+		{directoryOffset + offsetof(KeyIndexBlock, keyLength), 1u << 20, 4},
+		{offsetof(KeyIndexHeader, blocks), 1u << 30, 4},
+		{offsetof(KeyIndexHeader, directoryOffset), directoryOffset - 4, 8},
+		{offsetof(KeyIndexHeader, keysOffset), boost::uint64_t(1) << 40, 8}
+	};
+
+	for (unsigned i = 0; i < sizeof(damages) / sizeof(damages[0]); ++i)
+	{
+		vector<char> damaged(data);
+		memcpy(&damaged[damages[i].offset], &damages[i].value, damages[i].size);
+
+		FILE* file = fopen(filename.c_str(), "r+b");
+		BOOST_REQUIRE(file);
+		fwrite(&damaged.front(), 1, keysOffset, file);
+		fclose(file);
+
+		BOOST_CHECK_THROW(KeyIndex(filename.c_str()), std::runtime_error);
+	}
+
+	unlink(filename.c_str());
+}
+
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,332 @@
+/*
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Initial Developer of the Original Code is Adriano dos Santos Fernandes.
+ * Portions created by the Initial Developer are Copyright (C) 2012 the Initial Developer.
+ * All Rights Reserved.
+ *
+ * Contributor(s):
+ *
+ */
+
+
+#include "../../ods/Message.h"
+#include "../../ods/Format.h"
+#include "../../ods/RecordView.h"
+#include "../../ods/ScanStream.h"
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <vector>
+#include <boost/test/unit_test.hpp>
+
+using namespace fbods;
+using std::vector;
+
+//------------------------------------------------------------------------------
+
+namespace
+{
+	FBODS_MESSAGE(Account,
+		(FBODS_SMALLINT, branch)
+		(FBODS_INTEGER, id)
+		(FBODS_BIGINT, balance)
+		(FBODS_DOUBLE, rate)
+		(FBODS_DATE, opened)
+		(FBODS_TIMESTAMP, changed)
+		(FBODS_CHAR(3), currency)
+		(FBODS_VARCHAR(200), name)
+		(FBODS_NUMERIC(18, 2), limit)
+		(FBODS_NUMERIC(9, 3), fee)
+		(FBODS_BLOB, notes)
+	);
+
+	// Compresses a record the way the engine does, with runs of at least 3 bytes.
+	vector<boost::uint8_t> compress(const boost::uint8_t* p, size_t length,
+		Compression compression)
+	{
+		vector<boost::uint8_t> out;
+		const boost::uint8_t* const end = p + length;
+
+		if (compression == COMPRESSION_NONE)
+			return vector<boost::uint8_t>(p, end);
+
+		while (p < end)
+		{
+			const boost::uint8_t* run = p;
+
+			while (run < end && *run == *p)
+				++run;
+
+			size_t count = run - p;
+
+			if (count >= 3)
+			{
+				if (compression == COMPRESSION_RLE_LONG_RUNS && count > 128)
+				{
+					const boost::uint16_t shortCount = boost::uint16_t(std::min<size_t>(count, 0xFFFF));
+
+					out.push_back(boost::uint8_t(-1));
+					out.insert(out.end(), reinterpret_cast<const boost::uint8_t*>(&shortCount),
+						reinterpret_cast<const boost::uint8_t*>(&shortCount) + sizeof(shortCount));
+					count = shortCount;
+				}
+				else
+				{
+					count = std::min<size_t>(count, 128);
+					out.push_back(boost::uint8_t(-int(count)));
+				}
+
+				out.push_back(*p);
+				p += count;
+				continue;
+			}
+
+			// Literals up to the next run.
+			const boost::uint8_t* literalEnd = p;
+
+			while (literalEnd < end && literalEnd - p < 127 &&
+				!(literalEnd + 2 < end && literalEnd[0] == literalEnd[1] &&
+					literalEnd[1] == literalEnd[2]))
+			{
+				++literalEnd;
+			}
+
+			out.push_back(boost::uint8_t(literalEnd - p));
+			out.insert(out.end(), p, literalEnd);
+			p = literalEnd;
+		}
+
+		return out;
+	}
+
+	void fill(Account& account)
+	{
+		memset(&account, 0, sizeof(account));
+		account.branch = -12;
+		account.id = 123456;
+		account.balance = -9876543210LL;
+		account.rate = 0.125;
+		account.opened = Format::encodeDate(2012, 2, 29);
+		account.changed.date = Format::encodeDate(2012, 3, 1);
+		account.changed.time = 12 * 3600 * 10000;
+		memcpy(account.currency.data, "EUR", 3);
+		account.name.length = 5;
+		memcpy(account.name.data, "alpha", 5);
+		account.limit = 100000;		// 1000.00
+		account.fee = -1500;		// -1.500
+		account.nullFlags[0] = 1 << 10;	// notes
+	}
+}
+
+
+BOOST_AUTO_TEST_SUITE(ods)
+
+
+BOOST_AUTO_TEST_CASE(messageLayout)
+{
+	const Format format(Account::getSpec());
+
+	BOOST_REQUIRE_EQUAL(format.fields.size(), unsigned(Account::FIELD_COUNT));
+	BOOST_CHECK_EQUAL(format.fields[0].offset, offsetof(Account, branch));
+	BOOST_CHECK_EQUAL(format.fields[1].offset, offsetof(Account, id));
+	BOOST_CHECK_EQUAL(format.fields[2].offset, offsetof(Account, balance));
+	BOOST_CHECK_EQUAL(format.fields[3].offset, offsetof(Account, rate));
+	BOOST_CHECK_EQUAL(format.fields[4].offset, offsetof(Account, opened));
+	BOOST_CHECK_EQUAL(format.fields[5].offset, offsetof(Account, changed));
+	BOOST_CHECK_EQUAL(format.fields[6].offset, offsetof(Account, currency));
+	BOOST_CHECK_EQUAL(format.fields[7].offset, offsetof(Account, name));
+	BOOST_CHECK_EQUAL(format.fields[8].offset, offsetof(Account, limit));
+	BOOST_CHECK_EQUAL(format.fields[9].offset, offsetof(Account, fee));
+	BOOST_CHECK_EQUAL(format.fields[10].offset, offsetof(Account, notes));
+
+	for (unsigned i = 0; i < Account::FIELD_COUNT; ++i)
+		BOOST_CHECK_EQUAL(Account::getFieldEnd(i), format.fields[i].offset + format.fields[i].length);
+
+	BOOST_CHECK_EQUAL(format.fields[8].type, Format::TYPE_INT64);
+	BOOST_CHECK_EQUAL(format.fields[8].scale, -2);
+	BOOST_CHECK_EQUAL(format.fields[9].type, Format::TYPE_LONG);
+	BOOST_CHECK_EQUAL(format.fields[9].scale, -3);
+}
+
+BOOST_AUTO_TEST_CASE(messageDecode)
+{
+	static const Compression COMPRESSIONS[] = {
+		COMPRESSION_RLE, COMPRESSION_RLE_LONG_RUNS, COMPRESSION_NONE};
+
+	const Format format(Account::getSpec());
+	const unsigned length = Account::getFieldEnd(Account::FIELD_COUNT - 1);
+
+	Account record;
+	fill(record);
+
+	for (unsigned i = 0; i < sizeof(COMPRESSIONS) / sizeof(COMPRESSIONS[0]); ++i)
+	{
+		const vector<boost::uint8_t> packed = compress(
+			reinterpret_cast<const boost::uint8_t*>(&record), length, COMPRESSIONS[i]);
+		const boost::uint8_t* const begin = &packed[0];
+		const boost::uint8_t* const end = begin + packed.size();
+
+		Account message;
+		memset(&message, 0xFF, sizeof(message));
+		BOOST_CHECK_EQUAL(decodeMessage(begin, end, message, COMPRESSIONS[i]), length);
+
+		RecordView view(&format);
+		view.reset(begin, end, COMPRESSIONS[i]);
+
+		BOOST_CHECK(memcmp(&message, view.getRecord(), length) == 0);
+		BOOST_CHECK(memcmp(&message, &record, length) == 0);
+
+		view.reset(begin, end, COMPRESSIONS[i]);
+
+		BOOST_CHECK_EQUAL(view.getShort(0), message.branch);
+		BOOST_CHECK_EQUAL(view.getLong(1), message.id);
+		BOOST_CHECK_EQUAL(view.getInt64(2), message.balance);
+		BOOST_CHECK_EQUAL(view.getDouble(3), message.rate);
+		BOOST_CHECK_EQUAL(view.getLong(4), message.opened);
+		BOOST_CHECK_EQUAL(view.getInt64(8), message.limit);
+		BOOST_CHECK_EQUAL(view.getLong(9), message.fee);
+
+		unsigned textLength;
+		const char* text = view.getText(7, textLength);
+		BOOST_CHECK_EQUAL(textLength, message.name.length);
+		BOOST_CHECK(memcmp(text, message.name.data, textLength) == 0);
+
+		for (unsigned n = 0; n < Account::FIELD_COUNT; ++n)
+			BOOST_CHECK_EQUAL(view.isNull(n), message.isNull(n));
+
+		BOOST_CHECK(message.isNull(10));
+	}
+}
+
+// Records stored in an older format end before the last fields, which are decoded as null.
+BOOST_AUTO_TEST_CASE(messageShortRecord)
+{
+	const Format format(Account::getSpec());
+	const unsigned length = Account::getFieldEnd(4);
+
+	Account record;
+	fill(record);
+
+	const vector<boost::uint8_t> packed = compress(
+		reinterpret_cast<const boost::uint8_t*>(&record), length, COMPRESSION_RLE);
+
+	Account message;
+	memset(&message, 0xFF, sizeof(message));
+	BOOST_CHECK_EQUAL(decodeMessage(&packed[0], &packed[0] + packed.size(), message), length);
+
+	for (unsigned n = 0; n < Account::FIELD_COUNT; ++n)
+		BOOST_CHECK_EQUAL(message.isNull(n), n > 4);
+
+	BOOST_CHECK_EQUAL(message.id, record.id);
+	BOOST_CHECK_EQUAL(message.opened, record.opened);
+	BOOST_CHECK_EQUAL(message.limit, 0);
+}
+
+// Damaged records are decoded up to where their data ends.
+BOOST_AUTO_TEST_CASE(messageTruncated)
+{
+	static const Compression COMPRESSIONS[] = {COMPRESSION_RLE, COMPRESSION_RLE_LONG_RUNS};
+
+	const unsigned length = Account::getFieldEnd(Account::FIELD_COUNT - 1);
+
+	Account record;
+	fill(record);
+
+	for (unsigned i = 0; i < sizeof(COMPRESSIONS) / sizeof(COMPRESSIONS[0]); ++i)
+	{
+		const vector<boost::uint8_t> packed = compress(
+			reinterpret_cast<const boost::uint8_t*>(&record), length, COMPRESSIONS[i]);
+
+		for (size_t cut = 0; cut < packed.size(); ++cut)
+		{
+			// The byte after the cut must not be read.
+			vector<boost::uint8_t> truncated(packed.begin(), packed.begin() + cut);
+			truncated.push_back(0x7F);
+
+			Account message;
+			const size_t decoded = decodeMessage(&truncated[0], &truncated[0] + cut, message,
+				COMPRESSIONS[i]);
+
+			// The null flags of the missing fields are set.
+			const size_t start = std::min<size_t>(decoded, offsetof(Account, branch));
+
+			BOOST_CHECK(decoded < length);
+			BOOST_CHECK(memcmp(reinterpret_cast<const char*>(&message) + start,
+				reinterpret_cast<const char*>(&record) + start, decoded - start) == 0);
+
+			for (unsigned n = 0; n < Account::FIELD_COUNT; ++n)
+			{
+				if (Account::getFieldEnd(n) > decoded)
+					BOOST_CHECK(message.isNull(n));
+			}
+		}
+	}
+
+	const boost::uint8_t literal[] = {10, 1, 2, 3};
+	Account message;
+	BOOST_CHECK_EQUAL(decodeMessage(literal, literal + sizeof(literal), message), 3u);
+
+	const boost::uint8_t longRun[] = {1, 0, boost::uint8_t(-1), 0x10};
+	BOOST_CHECK_EQUAL(decodeMessage(longRun, longRun + sizeof(longRun), message,
+		COMPRESSION_RLE_LONG_RUNS), 1u);
+}
+
+// Damaged records are cut where their data ends, and runs past the buffer are cut at its end.
+BOOST_AUTO_TEST_CASE(recordViewTruncated)
+{
+	const Format format(Account::getSpec());
+	const unsigned length = Account::getFieldEnd(Account::FIELD_COUNT - 1);
+
+	Account record;
+	fill(record);
+
+	const vector<boost::uint8_t> packed = compress(
+		reinterpret_cast<const boost::uint8_t*>(&record), length, COMPRESSION_RLE_LONG_RUNS);
+	RecordView view(&format);
+
+	for (size_t cut = 0; cut < packed.size(); ++cut)
+	{
+		vector<boost::uint8_t> truncated(packed.begin(), packed.begin() + cut);
+		truncated.push_back(0);
+
+		view.reset(&truncated[0], &truncated[0] + cut, COMPRESSION_RLE_LONG_RUNS);
+		view.getRecord();
+		BOOST_CHECK(view.getDecodedLength() < length);
+		BOOST_CHECK(memcmp(view.getRecord(), &record, view.getDecodedLength()) == 0);
+	}
+
+	// A literal of 10 bytes with 3 left.
+	const boost::uint8_t literal[] = {10, 'a', 'b', 'c'};
+	view.reset(literal, literal + sizeof(literal));
+	view.getRecord();
+	BOOST_CHECK_EQUAL(view.getDecodedLength(), 3u);
+
+	// Long runs whose length or value is missing.
+	const boost::uint8_t shortLength[] = {1, 'a', boost::uint8_t(-1), 0x10};
+	view.reset(shortLength, shortLength + sizeof(shortLength), COMPRESSION_RLE_LONG_RUNS);
+	view.getRecord();
+	BOOST_CHECK_EQUAL(view.getDecodedLength(), 1u);
+
+	const boost::uint8_t noValue[] = {boost::uint8_t(-2), 0, 0, 1, 0};
+	view.reset(noValue, noValue + sizeof(noValue), COMPRESSION_RLE_LONG_RUNS);
+	view.getRecord();
+	BOOST_CHECK_EQUAL(view.getDecodedLength(), 0u);
+
+	// A run of 16 MB.
+	const boost::uint8_t longRun[] = {boost::uint8_t(-2), 0, 0, 0, 1, 'x', 3, 'a', 'b', 'c'};
+	view.reset(longRun, longRun + sizeof(longRun), COMPRESSION_RLE_LONG_RUNS);
+	BOOST_CHECK_EQUAL(static_cast<const boost::uint8_t*>(view.getRecord())[0], 'x');
+	BOOST_CHECK_EQUAL(view.getDecodedLength(), unsigned(ScanStream::MAX_RECORD_SIZE));
+}
+
+
+BOOST_AUTO_TEST_SUITE_END()
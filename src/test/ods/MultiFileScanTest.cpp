@@ -0,0 +1,95 @@
+/*
+ * The contents of this file are subject to the Mozilla Public License Version
+ * 1.1 (the "License"); you may not use this file except in compliance with
+ * the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS" basis,
+ * WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ * for the specific language governing rights and limitations under the
+ * License.
+ *
+ * The Initial Developer of the Original Code is Adriano dos Santos Fernandes.
+ * Portions created by the Initial Developer are Copyright (C) 2012 the Initial Developer.
+ * All Rights Reserved.
+ *
+ * Contributor(s):
+ *
+ */
+
+
+#include "../../ods/MultiFileScan.h"
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <boost/test/unit_test.hpp>
+#include <unistd.h>
+
+using namespace fbods;
+using std::string;
+using std::vector;
+
+//------------------------------------------------------------------------------
+
+namespace
+{
+	class CountingVisitor : public ChunkVisitor
+	{
+	public:
+		CountingVisitor()
+			: chunks(0)
+		{
+		}
+
+	public:
+		virtual void visit(unsigned /*file*/, ScanStream& /*scan*/)
+		{
+			++chunks;
+		}
+
+	public:
+		unsigned chunks;
+	};
+}
+
+
+BOOST_AUTO_TEST_SUITE(ods)
+
+
+// Files that can't be opened are reported, in their order, without stopping the scan.
+BOOST_AUTO_TEST_CASE(multiFileScanErrors)
+{
+	char s[64];
+	sprintf(s, "/tmp/fbodstest%u", unsigned(getpid()));
+
+	const string missing = string(s) + ".missing.fdb";
+	const string truncated = string(s) + ".truncated.fdb";
+
+	FILE* file = fopen(truncated.c_str(), "wb");
+	BOOST_REQUIRE(file);
+	fputs("not a database", file);
+	fclose(file);
+
+	vector<string> filenames;
+	filenames.push_back(truncated);
+	filenames.push_back(missing);
+	filenames.push_back(truncated);
+
+	CountingVisitor visitor1, visitor2;
+	vector<ChunkVisitor*> visitors;
+	visitors.push_back(&visitor1);
+	visitors.push_back(&visitor2);
+
+	vector<string> errors;
+	scanFiles(filenames, "T", visitors, MultiFileOptions(), errors);
+	unlink(truncated.c_str());
+
+	BOOST_REQUIRE_EQUAL(errors.size(), 3u);
+	BOOST_CHECK_EQUAL(errors[0].compare(0, truncated.length() + 2, truncated + ": "), 0);
+	BOOST_CHECK_EQUAL(errors[1].compare(0, missing.length() + 2, missing + ": "), 0);
+	BOOST_CHECK_EQUAL(errors[2], errors[0]);
+	BOOST_CHECK_EQUAL(visitor1.chunks + visitor2.chunks, 0u);
+}
+
+
+BOOST_AUTO_TEST_SUITE_END()